@@ -0,0 +1,335 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "corpus.hpp"
+#include "interner.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "profile.hpp"
+#include "tokenstream.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Every operator new in the process is counted, so a phase reports the
+// allocations it made while it ran
+static std::atomic<size_t> allocations {0};
+static std::atomic<size_t> allocatedBytes {0};
+
+static void* allocate(size_t size, size_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+#ifdef _WIN32
+    void* p = alignment > alignof(std::max_align_t) ? _aligned_malloc(size, alignment) : malloc(size);
+#else
+    void* p = alignment > alignof(std::max_align_t) ? aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1))
+                                                    : malloc(size);
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void release(void* p, size_t alignment) {
+#ifdef _WIN32
+    if (alignment > alignof(std::max_align_t)) return _aligned_free(p);
+#endif
+    (void) alignment;
+    free(p);
+}
+
+void* operator new(size_t size) { return allocate(size, 0); }
+void* operator new[](size_t size) { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocate(size, static_cast<size_t>(alignment)); }
+void operator delete(void* p) noexcept { release(p, 0); }
+void operator delete[](void* p) noexcept { release(p, 0); }
+void operator delete(void* p, size_t) noexcept { release(p, 0); }
+void operator delete[](void* p, size_t) noexcept { release(p, 0); }
+void operator delete(void* p, std::align_val_t alignment) noexcept { release(p, static_cast<size_t>(alignment)); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { release(p, static_cast<size_t>(alignment)); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { release(p, static_cast<size_t>(alignment)); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { release(p, static_cast<size_t>(alignment)); }
+
+// Peak resident set since the last reset, in bytes. Linux can reset the
+// high-water mark, elsewhere the peak is over the whole run.
+static void resetPeakRss() {
+#ifdef __linux__
+    if (FILE* refs = fopen("/proc/self/clear_refs", "w")) {
+        fputs("5", refs);
+        fclose(refs);
+    }
+#endif
+}
+
+static size_t peakRss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+#ifdef __linux__
+    if (FILE* status = fopen("/proc/self/status", "r")) {
+        char line[256];
+        size_t kb = 0;
+        while (fgets(line, sizeof(line), status))
+            if (sscanf(line, "VmHWM: %zu kB", &kb) == 1) break;
+        fclose(status);
+        if (kb) return kb << 10;
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) << 10;
+#endif
+#endif
+}
+
+enum Phase : uint8_t { PHASE_LEX, PHASE_INTERN, PHASE_PARSE, PHASES };
+static const char* phaseNames[PHASES] = {"lex", "intern", "parse"};
+
+struct Result {
+    std::string corpus;
+    size_t size;            // Corpus bytes
+    Phase phase;
+    double seconds;         // Best round
+    size_t bytes;           // Processed by the phase
+    size_t tokens;
+    size_t nodes;
+    size_t peakRss;
+    size_t allocations;
+    size_t allocatedBytes;
+};
+
+// Runs body at least three times and for a quarter second, keeping the best
+// time. Memory figures come from the first round.
+template <typename Body> static void measure(Result& result, Body body) {
+    double total = 0;
+    result.seconds = 1e30;
+    for (int round = 0; round < 3 || total < 0.25; ++round) {
+        size_t allocationsBefore = allocations.load(), bytesBefore = allocatedBytes.load();
+        if (round == 0) resetPeakRss();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (round == 0) {
+            result.peakRss = peakRss();
+            result.allocations = allocations.load() - allocationsBefore;
+            result.allocatedBytes = allocatedBytes.load() - bytesBefore;
+        }
+        if (seconds < result.seconds) result.seconds = seconds;
+        total += seconds;
+    }
+}
+
+// False if the corpus doesn't parse cleanly, so the parse rows would time
+// error recovery
+static bool run(CorpusKind kind, size_t size, std::vector<Result>& results) {
+    std::string src = generateCorpus(kind, size);
+    Result base {corpusName(kind), src.size(), PHASE_LEX, 0, src.size(), 0, 0, 0, 0, 0};
+
+    // Lexer::tokenize, construction and the intern table included
+    Result lex = base;
+    measure(lex, [&] {
+        Lexer lexer {std::string_view(src)};
+        lex.tokens = lexer.tokenize().size();
+    });
+    results.push_back(lex);
+
+    // Interner::intern of every identifier occurrence, into a fresh table
+    // sized for the worst case of all names distinct
+    Lexer lexer {std::string_view(src)};
+    std::vector<Token> tokens = lexer.tokenize();
+    std::vector<std::string_view> names;
+    Result intern = base;
+    intern.phase = PHASE_INTERN;
+    intern.bytes = 0;
+    for (const Token& token : tokens) {
+        if (token.type != TT_IDENT) continue;
+        names.emplace_back(src.data() + token.offset, token.length);
+        intern.bytes += token.length;
+    }
+    intern.tokens = names.size();
+    static volatile symbol_t sink;
+    measure(intern, [&] {
+        Interner interner(names.size());
+        symbol_t last = 0;
+        for (std::string_view name : names) last = interner.intern(name);
+        sink = last;
+    });
+    (void)sink;
+    results.push_back(intern);
+
+    // Parser::parse over the stream form the parser consumes
+    TokenStream stream(tokens, &lexer.pool, nullptr, &lexer.constants, &lexer.strings);
+    Result parse = base;
+    parse.phase = PHASE_PARSE;
+    parse.tokens = stream.size();
+    const char* firstError = nullptr;
+    uint32_t errorOffset = 0;
+    measure(parse, [&] {
+        Parser parser(stream, src);
+        parser.parse();
+        parse.nodes = parser.arena.nodes();
+        if (!parser.diagnostics.empty()) {
+            firstError = diagnosticMessage(parser.diagnostics[0].id);
+            errorOffset = parser.diagnostics[0].offset;
+        }
+    });
+    if (firstError) {
+        printf("%s corpus of %zu bytes doesn't parse: %s at offset %u\n", corpusName(kind), src.size(), firstError,
+               errorOffset);
+        return false;
+    }
+    results.push_back(parse);
+    return true;
+}
+
+static std::string key(const std::string& corpus, size_t size, const char* phase) {
+    return corpus + "/" + std::to_string(size) + "/" + phase;
+}
+
+// Seconds per corpus/size/phase from a previous --csv output
+static bool readBaseline(const char* path, std::map<std::string, double>& baseline) {
+    FILE* in = fopen(path, "r");
+    if (!in) return false;
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        char corpus[64], phase[16];
+        size_t size;
+        double seconds;
+        if (sscanf(line, "%63[^,],%zu,%15[^,],%lf", corpus, &size, phase, &seconds) == 4)
+            baseline[key(corpus, size, phase)] = seconds;
+    }
+    fclose(in);
+    return true;
+}
+
+static std::string sizeName(size_t size) {
+    static const char* units[] = {"B", "KB", "MB", "GB"};
+    int unit = 0;
+    while (size >= 1024 && size % 1024 == 0 && unit < 3) {
+        size >>= 10;
+        ++unit;
+    }
+    return std::to_string(size) + units[unit];
+}
+
+static size_t parseSize(const char* text) {
+    char* end;
+    size_t size = strtoull(text, &end, 10);
+    switch (*end | 0x20) {
+        case 'k': return size << 10;
+        case 'm': return size << 20;
+        case 'g': return size << 30;
+        default: return size;
+    }
+}
+
+static void usage() {
+    printf("usage: bench_suite [--min SIZE] [--max SIZE] [--corpus NAME] [--csv FILE] [--baseline FILE]\n"
+           "                   [--profile FILE] [--trace FILE]\n"
+           "  Sizes step by 16x from --min (1K) to --max (4M, up to 1G), e.g. 64K or 1G.\n"
+           "  --csv writes one row per corpus, size and phase; --baseline compares\n"
+           "  against such a file from another build.\n"
+           "  --profile and --trace write the profiler's JSON and Chrome trace; phases\n"
+           "  and counters need a build with LIGHTNING_PROFILE=ON.\n");
+}
+
+int main(int argc, char** argv) {
+    size_t minSize = 1 << 10, maxSize = 4u << 20;
+    const char* only = nullptr;
+    const char* csvPath = nullptr;
+    const char* baselinePath = nullptr;
+    const char* profilePath = nullptr;
+    const char* tracePath = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--min") && hasValue) minSize = parseSize(argv[++i]);
+        else if (!strcmp(argv[i], "--max") && hasValue) maxSize = parseSize(argv[++i]);
+        else if (!strcmp(argv[i], "--corpus") && hasValue) only = argv[++i];
+        else if (!strcmp(argv[i], "--csv") && hasValue) csvPath = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && hasValue) baselinePath = argv[++i];
+        else if (!strcmp(argv[i], "--profile") && hasValue) profilePath = argv[++i];
+        else if (!strcmp(argv[i], "--trace") && hasValue) tracePath = argv[++i];
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (maxSize > (size_t(1) << 30)) maxSize = size_t(1) << 30;
+
+    std::map<std::string, double> baseline;
+    if (baselinePath && !readBaseline(baselinePath, baseline)) {
+        printf("cannot read baseline %s\n", baselinePath);
+        return 1;
+    }
+
+    Profiler profiler;
+    if (profilePath || tracePath) Profiler::install(&profiler);
+
+    std::vector<Result> results;
+    printf("%-12s %6s %-6s %10s %10s %10s %10s %10s %9s%s\n", "corpus", "size", "phase", "ms", "MB/s", "Mtok/s",
+           "Mnode/s", "peak MB", "allocs", baselinePath ? "   vs base" : "");
+    for (int kind = 0; kind < CORPUS_KINDS; ++kind) {
+        if (only && strcmp(only, corpusName(static_cast<CorpusKind>(kind)))) continue;
+        for (size_t size = minSize; size <= maxSize; size <<= 4) {
+            size_t first = results.size();
+            if (!run(static_cast<CorpusKind>(kind), size, results)) return 1;
+            for (size_t i = first; i < results.size(); ++i) {
+                const Result& r = results[i];
+                printf("%-12s %6s %-6s %10.3f %10.1f %10.2f %10.2f %10.1f %9zu", r.corpus.c_str(),
+                       sizeName(size).c_str(), phaseNames[r.phase], r.seconds * 1e3, r.bytes / r.seconds / 1e6,
+                       r.tokens / r.seconds / 1e6, r.nodes / r.seconds / 1e6, r.peakRss / 1048576.0, r.allocations);
+                auto found = baseline.find(key(r.corpus, r.size, phaseNames[r.phase]));
+                if (found != baseline.end()) printf("   %6.2fx", found->second / r.seconds);
+                printf("\n");
+            }
+        }
+    }
+
+    if (csvPath) {
+        FILE* out = fopen(csvPath, "w");
+        if (!out) {
+            printf("cannot write %s\n", csvPath);
+            return 1;
+        }
+        fprintf(out, "corpus,size,phase,seconds,mb_per_s,tokens_per_s,nodes_per_s,peak_rss_bytes,allocations,"
+                     "allocated_bytes\n");
+        for (const Result& r : results)
+            fprintf(out, "%s,%zu,%s,%.9f,%.3f,%.1f,%.1f,%zu,%zu,%zu\n", r.corpus.c_str(), r.size,
+                    phaseNames[r.phase], r.seconds, r.bytes / r.seconds / 1e6, r.tokens / r.seconds,
+                    r.nodes / r.seconds, r.peakRss, r.allocations, r.allocatedBytes);
+        fclose(out);
+    }
+
+    Profiler::install(nullptr);
+    const char* paths[] = {profilePath, tracePath};
+    for (int i = 0; i < 2; ++i) {
+        if (!paths[i]) continue;
+        std::string text = i ? profiler.chromeTrace() : profiler.json();
+        FILE* out = fopen(paths[i], "w");
+        if (!out) {
+            printf("cannot write %s\n", paths[i]);
+            return 1;
+        }
+        fwrite(text.data(), 1, text.size(), out);
+        fclose(out);
+    }
+    return 0;
+}
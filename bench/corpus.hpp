@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// Deterministic synthetic sources for the benchmarks. The same kind, size
+// and seed give the same bytes on every machine and every commit, so
+// timings of two builds are comparable.
+enum CorpusKind : uint8_t {
+    CORPUS_INDENTATION,     // Deeply nested blocks, short statements
+    CORPUS_IDENTIFIERS,     // Long lines of many distinct names
+    CORPUS_OPERATORS,       // Expressions mixing every operator
+    CORPUS_COMMENTS,        // Long comment lines around sparse code
+    CORPUS_NUMBERS,         // Tables of int, float, hex and exponent literals
+    CORPUS_KINDS,
+};
+
+inline const char* corpusName(CorpusKind kind) {
+    static const char* names[CORPUS_KINDS] = {"indentation", "identifiers", "operators", "comments", "numbers"};
+    return names[kind];
+}
+
+// xorshift64*, enough for shaping text
+class CorpusRandom {
+public:
+    explicit CorpusRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull | 1) {};
+    uint32_t next(uint32_t bound) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<uint32_t>(((state * 0x2545F4914F6CDD1Dull) >> 32) % bound);
+    }
+
+private:
+    uint64_t state;
+};
+
+// Appends a name like "count_417", one of distinct per stem
+inline void appendName(std::string& out, CorpusRandom& random, uint32_t distinct) {
+    static const char* stems[] = {"count", "value", "node", "index", "buffer", "total", "left", "right",
+                                  "result", "offset", "module_state", "generated_symbol_table_entry"};
+    out += stems[random.next(sizeof(stems) / sizeof(stems[0]))];
+    out += '_';
+    out += std::to_string(random.next(distinct));
+}
+
+// At least bytes of source (two lines more at most), ending in a newline
+inline std::string generateCorpus(CorpusKind kind, size_t bytes, uint64_t seed = 1) {
+    CorpusRandom random(seed + kind);
+    std::string src;
+    src.reserve(bytes + 256);
+    uint32_t depth = 0;
+    while (src.size() < bytes) {
+        switch (kind) {
+            case CORPUS_INDENTATION: {
+                // Open a block most of the time, close a few on the way back
+                src.append(4 * depth, ' ');
+                if (depth < 12 && random.next(3)) {
+                    static const char* heads[] = {"if ", "while "};
+                    // def is a statement of the top level only
+                    if (depth == 0 && random.next(4) == 0) {
+                        src += "def f" + std::to_string(random.next(1000)) + "(a, b):\n";
+                    }
+                    else {
+                        src += heads[random.next(2)];
+                        appendName(src, random, 64);
+                        src += ":\n";
+                    }
+                    ++depth;
+                }
+                else {
+                    appendName(src, random, 64);
+                    src += " = 1\n";
+                    depth -= depth ? random.next(depth) + 1 : 0;
+                }
+                break;
+            }
+            case CORPUS_IDENTIFIERS: {
+                appendName(src, random, 50000);
+                src += " = ";
+                for (uint32_t n = random.next(6) + 4; n; --n) {
+                    appendName(src, random, 50000);
+                    src += n > 1 ? " + " : "\n";
+                }
+                break;
+            }
+            case CORPUS_OPERATORS: {
+                static const char* ops[] = {" + ", " - ", " * ", " / ", " % ", " << ", " >> ", " & ", " | ",
+                                            " ^ ", " && ", " || ", " == ", " != ", " <= ", " >= ", " < ", " > "};
+                src += "x = ";
+                for (uint32_t n = random.next(12) + 4; n; --n) {
+                    if (random.next(5) == 0) src += random.next(2) ? "-" : "~";
+                    if (random.next(4) == 0) src += "(a" + std::to_string(random.next(10)) + " * b)";
+                    else src += random.next(2) ? "a" : "7";
+                    src += n > 1 ? ops[random.next(sizeof(ops) / sizeof(ops[0]))] : "\n";
+                }
+                break;
+            }
+            case CORPUS_COMMENTS: {
+                static const char text[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
+                                           "tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim "
+                                           "veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea.";
+                for (uint32_t n = random.next(6) + 2; n; --n) {
+                    size_t length = 40 + random.next(sizeof(text) - 41);
+                    src += "# ";
+                    src.append(text, length);
+                    src += '\n';
+                }
+                appendName(src, random, 256);
+                src += " = other\n";
+                break;
+            }
+            case CORPUS_NUMBERS: {
+                src += "row" + std::to_string(random.next(100000)) + " = f(";
+                for (uint32_t n = 8; n; --n) {
+                    char cell[32];
+                    switch (random.next(5)) {
+                        case 0: snprintf(cell, sizeof(cell), "%u", random.next(1000000)); break;
+                        case 1: snprintf(cell, sizeof(cell), "%u.%02u", random.next(10000), random.next(100)); break;
+                        case 2: snprintf(cell, sizeof(cell), "0x%X", random.next(0x7FFFFFFF)); break;
+                        case 3: snprintf(cell, sizeof(cell), "%u.%ue-%u", random.next(10), random.next(1000), random.next(30)); break;
+                        default: snprintf(cell, sizeof(cell), "%u", random.next(16)); break;
+                    }
+                    src += cell;
+                    src += n > 1 ? ", " : ")\n";
+                }
+                break;
+            }
+            default:
+                return src;
+        }
+    }
+    // A block opened by the last line still needs its body
+    if (depth) {
+        src.append(4 * depth, ' ');
+        appendName(src, random, 64);
+        src += " = 1\n";
+    }
+    return src;
+}
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "bytecode.hpp"
+#include "ffi.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "tokenstream.hpp"
+#include "vm.hpp"
+
+// Per-call cost of labs and cos: called directly from C++ through a
+// function pointer, through their trampolines, and from a loop in the
+// language, against the same loop with an operator giving the same type
+// in place of the call. Natives, the VM's
+// other way out, are timed alongside for comparison.
+static constexpr int64_t calls = 10000000;
+
+template <typename F>
+static double bestOfThree(F&& run) {
+    double best = 1e30;
+    for (int i = 0; i < 3; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < best) best = seconds;
+    }
+    return best;
+}
+
+static bool labsNative(VM&, const Value* args, uint32_t count, Value& result) {
+    if (count != 1 || args[0].type != V_INT) return false;
+    result = Value::ofInt(labs(args[0].integer));
+    return true;
+}
+
+static bool cosNative(VM&, const Value* args, uint32_t count, Value& result) {
+    if (count != 1 || (args[0].type != V_INT && args[0].type != V_FLOAT)) return false;
+    result = Value::ofReal(cos(args[0].type == V_INT ? static_cast<double>(args[0].integer) : args[0].real));
+    return true;
+}
+
+// Seconds for the script's loop of calls, with c bound as the VM does it
+static double timeScript(const char* body, const ForeignFunction* foreign, Native native) {
+    std::string src = std::string("f(n):\n    s = 0\n    i = 0\n    while i < n:\n        s += ") + body +
+                      "\n        i += 1\n    return s\nreturn f(" + std::to_string(calls) + ")\n";
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    Program program;
+    Compiler compiler(parser.arena, lexer);
+    if (!compiler.compile(root, program)) return -1;
+    VM vm(program);
+    if (foreign) vm.define("c", *foreign);
+    if (native) vm.define("c", native);
+    bool ok = true;
+    double seconds = bestOfThree([&] {
+        Value result;
+        ok = ok && vm.run(result);
+    });
+    return ok ? seconds : -1;
+}
+
+int main() {
+    ForeignLibrary process(nullptr);
+    ForeignFunction labsForeign, cosForeign;
+    if (!process.lookup("labs", "l(l)", labsForeign) || !process.lookup("cos", "d(d)", cosForeign)) {
+        printf("lookup failed: %s\n", process.error.c_str());
+        return 1;
+    }
+
+    // Through volatile pointers, so the compiler can neither inline nor hoist the calls
+    int64_t (*volatile labsPointer)(int64_t) = reinterpret_cast<int64_t (*)(int64_t)>(labsForeign.address);
+    double (*volatile cosPointer)(double) = reinterpret_cast<double (*)(double)>(cosForeign.address);
+    volatile double sink = 0;
+
+    double directLabs = bestOfThree([&] {
+        int64_t sum = 0;
+        for (int64_t i = 0; i < calls; ++i) sum += labsPointer(i - 50);
+        sink = static_cast<double>(sum);
+    });
+    double directCos = bestOfThree([&] {
+        double sum = 0;
+        for (int64_t i = 0; i < calls; ++i) sum += cosPointer(static_cast<double>(i));
+        sink = sum;
+    });
+    double trampolineLabs = bestOfThree([&] {
+        int64_t sum = 0;
+        Value arg, result;
+        for (int64_t i = 0; i < calls; ++i) {
+            arg = Value::ofInt(i - 50);
+            labsForeign.call(labsForeign.address, &arg, result);
+            sum += result.integer;
+        }
+        sink = static_cast<double>(sum);
+    });
+    double trampolineCos = bestOfThree([&] {
+        double sum = 0;
+        Value arg, result;
+        for (int64_t i = 0; i < calls; ++i) {
+            arg = Value::ofInt(i);
+            cosForeign.call(cosForeign.address, &arg, result);
+            sum += result.real;
+        }
+        sink = sum;
+    });
+    (void)sink;
+
+    double intLoop = timeScript("i - 50", nullptr, nullptr);
+    double floatLoop = timeScript("i + 0.5", nullptr, nullptr);
+    double vmLabs = timeScript("c(i - 50)", &labsForeign, nullptr);
+    double vmCos = timeScript("c(i)", &cosForeign, nullptr);
+    double nativeLabs = timeScript("c(i - 50)", nullptr, labsNative);
+    double nativeCos = timeScript("c(i)", nullptr, cosNative);
+    if (intLoop < 0 || floatLoop < 0 || vmLabs < 0 || vmCos < 0 || nativeLabs < 0 || nativeCos < 0) {
+        printf("script failed\n");
+        return 1;
+    }
+
+    // The VM rows are the loop's time with the call less its time without
+    double ns = 1e9 / calls;
+    printf("%-22s %10s %10s\n", "ns per call", "labs", "cos");
+    printf("%-22s %10.2f %10.2f\n", "direct", directLabs * ns, directCos * ns);
+    printf("%-22s %10.2f %10.2f\n", "trampoline", trampolineLabs * ns, trampolineCos * ns);
+    printf("%-22s %10.2f %10.2f\n", "vm, foreign", (vmLabs - intLoop) * ns, (vmCos - floatLoop) * ns);
+    printf("%-22s %10.2f %10.2f\n", "vm, native", (nativeLabs - intLoop) * ns, (nativeCos - floatLoop) * ns);
+    return 0;
+}
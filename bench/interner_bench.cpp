@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "interner.hpp"
+#include "lexer.hpp"
+
+// A project of identifier-heavy files that share most of their names
+static std::vector<std::string> project(int files) {
+    std::vector<std::string> sources;
+    for (int f = 0; f < files; ++f) {
+        std::string src;
+        uint32_t seed = static_cast<uint32_t>(f) * 2654435761u;
+        for (int line = 0; line < 2000; ++line) {
+            seed = seed * 1103515245u + 12345u;
+            src += "common_name_" + std::to_string((seed >> 8) % 300);
+            src += " = module_local_" + std::to_string(f) + "_" + std::to_string(line % 200);
+            src += " + helper_" + std::to_string((seed >> 16) % 100) + "\n";
+        }
+        sources.push_back(std::move(src));
+    }
+    return sources;
+}
+
+// Lex every file on `threads` threads, each Lexer with its own table or all sharing one
+static double run(const std::vector<std::string>& sources, unsigned threads, Interner* shared) {
+    std::atomic<size_t> next {0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            size_t i;
+            while ((i = next.fetch_add(1)) < sources.size()) {
+                Lexer lexer {std::string_view(sources[i])};
+                lexer.setInterner(shared);
+                lexer.tokenize();
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Identifier-heavy single files: few short names, many long shared names,
+// and names that are nearly all distinct
+static std::string identifiers(const char* kind, size_t bytes) {
+    std::string src;
+    uint32_t seed = 1;
+    uint32_t n = 0;
+    while (src.size() < bytes) {
+        seed = seed * 1103515245u + 12345u;
+        if (kind[0] == 's') {
+            src += "x" + std::to_string((seed >> 8) % 64) + " = y" + std::to_string((seed >> 16) % 64) + " + z\n";
+        } else if (kind[0] == 'l') {
+            src += "generated_symbol_with_a_long_prefix_" + std::to_string((seed >> 8) % 4096);
+            src += " = another_long_generated_name_" + std::to_string((seed >> 16) % 4096) + "\n";
+        } else {
+            uint32_t name = n++;
+            src += "unique_" + std::to_string(name) + " = value_" + std::to_string(n) + "\n";
+        }
+    }
+    return src;
+}
+
+// The previous byte-at-a-time hash, as the baseline
+static uint64_t fnv1a(const char* string, uint32_t length) {
+    uint64_t hash = 1469598103934665603ull;
+    for (uint32_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(string[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static void identifierBench() {
+    const size_t bytes = 16u << 20;
+    printf("%-10s %10s %12s %12s\n", "corpus", "MB/s", "Mnames/s", "symbols");
+    for (const char* kind : {"short", "long", "unique"}) {
+        std::string src = identifiers(kind, bytes);
+        double best = 1e30;
+        size_t names = 0, symbols = 0;
+        for (int i = 0; i < 5; ++i) {
+            Lexer lexer(src);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<Token> tokens = lexer.tokenize();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (seconds < best) best = seconds;
+            names = 0;
+            for (const Token& token : tokens) names += token.type == TT_IDENT;
+            symbols = static_cast<size_t>(std::count(lexer.pool.begin(), lexer.pool.end(), '\0'));
+        }
+        printf("%-10s %10.1f %12.1f %12zu\n", kind, src.size() / best / 1e6, names / best / 1e6, symbols);
+    }
+
+    static volatile uint64_t sink;
+    printf("\n%-10s %10s %12s\n", "length", "fnv1a ns", "hash ns");
+    std::string text(64 * 1024, 'a');
+    for (size_t i = 0; i < text.size(); ++i) text[i] = static_cast<char>('a' + (i * 7) % 26);
+    for (uint32_t length : {4u, 8u, 16u, 32u, 64u}) {
+        const int rounds = 1 << 20;
+        uint64_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i) sum += fnv1a(text.data() + (i & 4095), length);
+        double fnv = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rounds; ++i) sum += hashSymbol(text.data() + (i & 4095), length);
+        double fast = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink = sum;
+        printf("%-10u %10.2f %12.2f\n", length, fnv * 1e9 / rounds, fast * 1e9 / rounds);
+    }
+    (void)sink;
+    printf("\n");
+}
+
+int main() {
+    identifierBench();
+
+    std::vector<std::string> sources = project(256);
+    size_t bytes = 0;
+    for (auto& src : sources) bytes += src.size();
+
+    printf("%-10s %-10s %10s %12s\n", "threads", "table", "MB/s", "symbols");
+    for (unsigned threads : {1u, 4u, 16u}) {
+        double local = run(sources, threads, nullptr);
+        printf("%-10u %-10s %10.1f %12s\n", threads, "per-lexer", bytes / local / 1e6, "-");
+
+        // Cold pays for every first insert; warm is a rebuild against the same table
+        Interner interner;
+        double cold = run(sources, threads, &interner);
+        printf("%-10u %-10s %10.1f %12zu\n", threads, "shared", bytes / cold / 1e6, interner.size());
+        double warm = run(sources, threads, &interner);
+        printf("%-10u %-10s %10.1f %12zu\n", threads, "warm", bytes / warm / 1e6, interner.size());
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lexer.hpp"
+#include "lineindex.hpp"
+#include "tokenstream.hpp"
+
+// Deterministic corpora shaped like our generated sources
+static std::string longComments(size_t bytes) {
+    std::string src;
+    while (src.size() < bytes) {
+        src += "# ";
+        src.append(150, '=');
+        src += " generated block header, do not edit by hand\n";
+        src += "value = other\n";
+    }
+    return src;
+}
+
+static std::string longIdentifiers(size_t bytes) {
+    std::string src;
+    uint32_t n = 0;
+    while (src.size() < bytes) {
+        src += "generated_module_prefix_symbol_name_" + std::to_string(n++ % 4096);
+        src += " = another_generated_identifier_with_a_long_name_0123456789\n";
+    }
+    return src;
+}
+
+static std::string mixed(size_t bytes) {
+    std::string src;
+    uint32_t n = 0;
+    while (src.size() < bytes) {
+        src += "def fn" + std::to_string(n++ % 512) + "(a, b):\n";
+        src += "    # compute\n";
+        src += "    x = a * 12345 + b / 3.25\n";
+        src += "    if x >= 10 && x != 20:\n";
+        src += "        return x << 2\n";
+    }
+    return src;
+}
+
+// Data files: rows of quoted keys and values, an escape in one row of eight
+static std::string stringTables(size_t bytes) {
+    std::string src = "table = {\n";
+    uint32_t n = 0;
+    while (src.size() < bytes) {
+        src += "    \"generated.message.key_" + std::to_string(n) + "\": ";
+        src += n++ % 8 ? "\"A translated message text, with punctuation and numbers 12345.\",\n"
+                       : "\"A \\\"quoted\\\" message\\twith escapes\\n\",\n";
+    }
+    src += "}\n";
+    return src;
+}
+
+static double run(const std::string& src, ScanLevel level, size_t& tokenCount) {
+    const int rounds = 5;
+    double best = 1e30;
+    for (int i = 0; i < rounds; ++i) {
+        Lexer lexer(src);
+        lexer.setScanLevel(level);
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Token> tokens = lexer.tokenize();
+        auto stop = std::chrono::steady_clock::now();
+        tokenCount = tokens.size();
+        double seconds = std::chrono::duration<double>(stop - start).count();
+        if (seconds < best) best = seconds;
+    }
+    return static_cast<double>(src.size()) / best / 1e6;
+}
+
+int main() {
+    const size_t bytes = 16u << 20;
+    struct { const char* name; std::string src; } corpora[] = {
+        {"long-comments", longComments(bytes)},
+        {"long-identifiers", longIdentifiers(bytes)},
+        {"mixed", mixed(bytes)},
+        {"string-tables", stringTables(bytes)},
+    };
+
+    printf("%-18s %-8s %10s %10s\n", "corpus", "kernels", "MB/s", "speedup");
+    for (auto& corpus : corpora) {
+        double baseline = 0;
+        for (int level = SCAN_SCALAR; level <= detectScanLevel(); ++level) {
+            size_t tokens = 0;
+            double mbps = run(corpus.src, static_cast<ScanLevel>(level), tokens);
+            if (level == SCAN_SCALAR) baseline = mbps;
+            printf("%-18s %-8s %10.1f %9.2fx\n", corpus.name,
+                   scanKernels(static_cast<ScanLevel>(level)).name, mbps, mbps / baseline);
+        }
+    }
+
+    // Token storage: memory and a type-only scan (block skipping) per layout
+    printf("\n%-18s %-8s %10s %10s\n", "corpus", "layout", "bytes/tok", "scan ms");
+    for (auto& corpus : corpora) {
+        Lexer vectorLexer(corpus.src);
+        std::vector<Token> tokens = vectorLexer.tokenize();
+        Lexer streamLexer(corpus.src);
+        TokenStream stream = streamLexer.tokenizeStream();
+
+        auto start = std::chrono::steady_clock::now();
+        size_t blocks = 0;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            if (tokens[i].type != TT_INDENT) continue;
+            size_t depth = 0;
+            for (size_t j = i; j < tokens.size(); ++j) {
+                if (tokens[j].type == TT_INDENT) ++depth;
+                else if (tokens[j].type == TT_DEDENT && --depth == 0) { blocks += j; break; }
+            }
+        }
+        double vectorMs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3;
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = stream.find(TT_INDENT, 0); i < stream.size(); i = stream.find(TT_INDENT, i + 1))
+            blocks -= stream.skipBlock(i);
+        double streamMs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e3;
+
+        printf("%-18s %-8s %10.1f %10.2f\n", corpus.name, "vector", static_cast<double>(sizeof(Token)), vectorMs);
+        printf("%-18s %-8s %10.1f %10.2f%s\n", corpus.name, "stream",
+               static_cast<double>(stream.bytes()) / stream.size(), streamMs, blocks ? " (mismatch)" : "");
+    }
+
+    // Line index: first-use build per kernel level, then a lookup
+    static volatile uint32_t sink;
+    printf("\n%-18s %-8s %10s %10s\n", "corpus", "kernels", "MB/s", "lookup ns");
+    for (auto& corpus : corpora) {
+        for (int level = SCAN_SCALAR; level <= detectScanLevel(); ++level) {
+            double best = 1e30, lookup = 0;
+            for (int i = 0; i < 5; ++i) {
+                LineIndex index(corpus.src);
+                index.setScanLevel(static_cast<ScanLevel>(level));
+                auto start = std::chrono::steady_clock::now();
+                index.locate(0);
+                auto built = std::chrono::steady_clock::now();
+                uint32_t lines = 0;
+                for (uint32_t k = 0; k < 100000; ++k)
+                    lines += index.locate(static_cast<uint32_t>((k * 2654435761u) % corpus.src.size())).line;
+                auto stop = std::chrono::steady_clock::now();
+                double seconds = std::chrono::duration<double>(built - start).count();
+                if (seconds < best) best = seconds;
+                lookup = std::chrono::duration<double>(stop - built).count() * 1e9 / 100000;
+                sink = lines;
+            }
+            printf("%-18s %-8s %10.1f %10.1f\n", corpus.name, scanKernels(static_cast<ScanLevel>(level)).name,
+                   static_cast<double>(corpus.src.size()) / best / 1e6, lookup);
+        }
+    }
+    (void)sink;
+
+    // Parallel mode at the best kernel level, scaling with worker count
+    printf("\n%-18s %-8s %10s %10s\n", "corpus", "threads", "MB/s", "speedup");
+    unsigned cores = std::thread::hardware_concurrency();
+    for (auto& corpus : corpora) {
+        double baseline = 0;
+        for (unsigned threads = 1; threads <= (cores ? cores : 1); threads <<= 1) {
+            ThreadPool workers(threads);
+            double best = 1e30;
+            for (int i = 0; i < 5; ++i) {
+                Lexer lexer(corpus.src);
+                auto start = std::chrono::steady_clock::now();
+                std::vector<Token> tokens = lexer.tokenizeParallel(workers);
+                auto stop = std::chrono::steady_clock::now();
+                double seconds = std::chrono::duration<double>(stop - start).count();
+                if (seconds < best) best = seconds;
+            }
+            double mbps = static_cast<double>(corpus.src.size()) / best / 1e6;
+            if (threads == 1) baseline = mbps;
+            printf("%-18s %-8u %10.1f %9.2fx\n", corpus.name, threads, mbps, mbps / baseline);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include "cache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "tokenstream.hpp"
+
+// Deterministic module shaped like our generated sources
+static std::string module(size_t bytes) {
+    std::string src;
+    uint32_t n = 0;
+    while (src.size() < bytes) {
+        src += "def fn" + std::to_string(n++ % 512) + "(a, b):\n";
+        src += "    x = a * 12345 + b / 3.25 - f(a, b, 7)\n";
+        src += "    while x >= 10 && x != 20:\n";
+        src += "        x -= g(x) << 2\n";
+        src += "    return x\n";
+    }
+    return src;
+}
+
+int main() {
+    std::string src = module(16u << 20);
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+
+    printf("%-8s %12s %10s %10s %10s\n", "threads", "Mnodes/s", "parse ms", "free ms", "speedup");
+    unsigned cores = std::thread::hardware_concurrency();
+    double baseline = 0;
+    for (unsigned threads = 0; threads <= (cores ? cores : 1); threads = threads ? threads << 1 : 1) {
+        ThreadPool workers(threads ? threads : 1);
+        double best = 1e30, freeing = 0;
+        size_t nodes = 0;
+        for (int i = 0; i < 5; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            Parser* parser = new Parser(tokens, src);
+            // threads == 0 is the serial parser
+            if (threads) parser->parseParallel(workers);
+            else parser->parse();
+            auto stop = std::chrono::steady_clock::now();
+            nodes = parser->arena.nodes();
+            delete parser;
+            double seconds = std::chrono::duration<double>(stop - start).count();
+            if (seconds < best) {
+                best = seconds;
+                freeing = std::chrono::duration<double>(std::chrono::steady_clock::now() - stop).count();
+            }
+        }
+        if (!threads) baseline = best;
+        printf("%-8s %12.1f %10.2f %10.2f %9.2fx\n", threads ? std::to_string(threads).c_str() : "serial",
+               nodes / best / 1e6, best * 1e3, freeing * 1e3, baseline / best);
+    }
+
+    // Warm build: lex and parse against mapping a cached entry
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "lightning_parser_bench";
+    std::filesystem::create_directories(directory);
+    TokenCache cache(directory.string());
+    double cold = 1e30, warm = 1e30;
+    for (int i = 0; i < 5; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        Lexer coldLexer(src);
+        std::vector<Token> coldTokens = coldLexer.tokenize();
+        TokenStream stream(coldTokens, &coldLexer.pool, nullptr, &coldLexer.constants, &coldLexer.strings);
+        Parser parser(stream, src);
+        NodeId root = parser.parse();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < cold) cold = seconds;
+        if (i == 0) cache.store(src, coldTokens, coldLexer, parser, root);
+    }
+    size_t cachedNodes = 0;
+    for (int i = 0; i < 5; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        CachedUnit unit(cache, src);
+        cachedNodes = unit.valid() ? unit[unit.root()].count : 0;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds < warm) warm = seconds;
+    }
+    std::filesystem::remove_all(directory);
+    printf("\n%-8s %10s %10s %10s\n", "build", "ms", "MB/s", "speedup");
+    printf("%-8s %10.2f %10.1f %9.2fx\n", "cold", cold * 1e3, src.size() / cold / 1e6, 1.0);
+    printf("%-8s %10.2f %10.1f %9.2fx%s\n", "cached", warm * 1e3, src.size() / warm / 1e6, cold / warm,
+           cachedNodes ? "" : " (miss)");
+    return 0;
+}
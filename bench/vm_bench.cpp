@@ -0,0 +1,135 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "bytecode.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "tokenstream.hpp"
+#include "vm.hpp"
+
+// Kernels that each stress one part of the interpreter: calls and returns,
+// a tight loop's compare and branch, int arithmetic, and float arithmetic.
+// Each runs as the tree compiler emits it under both dispatch loops, and
+// as the optimized IR lowers it under the threaded one, then JIT-compiled
+// from the first call or loop iteration.
+struct Kernel {
+    const char* name;
+    const char* source;
+    int64_t expected;   // Result as an int, floats truncated
+};
+
+static const Kernel kernels[] = {
+    {"fib", "fib(n):\n"
+            "    if n < 2:\n"
+            "        return n\n"
+            "    return fib(n - 1) + fib(n - 2)\n"
+            "return fib(27)\n",
+     196418},
+    {"loop", "count(n):\n"
+             "    i = 0\n"
+             "    while i < n:\n"
+             "        i += 1\n"
+             "    return i\n"
+             "return count(10000000)\n",
+     10000000},
+    {"collatz", "steps(n):\n"
+                "    s = 0\n"
+                "    while n != 1:\n"
+                "        if n & 1:\n"
+                "            n = 3 * n + 1\n"
+                "        else:\n"
+                "            n = n >> 1\n"
+                "        s += 1\n"
+                "    return s\n"
+                "total(limit):\n"
+                "    t = 0\n"
+                "    k = 1\n"
+                "    while k < limit:\n"
+                "        t += steps(k)\n"
+                "        k += 1\n"
+                "    return t\n"
+                "return total(30000)\n",
+     2864133},
+    {"leibniz", "pi(terms):\n"
+                "    s = 0.0\n"
+                "    sign = 1.0\n"
+                "    k = 0\n"
+                "    while k < terms:\n"
+                "        s += sign / (2 * k + 1)\n"
+                "        sign = -sign\n"
+                "        k += 1\n"
+                "    return s * 4 * 1000000\n"
+                "return pi(3000000)\n",
+     3141592},
+};
+
+// Best of three runs in ms, or a negative value after printing what went wrong
+static double timeRuns(const Kernel& kernel, const Program& program, Dispatch dispatch, uint32_t jitThreshold = 0) {
+    VM vm(program);
+    vm.setDispatch(dispatch);
+    vm.setJit(jitThreshold);
+    double best = 1e30;
+    for (int i = 0; i < 3; ++i) {
+        Value result;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = vm.run(result);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        int64_t value = result.type == V_FLOAT ? static_cast<int64_t>(result.real) : result.integer;
+        if (!ok || value != kernel.expected) {
+            printf("%-10s wrong result: %s\n", kernel.name, ok ? valueString(result).c_str() : vm.error.c_str());
+            return -1;
+        }
+        if (seconds < best) best = seconds;
+    }
+    return best * 1e3;
+}
+
+int main() {
+    // Speedup of the JIT over interpreting the same bytecode
+    printf("%-10s %12s %12s %12s %12s %10s\n", "kernel", "switch ms", "threaded ms", "optimized ms", "jit ms",
+           "speedup");
+    for (const Kernel& kernel : kernels) {
+        std::string src = kernel.source;
+        Lexer lexer(src);
+        TokenStream tokens = lexer.tokenizeStream();
+        Parser parser(tokens, src);
+        NodeId root = parser.parse();
+        Program program;
+        Compiler compiler(parser.arena, lexer);
+        if (!compiler.compile(root, program)) {
+            printf("%-10s compile error: %s\n", kernel.name, compiler.errors[0].c_str());
+            return 1;
+        }
+        IrModule module;
+        IrBuilder builder(parser.arena, lexer);
+        Program optimized;
+        std::vector<std::string> errors;
+        if (!builder.build(root, module)) {
+            printf("%-10s IR error: %s\n", kernel.name, builder.errors[0].c_str());
+            return 1;
+        }
+        optimize(module);
+        if (!lowerModule(module, optimized, errors)) {
+            printf("%-10s lowering error: %s\n", kernel.name, errors[0].c_str());
+            return 1;
+        }
+
+        double switched = timeRuns(kernel, program, DISPATCH_SWITCH);
+        double threaded = timeRuns(kernel, program, DISPATCH_THREADED);
+        double lowered = timeRuns(kernel, optimized, DISPATCH_THREADED);
+        double jitted = timeRuns(kernel, optimized, DISPATCH_THREADED, 1);
+        if (switched < 0 || threaded < 0 || lowered < 0 || jitted < 0) return 1;
+        printf("%-10s %12.1f %12.1f %12.1f %12.1f %9.2fx\n", kernel.name, switched, threaded, lowered, jitted,
+               lowered / jitted);
+    }
+#if !LIGHTNING_COMPUTED_GOTO
+    printf("(no computed goto in this build: every column uses the switch loop)\n");
+#endif
+#if !LIGHTNING_JIT
+    printf("(no JIT on this platform: the jit column is interpreted)\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+typedef uint32_t NodeId;
+
+enum NodeType : uint32_t {
+    AST_UNKNOWN,
+    AST_FUNCDEF, AST_ARG, AST_FUNCCALL,
+    AST_BLOCK, AST_TYPE,
+    AST_NULL, // Filler type
+
+    AST_IDENT, AST_NUMBER,
+    AST_UNARY, AST_BINARY, AST_ASSIGN,
+    AST_IF, AST_WHILE, AST_RETURN,
+    AST_ERROR,  // Placeholder where parsing failed, payload is the token offset
+    AST_IMPORT,
+};
+
+// Node header; the children follow inline, count of them
+struct AstNode {
+    NodeType type;
+    uint32_t count;
+    uint64_t payload;
+
+    const NodeId* children() const { return reinterpret_cast<const NodeId*>(this + 1); }
+    NodeId* children() { return reinterpret_cast<NodeId*>(this + 1); }
+    NodeId child(uint32_t i) const { return children()[i]; }
+}; // 16 bytes + 4 per child
+
+// Chunked bump allocator for AST nodes. Chunks never move, so node
+// references stay valid while the tree grows, and the whole tree is freed
+// at once with the arena. A NodeId encodes chunk index and word offset.
+// Id 0 is a permanent AST_NULL node, used for absent children.
+class AstArena {
+public:
+    static constexpr uint32_t CHUNK_SHIFT = 13;
+    static constexpr uint32_t CHUNK_WORDS = 1u << CHUNK_SHIFT;    // 8-byte words, 64 KB
+
+    AstArena();
+    ~AstArena();
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    NodeId create(NodeType type, uint64_t payload, const NodeId* children, uint32_t count);
+    NodeId create(NodeType type, uint64_t payload = 0, std::initializer_list<NodeId> children = {}) {
+        return create(type, payload, children.begin(), static_cast<uint32_t>(children.size()));
+    }
+
+    const AstNode& operator[](NodeId id) const {
+        return *reinterpret_cast<const AstNode*>(chunks[id >> CHUNK_SHIFT].words + (id & (CHUNK_WORDS - 1)));
+    }
+    AstNode& operator[](NodeId id) {
+        return *reinterpret_cast<AstNode*>(chunks[id >> CHUNK_SHIFT].words + (id & (CHUNK_WORDS - 1)));
+    }
+
+    // Parallel parsing builds one arena per worker and joins them. Ids in a
+    // worker arena are rewritten as if its chunks started at firstChunk,
+    // the chunk count of the target, then the chunks move without copying.
+    void relocate(uint32_t firstChunk);
+    static NodeId relocated(NodeId id, uint32_t firstChunk) {
+        return id ? id + (firstChunk << CHUNK_SHIFT) : 0;
+    }
+    void adopt(AstArena& other);    // Leaves other empty
+
+    // Words a node of count children takes, header and padding included
+    static uint32_t nodeWords(uint32_t count) {
+        return static_cast<uint32_t>((sizeof(AstNode) + count * sizeof(NodeId) + 7) / 8);
+    }
+    size_t nodes() const { return nodeCount; }
+    uint32_t chunkCount() const { return static_cast<uint32_t>(chunks.size()); }
+    // Words of a chunk and how many are in use, to write the arena out
+    const uint64_t* chunkWords(uint32_t chunk, uint32_t& used) const {
+        used = chunks[chunk].used;
+        return chunks[chunk].words;
+    }
+    size_t bytes() const;   // Reserved chunk memory
+    void countTypes(uint64_t* counts) const;    // Adds each node to counts[type]
+    void clear();           // Drop every node at once, keeping the first chunk
+
+private:
+    struct Chunk {
+        uint64_t* words;
+        uint32_t capacity;  // In words, CHUNK_WORDS unless it holds one large node
+        uint32_t used;
+    };
+    std::vector<Chunk> chunks;
+    size_t nodeCount = 0;
+
+    void addChunk(uint32_t words);
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "operators.hpp"
+
+enum ValueType : uint32_t {
+    V_UNSET,    // Global never assigned, local not yet assigned
+    V_NONE,     // Result of a function that returns nothing
+    V_INT,
+    V_FLOAT,
+    V_FUNCTION, // Program::functions index
+    V_NATIVE,   // VM native index
+    V_FOREIGN,  // VM foreign function index
+};
+
+struct Value {
+    union {
+        int64_t integer;
+        double real;
+        uint64_t index;
+    };
+    ValueType type;
+
+    static Value ofInt(int64_t integer) { Value v; v.integer = integer; v.type = V_INT; return v; }
+    static Value ofReal(double real) { Value v; v.real = real; v.type = V_FLOAT; return v; }
+    static Value of(ValueType type, uint64_t index = 0) { Value v; v.index = index; v.type = type; return v; }
+}; // 16 bytes
+
+// Instructions are 32 bits: the opcode in the low byte, then registers A,
+// B and C a byte each, or A and a 16-bit Bx in place of B and C. sBx and sC
+// are Bx and C biased to signed. Jumps are relative to the next instruction.
+enum Opcode : uint8_t {
+    OP_MOVE,        // A = B
+    OP_LOADI,       // A = sBx
+    OP_LOADK,       // A = constants[Bx]
+    OP_GETGLOBAL,   // A = globals[Bx]
+    OP_SETGLOBAL,   // globals[Bx] = A
+    OP_CLEAR,       // A = unset, for a local read before assignment
+    OP_CHECK,       // Stops with undefined name locals[Bx] if A is unset
+
+    // A = B op C. Integer arithmetic wraps; an int and a float give a float
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+    OP_BAND, OP_BOR, OP_BXOR, OP_SHL, OP_SHR,   // Ints only, shift counts taken mod 64
+    OP_EQ, OP_NE, OP_LT, OP_LE,                 // 1 or 0
+    OP_ADDI,        // A = B + sC
+
+    OP_NEG, OP_NOT, OP_BNOT,    // A = op B
+
+    OP_JMP,         // pc += sBx
+    OP_JMPF,        // if !A: pc += sBx
+    OP_JMPT,        // if A: pc += sBx
+
+    OP_CALL,        // A = A(A+1, ..., A+B); the callee's registers start at A+1
+    OP_RET,         // return A
+    OP_RET0,        // return none
+
+    OPCODES,
+};
+
+constexpr int32_t SBX_BIAS = 0x7FFF;
+constexpr int32_t SC_BIAS = 0x80;
+constexpr uint32_t MAX_REGISTERS = 256;
+
+inline uint32_t encode(Opcode op, uint32_t a, uint32_t b = 0, uint32_t c = 0) {
+    return op | a << 8 | b << 16 | c << 24;
+}
+inline uint32_t encodeBx(Opcode op, uint32_t a, uint32_t bx) { return op | a << 8 | bx << 16; }
+inline Opcode opcodeOf(uint32_t ins) { return static_cast<Opcode>(ins & 0xFF); }
+inline uint32_t argA(uint32_t ins) { return (ins >> 8) & 0xFF; }
+inline uint32_t argB(uint32_t ins) { return (ins >> 16) & 0xFF; }
+inline uint32_t argC(uint32_t ins) { return ins >> 24; }
+inline uint32_t argBx(uint32_t ins) { return ins >> 16; }
+inline int32_t argSBx(uint32_t ins) { return static_cast<int32_t>(ins >> 16) - SBX_BIAS; }
+inline int32_t argSC(uint32_t ins) { return static_cast<int32_t>(ins >> 24) - SC_BIAS; }
+
+struct Function {
+    std::string name;
+    uint32_t params = 0;
+    uint32_t registers = 0;     // Params first, then locals, then temporaries
+    std::vector<uint32_t> code;
+    std::vector<std::string> locals;    // Names, params first, for OP_CHECK
+};
+
+// functions[0] holds the module's top-level statements. Globals are slots
+// named by their source name; the VM binds each function to its slot, and
+// each native to the slot of the same name, before running.
+struct Program {
+    std::vector<Function> functions;
+    std::vector<Value> constants;
+    std::vector<std::string> globals;
+    std::vector<uint32_t> functionSlots;    // Global slot of functions[i], 0 for functions[0]
+};
+
+const char* opcodeName(Opcode op);
+// Opcode of a binary operator, OPCODES if it has none. TT_GT and TT_GE
+// come back as OP_LT and OP_LE with swap set.
+Opcode binaryOpcode(TokenType type, bool& swap);
+// Operator a compound assignment applies: TT_PLUS for TT_IADD, TT_EQUAL
+// for plain assignment, TT_UNKNOWN for the ones without an opcode
+TokenType compoundOperator(TokenType type);
+// Reads of a function's locals that some path reaches before the local is
+// assigned: the AST_IDENT nodes in body that both compilers check at run
+// time, so they stop as an unset global does. locals numbers the
+// function's locals, its params first.
+std::unordered_set<NodeId> uncertainReads(const AstArena& arena, NodeId body,
+                                          const std::unordered_map<symbol_t, uint32_t>& locals, uint32_t params);
+// One line per instruction, for tests and debugging
+std::string disassemble(const Program& program, const Function& function);
+
+// Lowers a parsed module to a Program. Names assigned anywhere in a
+// function body are its locals and live in registers, Python style; other
+// names are globals. Top-level defs are visible from the start, so calls
+// may precede definitions. Constructs the VM can't run (complex numbers,
+// member access, custom operators, nested defs) are reported in errors,
+// as are the AST_ERROR nodes of a failed parse.
+class Compiler {
+public:
+    // Symbols are read from lexer.pool, so the lexer can't use a shared Interner
+    Compiler(const AstArena& arena, const Lexer& lexer);
+    bool compile(NodeId root, Program& program);
+
+    std::vector<std::string> errors;
+
+private:
+    struct Scope {
+        Function* function;
+        std::unordered_map<symbol_t, uint32_t> locals;  // Symbol -> register
+        std::unordered_set<NodeId> uncertain;           // See uncertainReads
+        uint32_t top = 0;   // First free register
+    };
+
+    const AstArena& arena;
+    const Lexer& lexer;
+    Program* program = nullptr;
+    Scope* scope = nullptr;
+    std::unordered_map<symbol_t, uint32_t> globalSlots;
+    std::unordered_map<uint64_t, uint32_t> constantSlots;   // Int constants by value
+    std::unordered_map<uint64_t, uint32_t> realSlots;       // Float constants by bits
+
+    const char* name(symbol_t symbol) const { return lexer.pool.data() + symbol; }
+    void fail(const std::string& message);
+    uint32_t global(symbol_t symbol);
+    uint32_t constant(const Value& value);
+
+    void collectLocals(NodeId node, Scope& scope);
+    void compileFunction(NodeId def, uint32_t index);
+
+    uint32_t allocate();
+    uint32_t emit(uint32_t ins);
+    uint32_t emitJump(Opcode op, uint32_t a = 0);
+    void patch(uint32_t jump);
+    void patch(uint32_t jump, uint32_t target);
+
+    void statement(NodeId id);
+    void expression(NodeId id, uint32_t target);
+    uint32_t operand(NodeId id);     // Register holding the value, a temporary if needed
+    uint32_t readLocal(NodeId id, uint32_t reg);
+    void assignment(NodeId id, uint32_t target, bool wanted);
+    void call(NodeId id, uint32_t target);
+    void binary(Opcode op, NodeId left, NodeId right, uint32_t target, bool swap = false);
+};
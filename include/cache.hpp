@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "mappedfile.hpp"
+#include "parser.hpp"
+
+// On-disk cache of lexed and parsed files, keyed by a hash of the source.
+// An entry holds the tokens, the Lexer's pool, constants and strings, the
+// parser's diagnostics, the AST chunks in their in-memory layout and the
+// source, each section 8-byte aligned, so a mapped entry is used in place
+// with no deserialization.
+//
+// Entries are only valid for this build: the header records the format
+// version and the Token and AstNode sizes, and any mismatch, as well as a
+// different source, reads as a miss. The source is compared byte for
+// byte, so two files whose hashes collide never share an entry. The tree
+// and its diagnostics depend on operator precedence, so the header also
+// records the OperatorTable's fingerprint and a parse with another table
+// misses. Lexers with a shared Interner can't be cached, their symbols
+// are only meaningful in this process.
+class TokenCache {
+public:
+    static constexpr uint32_t VERSION = 3;
+
+    explicit TokenCache(std::string directory);
+
+    // Entry file for a source, named by its hash
+    std::string path(std::string_view source) const;
+    // Writes the entry through a temporary file renamed into place, so a
+    // concurrent reader sees the old entry or the new one. False if the
+    // directory is not writable or the lexer interned into an Interner.
+    bool store(std::string_view source, const std::vector<Token>& tokens, const Lexer& lexer,
+               const Parser& parser, NodeId root) const;
+
+private:
+    friend class CachedUnit;
+    std::string directory;
+
+    std::string path(uint64_t hash) const;
+};
+
+// A mapped cache entry. valid() is false on a miss; the accessors are only
+// meaningful on a hit and point into the mapping, which lives as long as
+// the CachedUnit. A damaged entry misses rather than hand out ids or
+// offsets that point outside it.
+class CachedUnit {
+public:
+    CachedUnit(const TokenCache& cache, std::string_view source,
+               const OperatorTable& operators = OperatorTable::builtin());
+    CachedUnit(const CachedUnit&) = delete;
+    CachedUnit& operator=(const CachedUnit&) = delete;
+
+    bool valid() const { return hit; }
+
+    const Token* tokens() const { return tokenData; }
+    size_t tokenCount() const { return tokenSize; }
+    // Lexer::pool contents, names at the offsets the symbols hold
+    const char* pool() const { return poolData; }
+    size_t poolBytes() const { return poolSize; }
+    const Constant* constants() const { return constantData; }
+    size_t constantCount() const { return constantSize; }
+    // Lexer::strings contents, see escapedString()
+    const char* strings() const { return stringData; }
+    size_t stringBytes() const { return stringSize; }
+    const Diagnostic* diagnostics() const { return diagnosticData; }
+    size_t diagnosticCount() const { return diagnosticSize; }
+
+    NodeId root() const { return rootId; }
+    size_t nodes() const { return nodeCount; }
+    const AstNode& operator[](NodeId id) const {
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(base + chunkOffsets[id >> AstArena::CHUNK_SHIFT]);
+        return *reinterpret_cast<const AstNode*>(words + (id & (AstArena::CHUNK_WORDS - 1)));
+    }
+
+private:
+    CachedUnit(const TokenCache& cache, std::string_view source, uint64_t hash, uint64_t operatorHash);
+    bool tokensInBounds(size_t sourceBytes) const;
+    bool nodesInBounds(uint32_t chunkCount, uint64_t end) const;    // end: of the node section
+
+    MappedFile file;
+    const char* base = nullptr;
+    bool hit = false;
+
+    const Token* tokenData = nullptr;
+    size_t tokenSize = 0;
+    const char* poolData = nullptr;
+    size_t poolSize = 0;
+    const Constant* constantData = nullptr;
+    size_t constantSize = 0;
+    const char* stringData = nullptr;
+    size_t stringSize = 0;
+    const Diagnostic* diagnosticData = nullptr;
+    size_t diagnosticSize = 0;
+    const uint64_t* chunkOffsets = nullptr;
+    NodeId rootId = 0;
+    size_t nodeCount = 0;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+enum Format : uint16_t {
+    F_NONE,
+    F_INT, F_FLOAT, F_COMPLEX,
+    F_ESCAPED,  // TT_STRING decoded into Lexer::strings
+};
+
+enum ConstantFlags : uint16_t {
+    K_OVERFLOW = 1,     // Integer past int64 (saturated), or float past double range
+    K_INVALID = 2,      // Char literal that is not exactly one character
+};
+
+// Decoded numeric or char literal. F_COMPLEX literals are imaginary ("2.5j"), their
+// imaginary part is in real.
+struct Constant {
+    union {
+        int64_t integer;    // F_INT, a char literal's code point
+        double real;        // F_FLOAT, F_COMPLEX
+    };
+    uint32_t length;        // Of the spelling in the source
+    Format format;
+    uint16_t flags;
+}; // 16 bytes
+
+// Decodes a literal as the lexer scans it: decimal digits with an optional
+// fraction and exponent, or 0x / 0b integers, '_' between digits, and an
+// optional 'j' suffix. Hex and binary literals keep their low 64 bits, so
+// 0xFFFFFFFFFFFFFFFF is -1; only wider ones overflow.
+Constant decodeNumber(const char* text, uint32_t length);
+
+// Decodes a char literal as the lexer scans it, quotes included. It holds
+// one byte, one UTF-8 sequence or one escape; the value is its code point,
+// or the byte for \xHH.
+Constant decodeChar(const char* text, uint32_t length);
+
+// Decodes the escapes in a string literal, quotes excluded, into out, which
+// must hold length bytes: decoding never lengthens. \xHH gives a byte,
+// \uHHHH and \UHHHHHHHH a code point in UTF-8, and an unknown escape stays
+// as written. Returns the decoded length.
+uint32_t decodeString(const char* text, uint32_t length, char* out);
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "bytecode.hpp"
+
+// Calls into C. A signature is the return type, then the parameter types
+// in parentheses, one letter each: 'l' a 64-bit integer (long, int64_t,
+// size_t), 'i' a 32-bit C int, 'd' a double, and 'v' for a void return.
+// "d(d)" is cos, "l(l)" labs, "d(di)" ldexp.
+constexpr uint32_t FFI_MAX_PARAMS = 4;
+
+// Converts args to the C types of one signature, calls address directly
+// and converts what it returns. False when an argument has the wrong
+// type: an 'l' parameter takes ints, an 'i' one ints that fit in 32 bits,
+// a double one ints or floats.
+using ForeignCall = bool (*)(void* address, const Value* args, Value& result);
+
+// The trampoline for signature: one function per signature shape,
+// instantiated at build time for every return type and up to
+// FFI_MAX_PARAMS parameters, so a call marshals nothing at run time
+// beyond its own arguments. Null, with params untouched, for a malformed
+// or unsupported signature.
+ForeignCall foreignTrampoline(const char* signature, uint32_t& params);
+
+// A C function bound to its trampoline, for VM::define
+struct ForeignFunction {
+    void* address = nullptr;
+    ForeignCall call = nullptr;
+    uint32_t params = 0;
+};
+
+// A shared library opened with dlopen (LoadLibrary on Windows), or the
+// running program and what it links when path is null. Functions looked
+// up in it are only valid while it stays open.
+class ForeignLibrary {
+public:
+    explicit ForeignLibrary(const char* path);
+    ~ForeignLibrary();
+    ForeignLibrary(const ForeignLibrary&) = delete;
+    ForeignLibrary& operator=(const ForeignLibrary&) = delete;
+
+    bool isOpen() const { return handle != nullptr; }
+    // False, with error set, when the symbol is missing or the signature
+    // is malformed
+    bool lookup(const char* symbol, const char* signature, ForeignFunction& function);
+
+    std::string error;
+
+private:
+    void* handle = nullptr;
+#ifdef _WIN32
+    bool owned = false;     // Not for the running program's own module
+#endif
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+typedef uint32_t symbol_t;
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+inline uint64_t load64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t load32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// 64x64 -> 128 bit multiply, folded to 64 bits
+inline uint64_t hashMix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t aLow = a & 0xFFFFFFFF, aHigh = a >> 32, bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+    uint64_t middle = aHigh * bLow + (aLow * bLow >> 32);
+    uint64_t middle2 = aLow * bHigh + (middle & 0xFFFFFFFF);
+    uint64_t high = aHigh * bHigh + (middle >> 32) + (middle2 >> 32);
+    return (a * b) ^ high;
+#endif
+}
+
+// wyhash-style: 16 bytes per multiply, and every load stays inside the
+// string, so names can be hashed in place at the end of a mapped file.
+// Never 0 so 0 can mark empty slots.
+inline uint64_t hashSymbol(const char* string, uint32_t length) {
+    const uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull, k2 = 0x8ebc6af09c88c6e3ull;
+    uint64_t seed = k0;
+    uint64_t a = 0, b = 0;
+    const char* p = string;
+    if (length <= 16) {
+        if (length >= 4) {
+            uint32_t shift = (length >> 3) << 2;    // 0 below 8 bytes, else 4
+            a = load32(p) << 32 | load32(p + shift);
+            b = load32(p + length - 4) << 32 | load32(p + length - 4 - shift);
+        } else if (length > 0) {
+            a = static_cast<uint64_t>(static_cast<unsigned char>(p[0])) << 16 |
+                static_cast<uint64_t>(static_cast<unsigned char>(p[length >> 1])) << 8 |
+                static_cast<unsigned char>(p[length - 1]);
+        }
+    } else {
+        uint32_t left = length;
+        for (; left > 16; left -= 16, p += 16) seed = hashMix(load64(p) ^ k1, load64(p + 8) ^ seed);
+        a = load64(p + left - 16);
+        b = load64(p + left - 8);
+    }
+    uint64_t hash = hashMix(k2 ^ length, hashMix(a ^ k1, b ^ seed));
+    return hash ? hash : 1;
+}
+
+// Equality of two names of the given length, a vector or word at a time,
+// with overlapping last loads instead of a byte loop
+inline bool sameName(const char* a, const char* b, uint32_t length) {
+    if (length >= 16) {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        uint32_t i = 0;
+        for (; i + 16 < length; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) return false;
+        }
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + length - 16));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + length - 16));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xFFFF;
+#else
+        return memcmp(a, b, length) == 0;
+#endif
+    }
+    if (length >= 8)
+        return load64(a) == load64(b) && load64(a + length - 8) == load64(b + length - 8);
+    if (length >= 4)
+        return load32(a) == load32(b) && load32(a + length - 4) == load32(b + length - 4);
+    for (uint32_t i = 0; i < length; ++i)
+        if (a[i] != b[i]) return false;
+    return true;
+}
+
+// Project-wide symbol table shared by many Lexers on many threads. Symbols
+// are stable ids, equal across files exactly when the strings are equal.
+// The table is split into shards picked by hash, each a Robin Hood table
+// under its own reader/writer lock, so lookups of known symbols only take
+// a shared lock and inserts contend per shard.
+class Interner {
+public:
+    static constexpr uint32_t SHARD_BITS = 6;
+    static constexpr uint32_t SHARDS = 1u << SHARD_BITS;
+
+    explicit Interner(size_t expectedSymbols = 1 << 16);
+    Interner(const Interner&) = delete;
+    Interner& operator=(const Interner&) = delete;
+
+    symbol_t intern(const char* string, uint32_t length);
+    symbol_t intern(std::string_view string) {
+        return intern(string.data(), static_cast<uint32_t>(string.size()));
+    }
+    std::string_view name(symbol_t symbol) const;
+    size_t size() const;
+
+private:
+    struct Slot {
+        uint64_t hash = 0;  // 0 = empty
+        uint32_t id;        // Index into names
+        uint32_t length;
+    }; // 16 bytes
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex lock;
+        std::vector<Slot> table;
+        uint32_t capacity;  // Power of two required
+        uint32_t threshold;
+        std::vector<std::string_view> names;
+
+        // String arena, blocks never move once allocated
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char* cursor = nullptr;
+        size_t left = 0;
+
+        bool find(uint64_t hash, const char* string, uint32_t length, uint32_t& id) const;
+        void insert(Slot slot);
+        void grow();
+        const char* store(const char* string, uint32_t length);
+    };
+
+    Shard shards[SHARDS];
+};
@@ -0,0 +1,188 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include "lexer.hpp"
+#include "threadpool.hpp"
+
+typedef uint32_t IrId;  // Index into IrFunction::insts
+constexpr IrId IR_NONE = 0xFFFFFFFF;
+
+enum IrOp : uint8_t {
+    IR_NOP,         // Removed by a pass, no longer in any block
+    IR_INT, IR_FLOAT,
+    IR_UNDEF,       // A local read before any assignment
+    IR_PARAM,       // index
+    IR_PHI,         // One operand per predecessor, in IrBlock::preds order
+    IR_GETGLOBAL,   // index is the slot
+    IR_SETGLOBAL,   // value; index is the slot
+    IR_CHECK,       // value; stops if unset, index is the IrFunction::locals name
+
+    // Same order as OP_ADD ... OP_LE, with the same semantics
+    IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD,
+    IR_BAND, IR_BOR, IR_BXOR, IR_SHL, IR_SHR,
+    IR_EQ, IR_NE, IR_LT, IR_LE,
+    IR_NEG, IR_NOT, IR_BNOT,
+
+    IR_CALL,        // callee, args...
+
+    // Terminators, one at the end of every reachable block
+    IR_JUMP,        // To succs[0]
+    IR_BRANCH,      // condition; succs[0] if truthy, else succs[1]
+    IR_RET,         // value
+    IR_RET0,
+    IR_OPS,
+};
+
+enum IrFlags : uint8_t {
+    IRF_COMPOUND = 1,   // Operator of a compound assignment, x op= y
+};
+
+struct IrInst {
+    IrOp op;
+    uint8_t flags;
+    uint16_t count;     // Operands
+    uint32_t block;
+    uint32_t first;     // Operands start here in IrFunction::operands
+    union {
+        int64_t integer;
+        double real;
+        uint32_t index;
+    };
+}; // 24 bytes
+
+struct IrBlock {
+    std::vector<IrId> insts;        // Phis first, terminator last
+    std::vector<uint32_t> preds;
+    std::vector<uint32_t> succs;
+};
+
+// One function in SSA form. Instructions and blocks live in flat arrays
+// and refer to each other by index; a pass that rewrites an instruction
+// changes it in place or turns it into an IR_NOP.
+struct IrFunction {
+    std::string name;
+    uint32_t params = 0;
+    std::vector<IrInst> insts;
+    std::vector<IrId> operands;
+    std::vector<IrBlock> blocks;    // blocks[0] is the entry; unreachable ones end up empty
+    std::vector<std::string> locals;    // As Function::locals
+
+    IrId operand(IrId id, uint32_t i) const { return operands[insts[id].first + i]; }
+    IrId& operand(IrId id, uint32_t i) { return operands[insts[id].first + i]; }
+    IrId append(uint32_t block, IrOp op, const IrId* args = nullptr, uint32_t count = 0);
+    IrId constant(int64_t value);   // New IR_INT at the top of the entry block
+    IrId realConstant(double value);
+};
+
+// Same global and function numbering as Program, which lowerModule fills
+struct IrModule {
+    std::vector<IrFunction> functions;  // functions[0] is the module body
+    std::vector<std::string> globals;
+    std::vector<uint32_t> functionSlots;
+};
+
+inline bool isTerminator(IrOp op) { return op >= IR_JUMP; }
+inline bool producesValue(IrOp op) { return op != IR_NOP && op != IR_SETGLOBAL && op != IR_CHECK && op < IR_JUMP; }
+
+// Reachable blocks, each before its successors except along back edges
+std::vector<uint32_t> reversePostorder(const IrFunction& function);
+// Drops the edge and the predecessor's operand from each phi of to
+void removeEdge(IrFunction& function, uint32_t from, uint32_t to);
+// Empties blocks the entry no longer reaches; returns how many
+uint32_t removeUnreachable(IrFunction& function);
+// Drops IR_NOP ids from the block lists
+void compactBlocks(IrFunction& function);
+
+std::string dumpIr(const IrModule& module, const IrFunction& function);
+
+// Builds SSA form straight from the tree, Braun et al. style: locals are
+// read through their definitions per block, with phis placed on demand
+// and completed when a block's predecessors are all known. Scoping and
+// the unsupported constructs are the same as Compiler's.
+class IrBuilder {
+public:
+    // Symbols are read from lexer.pool, so the lexer can't use a shared Interner
+    IrBuilder(const AstArena& arena, const Lexer& lexer);
+    bool build(NodeId root, IrModule& module);
+
+    std::vector<std::string> errors;
+
+private:
+    const AstArena& arena;
+    const Lexer& lexer;
+    IrModule* module = nullptr;
+    IrFunction* function = nullptr;
+    std::unordered_map<symbol_t, uint32_t> globalSlots;
+    std::unordered_map<symbol_t, uint32_t> variables;   // Locals of the function being built
+    std::unordered_set<NodeId> uncertain;               // See uncertainReads
+    std::vector<std::vector<IrId>> definitions;         // Per block, per variable
+    std::vector<uint8_t> sealed;
+    std::vector<std::vector<std::pair<uint32_t, IrId>>> incomplete;    // Per block: variable, phi
+    uint32_t current = 0;
+    IrId undefined = IR_NONE;
+
+    const char* name(symbol_t symbol) const { return lexer.pool.data() + symbol; }
+    void fail(const std::string& message) { errors.push_back(message); }
+    uint32_t global(symbol_t symbol);
+    void collectLocals(NodeId id);
+    void buildFunction(NodeId body, const std::vector<symbol_t>& params);
+
+    uint32_t newBlock();
+    void seal(uint32_t block);
+    bool terminated() const;
+    IrId emit(IrOp op, std::initializer_list<IrId> args = {});
+    void jump(uint32_t target);
+    void branch(IrId condition, uint32_t whenTrue, uint32_t whenFalse);
+    IrId phi(uint32_t block);
+    void completePhi(IrId phi, uint32_t variable);
+    IrId undef();
+    IrId read(uint32_t variable, uint32_t block);
+    IrId readLocal(NodeId id, uint32_t variable);
+
+    void statement(NodeId id);
+    IrId expression(NodeId id);
+    IrId assignment(NodeId id);
+    IrId logical(NodeId id, bool isAnd);
+};
+
+enum IrPass : uint8_t {
+    PASS_FOLD,      // Constant folding and propagation, branch folding, trivial phis
+    PASS_SIMPLIFY,  // Algebraic identities and strength reduction on int operands
+    PASS_CSE,       // Dominator-scoped value numbering
+    PASS_DCE,       // Mark and sweep from effects and possible traps
+    IR_PASSES,
+};
+
+const char* passName(IrPass pass);
+
+struct PassStats {
+    uint64_t nanos[IR_PASSES] = {};
+    uint64_t changes[IR_PASSES] = {};   // Instructions and edges rewritten or removed
+
+    void merge(const PassStats& other);
+};
+
+uint32_t foldConstants(IrFunction& function);
+uint32_t simplifyOperators(IrFunction& function);
+uint32_t numberValues(IrFunction& function);
+uint32_t eliminateDeadCode(IrFunction& function);
+
+// Runs the passes to a fixed point, a few rounds at most, on each function:
+// in parallel on workers when given. Times are summed over functions.
+PassStats optimizeFunction(IrFunction& function);
+PassStats optimize(IrModule& module, ThreadPool* workers = nullptr);
+
+// Out of SSA into register bytecode: phis become parallel copies on
+// their incoming edges, and registers are assigned first fit over live
+// ranges, in definition order. Constants are loaded where used rather than held in
+// registers. False, with errors, when a function needs more than 256
+// registers or a jump is out of range.
+bool lowerModule(const IrModule& module, Program& program, std::vector<std::string>& errors);
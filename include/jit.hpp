@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "bytecode.hpp"
+
+// Native code needs x86-64 and mmap; elsewhere compile() always fails and
+// the VM keeps interpreting
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__unix__)
+#define LIGHTNING_JIT 1
+#else
+#define LIGHTNING_JIT 0
+#endif
+
+// Baseline compiler from bytecode to x86-64. Every opcode has a machine
+// code template, assembled ahead of time, with holes for its registers,
+// immediates and jump targets: a function compiles by copying the
+// templates in order, patching the holes and making the copy executable.
+//
+// Registers stay in the VM's Value stack, so the interpreter and native
+// code can hand a frame to each other at any instruction. The templates
+// take the int cases inline and float arithmetic out of line; anything
+// else (calls, returns, other operand types, errors) leaves native code
+// at that instruction for the interpreter to run.
+class Jit {
+public:
+    // Functions compile once called, looped or returned into threshold times
+    Jit(const Program& program, uint32_t threshold);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Counts towards compiling functions[index], then runs its native code
+    // from instruction at, if it has any, on the frame at base. Returns the
+    // instruction the interpreter resumes at.
+    uint32_t enter(uint32_t index, uint32_t at, Value* base, Value* globals);
+
+    // False where there is no JIT or executable memory can't be had
+    bool compile(uint32_t index);
+    bool compiled(uint32_t index) const { return index < code.size() && code[index].entry; }
+
+    uint64_t entries = 0;   // Times native code was run
+    size_t codeBytes = 0;   // Machine code over all compiled functions
+
+private:
+    // Native code for one function: entry(base, globals, start) runs from
+    // start, one of offsets, and returns the instruction it stopped at
+    using Entry = uint32_t (*)(Value* base, Value* globals, const uint8_t* start);
+    struct Code {
+        Entry entry = nullptr;
+        uint8_t* memory = nullptr;
+        size_t size = 0;
+        std::vector<uint32_t> offsets;  // Native offset of each instruction
+    };
+
+    const Program& program;
+    uint32_t threshold;
+    std::vector<uint32_t> counters;
+    std::vector<Code> code;
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "lexer.hpp"
+
+// The keyword set. Each keyword has its own TokenType and never reaches the
+// intern table.
+struct Keyword {
+    const char* text;
+    TokenType type;
+};
+
+constexpr Keyword keywordList[] = {
+    {"def", TT_DEF}, {"if", TT_IF}, {"elif", TT_ELIF}, {"else", TT_ELSE},
+    {"while", TT_WHILE}, {"return", TT_RETURN}, {"import", TT_IMPORT},
+};
+
+// Direct-mapped table over a multiplicative hash of an identifier's bytes.
+// The constructor searches for a multiplier that gives every keyword its own
+// slot, so a lookup is one hash, one load and one compare, with no probing.
+class KeywordTable {
+public:
+    static constexpr uint32_t MIN_LENGTH = 2;
+    static constexpr uint32_t MAX_LENGTH = 8;
+    static constexpr uint32_t BITS = 4;
+    static constexpr uint32_t SLOTS = 1u << BITS;
+
+    constexpr KeywordTable() {
+        const uint64_t first = 0x9E3779B97F4A7C15ull;
+        for (uint64_t candidate = first; multiplier == 0 && candidate < first + 2 * 4096; candidate += 2) {
+            bool used[SLOTS] = {};
+            bool perfect = true;
+            for (const Keyword& keyword : keywordList) {
+                uint32_t length = textLength(keyword.text);
+                uint32_t slot = slotOf(key(keyword.text, length), candidate);
+                perfect = perfect && !used[slot] && length >= MIN_LENGTH && length <= MAX_LENGTH;
+                used[slot] = true;
+            }
+            if (perfect) multiplier = candidate;
+        }
+        for (const Keyword& keyword : keywordList) {
+            uint32_t length = textLength(keyword.text);
+            Slot& slot = slots[slotOf(key(keyword.text, length), multiplier)];
+            slot.key = key(keyword.text, length);
+            slot.length = length;
+            slot.type = keyword.type;
+        }
+    }
+
+    // Keyword type of an identifier, or TT_IDENT
+    TokenType find(const char* text, uint32_t length) const {
+        if (length - MIN_LENGTH > MAX_LENGTH - MIN_LENGTH) return TT_IDENT;
+        uint64_t word = key(text, length);
+        const Slot& slot = slots[slotOf(word, multiplier)];
+        // Equal words of different lengths need a periodic spelling, so
+        // the length compare almost never runs for a non-keyword
+        return slot.key == word && slot.length == length ? slot.type : TT_IDENT;
+    }
+
+    static constexpr uint32_t textLength(const char* text) {
+        uint32_t length = 0;
+        while (text[length]) ++length;
+        return length;
+    }
+
+    uint64_t multiplier = 0;    // 0 if the search failed
+
+private:
+    struct Slot {
+        uint64_t key = 0;       // Never an identifier's key
+        uint32_t length = 0;
+        TokenType type = TT_IDENT;
+    };
+    Slot slots[SLOTS] = {};
+
+    static constexpr uint32_t load16(const char* p) {
+        return static_cast<uint32_t>(static_cast<uint8_t>(p[0])) |
+               static_cast<uint32_t>(static_cast<uint8_t>(p[1])) << 8;
+    }
+    static constexpr uint32_t load32(const char* p) {
+        return load16(p) | load16(p + 2) << 16;
+    }
+    // All bytes of a 2-8 byte identifier, from two overlapping loads that
+    // stay inside it
+    static constexpr uint64_t key(const char* p, uint32_t length) {
+        return length >= 4 ? load32(p) | static_cast<uint64_t>(load32(p + length - 4)) << 32
+                           : load16(p) | static_cast<uint64_t>(load16(p + length - 2)) << 32;
+    }
+    static constexpr uint32_t slotOf(uint64_t word, uint64_t multiplier) {
+        return static_cast<uint32_t>((word * multiplier) >> (64 - BITS));
+    }
+};
+
+inline constexpr KeywordTable keywordTable{};
+static_assert(keywordTable.multiplier != 0, "no perfect hash for keywordList, raise KeywordTable::BITS");
@@ -1,15 +1,24 @@
 #pragma once
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "constants.hpp"
+#include "interner.hpp"
+#include "profile.hpp"
+#include "scan.hpp"
+#include "threadpool.hpp"
 
 typedef unsigned char uchar_t;
 
+class TokenStream;
+
 typedef uint32_t symbol_t;
 
 enum CharClass : uint8_t {
     CC_UNKNOWN    = 0,
     CC_NEWLINE    = 2,
+    CC_QUOTE      = 4,
     CC_PUNCT      = 32,
     CC_OPERATOR   = 64,
     CC_DIGIT      = 128,
@@ -19,10 +28,16 @@ enum CharClass : uint8_t {
     CC_UNDERSCORE = 129,
 };
 
+// Byte -> CharClass, or the TokenType for punctuation and operators
+extern const uint8_t charClassDict[256];
+
 enum TokenType : uint16_t {
     TT_UNKNOWN, TT_ERROR,
     TT_IDENT,
-    TT_NUMBER, TT_STRING,
+    TT_NUMBER, TT_STRING, TT_CHAR,
+
+    // Keywords (see keywords.hpp)
+    TT_DEF = 16, TT_IF, TT_ELIF, TT_ELSE, TT_WHILE, TT_RETURN, TT_IMPORT,
 
     TT_LPAREN = 32, TT_RPAREN, 
     TT_COMMA, TT_COLON, TT_SEMICOLON,
@@ -46,7 +61,7 @@ enum TokenType : uint16_t {
     TT_CARET, 
     TT_PIPE = 77, 
     TT_TILDE = 78,
-    TT_QUOT,
+    TT_QUOT,    // Unused, ' starts a char literal
     TT_QUESTION,
     TT_DOT,
 
@@ -70,51 +85,122 @@ enum TokenType : uint16_t {
     
     TT_LSHIFT, TT_RSHIFT, TT_LARROW, TT_RARROW,
 
-    TT_INDENT, TT_DEDENT, TT_NEWLINE, TT_EOF
-};
+    TT_INDENT, TT_DEDENT, TT_NEWLINE, TT_EOF,
 
-enum Format : uint16_t {
-    F_NONE,
-    F_INT, F_FLOAT, F_COMPLEX,
+    TT_LINE,    // Chunk-local line start, resolved to INDENT/DEDENT when stitching
 };
 
 struct Token {
-    symbol_t lexeme;
+    symbol_t lexeme;    // Symbol, constants index of a TT_NUMBER or TT_CHAR, or
+                        // strings offset of an F_ESCAPED TT_STRING
     uint32_t offset;
     uint32_t length;
     TokenType type;
     Format format = F_NONE;
 }; // 16 bytes
 
+// Replace removed bytes at offset with inserted, in pre-edit coordinates
+struct Edit {
+    uint32_t offset;
+    uint32_t removed;
+    std::string_view inserted;
+};
+
+// Starts each literal decoded into Lexer::strings, the bytes follow
+struct StringHeader {
+    uint32_t spelled;   // Source length, quotes included
+    uint32_t length;    // Decoded length
+};
+
+// Text of the F_ESCAPED literal at offset in a strings arena
+std::string_view escapedString(const std::vector<char>& strings, uint32_t offset);
+
+// Intern table slot. The hash, length and prefix reject nearly every
+// mismatch, and confirm names of up to 4 bytes, without touching pool.
 struct Entry {
-    uint64_t hash = 0;  // 0 = empty
+    uint32_t hash = 0;  // Low half of hashSymbol, 0 = empty
     uint32_t offset;
     uint32_t length;
+    uint32_t prefix;    // First 4 bytes of the name, zero padded
 }; // 16 bytes
 
 class Lexer {
 public:
     Lexer(std::string src);
+    // Copies, as before the view overload, so literals stay unambiguous
+    Lexer(const char* src);
+    // Lexes the caller's buffer in place, which must outlive the Lexer.
+    // Only the last unterminated line is copied, to give it a sentinel.
+    Lexer(std::string_view src);
     std::vector<Token> tokenize();
+    // Same tokens in compact structure-of-arrays form (see tokenstream.hpp)
+    TokenStream tokenizeStream();
+    // Same result as tokenize(), lexing newline-aligned chunks on the pool
+    std::vector<Token> tokenizeParallel(ThreadPool& workers, size_t chunkBytes = 1 << 18);
+    // Applies edit to the source and patches tokens, the last result of this
+    // Lexer, by re-lexing from the edited line until the old stream lines up
+    void relex(std::vector<Token>& tokens, const Edit& edit);
+    void setScanLevel(ScanLevel level);
+    // Intern through a shared table; lexemes are then Interner symbols and
+    // pool only caches this file's names
+    void setInterner(Interner* interner);
+    // Contents of a TT_STRING: a view of the input, or of strings if escaped
+    std::string_view literal(const Token& token) const;
     std::vector<char> pool;
+    std::vector<Constant> constants;    // Decoded numbers and chars, one per distinct spelling
+    std::vector<char> strings;          // String literals with escapes, decoded
+    bool sharesSymbols() const { return shared != nullptr; }
 private:
+    friend class StreamLexer;
+
     // Source memory
-    std::string source;
+    std::string source;     // Owned input, its terminator is the sentinel
+    std::string_view view;  // Caller's buffer, copied into source on the first edit
+    std::string tail;       // Padded copy of a view's last line
+    uint32_t tailBase = 0;  // Offset of tail in the input
+    bool tailPending = false;
     const char* begin;
     const char* current;
     const char* end;
+    uint32_t base = 0;      // Offset of begin in the input
+    const ScanKernels* scan;
 
     // Indentation memory
     std::vector<uint16_t> indentStack;
     bool atLineStart = true;
+    bool deferIndent = false;   // Chunk lexers emit TT_LINE instead
+    bool copyLiterals = false;  // Decode every string, the input is transient
 
     // Intern table memory and logic
+    Interner* shared = nullptr;
+    std::vector<symbol_t> sharedIds;    // Pool offset -> shared symbol
+    std::vector<uint32_t> constantIds;  // Pool offset -> constants index, plus droppedConstants
+    uint32_t droppedConstants = 0;      // Cleared from constants by a StreamLexer
     std::vector<Entry> table;
     uint32_t capacity;  // Power of two required
     uint32_t size = 0;
     uint32_t threshold;
 
+    PROFILE_ONLY(LexerCounters counters;)
+    PROFILE_ONLY(void countTokens(const std::vector<Token>& tokens, size_t from, size_t bytes);)
+    PROFILE_ONLY(void countTokens(const TokenStream& tokens, size_t bytes);)
+    PROFILE_ONLY(void publishCounters();)
+
+    // Chunk lexer over [from, to) of the segment starting at input offset segmentBase
+    Lexer(const Lexer& parent, const char* segment, uint32_t segmentBase, const char* from, const char* to);
+    void enterTail();
+    // Sink is std::vector<Token> or TokenStream
+    template <typename Sink> void lex(Sink& tokens);
+    template <typename Sink> void indentTo(uint32_t indent, uint32_t offset, Sink& tokens);
+    template <typename Sink> void finish(Sink& tokens);
+
+    void initTable(size_t bytes);
     symbol_t intern(const char* string, uint32_t length);
+    uint32_t internLocal(const char* string, uint32_t length, bool& added);
+    // Constant index for a number or char spelling, decoded on first sight unless given
+    uint32_t number(const char* string, uint32_t length, const Constant* decoded = nullptr);
+    // Decodes a string literal into strings, returns its offset there
+    uint32_t decodeLiteral(const char* string, uint32_t length);
     void grow();
     void insert(Entry entry);
 }; // 128 bytes
\ No newline at end of file
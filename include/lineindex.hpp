@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+#include "scan.hpp"
+
+// 1-based line, and 1-based column in bytes
+struct Location {
+    uint32_t line;
+    uint32_t column;
+};
+
+// Byte offset -> line and column, for diagnostics. The line starts are found
+// with the vector line kernels on the first lookup, lookups are a binary
+// search. Line breaks match the lexer: "\n", "\r\n" and a lone '\r'.
+// The source must outlive the index; lookups are not thread-safe because
+// the first one builds the table.
+class LineIndex {
+public:
+    LineIndex();
+    explicit LineIndex(std::string_view source);
+    void reset(std::string_view source);    // Drops the table until the next lookup
+
+    Location locate(uint32_t offset);
+    uint32_t lineStart(uint32_t line);      // Offset of a 1-based line
+    uint32_t lines();
+
+    // Follows an edit, given in pre-edit coordinates as for Lexer::relex,
+    // with source the text after it. Only the edited lines are rescanned.
+    void update(std::string_view source, const Edit& edit);
+    void setScanLevel(ScanLevel level);
+
+private:
+    std::string_view text;
+    std::vector<uint32_t> starts;   // Offsets of line starts, starts[0] = 0
+    bool built = false;
+    const ScanKernels* scan;
+
+    void build();
+};
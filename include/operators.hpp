@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lexer.hpp"
+
+// Binding powers for the Pratt parser, higher binds tighter
+enum Power : uint8_t {
+    P_NONE,
+    P_ASSIGN,
+    P_OR, P_AND,
+    P_BITOR, P_BITXOR, P_BITAND,
+    P_EQUALITY, P_COMPARISON,
+    P_SHIFT, P_TERM, P_FACTOR,
+    P_PREFIX,
+    P_CALL, P_MEMBER,
+};
+
+enum BindingFlags : uint8_t {
+    B_RIGHT  = 1,   // Right associative
+    B_ASSIGN = 2,   // Builds AST_ASSIGN instead of AST_BINARY
+};
+
+struct Binding {
+    uint8_t power = P_NONE;     // P_NONE: not an infix operator
+    uint8_t flags = 0;
+};
+
+// TokenType values are below this
+constexpr size_t TOKEN_TYPES = 128;
+
+// Infix and prefix binding per TokenType, plus user-defined operators that
+// the lexer returns as TT_CUSTOM_OP, looked up by spelling. Tables are plain
+// arrays indexed by type, so the parser pays one load per operator however
+// many levels exist. A table must outlive the Parsers using it and must not
+// be changed while they run.
+class OperatorTable {
+public:
+    OperatorTable();    // The built-in operators
+    static const OperatorTable& builtin();
+
+    // Defines or redefines a custom operator. False unless text is all
+    // operator characters, so that it lexes as one TT_CUSTOM_OP token.
+    bool define(std::string_view text, Binding infix, uint8_t prefix = P_NONE);
+
+    const Binding& infix(TokenType type) const { return infixes[type]; }
+    uint8_t prefix(TokenType type) const { return prefixes[type]; }
+
+    // Index of the custom operator spelled text, or -1
+    int32_t find(const char* text, uint32_t length) const;
+    const Binding& customInfix(uint32_t index) const { return customs[index].infix; }
+    uint8_t customPrefix(uint32_t index) const { return customs[index].prefix; }
+    std::string_view customName(uint32_t index) const { return customs[index].text; }
+    // Hash of every binding and custom spelling; tables that parse alike agree
+    uint64_t fingerprint() const;
+
+private:
+    struct Custom {
+        std::string text;
+        Binding infix;
+        uint8_t prefix;
+    };
+
+    Binding infixes[TOKEN_TYPES];
+    uint8_t prefixes[TOKEN_TYPES] = {};
+    std::vector<Custom> customs;    // Few entries, searched linearly
+};
+
+// Operator payload of AST_UNARY, AST_BINARY and AST_ASSIGN nodes: the
+// TokenType, with the OperatorTable index of a TT_CUSTOM_OP above it
+inline uint64_t operatorPayload(TokenType type, uint32_t custom = 0) {
+    return static_cast<uint64_t>(custom) << 32 | type;
+}
+inline TokenType payloadOperator(uint64_t payload) { return static_cast<TokenType>(payload & 0xFFFF); }
+inline uint32_t payloadCustom(uint64_t payload) { return static_cast<uint32_t>(payload >> 32); }
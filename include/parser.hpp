@@ -1,64 +1,126 @@
 #pragma once
+#include <string>
+#include <vector>
+#include "ast.hpp"
 #include "lexer.hpp"
+#include "operators.hpp"
+#include "profile.hpp"
+#include "tokenstream.hpp"
 
-typedef uint32_t NodeId;
-
-enum NodeType: uint32_t {
-    AST_UNKNOWN,
-    AST_FUNCDEF, AST_ARG, AST_FUNCCALL, 
-    AST_BLOCK, AST_TYPE,
-    AST_NULL, // Filler type
+enum DiagnosticId : uint32_t {
+    DIAG_INDENT,                // Dedent to a column no enclosing block uses
+    DIAG_UNEXPECTED_INDENT,
+    DIAG_UNEXPECTED_TOKEN,      // Trailing tokens after a statement
+    DIAG_EXPECTED_EXPRESSION,
+    DIAG_EXPECTED_NAME,
+    DIAG_EXPECTED_LPAREN,
+    DIAG_EXPECTED_RPAREN,
+    DIAG_EXPECTED_BLOCK,
+    DIAG_UNKNOWN_OPERATOR,      // TT_CUSTOM_OP missing from the OperatorTable
+    DIAG_NUMBER_RANGE,          // Literal past int64 or double
+    DIAG_CHAR_LITERAL,          // Char literal not holding one character
 };
 
-typedef struct {
-    NodeType type;
-    NodeId a;
-    NodeId b;
-    NodeId c;
-    uint64_t payload;
-} AstNode;
+struct Diagnostic {
+    uint32_t offset;    // Of the offending token
+    DiagnosticId id;
+}; // 8 bytes
+
+const char* diagnosticMessage(DiagnosticId id);
 
+// Node payloads: AST_IDENT, AST_ARG, AST_TYPE and AST_FUNCDEF carry the
+// name symbol, AST_IMPORT the offset of its first name, AST_NUMBER the
+// Lexer constants index of a number or char literal, and AST_UNARY,
+// AST_BINARY and AST_ASSIGN the operator payload (see operatorPayload).
+// Children by node:
+//   AST_FUNCDEF   args..., body
+//   AST_ARG       [type]
+//   AST_FUNCCALL  callee, args...
+//   AST_BLOCK     statements...
+//   AST_UNARY     operand
+//   AST_BINARY    left, right
+//   AST_ASSIGN    target, value
+//   AST_IF        condition, then, [else]
+//   AST_WHILE     condition, body
+//   AST_RETURN    [value]
+//   AST_ERROR     [block], for an indented block no statement opened
+//   AST_IMPORT    AST_IDENT per dotted name part
+//
+// Errors don't stop the parse. The first error in a statement is recorded,
+// an AST_ERROR stands in for what could not be parsed, and parsing resumes
+// at the next NEWLINE or DEDENT.
 class Parser {
     public:
-    Parser(const std::vector<Token>& tokens, const std::string& reference);
-    NodeId parse();
+    Parser(const TokenStream& tokens, const std::string& reference);
+    NodeId parse();     // Returns the module AST_BLOCK
+    // Same tree as parse(). Top-level declarations are cut into runs of about
+    // chunkTokens tokens, parsed into per-worker arenas and spliced together.
+    NodeId parseParallel(ThreadPool& workers, size_t chunkTokens = 1 << 14);
+    // Operator precedences, OperatorTable::builtin() by default
+    void setOperators(const OperatorTable* table);
+    const OperatorTable& operatorTable() const { return *operators; }
+    AstArena arena;
+
+    // Filled in source order, up to MAX_DIAGNOSTICS, then only counted
+    static constexpr size_t MAX_DIAGNOSTICS = 256;
+    std::vector<Diagnostic> diagnostics;
+    size_t droppedDiagnostics = 0;
 
     private:
-    std::vector<AstNode> nodes;
-    char stringPool[1 << 12] = {};
+    const TokenStream& toks;
     const char* source;
-    const std::vector<Token>& toks;
-    const Token* begin;
-    const Token* current;
-    const Token* end;
+    TokenStream::Iterator begin;
+    TokenStream::Iterator current;
+    TokenStream::Iterator end;
+    const OperatorTable* operators;
+    std::vector<NodeId> pending;    // Children of the nodes being built, as a stack
+    bool panicking = false;         // Error reported in this statement, quiet until the next
+    bool orphanBlock = false;       // Skipped a line that opened a block
+    PROFILE_ONLY(ParserCounters counters;)
+    PROFILE_ONLY(void publishCounters();)
+
+    // Worker parser over tokens [from, to) of the parent's stream
+    Parser(const Parser& parent, size_t from, size_t to);
 
     // Helper
-    NodeId createNode(NodeType type, NodeId a = 0, NodeId b = 0, NodeId c = 0, uint64_t payload = 0) {
-        nodes.push_back(AstNode {type, a, b, c, payload});
-        return static_cast<NodeId>(nodes.size() - 1);
+    TokenType peek() const { return current != end ? current.type() : TT_EOF; }
+    bool match(TokenType type) {
+        if (peek() != type) return false;
+        ++current;
+        return true;
     }
-    uint32_t internString(char* root, uint32_t offset, uint32_t length) {
-        
+    // Node from the children pushed since mark
+    NodeId finishNode(NodeType type, uint64_t payload, size_t mark);
+    void endStatement();
+
+    // Errors
+    uint32_t here() const;
+    void report(DiagnosticId id, uint32_t offset);
+    void report(DiagnosticId id) { report(id, here()); }
+    void expect(TokenType type, DiagnosticId id) {
+        if (!match(type)) report(id);
     }
+    NodeId error(DiagnosticId id);
+    void synchronize();
 
     // Parsing
+    void parseDeclarations();   // Pushes each top-level node onto pending
     NodeId parseDeclaration();
+    NodeId parseLine(bool topLevel);
 
     NodeId parseFunction();
     NodeId parseStatement();
 
+    NodeId parseBody();
     NodeId parseBlock();
     NodeId parseIf();
     NodeId parseWhile();
     NodeId parseReturn();
+    NodeId parseImport();
 
-    NodeId parseExpression();
-    NodeId parseAssignment();
-    NodeId parseEquality();
-    NodeId parseComparison();
-    NodeId parseTerm();
-    NodeId parseFactor();
-    NodeId parseUnary();
+    // Pratt loop, binds operators with power >= minPower
+    NodeId parseExpression(uint8_t minPower = P_ASSIGN);
+    NodeId parsePrefix();
     NodeId parsePrimary();
+    NodeId parseCall(NodeId callee);
 };
-
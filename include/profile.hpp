@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Opt-in instrumentation of the lexer and parser. Configure with
+// -DLIGHTNING_PROFILE=ON to compile the counters and phase timers in;
+// otherwise PROFILE_ONLY and PROFILE_PHASE expand to nothing and the hot
+// paths are the same code as an uninstrumented build. Either way the
+// Profiler class exists, so tools link against both builds.
+#if LIGHTNING_PROFILE
+#define PROFILE_ONLY(...) __VA_ARGS__
+#define PROFILE_PHASE(name) PhaseTimer phaseTimer(name)
+#else
+#define PROFILE_ONLY(...)
+#define PROFILE_PHASE(name)
+#endif
+
+enum TokenCategory : uint8_t {
+    TC_IDENT, TC_KEYWORD, TC_NUMBER, TC_STRING, TC_OPERATOR, TC_PUNCT,
+    TC_LAYOUT,  // INDENT, DEDENT, NEWLINE and EOF, counted without bytes
+    TC_ERROR,
+    TOKEN_CATEGORIES,
+};
+
+struct LexerCounters {
+    static constexpr uint32_t PROBE_BUCKETS = 16;   // The last one holds longer probes
+
+    uint64_t tokens[TOKEN_CATEGORIES] = {};
+    uint64_t bytes[TOKEN_CATEGORIES] = {};
+    uint64_t trivia = 0;            // Bytes of whitespace and comments
+    uint64_t internHits = 0;
+    uint64_t internInserts = 0;
+    uint64_t probes[PROBE_BUCKETS] = {};    // Robin Hood distance at which a lookup ended
+    uint64_t grows = 0;
+    uint64_t growNanos = 0;
+    uint64_t maxIndentDepth = 0;
+
+    void merge(const LexerCounters& other);
+};
+
+struct ParserCounters {
+    static constexpr uint32_t NODE_TYPES = 32;
+
+    uint64_t nodes[NODE_TYPES] = {};    // By NodeType
+    uint64_t arenaBytes = 0;
+    uint64_t lookahead = 0;     // Tokens scanned ahead to tell a call from a definition
+    uint64_t skipped = 0;       // Tokens dropped by error recovery
+
+    void merge(const ParserCounters& other);
+};
+
+struct PhaseRecord {
+    const char* name;
+    uint32_t thread;        // Small per-process id, in order of first use
+    uint64_t start;         // Nanoseconds since the Profiler was created
+    uint64_t wall;
+    uint64_t cpu;           // Thread CPU time
+};
+
+// Collects phases from every thread and the counters of each finished
+// lexer and parser run, while installed. Export as plain JSON or as
+// Chrome trace events, for chrome://tracing or Perfetto.
+class Profiler {
+public:
+    Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // One profiler at a time receives the data; nullptr stops collecting
+    static void install(Profiler* profiler);
+    static Profiler* active();
+
+    void addPhase(const PhaseRecord& phase);
+    void add(const LexerCounters& counters);
+    void add(const ParserCounters& counters);
+
+    std::vector<PhaseRecord> phases() const;
+    LexerCounters lexer() const;
+    ParserCounters parser() const;
+
+    std::string json() const;
+    std::string chromeTrace() const;
+
+    uint64_t now() const;   // Nanoseconds since construction
+
+private:
+    mutable std::mutex lock;
+    std::vector<PhaseRecord> records;
+    LexerCounters lexerTotals;
+    ParserCounters parserTotals;
+    uint64_t origin;
+};
+
+// Records the enclosing scope as a phase of the installed profiler
+class PhaseTimer {
+public:
+    explicit PhaseTimer(const char* name);
+    ~PhaseTimer();
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    Profiler* profiler;
+    const char* name;
+    uint64_t start;
+    uint64_t cpuStart;
+};
+
+uint64_t threadCpuNanos();
+uint32_t profileThreadId();
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "scheduler.hpp"
+#include "tokenstream.hpp"
+
+// A source file of a Project. Its name is the path under the root with
+// separators as dots and the extension dropped: pkg/util.lt is pkg.util,
+// which other modules reach with "import pkg.util".
+struct Module {
+    std::string name;
+    std::string path;
+    std::string source;
+    uint64_t hash = 0;      // hashSymbol of source
+    std::string error;      // Why the file couldn't be read; the module is then empty
+
+    // Front end, kept between builds and replaced when the source changes
+    std::unique_ptr<Lexer> lexer;
+    std::unique_ptr<TokenStream> tokens;
+    std::unique_ptr<Parser> parser;
+    NodeId root = 0;
+
+    std::vector<std::string> importNames;   // Top-level imports as written
+    std::vector<uint32_t> imports;          // Resolved, Project::modules() indices, no duplicates
+    std::vector<uint32_t> importers;
+    std::vector<std::string> unresolved;
+    bool blocked = false;   // In an import cycle, or importing one
+    bool cyclic = false;    // Blocked as a member of a cycle, not only behind one
+
+    // What the last build did
+    bool parsed = false;
+    bool staged = false;
+
+private:
+    friend class Project;
+    std::filesystem::file_time_type modified;
+    uintmax_t bytes = 0;
+    std::vector<std::string> resolvedBefore;    // Import targets of the previous build
+    bool stageValid = false;    // The last stage run saw the current source and imports
+    bool dirty = false;         // Stage runs in this build
+    std::atomic<uint32_t> waiting {0};          // Dirty imports whose stage hasn't run yet
+};
+
+struct BuildStats {
+    size_t modules = 0;
+    size_t parsed = 0;      // Read, lexed and parsed: new or changed files
+    size_t staged = 0;      // Stage ran: changed, or an import was re-staged
+    size_t blocked = 0;
+    size_t unreadable = 0;  // Files that vanished or couldn't be read since the scan
+    size_t unresolved = 0;  // Imports naming no module
+};
+
+// The files of a source tree, built as a dependency graph of modules.
+// build() lexes and parses new and changed files as independent tasks,
+// resolves their imports, then runs the stage on each module after the
+// stage of everything it imports, in parallel where the graph allows.
+// Between builds only the affected part is redone: a module is re-parsed
+// when its bytes change and re-staged when it was re-parsed, its imports
+// resolve differently, or one of its imports was re-staged.
+class Project {
+public:
+    // Runs on a worker, concurrently with the stages of unrelated modules.
+    // The stages of a module's imports have finished and are visible.
+    using Stage = std::function<void(Module&)>;
+
+    explicit Project(std::string root, std::string extension = ".lt");
+
+    BuildStats build(TaskScheduler& scheduler, const Stage& stage);
+
+    const std::vector<std::unique_ptr<Module>>& modules() const { return list; }
+    Module* find(const std::string& name) const;
+
+private:
+    std::string root;
+    std::string extension;
+    std::vector<std::unique_ptr<Module>> list;      // Sorted by name
+    std::unordered_map<std::string, uint32_t> byName;
+
+    void scan();
+    static void parse(Module& module);
+    void markCycles();
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Run scanners used by the lexer hot loops. Each kernel takes [p, end) and
+// returns the first byte that ends the run, or end if the run reaches it.
+typedef const char* (*ScanFn)(const char* p, const char* end);
+
+// Line breaks in [p, end) are '\n' and a '\r' not followed by '\n', as in
+// the lexer. Counts them, or writes the offset just past each one, given
+// the offset of p, and returns the new end of out.
+typedef size_t (*CountLinesFn)(const char* p, const char* end);
+typedef uint32_t* (*LineStartsFn)(const char* p, const char* end, uint32_t offset, uint32_t* out);
+
+enum ScanLevel : uint8_t {
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+struct ScanKernels {
+    ScanFn ident;       // info & CC_IDENT_CONT
+    ScanFn digits;      // info == CC_DIGIT
+    ScanFn operators;   // info & CC_OPERATOR
+    ScanFn spaces;      // ' '
+    ScanFn line;        // info != CC_NEWLINE
+    ScanFn string;      // Not '"', '\\' or CC_NEWLINE
+    CountLinesFn countLines;
+    LineStartsFn lineStarts;
+    const char* name;
+};
+
+// Best level supported by both the build and the running CPU
+ScanLevel detectScanLevel();
+
+// Kernels for a level, clamped to what is available
+const ScanKernels& scanKernels(ScanLevel level);
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing task pool for jobs that spawn more jobs, such as a build
+// whose finished modules release the modules importing them. Each worker
+// owns a deque: it pushes and pops its own tasks at the back, so a chain of
+// dependent tasks stays on one core with warm caches, and idle workers
+// steal the oldest task at the front of another worker's deque.
+//
+// Unlike ThreadPool, the task count isn't known up front. wait() runs
+// tasks on the calling thread until every spawned task, including the
+// ones spawned while waiting, has finished.
+class TaskScheduler {
+public:
+    using Task = std::function<void()>;
+
+    explicit TaskScheduler(unsigned threads = 0);   // 0 = hardware concurrency
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // From a task, onto the running worker's deque; from outside, onto the
+    // deque of the thread that calls wait()
+    void spawn(Task task);
+    // One caller at a time
+    void wait();
+
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+    uint64_t steals() const { return stolen.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;     // queues[0] belongs to the waiting thread
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> queued {0};     // Tasks sitting in some deque
+    std::atomic<size_t> pending {0};    // Spawned and not yet finished
+    std::atomic<unsigned> sleeping {0};
+    std::atomic<uint64_t> stolen {0};
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void work(unsigned index);
+    bool runOne(unsigned index);
+    bool take(unsigned index, Task& task);
+};
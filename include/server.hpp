@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Local Unix sockets; elsewhere listen() and sendRequest() fail
+#if defined(__unix__) || defined(__APPLE__)
+#define LIGHTNING_SERVER 1
+#else
+#define LIGHTNING_SERVER 0
+#endif
+
+// A command line as a client ran it, and where it ran it
+struct Request {
+    std::string directory;
+    std::vector<std::string> args;
+};
+
+// What the command would have printed, and its exit status
+struct Reply {
+    int status = 0;
+    std::string out;
+    std::string err;
+};
+
+// Answers requests on a Unix socket, one at a time, for a process that
+// keeps state warm between them. Each message is a sequence of
+// length-prefixed strings on a connection of its own.
+class CompileServer {
+public:
+    // Fills reply; false to stop serving once it's sent
+    using Handler = std::function<bool(const Request& request, Reply& reply)>;
+
+    explicit CompileServer(std::string path);
+    ~CompileServer();
+    CompileServer(const CompileServer&) = delete;
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    // Binds the socket, replacing a stale one no server answers on, and
+    // leaves it to its owner alone (mode 0600). False, with error set,
+    // when another server has it or it can't be made.
+    bool listen();
+    // Until the handler says to stop, then removes the socket. Malformed
+    // requests, and clients that stall past timeoutMs, are dropped.
+    void serve(const Handler& handler);
+
+    std::string error;
+    uint32_t timeoutMs = 5000;  // Per read or write on a client
+
+private:
+    void stop();
+
+    std::string path;
+    int listener = -1;
+};
+
+// Sends request to the server at path and waits for its reply
+bool sendRequest(const std::string& path, const Request& request, Reply& reply, std::string& error);
@@ -1,61 +1,60 @@
-/* DECAPRATED
 #pragma once
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
-#include <string>
-
-typedef unsigned char uchar_t;
-
-typedef enum : uint8_t {
-    CC_UNKNOWN    = 0,
-    CC_ALPHA      = 1,
-    CC_DIGIT      = 2,
-    CC_OPERATOR   = 4,
-    CC_PUNCT      = 8,
-    CC_SPACE      = 16,
-    CC_NEWLINE    = 32,
-    CC_UNDERSCORE = 64,
-    CC_ANNOT      = 128,
-    // Composition character classes
-    CC_IDENT_START = 65,
-    CC_IDENT_CONT = 67,
-} CharClass;
-
-typedef enum : uint8_t {
-    TT_UNKNOWN, TT_ERROR,
-    TT_IDENT, TT_KEYWORD,
-    TT_INT, TT_FLOAT, TT_COMPLEX, TT_STRING,
-    TT_OPERATOR,
-    TT_PUNCT,
-    TT_INDENT, TT_DEDENT, TT_NEWLINE, TT_EOF
-} TokenType;
-
-typedef struct {
-    TokenType type;
-    size_t index;
-    size_t length;
-} Token;
-
-class Lexer {
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "lexer.hpp"
+
+// Pull-based lexer for inputs too large to hold at once. A producer thread
+// reads fixed-size buffers, lexes the complete lines in each with the same
+// Lexer state machine, and hands the tokens over in batches through a
+// bounded ring, so memory stays constant and reading overlaps lexing.
+//
+// Tokens are identical to Lexer::tokenize() on the whole input. Symbols are
+// always interned into an Interner, which the consumer can read while the
+// producer is still interning; that table grows with the distinct names.
+// Number constants and string literals, all decoded since the buffers are
+// reused, travel with their batch and index its own arenas.
+class StreamLexer {
 public:
-    Lexer(const std::string& sourceCode);
-    Token nextToken();
-    const std::string& source;
-private:
-    // Source memory
-    const char* begin;
-    const char* current;
-    const char* end;
-
-    // Indentation memory
-    uint32_t indentStack[32] = {0};
-    uint32_t stackTop = 0;
-
-    uint32_t stackSize = 32;
-    uint32_t pendingDedents = 0;
-    bool atLineStart = true;
+    // Fills up to capacity bytes, returns 0 at end of input
+    typedef std::function<size_t(char* buffer, size_t capacity)> Reader;
+    static Reader fromFd(int fd);
+
+    StreamLexer(Reader reader, Interner& interner, size_t bufferBytes = 1 << 16, size_t ringBatches = 4);
+    ~StreamLexer();
+    StreamLexer(const StreamLexer&) = delete;
+    StreamLexer& operator=(const StreamLexer&) = delete;
+
+    // Swaps the next batch into batch, whose old storage is recycled, and
+    // its literals into constants and strings, whose old ones are too.
+    // Returns false once the batch ending in TT_EOF has been taken.
+    bool next(std::vector<Token>& batch);
+    // Constants and decoded strings of the batch last taken
+    std::vector<Constant> constants;
+    std::vector<char> strings;
 
-    inline bool isInstance(char c, CharClass cc);
+private:
+    Reader reader;
+    Lexer lexer;
+    std::vector<char> buffer;
+    std::thread producer;
+
+    // Bounded ring of batches
+    std::vector<std::vector<Token>> ring;
+    std::vector<std::vector<Constant>> ringConstants;   // Each batch's constants
+    std::vector<std::vector<char>> ringStrings;         // Each batch's strings
+    size_t head = 0;
+    size_t count = 0;
+    bool done = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable filled;
+    std::condition_variable drained;
+
+    void produce();
+    bool publish(std::vector<Token>& batch, bool last);
 };
-
-*/
\ No newline at end of file
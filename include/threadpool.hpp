@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers that run index-parallel jobs. run() hands out indices
+// [0, count) from a shared counter, joins in on the calling thread and
+// returns once every index is done.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0);  // 0 = hardware concurrency
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void run(size_t count, const std::function<void(size_t)>& task);
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // Current job
+    const std::function<void(size_t)>* task = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next {0};
+    std::atomic<size_t> finished {0};
+    uint64_t generation = 0;
+    unsigned active = 0;
+    bool stopping = false;
+
+    void work();
+    void drain(const std::function<void(size_t)>* job, size_t jobs);
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+#include "lexer.hpp"
+
+// Structure-of-arrays token storage, 9 bytes per token instead of 16.
+// Types, offsets and payloads live in separate arrays. The payload is the
+// symbol for identifiers and long custom operators, the constant index for
+// numbers and chars, the strings offset for escaped strings, the length for
+// other variable-length tokens, and unused otherwise. Lengths implied by the
+// type, and lengths of the other tokens, are worked out on access.
+//
+// Symbol lengths are read from the symbol text, number and char lengths and
+// formats from the constants, and escaped string lengths from the strings,
+// so the pool or Interner the tokens were interned into, and the Lexer's
+// constants and strings, must outlive the stream.
+class TokenStream {
+public:
+    class Iterator;
+
+    TokenStream() = default;
+    TokenStream(const std::vector<char>* pool, const Interner* interner = nullptr,
+                const std::vector<Constant>* constants = nullptr, const std::vector<char>* strings = nullptr);
+    TokenStream(const std::vector<Token>& tokens, const std::vector<char>* pool, const Interner* interner = nullptr,
+                const std::vector<Constant>* constants = nullptr, const std::vector<char>* strings = nullptr);
+
+    void push_back(const Token& token);
+    void reserve(size_t count);
+    size_t size() const { return offsets.size(); }
+    size_t bytes() const;
+
+    TokenType type(size_t i) const { return static_cast<TokenType>(types[i] & TYPE_MASK); }
+    uint32_t offset(size_t i) const { return offsets[i]; }
+    symbol_t lexeme(size_t i) const;
+    uint32_t length(size_t i) const;
+    Format format(size_t i) const;
+    const Constant& constant(size_t i) const { return (*constants)[payloads[i]]; }  // TT_NUMBER and TT_CHAR only
+    Token operator[](size_t i) const;
+
+    // Type-only scans over the 1-byte type array
+    const uint8_t* typeData() const { return types.data(); }
+    size_t find(TokenType type, size_t from) const;
+    size_t matchBracket(size_t open) const;     // Index of the closer, or size()
+    size_t skipBlock(size_t indent) const;      // Index of the DEDENT closing an INDENT, or size()
+
+    Iterator begin() const;
+    Iterator end() const;
+
+private:
+    static constexpr uint8_t TYPE_MASK = 0x7F;
+    static constexpr uint8_t SHORT_OP = 0x80;   // Custom op of 1-2 bytes, payload is its length
+    static constexpr uint8_t ESCAPED = 0x80;    // F_ESCAPED string, payload is its strings offset
+
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> payloads;
+    const std::vector<char>* pool = nullptr;
+    const Interner* interner = nullptr;
+    const std::vector<Constant>* constants = nullptr;
+    const std::vector<char>* strings = nullptr;
+
+    const char* text(symbol_t symbol, uint32_t& length) const;
+};
+
+// Random-access cursor for the parser. type() and offset() read one array
+// each; operator* decodes a full Token.
+class TokenStream::Iterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Token;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = Token;
+
+    Iterator() = default;
+    Iterator(const TokenStream* stream, size_t index) : stream(stream), index(index) {}
+
+    TokenType type() const { return stream->type(index); }
+    uint32_t offset() const { return stream->offset(index); }
+    symbol_t lexeme() const { return stream->lexeme(index); }
+    uint32_t length() const { return stream->length(index); }
+    Format format() const { return stream->format(index); }
+    size_t position() const { return index; }
+    Token operator*() const { return (*stream)[index]; }
+    Token operator[](difference_type n) const { return (*stream)[index + n]; }
+
+    Iterator& operator++() { ++index; return *this; }
+    Iterator operator++(int) { Iterator old = *this; ++index; return old; }
+    Iterator& operator--() { --index; return *this; }
+    Iterator operator--(int) { Iterator old = *this; --index; return old; }
+    Iterator& operator+=(difference_type n) { index += n; return *this; }
+    Iterator& operator-=(difference_type n) { index -= n; return *this; }
+    Iterator operator+(difference_type n) const { return Iterator(stream, index + n); }
+    Iterator operator-(difference_type n) const { return Iterator(stream, index - n); }
+    difference_type operator-(const Iterator& other) const {
+        return static_cast<difference_type>(index) - static_cast<difference_type>(other.index);
+    }
+
+    bool operator==(const Iterator& other) const { return index == other.index; }
+    bool operator!=(const Iterator& other) const { return index != other.index; }
+    bool operator<(const Iterator& other) const { return index < other.index; }
+    bool operator<=(const Iterator& other) const { return index <= other.index; }
+    bool operator>(const Iterator& other) const { return index > other.index; }
+    bool operator>=(const Iterator& other) const { return index >= other.index; }
+
+private:
+    const TokenStream* stream = nullptr;
+    size_t index = 0;
+};
+
+inline TokenStream::Iterator TokenStream::begin() const { return Iterator(this, 0); }
+inline TokenStream::Iterator TokenStream::end() const { return Iterator(this, size()); }
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bytecode.hpp"
+#include "ffi.hpp"
+
+// Computed-goto dispatch needs the GNU labels-as-values extension
+#if defined(__GNUC__) && !defined(LIGHTNING_NO_COMPUTED_GOTO)
+#define LIGHTNING_COMPUTED_GOTO 1
+#else
+#define LIGHTNING_COMPUTED_GOTO 0
+#endif
+
+enum Dispatch : uint8_t {
+    DISPATCH_SWITCH,    // One indirect branch shared by every opcode
+    DISPATCH_THREADED,  // A jump through the label table at the end of each handler
+};
+
+class Jit;
+class VM;
+// Called with the argument registers; sets result, or returns false with
+// VM::error set
+using Native = bool (*)(VM& vm, const Value* args, uint32_t count, Value& result);
+
+// Interprets a Program. Registers of all active calls share one stack of
+// Values: a call's frame starts right after its callee register, where the
+// caller left the arguments, so calls copy nothing. Both dispatch loops
+// are built from the same handlers; DISPATCH_THREADED is the default where
+// the compiler supports it. With the JIT on, calls, back edges and returns
+// into a function count towards compiling it, and once compiled its frame
+// is handed to the native code there.
+class VM {
+public:
+    explicit VM(const Program& program, size_t stackValues = 1 << 18);
+    ~VM();
+
+    // Runs the module body; result is what a top-level return gave, or
+    // V_NONE. False on a runtime error, described by error.
+    bool run(Value& result);
+
+    void setDispatch(Dispatch dispatch);    // Ignored without computed goto
+    Dispatch dispatch() const { return mode; }
+
+    // Compiles functions to native code after threshold calls or loop
+    // iterations; 0 turns the JIT off. Code compiled so far is dropped.
+    void setJit(uint32_t threshold);
+    const Jit* jit() const { return native.get(); }
+
+    // Bound to the global slot named name, if the program has one, on every
+    // run. "print" is registered from the start.
+    void define(const char* name, Native native);
+    // Same for a C function, called straight through its trampoline. The
+    // library it came from must stay open while the VM runs.
+    void define(const char* name, const ForeignFunction& function);
+
+    std::vector<Value> globals;
+    std::string error;
+    FILE* out = stdout;     // Where print writes
+
+private:
+    struct Frame {
+        const Function* function;
+        const uint32_t* pc;     // Where to resume
+        Value* base;
+    };
+
+    const Program& program;
+    std::vector<Value> stack;
+    std::vector<Frame> frames;  // Callers of the running function
+    std::vector<Native> natives;
+    std::vector<std::string> nativeNames;
+    std::vector<ForeignFunction> foreign;
+    std::vector<std::string> foreignNames;
+    Dispatch mode;
+    std::unique_ptr<Jit> native;
+
+    void reset();
+    template <bool THREADED>
+    bool execute(Value& result);
+    bool fail(const Function* function, const uint32_t* pc, const char* message, const char* detail = nullptr);
+};
+
+// Text of a value as print writes it
+std::string valueString(const Value& value);
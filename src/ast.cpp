@@ -0,0 +1,88 @@
+#include "ast.hpp"
+#include <cstring>
+
+AstArena::AstArena() {
+    addChunk(CHUNK_WORDS);
+    create(AST_NULL);
+};
+
+AstArena::~AstArena() {
+    for (Chunk& chunk : chunks) delete[] chunk.words;
+};
+
+void AstArena::addChunk(uint32_t words) {
+    chunks.push_back(Chunk {new uint64_t[words], words, 0});
+}
+
+NodeId AstArena::create(NodeType type, uint64_t payload, const NodeId* children, uint32_t count) {
+    uint32_t words = nodeWords(count);
+    Chunk* chunk = &chunks.back();
+
+    if (chunk->used + words > chunk->capacity) {
+        // Nodes larger than a chunk get a chunk of their own; ids only
+        // address the node header, which sits at word 0
+        addChunk(words > CHUNK_WORDS ? words : CHUNK_WORDS);
+        chunk = &chunks.back();
+    }
+
+    NodeId id = static_cast<NodeId>(((chunks.size() - 1) << CHUNK_SHIFT) | chunk->used);
+    AstNode* node = reinterpret_cast<AstNode*>(chunk->words + chunk->used);
+    node->type = type;
+    node->count = count;
+    node->payload = payload;
+    if (count) memcpy(node->children(), children, count * sizeof(NodeId));
+    chunk->used += words;
+    ++nodeCount;
+
+    // A large node fills its chunk, later nodes start a fresh one
+    if (words > CHUNK_WORDS) chunk->used = chunk->capacity;
+    return id;
+}
+
+void AstArena::relocate(uint32_t firstChunk) {
+    uint32_t shift = firstChunk << CHUNK_SHIFT;
+    for (Chunk& chunk : chunks) {
+        for (uint32_t word = 0; word < chunk.used;) {
+            AstNode* node = reinterpret_cast<AstNode*>(chunk.words + word);
+            NodeId* children = node->children();
+            for (uint32_t i = 0; i < node->count; ++i)
+                if (children[i]) children[i] += shift;
+            word += nodeWords(node->count);
+        }
+    }
+}
+
+void AstArena::adopt(AstArena& other) {
+    chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+    // The null node of other stays behind as filler
+    nodeCount += other.nodeCount - 1;
+
+    other.chunks.clear();
+    other.nodeCount = 0;
+    other.addChunk(CHUNK_WORDS);
+    other.create(AST_NULL);
+}
+
+void AstArena::countTypes(uint64_t* counts) const {
+    for (const Chunk& chunk : chunks) {
+        for (uint32_t word = 0; word < chunk.used;) {
+            const AstNode* node = reinterpret_cast<const AstNode*>(chunk.words + word);
+            ++counts[node->type];
+            word += nodeWords(node->count);
+        }
+    }
+}
+
+size_t AstArena::bytes() const {
+    size_t total = 0;
+    for (const Chunk& chunk : chunks) total += chunk.capacity * sizeof(uint64_t);
+    return total;
+}
+
+void AstArena::clear() {
+    for (size_t i = 1; i < chunks.size(); ++i) delete[] chunks[i].words;
+    chunks.resize(1);
+    chunks[0].used = 0;
+    nodeCount = 0;
+    create(AST_NULL);
+}
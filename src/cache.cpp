@@ -0,0 +1,266 @@
+#include "cache.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+static const char MAGIC[8] = {'L', 'T', 'N', 'G', 'C', 'A', 'C', 'H'};
+static const uint32_t ORDER_MARK = 0x01020304;
+
+enum CacheSection : uint32_t {
+    S_TOKENS, S_POOL, S_CONSTANTS, S_STRINGS, S_DIAGNOSTICS,
+    S_CHUNKS,   // File offset of each AST chunk's words
+    S_NODES,    // The chunk words, back to back
+    S_SOURCE,   // The source itself, compared in full on lookup
+    SECTIONS,
+};
+
+struct Section {
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint16_t tokenBytes;
+    uint16_t nodeBytes;
+    uint32_t root;
+    uint32_t chunkCount;
+    uint32_t reserved;
+    uint64_t nodeCount;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+    uint64_t operatorHash;  // OperatorTable::fingerprint() of the parse
+    Section sections[SECTIONS];
+};
+
+static inline uint64_t hashSource(std::string_view source) {
+    return hashSymbol(source.data(), static_cast<uint32_t>(source.size()));
+}
+
+static inline uint64_t alignUp(uint64_t offset) {
+    return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+TokenCache::TokenCache(std::string directory) : directory(std::move(directory)) {};
+
+std::string TokenCache::path(std::string_view source) const {
+    return path(hashSource(source));
+}
+
+std::string TokenCache::path(uint64_t hash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.ltc", static_cast<unsigned long long>(hash));
+    return directory + "/" + name;
+}
+
+bool TokenCache::store(std::string_view source, const std::vector<Token>& tokens, const Lexer& lexer,
+                       const Parser& parser, NodeId root) const {
+    if (lexer.sharesSymbols()) return false;
+
+    const AstArena& arena = parser.arena;
+    CacheHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = ORDER_MARK;
+    header.tokenBytes = sizeof(Token);
+    header.nodeBytes = sizeof(AstNode);
+    header.root = root;
+    header.chunkCount = arena.chunkCount();
+    header.nodeCount = arena.nodes();
+    header.sourceHash = hashSource(source);
+    header.sourceLength = source.size();
+    header.operatorHash = parser.operatorTable().fingerprint();
+
+    // Lay the sections out back to back, each 8-byte aligned
+    const void* data[SECTIONS] = {
+        tokens.data(), lexer.pool.data(), lexer.constants.data(), lexer.strings.data(),
+        parser.diagnostics.data(), nullptr, nullptr, source.data(),
+    };
+    uint64_t sizes[SECTIONS] = {
+        tokens.size() * sizeof(Token), lexer.pool.size(), lexer.constants.size() * sizeof(Constant),
+        lexer.strings.size(), parser.diagnostics.size() * sizeof(Diagnostic),
+        header.chunkCount * sizeof(uint64_t), 0, source.size(),
+    };
+    std::vector<uint64_t> chunkOffsets(header.chunkCount);
+    for (uint32_t chunk = 0; chunk < header.chunkCount; ++chunk) {
+        uint32_t used;
+        arena.chunkWords(chunk, used);
+        sizes[S_NODES] += used * sizeof(uint64_t);
+    }
+    data[S_CHUNKS] = chunkOffsets.data();
+
+    uint64_t offset = alignUp(sizeof(CacheHeader));
+    for (uint32_t s = 0; s < SECTIONS; ++s) {
+        header.sections[s] = Section {offset, sizes[s]};
+        offset = alignUp(offset + sizes[s]);
+    }
+    uint64_t nodeOffset = header.sections[S_NODES].offset;
+    for (uint32_t chunk = 0; chunk < header.chunkCount; ++chunk) {
+        uint32_t used;
+        arena.chunkWords(chunk, used);
+        chunkOffsets[chunk] = nodeOffset;
+        nodeOffset += used * sizeof(uint64_t);
+    }
+
+    // A name no other writer uses, renamed over the entry once complete
+    std::string target = path(header.sourceHash);
+    size_t unique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                    static_cast<size_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::string temporary = target + "." + std::to_string(unique) + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (!out) return false;
+
+    static const char padding[8] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    uint64_t written = sizeof(header);
+    for (uint32_t s = 0; s < SECTIONS && ok; ++s) {
+        const Section& section = header.sections[s];
+        ok = fwrite(padding, 1, section.offset - written, out) == section.offset - written;
+        if (s == S_NODES) {
+            for (uint32_t chunk = 0; chunk < header.chunkCount && ok; ++chunk) {
+                uint32_t used;
+                const uint64_t* words = arena.chunkWords(chunk, used);
+                ok = fwrite(words, sizeof(uint64_t), used, out) == used;
+            }
+        }
+        else if (section.bytes) ok = ok && fwrite(data[s], 1, section.bytes, out) == section.bytes;
+        written = section.offset + section.bytes;
+    }
+    ok = fclose(out) == 0 && ok;
+
+#ifdef _WIN32
+    if (ok) remove(target.c_str());
+#endif
+    if (ok) ok = rename(temporary.c_str(), target.c_str()) == 0;
+    if (!ok) remove(temporary.c_str());
+    return ok;
+}
+
+CachedUnit::CachedUnit(const TokenCache& cache, std::string_view source, const OperatorTable& operators)
+    : CachedUnit(cache, source, hashSource(source), operators.fingerprint()) {};
+
+// Every token lies in the source and its lexeme in the section it indexes
+bool CachedUnit::tokensInBounds(size_t sourceBytes) const {
+    for (size_t i = 0; i < tokenSize; ++i) {
+        const Token& token = tokenData[i];
+        if (token.type > TT_LINE || token.offset > sourceBytes || token.length > sourceBytes - token.offset) return false;
+        uint64_t lexeme = token.lexeme;
+        if (token.type == TT_IDENT || (token.type == TT_CUSTOM_OP && token.length > 2)) {
+            // The name and its terminator
+            if (lexeme >= poolSize || token.length >= poolSize - lexeme || poolData[lexeme + token.length] != '\0')
+                return false;
+        } else if (token.type == TT_NUMBER || token.type == TT_CHAR) {
+            if (lexeme >= constantSize) return false;
+        } else if (token.type == TT_STRING && token.format == F_ESCAPED) {
+            StringHeader string;
+            if (lexeme > stringSize || stringSize - lexeme < sizeof(string)) return false;
+            memcpy(&string, stringData + lexeme, sizeof(string));
+            if (string.length > stringSize - lexeme - sizeof(string)) return false;
+        }
+    }
+    return true;
+}
+
+// Walks each chunk node by node: every node fits its chunk, nodeCount is
+// at most how many there are (the null nodes of worker arenas are left
+// uncounted as filler), and the root and every child is the start of one.
+// A node is created after its children, so a child must start before
+// its parent and one pass checks both. Name and constant payloads are
+// checked like token lexemes.
+bool CachedUnit::nodesInBounds(uint32_t chunkCount, uint64_t end) const {
+    // Node starts as one bitmap over every chunk's words, chunk by chunk
+    std::vector<uint64_t> firstWord(chunkCount + 1);
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+        uint64_t next = chunk + 1 < chunkCount ? chunkOffsets[chunk + 1] : end;
+        if (next < chunkOffsets[chunk]) return false;
+        firstWord[chunk + 1] = firstWord[chunk] + (next - chunkOffsets[chunk]) / 8;
+    }
+    std::vector<uint64_t> starts((firstWord[chunkCount] + 63) / 64);
+    auto isStart = [&](NodeId id) {
+        uint32_t chunk = id >> AstArena::CHUNK_SHIFT;
+        if (chunk >= chunkCount) return false;
+        uint64_t bit = firstWord[chunk] + (id & (AstArena::CHUNK_WORDS - 1));
+        return bit < firstWord[chunk + 1] && (starts[bit >> 6] >> (bit & 63) & 1);
+    };
+
+    size_t count = 0;
+    for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+        const uint64_t* words = reinterpret_cast<const uint64_t*>(base + chunkOffsets[chunk]);
+        uint64_t used = firstWord[chunk + 1] - firstWord[chunk];
+        for (uint64_t word = 0; word < used; ++count) {
+            uint64_t left = used - word;
+            if (word >= AstArena::CHUNK_WORDS || left < AstArena::nodeWords(0)) return false;
+            const AstNode& node = *reinterpret_cast<const AstNode*>(words + word);
+            if (node.type > AST_IMPORT || node.count > 2 * left || AstArena::nodeWords(node.count) > left) return false;
+            bool named = node.type == AST_IDENT || node.type == AST_ARG || node.type == AST_TYPE ||
+                         node.type == AST_FUNCDEF;
+            if (named && node.payload && node.payload >= poolSize) return false;
+            if (node.type == AST_NUMBER && node.payload >= constantSize) return false;
+            for (uint32_t i = 0; i < node.count; ++i)
+                if (!isStart(node.child(i))) return false;
+            uint64_t bit = firstWord[chunk] + word;
+            starts[bit >> 6] |= 1ull << (bit & 63);
+            word += AstArena::nodeWords(node.count);
+        }
+    }
+    return count >= nodeCount && isStart(rootId);
+}
+
+// Checks the header, that every section lies inside the file, that the
+// stored source is this one (the hash alone could collide and hand back
+// another file's tree) and that every id and offset in the entry stays
+// inside it. Nothing is copied; checking is one pass over the tokens and
+// one over the nodes.
+CachedUnit::CachedUnit(const TokenCache& cache, std::string_view source, uint64_t hash, uint64_t operatorHash)
+    : file(cache.path(hash)) {
+    std::string_view mapped = file.view();
+    if (mapped.size() < sizeof(CacheHeader)) return;
+    base = mapped.data();
+    const CacheHeader& header = *reinterpret_cast<const CacheHeader*>(base);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != TokenCache::VERSION ||
+        header.byteOrder != ORDER_MARK || header.tokenBytes != sizeof(Token) || header.nodeBytes != sizeof(AstNode) ||
+        header.sourceHash != hash || header.sourceLength != source.size() || header.operatorHash != operatorHash)
+        return;
+
+    static const uint64_t elementBytes[SECTIONS] = {
+        sizeof(Token), 1, sizeof(Constant), 1, sizeof(Diagnostic), sizeof(uint64_t), sizeof(uint64_t), 1,
+    };
+    for (uint32_t s = 0; s < SECTIONS; ++s) {
+        const Section& section = header.sections[s];
+        if (section.offset % 8 || section.offset > mapped.size() || section.bytes > mapped.size() - section.offset ||
+            section.bytes % elementBytes[s])
+            return;
+    }
+    const Section* sections = header.sections;
+    if (sections[S_SOURCE].bytes != source.size() ||
+        (!source.empty() && memcmp(base + sections[S_SOURCE].offset, source.data(), source.size()) != 0))
+        return;
+    if (sections[S_CHUNKS].bytes != header.chunkCount * sizeof(uint64_t) || header.chunkCount == 0 ||
+        (header.root >> AstArena::CHUNK_SHIFT) >= header.chunkCount)
+        return;
+    chunkOffsets = reinterpret_cast<const uint64_t*>(base + sections[S_CHUNKS].offset);
+    const Section& nodes = sections[S_NODES];
+    for (uint32_t chunk = 0; chunk < header.chunkCount; ++chunk)
+        if (chunkOffsets[chunk] % 8 || chunkOffsets[chunk] < nodes.offset || chunkOffsets[chunk] > nodes.offset + nodes.bytes)
+            return;
+
+    tokenData = reinterpret_cast<const Token*>(base + sections[S_TOKENS].offset);
+    tokenSize = sections[S_TOKENS].bytes / sizeof(Token);
+    poolData = base + sections[S_POOL].offset;
+    poolSize = sections[S_POOL].bytes;
+    constantData = reinterpret_cast<const Constant*>(base + sections[S_CONSTANTS].offset);
+    constantSize = sections[S_CONSTANTS].bytes / sizeof(Constant);
+    stringData = base + sections[S_STRINGS].offset;
+    stringSize = sections[S_STRINGS].bytes;
+    diagnosticData = reinterpret_cast<const Diagnostic*>(base + sections[S_DIAGNOSTICS].offset);
+    diagnosticSize = sections[S_DIAGNOSTICS].bytes / sizeof(Diagnostic);
+    rootId = header.root;
+    nodeCount = header.nodeCount;
+    if (poolSize && poolData[poolSize - 1] != '\0') return;
+    if (!tokensInBounds(source.size()) || !nodesInBounds(header.chunkCount, nodes.offset + nodes.bytes)) return;
+    hit = true;
+}
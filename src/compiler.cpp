@@ -0,0 +1,574 @@
+#include "bytecode.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static const char* opcodeNames[OPCODES] = {
+    "move", "loadi", "loadk", "getglobal", "setglobal", "clear", "check",
+    "add", "sub", "mul", "div", "mod",
+    "band", "bor", "bxor", "shl", "shr",
+    "eq", "ne", "lt", "le",
+    "addi",
+    "neg", "not", "bnot",
+    "jmp", "jmpf", "jmpt",
+    "call", "ret", "ret0",
+};
+
+const char* opcodeName(Opcode op) {
+    return op < OPCODES ? opcodeNames[op] : "?";
+}
+
+std::string disassemble(const Program& program, const Function& function) {
+    std::string out;
+    char line[128];
+    for (size_t pc = 0; pc < function.code.size(); ++pc) {
+        uint32_t ins = function.code[pc];
+        Opcode op = opcodeOf(ins);
+        int n = snprintf(line, sizeof(line), "%4zu %-9s ", pc, opcodeName(op));
+        char* text = line + n;
+        size_t room = sizeof(line) - n;
+        switch (op) {
+            case OP_LOADI:
+                snprintf(text, room, "r%u %d", argA(ins), argSBx(ins));
+                break;
+            case OP_LOADK: {
+                const Value& k = program.constants[argBx(ins)];
+                if (k.type == V_INT) snprintf(text, room, "r%u %lld", argA(ins), static_cast<long long>(k.integer));
+                else snprintf(text, room, "r%u %g", argA(ins), k.real);
+                break;
+            }
+            case OP_GETGLOBAL: case OP_SETGLOBAL:
+                snprintf(text, room, "r%u %s", argA(ins), program.globals[argBx(ins)].c_str());
+                break;
+            case OP_CHECK:
+                snprintf(text, room, "r%u %s", argA(ins), function.locals[argBx(ins)].c_str());
+                break;
+            case OP_ADDI:
+                snprintf(text, room, "r%u r%u %d", argA(ins), argB(ins), argSC(ins));
+                break;
+            case OP_MOVE: case OP_NEG: case OP_NOT: case OP_BNOT:
+                snprintf(text, room, "r%u r%u", argA(ins), argB(ins));
+                break;
+            case OP_JMP:
+                snprintf(text, room, "-> %zu", pc + 1 + argSBx(ins));
+                break;
+            case OP_JMPF: case OP_JMPT:
+                snprintf(text, room, "r%u -> %zu", argA(ins), pc + 1 + argSBx(ins));
+                break;
+            case OP_CALL:
+                snprintf(text, room, "r%u %u", argA(ins), argB(ins));
+                break;
+            case OP_RET: case OP_CLEAR:
+                snprintf(text, room, "r%u", argA(ins));
+                break;
+            case OP_RET0:
+                text[0] = 0;
+                break;
+            default:
+                snprintf(text, room, "r%u r%u r%u", argA(ins), argB(ins), argC(ins));
+                break;
+        }
+        out += line;
+        while (!out.empty() && out.back() == ' ') out.pop_back();
+        out += "\n";
+    }
+    return out;
+}
+
+Opcode binaryOpcode(TokenType type, bool& swap) {
+    swap = false;
+    switch (type) {
+        case TT_PLUS: return OP_ADD;
+        case TT_MINUS: return OP_SUB;
+        case TT_STAR: return OP_MUL;
+        case TT_SLASH: return OP_DIV;
+        case TT_PERCENT: return OP_MOD;
+        case TT_AMPERSAND: return OP_BAND;
+        case TT_PIPE: return OP_BOR;
+        case TT_CARET: return OP_BXOR;
+        case TT_LSHIFT: return OP_SHL;
+        case TT_RSHIFT: return OP_SHR;
+        case TT_EQ: return OP_EQ;
+        case TT_NEQ: return OP_NE;
+        case TT_LT: return OP_LT;
+        case TT_LE: return OP_LE;
+        case TT_GT: swap = true; return OP_LT;
+        case TT_GE: swap = true; return OP_LE;
+        default: return OPCODES;
+    }
+}
+
+TokenType compoundOperator(TokenType type) {
+    switch (type) {
+        case TT_EQUAL: return TT_EQUAL;
+        case TT_IADD: return TT_PLUS;
+        case TT_ISUB: return TT_MINUS;
+        case TT_IMUL: return TT_STAR;
+        case TT_IDIV: return TT_SLASH;
+        case TT_IMOD: return TT_PERCENT;
+        case TT_IAND: return TT_AMPERSAND;
+        case TT_IOR: return TT_PIPE;
+        case TT_IXOR: return TT_CARET;
+        default: return TT_UNKNOWN;
+    }
+}
+
+// Immediate of an ADDI for "x op literal", when op is + or - and the
+// literal is an int that fits in sC
+static bool immediateStep(const Lexer& lexer, const AstNode& literal, Opcode op, uint32_t& c) {
+    if ((op != OP_ADD && op != OP_SUB) || literal.type != AST_NUMBER) return false;
+    const Constant& constant = lexer.constants[literal.payload];
+    if (constant.format != F_INT || constant.integer < -(SC_BIAS - 1) || constant.integer > SC_BIAS - 1) return false;
+    int64_t step = op == OP_ADD ? constant.integer : -constant.integer;
+    c = static_cast<uint32_t>(step + SC_BIAS);
+    return true;
+}
+
+// Definite assignment, walking the tree in evaluation order. A local is
+// assigned after a statement when it is on every path through it; a
+// return ends its paths, so everything counts as assigned after one.
+struct AssignedLocals {
+    const AstArena& arena;
+    const std::unordered_map<symbol_t, uint32_t>& locals;
+    std::unordered_set<NodeId>& uncertain;
+    std::vector<uint8_t> assigned;
+
+    uint32_t local(const AstNode& node) const {
+        auto found = node.type == AST_IDENT ? locals.find(static_cast<symbol_t>(node.payload)) : locals.end();
+        return found == locals.end() ? MAX_REGISTERS : found->second;
+    }
+    void read(NodeId id) {
+        uint32_t index = local(arena[id]);
+        if (index < assigned.size() && !assigned[index]) uncertain.insert(id);
+    }
+    void walk(NodeId id);
+};
+
+void AssignedLocals::walk(NodeId id) {
+    const AstNode& node = arena[id];
+    switch (node.type) {
+        case AST_FUNCDEF:
+            return;
+        case AST_IDENT:
+            read(id);
+            return;
+        case AST_ASSIGN: {
+            // A compound assignment reads its target before the value
+            if (compoundOperator(payloadOperator(node.payload)) != TT_EQUAL) read(node.child(0));
+            walk(node.child(1));
+            uint32_t index = local(arena[node.child(0)]);
+            if (index < assigned.size()) assigned[index] = 1;
+            return;
+        }
+        case AST_BINARY: {
+            TokenType type = payloadOperator(node.payload);
+            if (type != TT_AND && type != TT_OR) break;
+            walk(node.child(0));
+            std::vector<uint8_t> before = assigned;
+            walk(node.child(1));
+            assigned = std::move(before);
+            return;
+        }
+        case AST_IF: {
+            walk(node.child(0));
+            std::vector<uint8_t> before = assigned;
+            walk(node.child(1));
+            std::swap(before, assigned);
+            if (node.count > 2) walk(node.child(2));
+            for (size_t i = 0; i < assigned.size(); ++i) assigned[i] &= before[i];
+            return;
+        }
+        case AST_WHILE: {
+            walk(node.child(0));
+            std::vector<uint8_t> before = assigned;
+            walk(node.child(1));
+            assigned = std::move(before);
+            return;
+        }
+        case AST_RETURN:
+            if (node.count) walk(node.child(0));
+            std::fill(assigned.begin(), assigned.end(), 1);
+            return;
+        default:
+            break;
+    }
+    for (uint32_t i = 0; i < node.count; ++i) walk(node.child(i));
+}
+
+std::unordered_set<NodeId> uncertainReads(const AstArena& arena, NodeId body,
+                                          const std::unordered_map<symbol_t, uint32_t>& locals, uint32_t params) {
+    std::unordered_set<NodeId> uncertain;
+    AssignedLocals walker {arena, locals, uncertain, std::vector<uint8_t>(locals.size())};
+    std::fill(walker.assigned.begin(), walker.assigned.begin() + std::min<size_t>(params, locals.size()), 1);
+    walker.walk(body);
+    return uncertain;
+}
+
+Compiler::Compiler(const AstArena& arena, const Lexer& lexer) : arena(arena), lexer(lexer) {};
+
+void Compiler::fail(const std::string& message) {
+    errors.push_back(message);
+}
+
+uint32_t Compiler::global(symbol_t symbol) {
+    auto found = globalSlots.find(symbol);
+    if (found != globalSlots.end()) return found->second;
+    uint32_t slot = static_cast<uint32_t>(program->globals.size());
+    if (slot > 0xFFFF) {
+        fail("more than 65536 globals");
+        return 0;
+    }
+    program->globals.emplace_back(name(symbol));
+    globalSlots.emplace(symbol, slot);
+    return slot;
+}
+
+uint32_t Compiler::constant(const Value& value) {
+    auto& slots = value.type == V_INT ? constantSlots : realSlots;
+    auto found = slots.find(value.index);
+    if (found != slots.end()) return found->second;
+    uint32_t slot = static_cast<uint32_t>(program->constants.size());
+    if (slot > 0xFFFF) {
+        fail("more than 65536 constants");
+        return 0;
+    }
+    program->constants.push_back(value);
+    slots.emplace(value.index, slot);
+    return slot;
+}
+
+bool Compiler::compile(NodeId root, Program& out) {
+    if (lexer.sharesSymbols()) {
+        errors.push_back("lexer uses a shared interner");
+        return false;
+    }
+    program = &out;
+    out = Program();
+    globalSlots.clear();
+    constantSlots.clear();
+    realSlots.clear();
+
+    // Slots for every top-level def first, so the module body and other
+    // functions can call them before their definition runs
+    const AstNode& module = arena[root];
+    out.functions.emplace_back();
+    out.functions[0].name = "<module>";
+    out.functionSlots.push_back(0);
+    std::vector<NodeId> defs;
+    for (uint32_t i = 0; i < module.count; ++i) {
+        NodeId id = module.child(i);
+        if (arena[id].type != AST_FUNCDEF) continue;
+        defs.push_back(id);
+        out.functions.emplace_back();
+        out.functions.back().name = name(static_cast<symbol_t>(arena[id].payload));
+        out.functionSlots.push_back(global(static_cast<symbol_t>(arena[id].payload)));
+    }
+
+    Scope moduleScope;
+    moduleScope.function = &out.functions[0];
+    scope = &moduleScope;
+    for (uint32_t i = 0; i < module.count; ++i) {
+        NodeId id = module.child(i);
+        if (arena[id].type != AST_FUNCDEF) statement(id);
+    }
+    emit(encode(OP_RET0, 0));
+
+    for (size_t i = 0; i < defs.size(); ++i) compileFunction(defs[i], static_cast<uint32_t>(i + 1));
+    scope = nullptr;
+    return errors.empty();
+}
+
+// Assigned names, not descending into nested defs, which are errors anyway
+void Compiler::collectLocals(NodeId id, Scope& into) {
+    const AstNode& node = arena[id];
+    if (node.type == AST_FUNCDEF) return;
+    if (node.type == AST_ASSIGN) {
+        const AstNode& target = arena[node.child(0)];
+        if (target.type == AST_IDENT) {
+            symbol_t symbol = static_cast<symbol_t>(target.payload);
+            if (!into.locals.count(symbol)) {
+                uint32_t reg = static_cast<uint32_t>(into.locals.size());
+                into.locals.emplace(symbol, reg);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < node.count; ++i) collectLocals(node.child(i), into);
+}
+
+void Compiler::compileFunction(NodeId def, uint32_t index) {
+    const AstNode& node = arena[def];
+    Function& function = program->functions[index];
+    Scope local;
+    local.function = &function;
+    uint32_t params = node.count - 1;
+    for (uint32_t i = 0; i < params; ++i) {
+        symbol_t symbol = static_cast<symbol_t>(arena[node.child(i)].payload);
+        if (!local.locals.emplace(symbol, i).second) fail(function.name + ": duplicate parameter " + name(symbol));
+    }
+    function.params = params;
+    collectLocals(node.child(params), local);
+    local.top = static_cast<uint32_t>(local.locals.size());
+    if (local.top > MAX_REGISTERS) {
+        fail(function.name + ": too many locals");
+        return;
+    }
+    function.registers = local.top;
+    function.locals.resize(local.locals.size());
+    for (const auto& entry : local.locals) function.locals[entry.second] = name(entry.first);
+    local.uncertain = uncertainReads(arena, node.child(params), local.locals, params);
+
+    scope = &local;
+    statement(node.child(params));
+    emit(encode(OP_RET0, 0));
+}
+
+uint32_t Compiler::allocate() {
+    uint32_t reg = scope->top++;
+    if (reg >= MAX_REGISTERS) {
+        fail(scope->function->name + ": expression needs more than 256 registers");
+        scope->top = MAX_REGISTERS;
+        return MAX_REGISTERS - 1;
+    }
+    if (scope->top > scope->function->registers) scope->function->registers = scope->top;
+    return reg;
+}
+
+uint32_t Compiler::emit(uint32_t ins) {
+    std::vector<uint32_t>& code = scope->function->code;
+    code.push_back(ins);
+    return static_cast<uint32_t>(code.size() - 1);
+}
+
+uint32_t Compiler::emitJump(Opcode op, uint32_t a) {
+    return emit(encodeBx(op, a, SBX_BIAS));
+}
+
+void Compiler::patch(uint32_t jump) {
+    patch(jump, static_cast<uint32_t>(scope->function->code.size()));
+}
+
+void Compiler::patch(uint32_t jump, uint32_t target) {
+    int64_t offset = static_cast<int64_t>(target) - (static_cast<int64_t>(jump) + 1);
+    if (offset < -SBX_BIAS || offset > 0xFFFF - SBX_BIAS) {
+        fail(scope->function->name + ": jump too long");
+        return;
+    }
+    uint32_t& ins = scope->function->code[jump];
+    ins = encodeBx(opcodeOf(ins), argA(ins), static_cast<uint32_t>(offset + SBX_BIAS));
+}
+
+void Compiler::statement(NodeId id) {
+    const AstNode& node = arena[id];
+    uint32_t mark = scope->top;
+    switch (node.type) {
+        case AST_BLOCK:
+            for (uint32_t i = 0; i < node.count; ++i) statement(node.child(i));
+            break;
+        case AST_IF: {
+            uint32_t skip = emitJump(OP_JMPF, operand(node.child(0)));
+            scope->top = mark;
+            statement(node.child(1));
+            if (node.count > 2) {
+                uint32_t end = emitJump(OP_JMP);
+                patch(skip);
+                statement(node.child(2));
+                patch(end);
+            } else {
+                patch(skip);
+            }
+            break;
+        }
+        case AST_WHILE: {
+            uint32_t top = static_cast<uint32_t>(scope->function->code.size());
+            uint32_t exit = emitJump(OP_JMPF, operand(node.child(0)));
+            scope->top = mark;
+            statement(node.child(1));
+            patch(emitJump(OP_JMP), top);
+            patch(exit);
+            break;
+        }
+        case AST_RETURN:
+            if (node.count) emit(encode(OP_RET, operand(node.child(0))));
+            else emit(encode(OP_RET0, 0));
+            break;
+        case AST_ASSIGN:
+            assignment(id, 0, false);
+            break;
+        case AST_FUNCDEF:
+            fail(std::string("nested function ") + name(static_cast<symbol_t>(node.payload)));
+            break;
+        case AST_IMPORT:
+            // Modules compile one at a time; linking them is the driver's job
+            break;
+        case AST_NULL:
+            break;
+        default:
+            expression(id, allocate());
+            break;
+    }
+    scope->top = mark;
+}
+
+uint32_t Compiler::operand(NodeId id) {
+    const AstNode& node = arena[id];
+    if (node.type == AST_IDENT) {
+        auto found = scope->locals.find(static_cast<symbol_t>(node.payload));
+        if (found != scope->locals.end()) return readLocal(id, found->second);
+    }
+    uint32_t reg = allocate();
+    expression(id, reg);
+    return reg;
+}
+
+// A local's register is its index in Function::locals
+uint32_t Compiler::readLocal(NodeId id, uint32_t reg) {
+    if (scope->uncertain.count(id)) emit(encodeBx(OP_CHECK, reg, reg));
+    return reg;
+}
+
+// Writes target last, after every operand has been read, so that target
+// may be a local the expression also reads
+void Compiler::expression(NodeId id, uint32_t target) {
+    const AstNode& node = arena[id];
+    uint32_t mark = scope->top;
+    switch (node.type) {
+        case AST_NUMBER: {
+            const Constant& literal = lexer.constants[node.payload];
+            if (literal.format == F_COMPLEX) {
+                fail("complex numbers are not supported");
+                break;
+            }
+            if (literal.format == F_INT && literal.integer >= -SBX_BIAS && literal.integer <= 0xFFFF - SBX_BIAS) {
+                emit(encodeBx(OP_LOADI, target, static_cast<uint32_t>(literal.integer + SBX_BIAS)));
+                break;
+            }
+            Value value = literal.format == F_INT ? Value::ofInt(literal.integer) : Value::ofReal(literal.real);
+            emit(encodeBx(OP_LOADK, target, constant(value)));
+            break;
+        }
+        case AST_IDENT: {
+            symbol_t symbol = static_cast<symbol_t>(node.payload);
+            auto found = scope->locals.find(symbol);
+            if (found == scope->locals.end()) emit(encodeBx(OP_GETGLOBAL, target, global(symbol)));
+            else if (readLocal(id, found->second) != target) emit(encode(OP_MOVE, target, found->second));
+            break;
+        }
+        case AST_UNARY: {
+            TokenType type = payloadOperator(node.payload);
+            if (type == TT_PLUS) {
+                expression(node.child(0), target);
+                break;
+            }
+            Opcode op = type == TT_MINUS ? OP_NEG : type == TT_EXCL ? OP_NOT : type == TT_TILDE ? OP_BNOT : OPCODES;
+            if (op == OPCODES) {
+                fail("unsupported prefix operator");
+                break;
+            }
+            emit(encode(op, target, operand(node.child(0))));
+            break;
+        }
+        case AST_BINARY: {
+            TokenType type = payloadOperator(node.payload);
+            if (type == TT_AND || type == TT_OR) {
+                // The value of the last operand evaluated. The left one is
+                // kept in a temporary, since target may be read on the right.
+                uint32_t left = allocate();
+                expression(node.child(0), left);
+                uint32_t done = emitJump(type == TT_AND ? OP_JMPF : OP_JMPT, left);
+                expression(node.child(1), left);
+                patch(done);
+                emit(encode(OP_MOVE, target, left));
+                break;
+            }
+            bool swap;
+            Opcode op = binaryOpcode(type, swap);
+            if (op == OPCODES) {
+                fail("unsupported binary operator");
+                break;
+            }
+            binary(op, node.child(0), node.child(1), target, swap);
+            break;
+        }
+        case AST_ASSIGN:
+            assignment(id, target, true);
+            break;
+        case AST_FUNCCALL:
+            call(id, target);
+            break;
+        case AST_ERROR:
+            fail("syntax error");
+            break;
+        default:
+            fail("unsupported expression");
+            break;
+    }
+    scope->top = mark;
+}
+
+// Operands are evaluated left to right even when swap has the opcode
+// read them the other way round
+void Compiler::binary(Opcode op, NodeId left, NodeId right, uint32_t target, bool swap) {
+    uint32_t step;
+    if (immediateStep(lexer, arena[right], op, step)) {
+        emit(encode(OP_ADDI, target, operand(left), step));
+        return;
+    }
+    uint32_t a = operand(left);
+    uint32_t b = operand(right);
+    if (swap) emit(encode(op, target, b, a));
+    else emit(encode(op, target, a, b));
+}
+
+void Compiler::assignment(NodeId id, uint32_t target, bool wanted) {
+    const AstNode& node = arena[id];
+    const AstNode& place = arena[node.child(0)];
+    if (place.type != AST_IDENT) {
+        fail("can only assign to a name");
+        return;
+    }
+    TokenType op = compoundOperator(payloadOperator(node.payload));
+    if (op == TT_UNKNOWN) {
+        fail("unsupported assignment operator");
+        return;
+    }
+    symbol_t symbol = static_cast<symbol_t>(place.payload);
+    auto found = scope->locals.find(symbol);
+    bool local = found != scope->locals.end();
+    uint32_t reg = local ? found->second : wanted ? target : allocate();
+
+    if (op == TT_EQUAL) {
+        expression(node.child(1), reg);
+    } else {
+        bool swap;
+        Opcode binaryOp = binaryOpcode(op, swap);
+        if (!local) emit(encodeBx(OP_GETGLOBAL, reg, global(symbol)));
+        else readLocal(node.child(0), reg);
+        // reg op value, reg being its own left operand
+        uint32_t step;
+        if (immediateStep(lexer, arena[node.child(1)], binaryOp, step)) {
+            emit(encode(OP_ADDI, reg, reg, step));
+        } else {
+            uint32_t mark = scope->top;
+            emit(encode(binaryOp, reg, reg, operand(node.child(1))));
+            scope->top = mark;
+        }
+    }
+    if (!local) emit(encodeBx(OP_SETGLOBAL, reg, global(symbol)));
+    if (wanted && reg != target) emit(encode(OP_MOVE, target, reg));
+}
+
+// Callee and arguments go in consecutive registers at the top of the
+// frame, where the callee's frame will start
+void Compiler::call(NodeId id, uint32_t target) {
+    const AstNode& node = arena[id];
+    uint32_t args = node.count - 1;
+    if (args > 255) {
+        fail("more than 255 arguments");
+        return;
+    }
+    uint32_t base = allocate();
+    expression(node.child(0), base);
+    for (uint32_t i = 0; i < args; ++i) expression(node.child(i + 1), allocate());
+    emit(encode(OP_CALL, base, args));
+    if (base != target) emit(encode(OP_MOVE, target, base));
+}
@@ -0,0 +1,264 @@
+#include "constants.hpp"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+
+// Exactly representable powers of ten
+static const double exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline uint32_t digitValue(char c) {
+    if (c >= '0' && c <= '9') return static_cast<uint32_t>(c - '0');
+    return static_cast<uint32_t>((c | 0x20) - 'a' + 10);
+}
+
+// Correctly rounded conversion of the literal without its '_' and 'j'
+static double slowReal(const char* text, const char* end, uint16_t& flags) {
+    char small[64];
+    std::string large;
+    char* out = small;
+    if (end - text > static_cast<long>(sizeof(small))) {
+        large.resize(end - text);
+        out = &large[0];
+    }
+    char* start = out;
+    for (const char* p = text; p < end; ++p)
+        if (*p != '_') *out++ = *p;
+
+    double value = 0;
+    std::from_chars_result result = std::from_chars(start, out, value);
+    if (result.ec == std::errc::result_out_of_range) {
+        // Underflow to zero is fine, overflow is not
+        const char* e = static_cast<const char*>(memchr(start, 'e', out - start));
+        if (!e) e = static_cast<const char*>(memchr(start, 'E', out - start));
+        bool tiny = e && e[1] == '-';
+        value = tiny ? 0.0 : std::numeric_limits<double>::infinity();
+        if (!tiny) flags |= K_OVERFLOW;
+    }
+    return value;
+}
+
+Constant decodeNumber(const char* text, uint32_t length) {
+    Constant constant;
+    constant.integer = 0;
+    constant.length = length;
+    constant.format = F_INT;
+    constant.flags = 0;
+
+    const char* p = text;
+    const char* end = text + length;
+    bool imaginary = length > 1 && end[-1] == 'j';
+    end -= imaginary;
+
+    // Hex and binary integers
+    char radix = length > 2 ? static_cast<char>(p[1] | 0x20) : 0;
+    if (p[0] == '0' && (radix == 'x' || radix == 'b')) {
+        uint32_t shift = radix == 'x' ? 4 : 1;
+        uint64_t value = 0;
+        for (p += 2; p < end; ++p) {
+            if (*p == '_') continue;
+            if (value >> (64 - shift)) constant.flags |= K_OVERFLOW;
+            value = value << shift | digitValue(*p);
+        }
+        constant.integer = static_cast<int64_t>(value);
+        return constant;
+    }
+
+    // Decimal integers
+    bool isFloat = imaginary;
+    for (const char* q = p; q < end && !isFloat; ++q) isFloat = *q == '.' || (*q | 0x20) == 'e';
+    if (!isFloat) {
+        const uint64_t limit = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+        uint64_t value = 0;
+        for (; p < end; ++p) {
+            if (*p == '_') continue;
+            uint64_t digit = static_cast<uint64_t>(*p - '0');
+            if (value > (limit - digit) / 10) {
+                constant.flags |= K_OVERFLOW;
+                value = limit;
+                break;
+            }
+            value = value * 10 + digit;
+        }
+        constant.integer = static_cast<int64_t>(value);
+        return constant;
+    }
+
+    // Decimal floats: up to 19 significant digits go in mantissa, the rest
+    // only move the decimal exponent
+    uint64_t mantissa = 0;
+    int64_t exponent = 0;
+    bool truncated = false;
+    bool fraction = false;
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == '_') continue;
+        if (c == '.') {
+            fraction = true;
+            continue;
+        }
+        if ((c | 0x20) == 'e') {
+            ++p;
+            bool negative = *p == '-';
+            p += *p == '-' || *p == '+';
+            int64_t written = 0;
+            for (; p < end; ++p)
+                if (*p != '_' && written < 100000) written = written * 10 + (*p - '0');
+            exponent += negative ? -written : written;
+            break;
+        }
+        uint32_t digit = static_cast<uint32_t>(c - '0');
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = mantissa * 10 + digit;
+            exponent -= fraction;
+        } else {
+            truncated |= digit != 0;
+            exponent += !fraction;
+        }
+    }
+
+    // Fast path: an exact mantissa and an exact power of ten give a
+    // correctly rounded product or quotient. Surplus powers move into the
+    // mantissa while it stays exact.
+    constant.format = imaginary ? F_COMPLEX : F_FLOAT;
+    const uint64_t exactMantissa = 1ull << 53;
+    if (!truncated && mantissa <= exactMantissa) {
+        while (exponent > 22 && exponent <= 22 + 16 && mantissa <= exactMantissa / 10) {
+            mantissa *= 10;
+            --exponent;
+        }
+        if (exponent >= -22 && exponent <= 22) {
+            double value = static_cast<double>(mantissa);
+            constant.real = exponent < 0 ? value / exactPowers[-exponent] : value * exactPowers[exponent];
+            return constant;
+        }
+    }
+    constant.real = slowReal(text, end, constant.flags);
+    return constant;
+}
+
+static inline bool isHex(char c) {
+    return (c >= '0' && c <= '9') || static_cast<unsigned char>((c | 0x20) - 'a') < 6;
+}
+
+// Escape whose backslash precedes text: stores its value and returns the
+// bytes after the backslash it spans, or 0 if it is no escape. \u and \U
+// give a code point and set unicode, \xHH gives a raw byte.
+static uint32_t decodeEscape(const char* text, const char* end, uint32_t& value, bool& unicode) {
+    unicode = false;
+    if (text >= end) return 0;
+    switch (*text) {
+        case 'n': value = '\n'; return 1;
+        case 't': value = '\t'; return 1;
+        case 'r': value = '\r'; return 1;
+        case '0': value = 0; return 1;
+        case 'a': value = '\a'; return 1;
+        case 'b': value = '\b'; return 1;
+        case 'f': value = '\f'; return 1;
+        case 'v': value = '\v'; return 1;
+        case '\\': case '"': case '\'':
+            value = static_cast<unsigned char>(*text);
+            return 1;
+    }
+
+    uint32_t digits = *text == 'x' ? 2 : *text == 'u' ? 4 : *text == 'U' ? 8 : 0;
+    if (!digits || end - text <= static_cast<long>(digits)) return 0;
+    value = 0;
+    for (uint32_t i = 1; i <= digits; ++i) {
+        if (!isHex(text[i])) return 0;
+        value = value << 4 | digitValue(text[i]);
+    }
+    unicode = digits > 2;
+    if (unicode && (value > 0x10FFFF || (value >= 0xD800 && value <= 0xDFFF))) return 0;
+    return digits + 1;
+}
+
+static char* encodeUtf8(uint32_t point, char* out) {
+    if (point < 0x80) {
+        *out++ = static_cast<char>(point);
+    } else if (point < 0x800) {
+        *out++ = static_cast<char>(0xC0 | point >> 6);
+        *out++ = static_cast<char>(0x80 | (point & 0x3F));
+    } else if (point < 0x10000) {
+        *out++ = static_cast<char>(0xE0 | point >> 12);
+        *out++ = static_cast<char>(0x80 | (point >> 6 & 0x3F));
+        *out++ = static_cast<char>(0x80 | (point & 0x3F));
+    } else {
+        *out++ = static_cast<char>(0xF0 | point >> 18);
+        *out++ = static_cast<char>(0x80 | (point >> 12 & 0x3F));
+        *out++ = static_cast<char>(0x80 | (point >> 6 & 0x3F));
+        *out++ = static_cast<char>(0x80 | (point & 0x3F));
+    }
+    return out;
+}
+
+Constant decodeChar(const char* text, uint32_t length) {
+    Constant constant;
+    constant.integer = 0;
+    constant.length = length;
+    constant.format = F_INT;
+    constant.flags = K_INVALID;
+
+    const char* p = text + 1;
+    const char* end = text + length - 1;    // The closing quote
+    unsigned char lead = p < end ? static_cast<unsigned char>(*p) : 0;
+    uint32_t span = 0;
+    uint32_t value = 0;
+    if (lead == '\\') {
+        bool unicode;
+        span = decodeEscape(p + 1, end, value, unicode);
+        span += span != 0;
+    }
+    else if (lead >= 0xC0 && lead < 0xF8) {
+        // One UTF-8 sequence
+        span = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+        value = lead & (0x7F >> span);
+        for (uint32_t i = 1; i < span; ++i) {
+            if (p + i >= end || (p[i] & 0xC0) != 0x80) {
+                span = 0;
+                break;
+            }
+            value = value << 6 | (p[i] & 0x3F);
+        }
+    }
+    else if (p < end && lead < 0x80) {
+        span = 1;
+        value = lead;
+    }
+
+    if (span && p + span == end) {
+        constant.integer = value;
+        constant.flags = 0;
+    }
+    return constant;
+}
+
+uint32_t decodeString(const char* text, uint32_t length, char* out) {
+    const char* end = text + length;
+    char* start = out;
+    while (text < end) {
+        const char* slash = static_cast<const char*>(memchr(text, '\\', end - text));
+        const char* run = slash ? slash : end;
+        memcpy(out, text, run - text);
+        out += run - text;
+        if (!slash) break;
+
+        uint32_t value;
+        bool unicode;
+        uint32_t span = decodeEscape(slash + 1, end, value, unicode);
+        if (!span) {
+            // Kept as written; the byte after it is copied as is
+            *out++ = '\\';
+            text = slash + 1;
+            continue;
+        }
+        if (unicode) out = encodeUtf8(value, out);
+        else *out++ = static_cast<char>(value);
+        text = slash + 1 + span;
+    }
+    return static_cast<uint32_t>(out - start);
+}
@@ -0,0 +1,169 @@
+#include "ffi.hpp"
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+// Rows of the trampoline table, by the return letter's place in "vild"
+static const char* const returnLetters = "vild";
+constexpr uint32_t RETURN_KINDS = 4;
+// Parameter lists of 0 to FFI_MAX_PARAMS longs, ints and doubles. A list
+// of n starts where the shorter lists end, at (3^n - 1) / 2, offset by
+// its parameters read as base 3 digits: 0 'l', 1 'i', 2 'd', the first
+// parameter the lowest.
+static constexpr uint32_t shapesBelow(uint32_t count) { return count ? 3 * shapesBelow(count - 1) + 1 : 0; }
+constexpr uint32_t SHAPES = shapesBelow(FFI_MAX_PARAMS + 1);
+
+static inline bool argument(const Value& value, int64_t& out) {
+    if (value.type != V_INT) return false;
+    out = value.integer;
+    return true;
+}
+
+static inline bool argument(const Value& value, int32_t& out) {
+    if (value.type != V_INT || value.integer < INT32_MIN || value.integer > INT32_MAX) return false;
+    out = static_cast<int32_t>(value.integer);
+    return true;
+}
+
+static inline bool argument(const Value& value, double& out) {
+    if (value.type == V_FLOAT) out = value.real;
+    else if (value.type == V_INT) out = static_cast<double>(value.integer);
+    else return false;
+    return true;
+}
+
+template <typename R, typename... A>
+struct Trampoline {
+    template <size_t... I>
+    static bool invoke(void* address, const Value* args, Value& result, std::index_sequence<I...>) {
+        (void)args;
+        std::tuple<A...> values;
+        if (!(true && ... && argument(args[I], std::get<I>(values)))) return false;
+        auto function = reinterpret_cast<R (*)(A...)>(address);
+        if constexpr (std::is_void<R>::value) {
+            function(std::get<I>(values)...);
+            result = Value::of(V_NONE);
+        } else if constexpr (std::is_floating_point<R>::value) {
+            result = Value::ofReal(function(std::get<I>(values)...));
+        } else {
+            result = Value::ofInt(function(std::get<I>(values)...));
+        }
+        return true;
+    }
+
+    static bool call(void* address, const Value* args, Value& result) {
+        return invoke(address, args, result, std::index_sequence_for<A...>());
+    }
+};
+
+template <typename A>
+static constexpr uint32_t kind() {
+    return std::is_same<A, double>::value ? 2 : std::is_same<A, int32_t>::value ? 1 : 0;
+}
+
+template <typename... A>
+static constexpr uint32_t shape() {
+    uint32_t digits = 0, place = 1;
+    ((digits += kind<A>() * place, place *= 3), ...);
+    (void)place;
+    return shapesBelow(sizeof...(A)) + digits;
+}
+
+// Every parameter list that extends A, up to FFI_MAX_PARAMS
+template <typename R, typename... A>
+static void fill(ForeignCall* row) {
+    row[shape<A...>()] = &Trampoline<R, A...>::call;
+    if constexpr (sizeof...(A) < FFI_MAX_PARAMS) {
+        fill<R, A..., int64_t>(row);
+        fill<R, A..., int32_t>(row);
+        fill<R, A..., double>(row);
+    }
+}
+
+struct Trampolines {
+    ForeignCall calls[RETURN_KINDS][SHAPES] = {};
+
+    Trampolines() {
+        fill<void>(calls[0]);
+        fill<int32_t>(calls[1]);
+        fill<int64_t>(calls[2]);
+        fill<double>(calls[3]);
+    };
+};
+
+ForeignCall foreignTrampoline(const char* signature, uint32_t& params) {
+    static const Trampolines table;
+    if (!signature || !*signature || signature[1] != '(') return nullptr;
+    const char* letter = strchr(returnLetters, signature[0]);
+    if (!letter) return nullptr;
+    static const char* const paramLetters = "lid";
+    uint32_t count = 0, digits = 0, place = 1;
+    const char* p = signature + 2;
+    for (; *p && *p != ')'; ++p, ++count, place *= 3) {
+        const char* param = count < FFI_MAX_PARAMS ? strchr(paramLetters, *p) : nullptr;
+        if (!param) return nullptr;
+        digits += static_cast<uint32_t>(param - paramLetters) * place;
+    }
+    if (*p != ')' || p[1]) return nullptr;
+    params = count;
+    return table.calls[letter - returnLetters][shapesBelow(count) + digits];
+}
+
+#ifdef _WIN32
+
+ForeignLibrary::ForeignLibrary(const char* path) {
+    handle = path ? LoadLibraryA(path) : GetModuleHandleA(nullptr);
+    if (!handle) error = std::string("cannot load ") + path;
+    owned = path != nullptr;
+};
+
+ForeignLibrary::~ForeignLibrary() {
+    if (handle && owned) FreeLibrary(static_cast<HMODULE>(handle));
+};
+
+static void* symbolAddress(void* handle, const char* symbol) {
+    return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(handle), symbol));
+}
+
+#else
+
+ForeignLibrary::ForeignLibrary(const char* path) {
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) error = dlerror();
+};
+
+ForeignLibrary::~ForeignLibrary() {
+    if (handle) dlclose(handle);
+};
+
+static void* symbolAddress(void* handle, const char* symbol) { return dlsym(handle, symbol); }
+
+#endif
+
+bool ForeignLibrary::lookup(const char* symbol, const char* signature, ForeignFunction& function) {
+    if (!handle) return false;
+    uint32_t params = 0;
+    ForeignCall call = foreignTrampoline(signature, params);
+    if (!call) {
+        error = std::string("bad signature ") + (signature ? signature : "") + " for " + symbol;
+        return false;
+    }
+    void* address = symbolAddress(handle, symbol);
+    if (!address) {
+        error = std::string("no symbol ") + symbol;
+        return false;
+    }
+    function.address = address;
+    function.call = call;
+    function.params = params;
+    return true;
+}
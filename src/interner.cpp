@@ -0,0 +1,130 @@
+#include "interner.hpp"
+#include <cstring>
+#include <mutex>
+
+static const size_t BLOCK_BYTES = 1 << 16;
+
+Interner::Interner(size_t expectedSymbols) {
+    size_t perShard = expectedSymbols / SHARDS;
+    for (Shard& shard : shards) {
+        shard.capacity = 1;
+        while (shard.capacity < perShard + (perShard >> 1)) shard.capacity <<= 1;
+        if (shard.capacity < 64) shard.capacity = 64;
+        shard.threshold = shard.capacity - (shard.capacity >> 2);
+        shard.table = std::vector<Slot>(shard.capacity);
+    }
+};
+
+bool Interner::Shard::find(uint64_t hash, const char* string, uint32_t length, uint32_t& id) const {
+    size_t mask = capacity - 1;
+    size_t index = hash & mask;
+    size_t distance = 0;
+
+    while (true) {
+        const Slot& current = table[index];
+        if (current.hash == 0) return false;
+
+        if (current.hash == hash && current.length == length && sameName(names[current.id].data(), string, length)) {
+            id = current.id;
+            return true;
+        }
+
+        size_t ideal = current.hash & mask;
+        size_t currentDistance = (index - ideal) & mask;
+        if (currentDistance < distance) return false; // Robin-hood invariant: not present
+
+        index = (index + 1) & mask;
+        ++distance;
+    }
+}
+
+void Interner::Shard::insert(Slot slot) {
+    size_t mask = capacity - 1;
+    size_t index = slot.hash & mask;
+    size_t distance = 0;
+
+    while (true) {
+        Slot& current = table[index];
+
+        if (current.hash == 0) {
+            current = slot;
+            return;
+        }
+        // Robin-hood logic
+        size_t ideal = current.hash & mask;
+        size_t currentDistance = (index - ideal) & mask;
+
+        if (currentDistance < distance) {
+            std::swap(current, slot);
+            distance = currentDistance;
+        }
+
+        index = (index + 1) & mask;
+        ++distance;
+    }
+}
+
+void Interner::Shard::grow() {
+    std::vector<Slot> old = std::move(table);
+    capacity <<= 1;
+    threshold = capacity - (capacity >> 2);
+    table = std::vector<Slot>(capacity);
+
+    for (auto& s : old) {
+        if (s.hash != 0) insert(s);
+    }
+}
+
+const char* Interner::Shard::store(const char* string, uint32_t length) {
+    size_t bytes = static_cast<size_t>(length) + 1;
+    if (bytes > left) {
+        size_t blockBytes = bytes > BLOCK_BYTES ? bytes : BLOCK_BYTES;
+        blocks.emplace_back(new char[blockBytes]);
+        cursor = blocks.back().get();
+        left = blockBytes;
+    }
+    char* stored = cursor;
+    memcpy(stored, string, length);
+    stored[length] = '\0';
+    cursor += bytes;
+    left -= bytes;
+    return stored;
+}
+
+symbol_t Interner::intern(const char* string, uint32_t length) {
+    uint64_t hash = hashSymbol(string, length);
+    // Low bits pick the slot, so take the shard from the top
+    uint32_t shardIndex = static_cast<uint32_t>(hash >> (64 - SHARD_BITS));
+    Shard& shard = shards[shardIndex];
+    uint32_t id;
+
+    {
+        std::shared_lock<std::shared_mutex> read(shard.lock);
+        if (shard.find(hash, string, length, id)) return (id << SHARD_BITS) | shardIndex;
+    }
+
+    std::unique_lock<std::shared_mutex> write(shard.lock);
+    // Another thread may have inserted it between the locks
+    if (shard.find(hash, string, length, id)) return (id << SHARD_BITS) | shardIndex;
+
+    if (shard.names.size() >= shard.threshold) shard.grow();
+    id = static_cast<uint32_t>(shard.names.size());
+    shard.names.emplace_back(shard.store(string, length), length);
+    shard.insert(Slot {hash, id, length});
+    return (id << SHARD_BITS) | shardIndex;
+}
+
+std::string_view Interner::name(symbol_t symbol) const {
+    const Shard& shard = shards[symbol & (SHARDS - 1)];
+    std::shared_lock<std::shared_mutex> read(shard.lock);
+    return shard.names[symbol >> SHARD_BITS];
+}
+
+size_t Interner::size() const {
+    size_t total = 0;
+    for (const Shard& shard : shards) {
+        std::shared_lock<std::shared_mutex> read(shard.lock);
+        total += shard.names.size();
+    }
+    return total;
+}
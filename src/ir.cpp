@@ -0,0 +1,546 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <cstdio>
+
+static const char* irNames[IR_OPS] = {
+    "nop", "int", "float", "undef", "param", "phi", "getglobal", "setglobal", "check",
+    "add", "sub", "mul", "div", "mod",
+    "band", "bor", "bxor", "shl", "shr",
+    "eq", "ne", "lt", "le",
+    "neg", "not", "bnot",
+    "call",
+    "jump", "branch", "ret", "ret0",
+};
+
+IrId IrFunction::append(uint32_t block, IrOp op, const IrId* args, uint32_t count) {
+    IrId id = static_cast<IrId>(insts.size());
+    IrInst inst;
+    inst.op = op;
+    inst.flags = 0;
+    inst.count = static_cast<uint16_t>(count);
+    inst.block = block;
+    inst.first = static_cast<uint32_t>(operands.size());
+    inst.integer = 0;
+    insts.push_back(inst);
+    operands.insert(operands.end(), args, args + count);
+    blocks[block].insts.push_back(id);
+    return id;
+}
+
+// The entry has no phis and dominates every use
+static IrId prepend(IrFunction& function, IrOp op) {
+    IrId id = function.append(0, op);
+    std::vector<IrId>& entry = function.blocks[0].insts;
+    std::rotate(entry.begin(), entry.end() - 1, entry.end());
+    return id;
+}
+
+IrId IrFunction::constant(int64_t value) {
+    IrId id = prepend(*this, IR_INT);
+    insts[id].integer = value;
+    return id;
+}
+
+IrId IrFunction::realConstant(double value) {
+    IrId id = prepend(*this, IR_FLOAT);
+    insts[id].real = value;
+    return id;
+}
+
+std::vector<uint32_t> reversePostorder(const IrFunction& function) {
+    std::vector<uint32_t> order;
+    std::vector<uint8_t> seen(function.blocks.size());
+    std::vector<std::pair<uint32_t, uint32_t>> stack;  // Block, next successor
+    stack.emplace_back(0, 0);
+    seen[0] = 1;
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        const IrBlock& block = function.blocks[top.first];
+        // Last successor first, so the first one comes right after the
+        // block in the order: a branch's taken side, a loop's body
+        if (top.second < block.succs.size()) {
+            uint32_t succ = block.succs[block.succs.size() - 1 - top.second++];
+            if (!seen[succ]) {
+                seen[succ] = 1;
+                stack.emplace_back(succ, 0);
+            }
+            continue;
+        }
+        order.push_back(top.first);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+void removeEdge(IrFunction& function, uint32_t from, uint32_t to) {
+    std::vector<uint32_t>& succs = function.blocks[from].succs;
+    succs.erase(std::find(succs.begin(), succs.end(), to));
+    std::vector<uint32_t>& preds = function.blocks[to].preds;
+    auto found = std::find(preds.begin(), preds.end(), from);
+    uint32_t k = static_cast<uint32_t>(found - preds.begin());
+    preds.erase(found);
+    for (IrId id : function.blocks[to].insts) {
+        IrInst& phi = function.insts[id];
+        if (phi.op == IR_NOP) continue;
+        if (phi.op != IR_PHI) break;
+        if (k >= phi.count) continue;   // Incomplete, or already trimmed
+        IrId* operands = function.operands.data() + phi.first;
+        std::copy(operands + k + 1, operands + phi.count, operands + k);
+        --phi.count;
+    }
+}
+
+uint32_t removeUnreachable(IrFunction& function) {
+    std::vector<uint8_t> reached(function.blocks.size());
+    for (uint32_t block : reversePostorder(function)) reached[block] = 1;
+    uint32_t removed = 0;
+    for (uint32_t b = 0; b < function.blocks.size(); ++b) {
+        IrBlock& block = function.blocks[b];
+        if (reached[b] || (block.insts.empty() && block.succs.empty())) continue;
+        while (!block.succs.empty()) removeEdge(function, b, block.succs.back());
+        for (IrId id : block.insts) function.insts[id].op = IR_NOP;
+        block.insts.clear();
+        ++removed;
+    }
+    // Preds left over are unreachable blocks that were emptied above
+    for (uint32_t b = 0; b < function.blocks.size(); ++b)
+        if (!reached[b]) function.blocks[b].preds.clear();
+    return removed;
+}
+
+void compactBlocks(IrFunction& function) {
+    for (IrBlock& block : function.blocks)
+        block.insts.erase(std::remove_if(block.insts.begin(), block.insts.end(),
+                                         [&](IrId id) { return function.insts[id].op == IR_NOP; }),
+                          block.insts.end());
+}
+
+std::string dumpIr(const IrModule& module, const IrFunction& function) {
+    std::string out;
+    char text[96];
+    for (uint32_t b = 0; b < function.blocks.size(); ++b) {
+        const IrBlock& block = function.blocks[b];
+        if (block.insts.empty()) continue;
+        snprintf(text, sizeof(text), "b%u:", b);
+        out += text;
+        if (!block.preds.empty()) {
+            out += " <-";
+            for (uint32_t pred : block.preds) out += " b" + std::to_string(pred);
+        }
+        out += "\n";
+        for (IrId id : block.insts) {
+            const IrInst& inst = function.insts[id];
+            out += "  ";
+            if (producesValue(inst.op)) out += "v" + std::to_string(id) + " = ";
+            out += irNames[inst.op];
+            switch (inst.op) {
+                case IR_INT: out += " " + std::to_string(inst.integer); break;
+                case IR_FLOAT:
+                    snprintf(text, sizeof(text), " %g", inst.real);
+                    out += text;
+                    break;
+                case IR_PARAM: out += " " + std::to_string(inst.index); break;
+                case IR_GETGLOBAL: case IR_SETGLOBAL: out += " " + module.globals[inst.index]; break;
+                case IR_CHECK: out += " " + function.locals[inst.index]; break;
+                default: break;
+            }
+            for (uint32_t i = 0; i < inst.count; ++i) out += " v" + std::to_string(function.operand(id, i));
+            for (uint32_t succ : isTerminator(inst.op) ? block.succs : std::vector<uint32_t>())
+                out += " b" + std::to_string(succ);
+            if (inst.flags & IRF_COMPOUND) out += " ; compound";
+            out += "\n";
+        }
+    }
+    return out;
+}
+
+IrBuilder::IrBuilder(const AstArena& arena, const Lexer& lexer) : arena(arena), lexer(lexer) {};
+
+uint32_t IrBuilder::global(symbol_t symbol) {
+    auto found = globalSlots.find(symbol);
+    if (found != globalSlots.end()) return found->second;
+    uint32_t slot = static_cast<uint32_t>(module->globals.size());
+    module->globals.emplace_back(name(symbol));
+    globalSlots.emplace(symbol, slot);
+    return slot;
+}
+
+bool IrBuilder::build(NodeId root, IrModule& out) {
+    if (lexer.sharesSymbols()) {
+        fail("lexer uses a shared interner");
+        return false;
+    }
+    module = &out;
+    out = IrModule();
+    globalSlots.clear();
+
+    // Slots for every top-level def first, as Compiler numbers them
+    const AstNode& body = arena[root];
+    out.functions.emplace_back();
+    out.functions[0].name = "<module>";
+    out.functionSlots.push_back(0);
+    std::vector<NodeId> defs;
+    for (uint32_t i = 0; i < body.count; ++i) {
+        NodeId id = body.child(i);
+        if (arena[id].type != AST_FUNCDEF) continue;
+        defs.push_back(id);
+        out.functions.emplace_back();
+        out.functions.back().name = name(static_cast<symbol_t>(arena[id].payload));
+        out.functionSlots.push_back(global(static_cast<symbol_t>(arena[id].payload)));
+    }
+
+    function = &out.functions[0];
+    buildFunction(root, {});
+    for (size_t k = 0; k < defs.size(); ++k) {
+        const AstNode& def = arena[defs[k]];
+        std::vector<symbol_t> params;
+        for (uint32_t i = 0; i + 1 < def.count; ++i) params.push_back(static_cast<symbol_t>(arena[def.child(i)].payload));
+        function = &out.functions[k + 1];
+        buildFunction(def.child(def.count - 1), params);
+    }
+    function = nullptr;
+    return errors.empty();
+}
+
+// Assigned names, not descending into nested defs, which are errors anyway
+void IrBuilder::collectLocals(NodeId id) {
+    const AstNode& node = arena[id];
+    if (node.type == AST_FUNCDEF) return;
+    if (node.type == AST_ASSIGN) {
+        const AstNode& target = arena[node.child(0)];
+        if (target.type == AST_IDENT) {
+            symbol_t symbol = static_cast<symbol_t>(target.payload);
+            if (!variables.count(symbol)) variables.emplace(symbol, static_cast<uint32_t>(variables.size()));
+        }
+    }
+    for (uint32_t i = 0; i < node.count; ++i) collectLocals(node.child(i));
+}
+
+// The module body (function 0) has no locals: every name in it is global
+void IrBuilder::buildFunction(NodeId body, const std::vector<symbol_t>& params) {
+    bool moduleBody = function == &module->functions[0];
+    variables.clear();
+    definitions.clear();
+    sealed.clear();
+    incomplete.clear();
+    undefined = IR_NONE;
+    function->params = static_cast<uint32_t>(params.size());
+    for (symbol_t param : params)
+        if (!variables.emplace(param, static_cast<uint32_t>(variables.size())).second)
+            fail(function->name + ": duplicate parameter " + name(param));
+    uncertain.clear();
+    if (!moduleBody) {
+        collectLocals(body);
+        function->locals.resize(variables.size());
+        for (const auto& entry : variables) function->locals[entry.second] = name(entry.first);
+        uncertain = uncertainReads(arena, body, variables, function->params);
+    }
+
+    current = newBlock();
+    seal(current);
+    for (uint32_t i = 0; i < params.size(); ++i) {
+        IrId param = emit(IR_PARAM);
+        function->insts[param].index = i;
+        definitions[current][variables[params[i]]] = param;
+    }
+    if (moduleBody) {
+        const AstNode& node = arena[body];
+        for (uint32_t i = 0; i < node.count; ++i)
+            if (arena[node.child(i)].type != AST_FUNCDEF) statement(node.child(i));
+    } else {
+        statement(body);
+    }
+    if (!terminated()) emit(IR_RET0);
+}
+
+uint32_t IrBuilder::newBlock() {
+    function->blocks.emplace_back();
+    definitions.emplace_back(variables.size(), IR_NONE);
+    sealed.push_back(0);
+    incomplete.emplace_back();
+    return static_cast<uint32_t>(function->blocks.size() - 1);
+}
+
+// Every predecessor is known: complete the phis read before that was so.
+// Completing one can add more to the list, through a loop back here.
+void IrBuilder::seal(uint32_t block) {
+    for (size_t i = 0; i < incomplete[block].size(); ++i) {
+        std::pair<uint32_t, IrId> entry = incomplete[block][i];
+        completePhi(entry.second, entry.first);
+    }
+    incomplete[block].clear();
+    sealed[block] = 1;
+}
+
+bool IrBuilder::terminated() const {
+    const std::vector<IrId>& insts = function->blocks[current].insts;
+    return !insts.empty() && isTerminator(function->insts[insts.back()].op);
+}
+
+IrId IrBuilder::emit(IrOp op, std::initializer_list<IrId> args) {
+    return function->append(current, op, args.begin(), static_cast<uint32_t>(args.size()));
+}
+
+void IrBuilder::jump(uint32_t target) {
+    emit(IR_JUMP);
+    function->blocks[current].succs.push_back(target);
+    function->blocks[target].preds.push_back(current);
+}
+
+void IrBuilder::branch(IrId condition, uint32_t whenTrue, uint32_t whenFalse) {
+    emit(IR_BRANCH, {condition});
+    function->blocks[current].succs = {whenTrue, whenFalse};
+    function->blocks[whenTrue].preds.push_back(current);
+    function->blocks[whenFalse].preds.push_back(current);
+}
+
+// Operand-less phi after the block's other phis
+IrId IrBuilder::phi(uint32_t block) {
+    IrId id = function->append(block, IR_PHI);
+    std::vector<IrId>& insts = function->blocks[block].insts;
+    auto at = std::find_if(insts.begin(), insts.end() - 1, [&](IrId other) { return function->insts[other].op != IR_PHI; });
+    std::rotate(at, insts.end() - 1, insts.end());
+    return id;
+}
+
+void IrBuilder::completePhi(IrId id, uint32_t variable) {
+    std::vector<IrId> values;
+    uint32_t block = function->insts[id].block;
+    std::vector<uint32_t> preds = function->blocks[block].preds;
+    for (uint32_t pred : preds) values.push_back(read(variable, pred));
+    IrInst& inst = function->insts[id];
+    inst.first = static_cast<uint32_t>(function->operands.size());
+    inst.count = static_cast<uint16_t>(values.size());
+    function->operands.insert(function->operands.end(), values.begin(), values.end());
+}
+
+IrId IrBuilder::undef() {
+    if (undefined == IR_NONE) undefined = prepend(*function, IR_UNDEF);
+    return undefined;
+}
+
+// The variable's value at id, checked first when it may be unassigned
+IrId IrBuilder::readLocal(NodeId id, uint32_t variable) {
+    IrId value = read(variable, current);
+    if (uncertain.count(id)) function->insts[emit(IR_CHECK, {value})].index = variable;
+    return value;
+}
+
+IrId IrBuilder::read(uint32_t variable, uint32_t block) {
+    IrId value = definitions[block][variable];
+    if (value != IR_NONE) return value;
+    const std::vector<uint32_t>& preds = function->blocks[block].preds;
+    if (!sealed[block]) {
+        value = phi(block);
+        incomplete[block].emplace_back(variable, value);
+    } else if (preds.size() == 1) {
+        value = read(variable, preds[0]);
+    } else if (preds.empty()) {
+        value = undef();
+    } else {
+        // Recorded before the operands are read, to end cycles through loops
+        value = phi(block);
+        definitions[block][variable] = value;
+        completePhi(value, variable);
+    }
+    definitions[block][variable] = value;
+    return value;
+}
+
+void IrBuilder::statement(NodeId id) {
+    const AstNode& node = arena[id];
+    switch (node.type) {
+        case AST_BLOCK:
+            for (uint32_t i = 0; i < node.count; ++i) statement(node.child(i));
+            break;
+        case AST_IF: {
+            IrId condition = expression(node.child(0));
+            uint32_t then = newBlock();
+            uint32_t otherwise = node.count > 2 ? newBlock() : 0;
+            uint32_t join = newBlock();
+            branch(condition, then, node.count > 2 ? otherwise : join);
+            seal(then);
+            current = then;
+            statement(node.child(1));
+            if (!terminated()) jump(join);
+            if (node.count > 2) {
+                seal(otherwise);
+                current = otherwise;
+                statement(node.child(2));
+                if (!terminated()) jump(join);
+            }
+            seal(join);
+            current = join;
+            break;
+        }
+        case AST_WHILE: {
+            uint32_t header = newBlock();
+            jump(header);
+            current = header;
+            IrId condition = expression(node.child(0));
+            uint32_t body = newBlock();
+            uint32_t exit = newBlock();
+            branch(condition, body, exit);
+            seal(body);
+            current = body;
+            statement(node.child(1));
+            if (!terminated()) jump(header);
+            seal(header);
+            seal(exit);
+            current = exit;
+            break;
+        }
+        case AST_RETURN:
+            if (node.count) emit(IR_RET, {expression(node.child(0))});
+            else emit(IR_RET0);
+            // Whatever follows is unreachable
+            current = newBlock();
+            seal(current);
+            break;
+        case AST_ASSIGN:
+            assignment(id);
+            break;
+        case AST_FUNCDEF:
+            fail(std::string("nested function ") + name(static_cast<symbol_t>(node.payload)));
+            break;
+        case AST_IMPORT: case AST_NULL:
+            break;
+        default:
+            expression(id);
+            break;
+    }
+}
+
+IrId IrBuilder::expression(NodeId id) {
+    const AstNode& node = arena[id];
+    switch (node.type) {
+        case AST_NUMBER: {
+            const Constant& literal = lexer.constants[node.payload];
+            if (literal.format == F_COMPLEX) {
+                fail("complex numbers are not supported");
+                return undef();
+            }
+            IrId value = emit(literal.format == F_INT ? IR_INT : IR_FLOAT);
+            if (literal.format == F_INT) function->insts[value].integer = literal.integer;
+            else function->insts[value].real = literal.real;
+            return value;
+        }
+        case AST_IDENT: {
+            symbol_t symbol = static_cast<symbol_t>(node.payload);
+            auto found = variables.find(symbol);
+            if (found != variables.end()) return readLocal(id, found->second);
+            IrId value = emit(IR_GETGLOBAL);
+            function->insts[value].index = global(symbol);
+            return value;
+        }
+        case AST_UNARY: {
+            TokenType type = payloadOperator(node.payload);
+            if (type == TT_PLUS) return expression(node.child(0));
+            IrOp op = type == TT_MINUS ? IR_NEG : type == TT_EXCL ? IR_NOT : type == TT_TILDE ? IR_BNOT : IR_NOP;
+            if (op == IR_NOP) {
+                fail("unsupported prefix operator");
+                return undef();
+            }
+            return emit(op, {expression(node.child(0))});
+        }
+        case AST_BINARY: {
+            TokenType type = payloadOperator(node.payload);
+            if (type == TT_AND || type == TT_OR) return logical(id, type == TT_AND);
+            bool swap;
+            Opcode op = binaryOpcode(type, swap);
+            if (op == OPCODES) {
+                fail("unsupported binary operator");
+                return undef();
+            }
+            IrId left = expression(node.child(0));
+            IrId right = expression(node.child(1));
+            IrOp irOp = static_cast<IrOp>(IR_ADD + (op - OP_ADD));
+            return swap ? emit(irOp, {right, left}) : emit(irOp, {left, right});
+        }
+        case AST_ASSIGN:
+            return assignment(id);
+        case AST_FUNCCALL: {
+            if (node.count > 256) {
+                fail("more than 255 arguments");
+                return undef();
+            }
+            std::vector<IrId> args;
+            for (uint32_t i = 0; i < node.count; ++i) args.push_back(expression(node.child(i)));
+            return function->append(current, IR_CALL, args.data(), static_cast<uint32_t>(args.size()));
+        }
+        case AST_ERROR:
+            fail("syntax error");
+            return undef();
+        default:
+            fail("unsupported expression");
+            return undef();
+    }
+}
+
+IrId IrBuilder::assignment(NodeId id) {
+    const AstNode& node = arena[id];
+    const AstNode& place = arena[node.child(0)];
+    if (place.type != AST_IDENT) {
+        fail("can only assign to a name");
+        return undef();
+    }
+    TokenType op = compoundOperator(payloadOperator(node.payload));
+    if (op == TT_UNKNOWN) {
+        fail("unsupported assignment operator");
+        return undef();
+    }
+    symbol_t symbol = static_cast<symbol_t>(place.payload);
+    auto found = variables.find(symbol);
+    bool local = found != variables.end();
+
+    IrId value;
+    if (op == TT_EQUAL) {
+        value = expression(node.child(1));
+    } else {
+        IrId old;
+        if (local) {
+            old = readLocal(node.child(0), found->second);
+        } else {
+            old = emit(IR_GETGLOBAL);
+            function->insts[old].index = global(symbol);
+        }
+        IrId right = expression(node.child(1));
+        bool swap;
+        Opcode binaryOp = binaryOpcode(op, swap);
+        value = emit(static_cast<IrOp>(IR_ADD + (binaryOp - OP_ADD)), {old, right});
+        function->insts[value].flags |= IRF_COMPOUND;
+    }
+    if (local) {
+        definitions[current][found->second] = value;
+    } else {
+        IrId store = emit(IR_SETGLOBAL, {value});
+        function->insts[store].index = global(symbol);
+    }
+    return value;
+}
+
+// The value of the last operand evaluated, through a phi where the paths meet
+IrId IrBuilder::logical(NodeId id, bool isAnd) {
+    const AstNode& node = arena[id];
+    IrId left = expression(node.child(0));
+    uint32_t from = current;
+    uint32_t right = newBlock();
+    uint32_t join = newBlock();
+    if (isAnd) branch(left, right, join);
+    else branch(left, join, right);
+    seal(right);
+    current = right;
+    IrId value = expression(node.child(1));
+    jump(join);
+    seal(join);
+    current = join;
+    IrId result = phi(join);
+    std::vector<IrId> values;
+    for (uint32_t pred : function->blocks[join].preds) values.push_back(pred == from ? left : value);
+    IrInst& inst = function->insts[result];
+    inst.first = static_cast<uint32_t>(function->operands.size());
+    inst.count = static_cast<uint16_t>(values.size());
+    function->operands.insert(function->operands.end(), values.begin(), values.end());
+    return result;
+}
@@ -0,0 +1,353 @@
+#include "jit.hpp"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if LIGHTNING_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Templates hard-code the Value layout and these type tags
+static_assert(sizeof(Value) == 16 && offsetof(Value, type) == 8, "templates assume 16-byte Values, type at 8");
+static_assert(V_UNSET == 0 && V_INT == 2 && V_FLOAT == 3, "templates assume these type tags");
+
+// What a hole in a template is patched with. Register and global holes
+// are 32-bit displacements from rbx (the frame) and r12 (the globals);
+// the jump holes are rel32 to a label of the instruction being compiled.
+enum Hole : uint8_t {
+    HOLE_A, HOLE_B, HOLE_C,     // Register offsets
+    HOLE_AT, HOLE_BT, HOLE_CT,  // Offsets of their type fields
+    HOLE_G, HOLE_GT,            // Global Bx, and its type field
+    HOLE_SBX, HOLE_SC,          // Immediates
+    HOLE_K, HOLE_KTYPE,         // Constant Bx: its 64 bits, and its type
+    HOLE_INDEX,                 // The instruction's index
+    HOLE_SLOW,                  // Its out-of-line template
+    HOLE_EXIT,                  // A stub returning its index to the interpreter
+    HOLE_NEXT,                  // The next instruction
+    HOLE_TARGET,                // Its jump target
+    HOLE_LEAVE,                 // The epilogue
+    HOLES,
+};
+
+static const char* const holeNames[HOLES] = {
+    "A", "B", "C", "AT", "BT", "CT", "G", "GT", "SBX", "SC", "K", "KTYPE", "INDEX", "SLOW", "EXIT", "NEXT", "TARGET",
+    "LEAVE",
+};
+
+// Machine code as hex bytes, holes as {NAME}. Native code keeps the frame
+// in rbx and the globals in r12 and is otherwise free to use rax, rcx, rdx
+// and xmm0-1; no template calls out, so the stack is left alone.
+#define INTS(SLOW) "83 BB {BT} 02 0F 85 " SLOW " 83 BB {CT} 02 0F 85 " SLOW " " // B and C are ints, or SLOW
+#define LOAD_B "48 8B 83 {B} "                                                // mov rax, B
+#define STORE_INT "48 89 83 {A} C7 83 {AT} 02 00 00 00 "                      // A = int rax
+#define STORE_FLOAT "F2 0F 11 83 {A} C7 83 {AT} 03 00 00 00 "                 // A = float xmm0
+#define NEXT "E9 {NEXT}"
+// xmm0 = B and xmm1 = C as doubles, converting ints; exits unless both are numbers
+#define REALS \
+    "8B 83 {BT} 83 F8 02 75 0B F2 48 0F 2A 83 {B} EB 11 83 F8 03 0F 85 {EXIT} F2 0F 10 83 {B} " \
+    "8B 83 {CT} 83 F8 02 75 0B F2 48 0F 2A 8B {C} EB 11 83 F8 03 0F 85 {EXIT} F2 0F 10 8B {C} "
+#define EXIT_HERE "B8 {INDEX} E9 {LEAVE}"
+
+struct TemplateText {
+    Opcode op;
+    const char* hot;
+    const char* cold;   // Out of line, reached through {SLOW}
+};
+
+static constexpr TemplateText templateTexts[] = {
+    {OP_MOVE, "0F 10 83 {B} 0F 11 83 {A}", nullptr},
+    {OP_LOADI, "48 C7 83 {A} {SBX} C7 83 {AT} 02 00 00 00", nullptr},
+    {OP_LOADK, "48 B8 {K} 48 89 83 {A} C7 83 {AT} {KTYPE}", nullptr},
+    {OP_GETGLOBAL, "41 8B 84 24 {GT} 85 C0 0F 84 {EXIT} 49 8B 94 24 {G} 48 89 93 {A} 89 83 {AT}", nullptr},
+    {OP_SETGLOBAL, "0F 10 83 {A} 41 0F 11 84 24 {G}", nullptr},
+    {OP_CLEAR, "C7 83 {AT} 00 00 00 00", nullptr},
+    {OP_CHECK, "83 BB {AT} 00 0F 84 {EXIT}", nullptr},     // The interpreter reports it
+
+    {OP_ADD, INTS("{SLOW}") LOAD_B "48 03 83 {C} " STORE_INT, REALS "F2 0F 58 C1 " STORE_FLOAT NEXT},
+    {OP_SUB, INTS("{SLOW}") LOAD_B "48 2B 83 {C} " STORE_INT, REALS "F2 0F 5C C1 " STORE_FLOAT NEXT},
+    {OP_MUL, INTS("{SLOW}") LOAD_B "48 0F AF 83 {C} " STORE_INT, REALS "F2 0F 59 C1 " STORE_FLOAT NEXT},
+    // Division by 0 and by -1 are left to the interpreter
+    {OP_DIV, INTS("{SLOW}") "48 8B 8B {C} 48 85 C9 0F 84 {EXIT} 48 83 F9 FF 0F 84 {EXIT} " LOAD_B
+             "48 99 48 F7 F9 " STORE_INT,
+     REALS "F2 0F 5E C1 " STORE_FLOAT NEXT},
+    {OP_MOD, INTS("{EXIT}") "48 8B 8B {C} 48 85 C9 0F 84 {EXIT} 48 83 F9 FF 0F 84 {EXIT} " LOAD_B
+             "48 99 48 F7 F9 48 89 93 {A} C7 83 {AT} 02 00 00 00",
+     nullptr},
+    {OP_BAND, INTS("{EXIT}") LOAD_B "48 23 83 {C} " STORE_INT, nullptr},
+    {OP_BOR, INTS("{EXIT}") LOAD_B "48 0B 83 {C} " STORE_INT, nullptr},
+    {OP_BXOR, INTS("{EXIT}") LOAD_B "48 33 83 {C} " STORE_INT, nullptr},
+    {OP_SHL, INTS("{EXIT}") LOAD_B "48 8B 8B {C} 48 D3 E0 " STORE_INT, nullptr},   // The CPU masks the count to 63
+    {OP_SHR, INTS("{EXIT}") LOAD_B "48 8B 8B {C} 48 D3 F8 " STORE_INT, nullptr},
+    // Float compares are false when unordered, except NE
+    {OP_EQ, INTS("{SLOW}") LOAD_B "48 3B 83 {C} 0F 94 C0 0F B6 C0 " STORE_INT,
+     REALS "66 0F 2E C1 0F 94 C0 0F 9B C1 20 C8 0F B6 C0 " STORE_INT NEXT},
+    {OP_NE, INTS("{SLOW}") LOAD_B "48 3B 83 {C} 0F 95 C0 0F B6 C0 " STORE_INT,
+     REALS "66 0F 2E C1 0F 95 C0 0F 9A C1 08 C8 0F B6 C0 " STORE_INT NEXT},
+    {OP_LT, INTS("{SLOW}") LOAD_B "48 3B 83 {C} 0F 9C C0 0F B6 C0 " STORE_INT,
+     REALS "66 0F 2E C8 0F 97 C0 0F B6 C0 " STORE_INT NEXT},
+    {OP_LE, INTS("{SLOW}") LOAD_B "48 3B 83 {C} 0F 9E C0 0F B6 C0 " STORE_INT,
+     REALS "66 0F 2E C8 0F 93 C0 0F B6 C0 " STORE_INT NEXT},
+    {OP_ADDI, "83 BB {BT} 02 0F 85 {EXIT} " LOAD_B "48 05 {SC} " STORE_INT, nullptr},
+
+    {OP_NEG, "83 BB {BT} 02 0F 85 {SLOW} " LOAD_B "48 F7 D8 " STORE_INT,
+     "83 BB {BT} 03 0F 85 {EXIT} " LOAD_B "48 0F BA F8 3F 48 89 83 {A} C7 83 {AT} 03 00 00 00 " NEXT},
+    {OP_NOT, "83 BB {BT} 02 0F 85 {EXIT} 31 C0 48 83 BB {B} 00 0F 94 C0 " STORE_INT, nullptr},
+    {OP_BNOT, "83 BB {BT} 02 0F 85 {EXIT} " LOAD_B "48 F7 D0 " STORE_INT, nullptr},
+
+    {OP_JMP, "E9 {TARGET}", nullptr},
+    {OP_JMPF, "83 BB {AT} 02 0F 85 {EXIT} 48 83 BB {A} 00 0F 84 {TARGET}", nullptr},
+    {OP_JMPT, "83 BB {AT} 02 0F 85 {EXIT} 48 83 BB {A} 00 0F 85 {TARGET}", nullptr},
+
+    {OP_CALL, EXIT_HERE, nullptr},
+    {OP_RET, EXIT_HERE, nullptr},
+    {OP_RET0, EXIT_HERE, nullptr},
+};
+
+static constexpr bool inOrder() {
+    for (size_t i = 0; i < sizeof(templateTexts) / sizeof(templateTexts[0]); ++i)
+        if (templateTexts[i].op != i) return false;
+    return sizeof(templateTexts) / sizeof(templateTexts[0]) == OPCODES;
+}
+static_assert(inOrder(), "templateTexts out of step with enum Opcode");
+
+// push rbx; push r12; mov rbx, rdi; mov r12, rsi; jmp rdx
+static const char* const prologueText = "53 41 54 48 89 FB 49 89 F4 FF E2";
+// pop r12; pop rbx; ret
+static const char* const epilogueText = "41 5C 5B C3";
+
+#undef INTS
+#undef LOAD_B
+#undef STORE_INT
+#undef STORE_FLOAT
+#undef NEXT
+#undef REALS
+
+struct Template {
+    std::vector<uint8_t> bytes;
+    std::vector<std::pair<uint32_t, Hole>> holes;   // Offset in bytes, what goes there
+};
+
+static Template assemble(const char* text) {
+    Template result;
+    if (!text) return result;
+    for (const char* p = text; *p;) {
+        if (*p == ' ') {
+            ++p;
+        } else if (*p == '{') {
+            const char* close = strchr(p, '}');
+            std::string name(p + 1, close);
+            uint8_t hole = 0;
+            while (hole < HOLES && name != holeNames[hole]) ++hole;
+            result.holes.push_back({static_cast<uint32_t>(result.bytes.size()), static_cast<Hole>(hole)});
+            result.bytes.resize(result.bytes.size() + (hole == HOLE_K ? 8 : 4));
+            p = close + 1;
+        } else {
+            result.bytes.push_back(static_cast<uint8_t>(strtoul(std::string(p, 2).c_str(), nullptr, 16)));
+            p += 2;
+        }
+    }
+    return result;
+}
+
+struct Templates {
+    Template hot[OPCODES];
+    Template cold[OPCODES];
+    Template exit, prologue, epilogue;
+
+    Templates() {
+        for (const TemplateText& text : templateTexts) {
+            hot[text.op] = assemble(text.hot);
+            cold[text.op] = assemble(text.cold);
+        }
+        exit = assemble(EXIT_HERE);
+        prologue = assemble(prologueText);
+        epilogue = assemble(epilogueText);
+    };
+};
+
+#undef EXIT_HERE
+
+static const Templates& templates() {
+    static const Templates table;
+    return table;
+}
+
+Jit::Jit(const Program& program, uint32_t threshold)
+    : program(program), threshold(threshold ? threshold : 1), counters(program.functions.size()),
+      code(program.functions.size()) {};
+
+Jit::~Jit() {
+#if LIGHTNING_JIT
+    for (Code& native : code)
+        if (native.memory) munmap(native.memory, native.size);
+#endif
+};
+
+uint32_t Jit::enter(uint32_t index, uint32_t at, Value* base, Value* globals) {
+    Code& native = code[index];
+    if (!native.entry) {
+        // Past the threshold without code: compiling failed, don't retry
+        if (counters[index] >= threshold || ++counters[index] < threshold || !compile(index)) return at;
+    }
+    ++entries;
+    return native.entry(base, globals, native.memory + native.offsets[at]);
+}
+
+namespace {
+
+// Copies templates into one buffer: the hot templates in instruction
+// order, then the cold ones and the exit stubs, then the epilogue. Jumps
+// are patched once every label is placed.
+class Assembler {
+public:
+    Assembler(const Program& program, const Function& function) : program(program), function(function) {};
+
+    bool assemble(std::vector<uint8_t>& out, std::vector<uint32_t>& offsets) {
+        const Templates& table = templates();
+        const std::vector<uint32_t>& ins = function.code;
+        size_t count = ins.size();
+        // Native code must not run off the end, so the last instruction is a jump or return
+        if (!count) return false;
+        Opcode last = opcodeOf(ins.back());
+        if (last != OP_JMP && last != OP_RET && last != OP_RET0) return false;
+
+        offsets.assign(count + 1, 0);
+        labels[HOLE_SLOW].assign(count, 0);
+        labels[HOLE_EXIT].assign(count, 0);
+        exits.assign(count, 0);
+        paste(table.prologue, 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (opcodeOf(ins[i]) >= OPCODES) return false;
+            offsets[i] = size();
+            if (!paste(table.hot[opcodeOf(ins[i])], i)) return false;
+        }
+        offsets[count] = size();
+        for (uint32_t i = 0; i < count; ++i) {
+            const Template& cold = table.cold[opcodeOf(ins[i])];
+            if (cold.bytes.empty()) continue;
+            labels[HOLE_SLOW][i] = size();
+            if (!paste(cold, i)) return false;
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!exits[i]) continue;
+            labels[HOLE_EXIT][i] = size();
+            paste(table.exit, i);
+        }
+        uint32_t leave = size();
+        paste(table.epilogue, 0);
+
+        for (const Fixup& fixup : fixups) {
+            uint32_t target;
+            switch (fixup.hole) {
+                case HOLE_NEXT: target = offsets[fixup.index + 1]; break;
+                case HOLE_TARGET: target = offsets[fixup.index + 1 + argSBx(ins[fixup.index])]; break;
+                case HOLE_LEAVE: target = leave; break;
+                default: target = labels[fixup.hole][fixup.index]; break;
+            }
+            put32(fixup.at, target - (fixup.at + 4));
+        }
+        out = std::move(bytes);
+        return true;
+    }
+
+private:
+    struct Fixup {
+        uint32_t at;
+        Hole hole;
+        uint32_t index;
+    };
+
+    const Program& program;
+    const Function& function;
+    std::vector<uint8_t> bytes;
+    std::vector<Fixup> fixups;
+    std::vector<uint32_t> labels[HOLES];    // Per instruction, for the label holes
+    std::vector<uint8_t> exits;             // Whether each instruction needs an exit stub
+
+    uint32_t size() const { return static_cast<uint32_t>(bytes.size()); }
+    void put32(uint32_t at, uint32_t value) { memcpy(&bytes[at], &value, 4); }
+
+    bool paste(const Template& piece, uint32_t index) {
+        uint32_t start = size();
+        uint32_t ins = function.code.empty() ? 0 : function.code[index];
+        bytes.insert(bytes.end(), piece.bytes.begin(), piece.bytes.end());
+        for (const auto& hole : piece.holes) {
+            uint32_t at = start + hole.first;
+            switch (hole.second) {
+                case HOLE_A: put32(at, argA(ins) * 16); break;
+                case HOLE_B: put32(at, argB(ins) * 16); break;
+                case HOLE_C: put32(at, argC(ins) * 16); break;
+                case HOLE_AT: put32(at, argA(ins) * 16 + 8); break;
+                case HOLE_BT: put32(at, argB(ins) * 16 + 8); break;
+                case HOLE_CT: put32(at, argC(ins) * 16 + 8); break;
+                case HOLE_G:
+                case HOLE_GT:
+                    if (argBx(ins) >= program.globals.size()) return false;
+                    put32(at, argBx(ins) * 16 + (hole.second == HOLE_GT ? 8 : 0));
+                    break;
+                case HOLE_SBX: put32(at, static_cast<uint32_t>(argSBx(ins))); break;
+                case HOLE_SC: put32(at, static_cast<uint32_t>(argSC(ins))); break;
+                case HOLE_K:
+                case HOLE_KTYPE: {
+                    if (argBx(ins) >= program.constants.size()) return false;
+                    const Value& constant = program.constants[argBx(ins)];
+                    if (hole.second == HOLE_K) memcpy(&bytes[at], &constant.index, 8);
+                    else put32(at, constant.type);
+                    break;
+                }
+                case HOLE_INDEX: put32(at, index); break;
+                case HOLE_TARGET: {
+                    int64_t target = static_cast<int64_t>(index) + 1 + argSBx(ins);
+                    if (target < 0 || target >= static_cast<int64_t>(function.code.size())) return false;
+                    fixups.push_back({at, hole.second, index});
+                    break;
+                }
+                case HOLE_EXIT:
+                    exits[index] = 1;
+                    fixups.push_back({at, hole.second, index});
+                    break;
+                case HOLE_SLOW:
+                case HOLE_NEXT:
+                case HOLE_LEAVE: fixups.push_back({at, hole.second, index}); break;
+                default: return false;  // A misspelt hole name
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+bool Jit::compile(uint32_t index) {
+#if LIGHTNING_JIT
+    if (index >= code.size()) return false;
+    if (code[index].entry) return true;
+    std::vector<uint8_t> bytes;
+    std::vector<uint32_t> offsets;
+    Assembler assembler(program, program.functions[index]);
+    if (!assembler.assemble(bytes, offsets)) return false;
+
+    // Written, then flipped to executable, never both at once
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (bytes.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return false;
+    }
+    Code& native = code[index];
+    native.memory = static_cast<uint8_t*>(memory);
+    native.size = size;
+    native.offsets = std::move(offsets);
+    native.entry = reinterpret_cast<Entry>(memory);
+    codeBytes += bytes.size();
+    return true;
+#else
+    (void)index;
+    return false;
+#endif
+}
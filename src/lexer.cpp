@@ -1,9 +1,15 @@
 #include "lexer.hpp"
+#include "keywords.hpp"
+#include "tokenstream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
+#include <memory>
 
 alignas(64)
-static const uint8_t charClassDict[256] = {
+const uint8_t charClassDict[256] = {
     /* 0x00 - 0x0F */
     0,0,0,0,0,0,0,0,0,
     0,                // \t  0x09
@@ -18,12 +24,12 @@ static const uint8_t charClassDict[256] = {
     /* 0x20 - 0x2F */
     0,   // ' '
     TT_EXCL,// !
-    0,          // "
+    CC_QUOTE,   // "
     0,   // #
     0,          // $
     TT_PERCENT,// %
     TT_AMPERSAND,// &
-    TT_QUOT,// '
+    CC_QUOTE,   // '
     TT_LPAREN,   // (
     TT_RPAREN,   // )
     TT_STAR,// *
@@ -84,24 +90,97 @@ inline uint8_t info(char c) {
     return charClassDict[static_cast<uchar_t>(c)];
 };
 
+static inline bool isHexDigit(char c) {
+    return info(c) == CC_DIGIT || static_cast<uchar_t>((c | 0x20) - 'a') < 6;
+}
+
+// The lexer reads at most one byte past end, and only expects a byte that
+// ends every run there. std::string's terminator is such a byte, so owned
+// input needs no copy.
 Lexer::Lexer(std::string src) : source(std::move(src)) {
-    source.reserve(src.size() + 2);
-    source.push_back('\0');
-    source.push_back('\0');
     begin = source.data();
     current = begin;
-    end = begin + source.size() - 2;
+    end = begin + source.size();
+    scan = &scanKernels(detectScanLevel());
     indentStack.reserve(64);
     indentStack.push_back(0);
+    initTable(source.size());
+};
+
+Lexer::Lexer(const char* src) : Lexer(std::string(src)) {};
+
+// A view may end at an unmapped page, so lex up to its last '\n' in place:
+// no read goes past a chunk that ends in a newline. The remaining partial
+// line is lexed from a small owned copy.
+Lexer::Lexer(std::string_view src) {
+    view = src;
+    size_t split = src.rfind('\n');
+    split = split == std::string_view::npos ? 0 : split + 1;
+    tail.assign(src.data() + split, src.size() - split);
+    tailBase = static_cast<uint32_t>(split);
+    tailPending = !tail.empty();
 
-    size_t estimatedSymbols = source.size() >> 3;
-    capacity = 1;
-    while (capacity < estimatedSymbols) capacity <<= 1;
-    if (capacity < 64) capacity = 64;
+    begin = src.data();
+    current = begin;
+    end = begin + split;
+    scan = &scanKernels(detectScanLevel());
+    indentStack.reserve(64);
+    indentStack.push_back(0);
+    initTable(src.size());
+};
+
+Lexer::Lexer(const Lexer& parent, const char* segment, uint32_t segmentBase, const char* from, const char* to) {
+    begin = segment;
+    base = segmentBase;
+    current = from;
+    end = to;
+    scan = parent.scan;
+    shared = parent.shared;
+    deferIndent = true;
+    copyLiterals = parent.copyLiterals;
+    initTable(static_cast<size_t>(to - from));
+};
+
+// Distinct names grow about with the square root of the input size (Heaps'
+// law), so size for that at 3/4 load rather than for one name per 8 bytes,
+// which overshoots large files by orders of magnitude. grow() covers files
+// of mostly unique names.
+void Lexer::initTable(size_t bytes) {
+    size_t estimatedSymbols = 8 * static_cast<size_t>(std::sqrt(static_cast<double>(bytes)));
+    if (estimatedSymbols > (bytes >> 3)) estimatedSymbols = bytes >> 3;
+    capacity = 64;
+    while (capacity - (capacity >> 2) < estimatedSymbols) capacity <<= 1;
 
     threshold = capacity - (capacity >> 2);
     table = std::vector<Entry>(capacity);
-};
+}
+
+static inline uint32_t tableHash(const char* string, uint32_t length) {
+    uint32_t hash = static_cast<uint32_t>(hashSymbol(string, length));
+    return hash ? hash : 1;
+}
+
+static inline uint32_t namePrefix(const char* string, uint32_t length) {
+    uint32_t prefix = 0;
+    memcpy(&prefix, string, length < 4 ? length : 4);
+    return prefix;
+}
+
+void Lexer::enterTail() {
+    begin = tail.data();
+    current = begin;
+    end = begin + tail.size();
+    base = tailBase;
+    tailPending = false;
+}
+
+void Lexer::setScanLevel(ScanLevel level) {
+    scan = &scanKernels(level);
+}
+
+void Lexer::setInterner(Interner* interner) {
+    shared = interner;
+}
 
 void Lexer::insert(Entry entry) {
     size_t mask = capacity - 1;
@@ -131,15 +210,59 @@ void Lexer::insert(Entry entry) {
 }
 
 symbol_t Lexer::intern(const char* string, uint32_t length) {
-    if (size >= threshold) grow();
+    bool added;
+    uint32_t offset = internLocal(string, length, added);
+    if (!shared) return offset;
+
+    // The local table caches the shared ids, so each name takes the shared
+    // table's locks once per file
+    if (added) {
+        sharedIds.resize(pool.size());
+        sharedIds[offset] = shared->intern(string, length);
+    }
+    return sharedIds[offset];
+}
 
-    // Hash
-    uint64_t hash = 1469598103934665603ull;
-    for (uint32_t i = 0; i < length; ++i) {
-        hash ^= static_cast<uchar_t>(string[i]);
-        hash *= 1099511628211ull;
+uint32_t Lexer::number(const char* string, uint32_t length, const Constant* decoded) {
+    bool added;
+    uint32_t offset = internLocal(string, length, added);
+    if (added) constantIds.resize(pool.size(), UINT32_MAX);
+    // A spelling seen before the last drop is decoded again
+    if (added || constantIds[offset] < droppedConstants) {
+        constantIds[offset] = droppedConstants + static_cast<uint32_t>(constants.size());
+        if (decoded) constants.push_back(*decoded);
+        else constants.push_back(string[0] == '\'' ? decodeChar(string, length) : decodeNumber(string, length));
     }
-    if (!hash) hash = 1;
+    return constantIds[offset] - droppedConstants;
+}
+
+uint32_t Lexer::decodeLiteral(const char* string, uint32_t length) {
+    uint32_t offset = static_cast<uint32_t>(strings.size());
+    strings.resize(offset + sizeof(StringHeader) + length - 2);
+    StringHeader header {length, decodeString(string + 1, length - 2, strings.data() + offset + sizeof(StringHeader))};
+    memcpy(strings.data() + offset, &header, sizeof(header));
+    strings.resize(offset + sizeof(header) + header.length);
+    return offset;
+}
+
+std::string_view escapedString(const std::vector<char>& strings, uint32_t offset) {
+    StringHeader header;
+    memcpy(&header, strings.data() + offset, sizeof(header));
+    return std::string_view(strings.data() + offset + sizeof(header), header.length);
+}
+
+std::string_view Lexer::literal(const Token& token) const {
+    if (token.format == F_ESCAPED) return escapedString(strings, token.lexeme);
+    const char* input = view.empty() ? source.data() : view.data();
+    return std::string_view(input + token.offset + 1, token.length - 2);
+}
+
+uint32_t Lexer::internLocal(const char* string, uint32_t length, bool& added) {
+    added = false;
+    if (size >= threshold) grow();
+
+    uint32_t hash = tableHash(string, length);
+    uint32_t prefix = namePrefix(string, length);
 
     size_t mask = capacity - 1;
     size_t index = hash & mask;
@@ -152,12 +275,13 @@ symbol_t Lexer::intern(const char* string, uint32_t length) {
         if (current.hash == 0)
             break;
 
-        if (current.hash == hash && current.length == length) {
-            const char* stored =
-                pool.data() + static_cast<size_t>(current.offset);
-
-            if (memcmp(stored, string, length) == 0)
+        if (current.hash == hash && current.length == length && current.prefix == prefix) {
+            const char* stored = pool.data() + static_cast<size_t>(current.offset);
+            if (length <= 4 || sameName(stored + 4, string + 4, length - 4)) {
+                PROFILE_ONLY(++counters.internHits;)
+                PROFILE_ONLY(++counters.probes[std::min<size_t>(distance, LexerCounters::PROBE_BUCKETS - 1)];)
                 return current.offset;
+            }
         }
 
         size_t ideal = current.hash & mask;
@@ -169,17 +293,21 @@ symbol_t Lexer::intern(const char* string, uint32_t length) {
         ++distance;
     }
 
+    PROFILE_ONLY(++counters.internInserts;)
+    PROFILE_ONLY(++counters.probes[std::min<size_t>(distance, LexerCounters::PROBE_BUCKETS - 1)];)
+
     // Not found: allocate string
     uint32_t offset = pool.size();
     pool.insert(pool.end(), string, string + length);
     pool.push_back('\0');
 
-    insert(Entry {hash, offset, length});
-
+    insert(Entry {hash, offset, length, prefix});
+    added = true;
     return offset;
 }
 
 void Lexer::grow() {
+    PROFILE_ONLY(auto start = std::chrono::steady_clock::now();)
     std::vector<Entry> old = std::move(table);
     capacity <<= 1;
     threshold = capacity - (capacity >> 2);
@@ -192,23 +320,55 @@ void Lexer::grow() {
             insert(e);
         }
     }
+    PROFILE_ONLY(++counters.grows;)
+    PROFILE_ONLY(counters.growNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();)
 }
 
-std::vector<Token> Lexer::tokenize() {
-    std::vector<Token> tokens;
-    tokens.reserve(1024);
+
+template <typename Sink>
+void Lexer::indentTo(uint32_t indent, uint32_t offset, Sink& tokens) {
+    uint32_t previous = indentStack.back();
+
+    if (indent > previous) {
+        indentStack.push_back(indent);
+        PROFILE_ONLY(counters.maxIndentDepth = std::max<uint64_t>(counters.maxIndentDepth, indentStack.size() - 1);)
+        tokens.push_back(Token {0, offset, indent, TT_INDENT});
+    }
+    else if (indent < previous) {
+        while (indentStack.size() > 0 && indent < indentStack.back()) {
+            indentStack.pop_back();
+            tokens.push_back(Token {0, offset, 0, TT_DEDENT});
+        }
+        // Handle indent mismatch
+        if (indent != indentStack.back())
+            tokens.push_back(Token {0, offset, 0, TT_ERROR});
+    }
+}
+
+template <typename Sink>
+void Lexer::finish(Sink& tokens) {
+    // Handle EOF
+    uint32_t offset = static_cast<uint32_t>(current - begin) + base;
+    while (indentStack.size() > 0) {
+        indentStack.pop_back();
+        tokens.push_back(Token {0, offset, 0, TT_DEDENT});
+    }
+    tokens.push_back(Token {0, offset, 0, TT_EOF});
+}
+
+template <typename Sink>
+void Lexer::lex(Sink& tokens) {
     while (current < end) {
         // Handle indentation
         if (atLineStart) {
             const char* indentStart = current;
             uint32_t indent = 0;
             atLineStart = false;
-            uint32_t offset = static_cast<uint32_t>(indentStart - begin);
+            uint32_t offset = static_cast<uint32_t>(indentStart - begin) + base;
             
-            while (*current == ' ') {
-                ++current;
-                ++indent;
-            }
+            if (*current == ' ') current = scan->spaces(current + 1, end);
+            indent = static_cast<uint32_t>(current - indentStart);
             
             if (info(*current) == CC_NEWLINE) {
                 ++current;
@@ -216,33 +376,20 @@ std::vector<Token> Lexer::tokenize() {
                 continue;
             }
             
-            uint32_t previous = indentStack.back();
-
-            if (indent > previous) {
-                indentStack.push_back(indent);
-                tokens.push_back(Token {0, offset, indent, TT_INDENT}); 
-            }
-            else if (indent < previous) {
-                while (indentStack.size() > 0 && indent < indentStack.back()) {
-                    indentStack.pop_back();
-                    tokens.push_back(Token {0, offset, 0, TT_DEDENT});
-                }
-                // Handle indent mismatch
-                if (indent != indentStack.back()) 
-                    tokens.push_back(Token {0, offset, 0, TT_ERROR});
-                
-            }
+            // Chunks don't know the enclosing indentation, defer to the stitch
+            if (deferIndent) tokens.push_back(Token {0, offset, indent, TT_LINE});
+            else indentTo(indent, offset, tokens);
         }
-        // Skip space in the non-indent context
-        while (*current == ' ') ++current;
+        // Skip space in the non-indent context, single spaces stay inline
+        if (*current == ' ' && *++current == ' ') current = scan->spaces(current + 1, end);
 
         // Throw EOF
         if (current >= end) break;
 
         // Skip the comment
         if (*current == '#') {
-            while (info(*current) != CC_NEWLINE) ++current;
-            while (info(*current) == CC_NEWLINE) ++current;
+            current = scan->line(current, end);
+            while (current < end && info(*current) == CC_NEWLINE) ++current;
             atLineStart = true;
             continue;
         }
@@ -251,7 +398,7 @@ std::vector<Token> Lexer::tokenize() {
         const char* lexemeStart = current;
         uchar_t c = *current;
         uint8_t cls = info(c);
-        uint32_t offset = static_cast<uint32_t>(lexemeStart - begin);
+        uint32_t offset = static_cast<uint32_t>(lexemeStart - begin) + base;
         ++current;  // Optimize for repetition in branches
 
         // Check if newline
@@ -266,33 +413,97 @@ std::vector<Token> Lexer::tokenize() {
         // Check if identifier
         if (cls == CC_IDENT_START) {
             // ++current;
-            while (info(*current) & CC_IDENT_CONT) ++current;
+            if (info(*current) & CC_IDENT_CONT) current = scan->ident(current + 1, end);
             uint32_t length = static_cast<uint32_t>(current - lexemeStart);
+            TokenType keyword = keywordTable.find(lexemeStart, length);
+            if (keyword != TT_IDENT) {
+                tokens.push_back(Token {0, offset, length, keyword});
+                continue;
+            }
             symbol_t identifier = intern(lexemeStart, length);
             tokens.push_back(Token {identifier, offset, length, TT_IDENT});
             continue;
         }
 
-        // Check if number
+        // Check if number. Every lookahead follows a byte that is part of
+        // the literal, so none goes past the sentinel.
         if (cls == CC_DIGIT) {
             // ++current;
-            while (info(*current) == CC_DIGIT) ++current;
+            char radix = static_cast<char>(*current | 0x20);
+            if (c == '0' && radix == 'x' && isHexDigit(current[1])) {
+                current += 2;
+                while (isHexDigit(*current) || (*current == '_' && isHexDigit(current[1]))) ++current;
+            }
+            else if (c == '0' && radix == 'b' && (current[1] == '0' || current[1] == '1')) {
+                current += 2;
+                while (*current == '0' || *current == '1' || (*current == '_' && (current[1] == '0' || current[1] == '1'))) ++current;
+            }
+            else {
+                if (info(*current) == CC_DIGIT) current = scan->digits(current + 1, end);
+                while (*current == '_' && info(current[1]) == CC_DIGIT) current = scan->digits(current + 2, end);
 
-            bool isFloat = *current == '.' && info(*(current + 1)) == CC_DIGIT;
-            current += isFloat;
-            if (isFloat) while (info(*current) == CC_DIGIT) ++current;
+                if (*current == '.' && info(current[1]) == CC_DIGIT) {
+                    current = scan->digits(current + 2, end);
+                    while (*current == '_' && info(current[1]) == CC_DIGIT) current = scan->digits(current + 2, end);
+                }
+                if ((*current | 0x20) == 'e') {
+                    const char* digits = current + 1;
+                    digits += *digits == '+' || *digits == '-';
+                    if (info(*digits) == CC_DIGIT) current = scan->digits(digits + 1, end);
+                }
+                if (*current == 'j' && !(info(current[1]) & CC_IDENT_CONT)) ++current;
+            }
 
             uint32_t length = static_cast<uint32_t>(current - lexemeStart);
-            symbol_t number = intern(lexemeStart, length);
-            
-            tokens.push_back(Token {number, offset, length, TT_NUMBER, isFloat ? F_FLOAT : F_INT});
+            uint32_t constant = number(lexemeStart, length);
+            tokens.push_back(Token {constant, offset, length, TT_NUMBER, constants[constant].format});
+            continue;
+        }
+
+        // Check if string or char. Both end at a line break, so a chunk or a
+        // relexed line holds whole literals. Strings without escapes stay
+        // views of the input.
+        if (cls == CC_QUOTE) {
+            const char* close;
+            bool escaped = copyLiterals;
+            if (c == '"') {
+                close = scan->string(current, end);
+                while (close < end && *close == '\\') {
+                    escaped = true;
+                    close += 1 + (close + 1 < end && info(close[1]) != CC_NEWLINE);
+                    close = scan->string(close, end);
+                }
+            }
+            else {
+                close = current;
+                while (close < end && *close != '\'' && info(*close) != CC_NEWLINE)
+                    close += 1 + (*close == '\\' && close + 1 < end && info(close[1]) != CC_NEWLINE);
+            }
+
+            // Unterminated, up to the line break
+            if (close >= end || *close != static_cast<char>(c)) {
+                current = close;
+                tokens.push_back(Token {0, offset, static_cast<uint32_t>(current - lexemeStart), TT_UNKNOWN});
+                continue;
+            }
+
+            current = close + 1;
+            uint32_t length = static_cast<uint32_t>(current - lexemeStart);
+            if (c == '\'') {
+                uint32_t constant = number(lexemeStart, length);
+                tokens.push_back(Token {constant, offset, length, TT_CHAR, constants[constant].format});
+            }
+            else if (escaped)
+                tokens.push_back(Token {decodeLiteral(lexemeStart, length), offset, length, TT_STRING, F_ESCAPED});
+            else
+                tokens.push_back(Token {0, offset, length, TT_STRING});
             continue;
         }
 
         // Check if operator (max munch for custom ops later)
         if (cls & CC_OPERATOR) {
             // ++current;
-            while (info(*current) & CC_OPERATOR) ++current;
+            if (info(*current) & CC_OPERATOR) current = scan->operators(current + 1, end);
             uint32_t length = static_cast<uint32_t>(current - lexemeStart);
             TokenType type;
             symbol_t op = 0;
@@ -340,17 +551,289 @@ std::vector<Token> Lexer::tokenize() {
         // Group unknown characters
         if (!cls) {
             // ++current;
-            while (info(*current) == CC_UNKNOWN) ++current;
+            while (current < end && info(*current) == CC_UNKNOWN) ++current;
             tokens.push_back(Token {0, offset, static_cast<uint32_t>(current - lexemeStart), TT_UNKNOWN});
             continue;
         }
     }
-    // Handle EOF
-    uint32_t offset = static_cast<uint32_t>(current - begin);
-    while (indentStack.size() > 0) {
-        indentStack.pop_back();
-        tokens.push_back(Token {0, offset, 0, TT_DEDENT});
+};
+
+std::vector<Token> Lexer::tokenize() {
+    PROFILE_PHASE("lex");
+    PROFILE_ONLY(size_t bytes = static_cast<size_t>(end - current) + (tailPending ? tail.size() : 0);)
+    std::vector<Token> tokens;
+    tokens.reserve(1024);
+    lex(tokens);
+    if (tailPending) {
+        enterTail();
+        lex(tokens);
     }
-    tokens.push_back(Token {0, offset, 0, TT_EOF});
+    finish(tokens);
+    PROFILE_ONLY(countTokens(tokens, 0, bytes);)
+    PROFILE_ONLY(publishCounters();)
+    return tokens;
+};
+
+TokenStream Lexer::tokenizeStream() {
+    PROFILE_PHASE("lex");
+    PROFILE_ONLY(size_t bytes = static_cast<size_t>(end - current) + (tailPending ? tail.size() : 0);)
+    TokenStream tokens(shared ? nullptr : &pool, shared, &constants, &strings);
+    tokens.reserve(1024);
+    lex(tokens);
+    if (tailPending) {
+        enterTail();
+        lex(tokens);
+    }
+    finish(tokens);
+    PROFILE_ONLY(countTokens(tokens, bytes);)
+    PROFILE_ONLY(publishCounters();)
     return tokens;
 };
+
+#if LIGHTNING_PROFILE
+static TokenCategory tokenCategory(TokenType type) {
+    if (type == TT_IDENT) return TC_IDENT;
+    if (type == TT_NUMBER || type == TT_CHAR) return TC_NUMBER;
+    if (type == TT_STRING) return TC_STRING;
+    if (type >= TT_DEF && type < TT_LPAREN) return TC_KEYWORD;
+    if (type >= TT_LPAREN && type < TT_CUSTOM_OP) return TC_PUNCT;
+    if (type >= TT_CUSTOM_OP && type < TT_INDENT) return TC_OPERATOR;
+    if (type >= TT_INDENT && type <= TT_LINE) return TC_LAYOUT;
+    return TC_ERROR;
+}
+
+// Categories of tokens[from...], bytes of input they came from; what no
+// token covers is whitespace and comments
+void Lexer::countTokens(const std::vector<Token>& tokens, size_t from, size_t bytes) {
+    uint64_t covered = 0;
+    for (size_t i = from; i < tokens.size(); ++i) {
+        TokenCategory category = tokenCategory(tokens[i].type);
+        ++counters.tokens[category];
+        if (category == TC_LAYOUT) continue;
+        counters.bytes[category] += tokens[i].length;
+        covered += tokens[i].length;
+    }
+    counters.trivia += bytes > covered ? bytes - covered : 0;
+}
+
+void Lexer::countTokens(const TokenStream& tokens, size_t bytes) {
+    uint64_t covered = 0;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        TokenCategory category = tokenCategory(tokens.type(i));
+        ++counters.tokens[category];
+        if (category == TC_LAYOUT) continue;
+        uint32_t length = tokens.length(i);
+        counters.bytes[category] += length;
+        covered += length;
+    }
+    counters.trivia += bytes > covered ? bytes - covered : 0;
+}
+
+void Lexer::publishCounters() {
+    if (Profiler* profiler = Profiler::active()) profiler->add(counters);
+    counters = LexerCounters();
+}
+#endif
+
+// Tokens whose lexeme is an offset into pool
+static inline bool hasSymbol(const Token& token) {
+    return token.type == TT_IDENT || (token.type == TT_CUSTOM_OP && token.length > 2);
+}
+
+std::vector<Token> Lexer::tokenizeParallel(ThreadPool& workers, size_t chunkBytes) {
+    size_t bytes = static_cast<size_t>(end - current) + (tailPending ? tail.size() : 0);
+    if (workers.size() < 2 || bytes <= chunkBytes) return tokenize();
+    PROFILE_PHASE("lex-parallel");
+
+    // Cut after a '\n' so every chunk starts where the serial lexer is at a line start
+    struct Range {
+        const char* from;
+        const char* to;
+    };
+    std::vector<Range> ranges;
+    const char* cut = current;
+    while (static_cast<size_t>(end - cut) > chunkBytes) {
+        const char* newline = static_cast<const char*>(memchr(cut + chunkBytes, '\n', end - cut - chunkBytes));
+        if (!newline) break;
+        ranges.push_back(Range {cut, newline + 1});
+        cut = newline + 1;
+    }
+    ranges.push_back(Range {cut, end});
+
+    // A view's copied last line is one more chunk, in its own segment
+    size_t count = ranges.size() + tailPending;
+
+    struct Chunk {
+        std::unique_ptr<Lexer> lexer;
+        std::vector<Token> tokens;
+        std::vector<Token> lines;           // The TT_LINE tokens, gathered by the worker
+        std::vector<Token> fixes;           // Resolved TT_LINE expansions, in order
+        std::vector<uint32_t> fixCounts;    // Tokens per TT_LINE
+        std::vector<symbol_t> remap;        // Chunk pool offset -> pool offset
+        std::vector<uint32_t> constantRemap; // Chunk constant -> constant
+        uint32_t stringBase = 0;            // Of the chunk's strings in strings
+        size_t outputStart = 0;
+    };
+    std::vector<Chunk> chunks(count);
+
+    workers.run(count, [&](size_t i) {
+        PROFILE_PHASE("lex-chunk");
+        Chunk& chunk = chunks[i];
+        if (i < ranges.size())
+            chunk.lexer.reset(new Lexer(*this, begin, base, ranges[i].from, ranges[i].to));
+        else
+            chunk.lexer.reset(new Lexer(*this, tail.data(), tailBase, tail.data(), tail.data() + tail.size()));
+        chunk.tokens.reserve(static_cast<size_t>(chunk.lexer->end - chunk.lexer->current) >> 2);
+        chunk.lexer->lex(chunk.tokens);
+        for (const Token& token : chunk.tokens)
+            if (token.type == TT_LINE) chunk.lines.push_back(token);
+    });
+
+    // Stitch in source order: replay indentation and merge symbols so the
+    // indent stack, pool and table end up exactly as the serial lexer leaves them
+    size_t total = 0;
+    for (Chunk& chunk : chunks) {
+        for (const Token& token : chunk.lines) {
+            size_t before = chunk.fixes.size();
+            indentTo(token.length, token.offset, chunk.fixes);
+            chunk.fixCounts.push_back(static_cast<uint32_t>(chunk.fixes.size() - before));
+        }
+
+        // Chunks resolve shared symbols themselves, then only numbers need merging
+        const Lexer& local = *chunk.lexer;
+        PROFILE_ONLY(counters.merge(local.counters);)
+        if (!shared) chunk.remap.resize(local.pool.size());
+        chunk.constantRemap.resize(local.constants.size());
+        for (size_t offset = 0; offset < local.pool.size() && !(shared && local.constants.empty());) {
+            const char* string = local.pool.data() + offset;
+            uint32_t length = static_cast<uint32_t>(strlen(string));
+            uint32_t constant = offset < local.constantIds.size() ? local.constantIds[offset] : UINT32_MAX;
+            if (constant != UINT32_MAX)
+                chunk.constantRemap[constant] = number(string, length, &local.constants[constant]);
+            else if (!shared)
+                chunk.remap[offset] = intern(string, length);
+            offset += length + 1;
+        }
+
+        chunk.stringBase = static_cast<uint32_t>(strings.size());
+        strings.insert(strings.end(), local.strings.begin(), local.strings.end());
+
+        chunk.outputStart = total;
+        total += chunk.tokens.size() - chunk.fixCounts.size() + chunk.fixes.size();
+    }
+
+    std::vector<Token> tokens(total);
+    workers.run(count, [&](size_t i) {
+        Chunk& chunk = chunks[i];
+        Token* out = tokens.data() + chunk.outputStart;
+        const Token* fix = chunk.fixes.data();
+        size_t line = 0;
+        for (Token token : chunk.tokens) {
+            if (token.type == TT_LINE) {
+                for (uint32_t k = chunk.fixCounts[line++]; k > 0; --k) *out++ = *fix++;
+                continue;
+            }
+            if (token.type == TT_NUMBER || token.type == TT_CHAR) token.lexeme = chunk.constantRemap[token.lexeme];
+            else if (token.format == F_ESCAPED) token.lexeme += chunk.stringBase;
+            else if (!shared && hasSymbol(token)) token.lexeme = chunk.remap[token.lexeme];
+            *out++ = token;
+        }
+        chunk.lexer.reset();
+    });
+
+    if (tailPending) enterTail();
+    current = end;
+    finish(tokens);
+    PROFILE_ONLY(countTokens(tokens, 0, bytes);)
+    PROFILE_ONLY(publishCounters();)
+    return tokens;
+}
+
+void Lexer::relex(std::vector<Token>& tokens, const Edit& edit) {
+    PROFILE_PHASE("relex");
+    if (!view.empty()) {
+        source.assign(view.data(), view.size());
+        view = std::string_view();
+        tail.clear();
+        tailPending = false;
+    }
+
+    // Restart at the start of the edited line; nothing before it can change
+    size_t restart = edit.offset;
+    while (restart > 0 && source[restart - 1] != '\n') --restart;
+    size_t keep = std::lower_bound(tokens.begin(), tokens.end(), restart,
+        [](const Token& token, size_t offset) { return token.offset < offset; }) - tokens.begin();
+
+    // Rebuild the indent stack from the tokens before the restart, walking back
+    // only to the last token at column 0, where the stack is just the base level
+    std::vector<uint16_t> opened;
+    size_t pops = 0;
+    for (size_t i = keep; i > 0; --i) {
+        const Token& token = tokens[i - 1];
+        if (token.type == TT_DEDENT) ++pops;
+        else if (token.type == TT_INDENT) {
+            if (pops) --pops;
+            else opened.push_back(static_cast<uint16_t>(token.length));
+        }
+        else if (token.type != TT_ERROR && (token.offset == 0 || source[token.offset - 1] == '\n'))
+            break;
+    }
+    indentStack.assign(1, 0);
+    indentStack.insert(indentStack.end(), opened.rbegin(), opened.rend());
+    std::vector<uint16_t> oldStack = indentStack;
+
+    source.replace(edit.offset, edit.removed, edit.inserted.data(), edit.inserted.size());
+    const char* text = source.data();
+    const char* last = text + source.size();
+    int64_t delta = static_cast<int64_t>(edit.inserted.size()) - edit.removed;
+    size_t changedEnd = edit.offset + edit.inserted.size();
+
+    begin = text;
+    base = 0;
+    current = text + restart;
+    atLineStart = true;
+
+    // Lex line by line. Past the edit, a line start after an unchanged '\n' was
+    // also a line start before the edit; once the indent stacks agree there,
+    // the rest of the old stream is valid as is.
+    std::vector<Token> fresh;
+    size_t old = keep;
+    bool synced = false;
+    while (current < last) {
+        size_t position = static_cast<size_t>(current - text);
+        if (position > changedEnd) {
+            uint32_t oldPosition = static_cast<uint32_t>(static_cast<int64_t>(position) - delta);
+            for (; old < tokens.size() && tokens[old].offset < oldPosition; ++old) {
+                if (tokens[old].type == TT_INDENT) oldStack.push_back(static_cast<uint16_t>(tokens[old].length));
+                else if (tokens[old].type == TT_DEDENT) oldStack.pop_back();
+            }
+            if (oldStack == indentStack) {
+                synced = true;
+                break;
+            }
+        }
+        const char* newline = static_cast<const char*>(memchr(current, '\n', last - current));
+        end = newline ? newline + 1 : last;
+        lex(fresh);
+    }
+    end = last;
+
+    if (!synced) {
+        current = end;
+        finish(fresh);
+        old = tokens.size();
+    }
+
+    // Splice: kept prefix, fresh tokens, then the old suffix shifted by delta
+    for (size_t i = old; i < tokens.size(); ++i)
+        tokens[i].offset = static_cast<uint32_t>(tokens[i].offset + delta);
+    if (fresh.size() <= old - keep) {
+        std::copy(fresh.begin(), fresh.end(), tokens.begin() + keep);
+        tokens.erase(tokens.begin() + keep + fresh.size(), tokens.begin() + old);
+    }
+    else {
+        std::copy(fresh.begin(), fresh.begin() + (old - keep), tokens.begin() + keep);
+        tokens.insert(tokens.begin() + old, fresh.begin() + (old - keep), fresh.end());
+    }
+    PROFILE_ONLY(publishCounters();)
+}
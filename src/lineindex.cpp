@@ -0,0 +1,87 @@
+#include "lineindex.hpp"
+#include <algorithm>
+
+LineIndex::LineIndex() {
+    scan = &scanKernels(detectScanLevel());
+};
+
+LineIndex::LineIndex(std::string_view source) : text(source) {
+    scan = &scanKernels(detectScanLevel());
+};
+
+void LineIndex::reset(std::string_view source) {
+    text = source;
+    built = false;
+}
+
+void LineIndex::setScanLevel(ScanLevel level) {
+    scan = &scanKernels(level);
+}
+
+void LineIndex::build() {
+    const char* p = text.data();
+    const char* end = p + text.size();
+    // Count first so the table is allocated once at its final size
+    starts.resize(scan->countLines(p, end) + 1);
+    starts[0] = 0;
+    scan->lineStarts(p, end, 0, starts.data() + 1);
+    built = true;
+}
+
+Location LineIndex::locate(uint32_t offset) {
+    if (!built) build();
+    size_t line = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+    return Location {static_cast<uint32_t>(line), offset - starts[line - 1] + 1};
+}
+
+uint32_t LineIndex::lineStart(uint32_t line) {
+    if (!built) build();
+    if (line == 0) return 0;
+    if (line > starts.size()) return static_cast<uint32_t>(text.size());
+    return starts[line - 1];
+}
+
+uint32_t LineIndex::lines() {
+    if (!built) build();
+    return static_cast<uint32_t>(starts.size());
+}
+
+void LineIndex::update(std::string_view source, const Edit& edit) {
+    text = source;
+    if (!built) return;
+
+    // Whether a byte breaks a line depends on the byte after it, so the
+    // byte before the edit is rescanned too
+    uint32_t from = edit.offset ? edit.offset - 1 : 0;
+    uint32_t insertedEnd = edit.offset + static_cast<uint32_t>(edit.inserted.size());
+    int64_t delta = static_cast<int64_t>(edit.inserted.size()) - edit.removed;
+
+    // Old starts in (from, offset + removed] go, later ones shift
+    auto first = std::upper_bound(starts.begin(), starts.end(), from);
+    auto last = std::upper_bound(first, starts.end(), edit.offset + edit.removed);
+    for (auto it = last; it != starts.end(); ++it) *it = static_cast<uint32_t>(*it + delta);
+
+    // New starts in (from, insertedEnd]; one byte of lookahead past the
+    // insertion, whose own start is dropped since its lookahead is missing
+    const char* p = source.data() + from;
+    const char* end = source.data() + std::min<size_t>(insertedEnd + 1, source.size());
+    uint32_t small[40];
+    std::vector<uint32_t> large;
+    uint32_t* fresh = small;
+    if (end - p > 32) {
+        large.resize(scan->countLines(p, end));
+        fresh = large.data();
+    }
+    uint32_t* freshEnd = scan->lineStarts(p, end, from, fresh);
+    while (freshEnd != fresh && freshEnd[-1] > insertedEnd) --freshEnd;
+
+    // Replace in place when the line count holds, the common case for typing
+    size_t count = freshEnd - fresh;
+    if (static_cast<size_t>(last - first) == count) {
+        std::copy(fresh, freshEnd, first);
+    } else {
+        size_t at = first - starts.begin();
+        starts.erase(first, last);
+        starts.insert(starts.begin() + at, fresh, freshEnd);
+    }
+}
@@ -0,0 +1,553 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <cstring>
+
+// Int constants by value, float ones by bits, shared by every function of
+// the program
+struct ConstantPool {
+    Program& program;
+    std::unordered_map<uint64_t, uint32_t> ints;
+    std::unordered_map<uint64_t, uint32_t> reals;
+
+    explicit ConstantPool(Program& program) : program(program) {};
+
+    bool slot(const Value& value, uint32_t& index) {
+        auto& slots = value.type == V_INT ? ints : reals;
+        auto found = slots.find(value.index);
+        if (found != slots.end()) {
+            index = found->second;
+            return true;
+        }
+        index = static_cast<uint32_t>(program.constants.size());
+        if (index > 0xFFFF) return false;
+        program.constants.push_back(value);
+        slots.emplace(value.index, index);
+        return true;
+    }
+};
+
+static bool isConstant(IrOp op) { return op == IR_INT || op == IR_FLOAT || op == IR_UNDEF; }
+
+// Can run after a global read without changing which error, if any, the
+// program stops with
+static bool quiet(IrOp op) {
+    return isConstant(op) || op == IR_PARAM || op == IR_EQ || op == IR_NE || op == IR_NOT;
+}
+
+static bool smallStep(const IrInst& inst, bool negate, uint32_t& c) {
+    if (inst.op != IR_INT || inst.integer < -(SC_BIAS - 1) || inst.integer > SC_BIAS - 1) return false;
+    c = static_cast<uint32_t>((negate ? -inst.integer : inst.integer) + SC_BIAS);
+    return true;
+}
+
+// One function's way out of SSA. Works on its own copy of the function,
+// since edges are split and blocks laid out along the way.
+class FunctionLowering {
+public:
+    FunctionLowering(const IrFunction& source, Function& out, ConstantPool& pool, std::vector<std::string>& errors)
+        : function(source), out(out), pool(pool), errors(errors) {};
+
+    bool lower();
+
+private:
+    static constexpr uint32_t NO_REGISTER = 0xFFFFFFFF;
+
+    IrFunction function;
+    Function& out;
+    ConstantPool& pool;
+    std::vector<std::string>& errors;
+
+    std::vector<uint32_t> layout;
+    std::vector<uint32_t> blockStart;   // Position of the block's phis
+    std::vector<uint32_t> blockEnd;     // Just past the terminator
+    std::vector<uint32_t> at;           // Position of each instruction
+    std::vector<uint32_t> uses;
+    std::vector<uint8_t> sunk;          // Global reads emitted straight into a call's callee register
+    typedef std::pair<uint32_t, uint32_t> Range;    // Positions [first, second)
+    std::vector<std::vector<Range>> ranges;         // Where each value in a register is live, in order
+    std::vector<std::vector<Range>> occupied;       // Ranges of the values given each register
+    std::vector<uint32_t> reg;
+    std::vector<uint32_t> callBase;
+    std::vector<uint32_t> blockPc;
+    std::vector<std::pair<uint32_t, uint32_t>> fixups;  // Jump pc, target block
+    uint32_t maxRegister = 0;
+    uint32_t frame = 0;     // At least what calls and scratch need
+    bool ok = true;
+
+    void fail(const std::string& message) {
+        if (ok) errors.push_back(function.name + ": " + message);
+        ok = false;
+    }
+    bool inRegister(IrId id) const {
+        IrOp op = function.insts[id].op;
+        return producesValue(op) && !isConstant(op) && !sunk[id] && !(op == IR_CALL && !uses[id]);
+    }
+
+    void splitEdges();
+    void number();
+    void sinkGlobals();
+    void liveRanges();
+    bool fits(IrId id, uint32_t r) const;
+    uint32_t callArea(uint32_t position) const;
+    void allocate();
+
+    uint32_t emit(uint32_t ins) {
+        out.code.push_back(ins);
+        return static_cast<uint32_t>(out.code.size() - 1);
+    }
+    uint32_t scratch(uint32_t k);
+    void load(IrId id, uint32_t target);
+    uint32_t operand(IrId id, uint32_t k);
+    void parallelMove(std::vector<std::pair<uint32_t, uint32_t>>& moves, uint32_t temporary);
+    void copies(uint32_t from, uint32_t to);
+    void instruction(IrId id, uint32_t next);
+};
+
+// A branch target with phis gets a block of its own for the copies
+void FunctionLowering::splitEdges() {
+    size_t count = function.blocks.size();
+    for (uint32_t b = 0; b < count; ++b) {
+        for (uint32_t k = 0; k < function.blocks[b].succs.size() && function.blocks[b].succs.size() > 1; ++k) {
+            uint32_t succ = function.blocks[b].succs[k];
+            const std::vector<IrId>& insts = function.blocks[succ].insts;
+            if (insts.empty() || function.insts[insts[0]].op != IR_PHI) continue;
+            uint32_t middle = static_cast<uint32_t>(function.blocks.size());
+            function.blocks.emplace_back();
+            function.append(middle, IR_JUMP);
+            function.blocks[middle].preds.push_back(b);
+            function.blocks[middle].succs.push_back(succ);
+            function.blocks[b].succs[k] = middle;
+            std::vector<uint32_t>& preds = function.blocks[succ].preds;
+            *std::find(preds.begin(), preds.end(), b) = middle;
+        }
+    }
+}
+
+// Params are at 0, a block's phis at its start, and everything else at
+// even positions after that, so that a value whose range ends at an
+// instruction leaves its register free for the instruction's own result
+void FunctionLowering::number() {
+    layout = reversePostorder(function);
+    blockStart.assign(function.blocks.size(), 0);
+    blockEnd.assign(function.blocks.size(), 0);
+    at.assign(function.insts.size(), 0);
+    uint32_t position = 0;
+    for (uint32_t b : layout) {
+        position += 2;
+        blockStart[b] = position;
+        for (IrId id : function.blocks[b].insts) {
+            if (function.insts[id].op == IR_PHI) {
+                at[id] = blockStart[b];
+            } else if (function.insts[id].op != IR_PARAM) {
+                position += 2;
+                at[id] = position;
+            }
+        }
+        blockEnd[b] = position + 1;
+    }
+}
+
+void FunctionLowering::sinkGlobals() {
+    uses.assign(function.insts.size(), 0);
+    sunk.assign(function.insts.size(), 0);
+    for (uint32_t b : layout)
+        for (IrId id : function.blocks[b].insts)
+            for (uint32_t i = 0; i < function.insts[id].count; ++i) ++uses[function.operand(id, i)];
+    for (uint32_t b : layout) {
+        const std::vector<IrId>& insts = function.blocks[b].insts;
+        for (size_t i = 0; i < insts.size(); ++i) {
+            if (function.insts[insts[i]].op != IR_GETGLOBAL || uses[insts[i]] != 1) continue;
+            size_t k = i + 1;
+            while (k < insts.size() && quiet(function.insts[insts[k]].op)) ++k;
+            if (k < insts.size() && function.insts[insts[k]].op == IR_CALL && function.operand(insts[k], 0) == insts[i])
+                sunk[insts[i]] = 1;
+        }
+    }
+}
+
+// Backward liveness over the layout, then the ranges of positions each
+// value is live over, one per block at most. A phi operand is live out of
+// its predecessor, not into the phi's block.
+void FunctionLowering::liveRanges() {
+    size_t words = (function.insts.size() + 63) / 64;
+    std::vector<std::vector<uint64_t>> liveIn(function.blocks.size(), std::vector<uint64_t>(words));
+    std::vector<std::vector<uint64_t>> liveOut = liveIn;
+    std::vector<std::vector<uint64_t>> used = liveIn, defined = liveIn;
+    auto set = [](std::vector<uint64_t>& bits, IrId id) { bits[id >> 6] |= uint64_t(1) << (id & 63); };
+    auto has = [](const std::vector<uint64_t>& bits, IrId id) { return (bits[id >> 6] >> (id & 63)) & 1; };
+
+    for (uint32_t b : layout)
+        for (IrId id : function.blocks[b].insts) {
+            if (inRegister(id)) set(defined[b], id);
+            if (function.insts[id].op == IR_PHI) continue;
+            for (uint32_t i = 0; i < function.insts[id].count; ++i) {
+                IrId value = function.operand(id, i);
+                if (inRegister(value) && function.insts[value].block != b) set(used[b], value);
+            }
+        }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = layout.size(); i-- > 0;) {
+            uint32_t b = layout[i];
+            std::vector<uint64_t> outBits(words);
+            for (uint32_t succ : function.blocks[b].succs) {
+                for (size_t w = 0; w < words; ++w) outBits[w] |= liveIn[succ][w];
+                const IrBlock& target = function.blocks[succ];
+                uint32_t k = static_cast<uint32_t>(std::find(target.preds.begin(), target.preds.end(), b) - target.preds.begin());
+                for (IrId id : target.insts) {
+                    if (function.insts[id].op != IR_PHI) break;
+                    IrId value = function.operand(id, k);
+                    if (inRegister(value)) set(outBits, value);
+                }
+            }
+            std::vector<uint64_t> inBits(words);
+            for (size_t w = 0; w < words; ++w) inBits[w] = used[b][w] | (outBits[w] & ~defined[b][w]);
+            if (inBits != liveIn[b] || outBits != liveOut[b]) {
+                liveIn[b] = std::move(inBits);
+                liveOut[b] = std::move(outBits);
+                changed = true;
+            }
+        }
+    }
+
+    // In each block a value is live from its definition or the block's
+    // start, to its last use there or the block's end
+    ranges.assign(function.insts.size(), {});
+    std::vector<uint32_t> lastUse(function.insts.size(), 0);
+    for (uint32_t b : layout) {
+        const std::vector<IrId>& insts = function.blocks[b].insts;
+        for (IrId id : insts) {
+            if (function.insts[id].op == IR_PHI) continue;
+            for (uint32_t i = 0; i < function.insts[id].count; ++i) lastUse[function.operand(id, i)] = at[id];
+        }
+        auto add = [&](IrId value, uint32_t from) {
+            uint32_t to = has(liveOut[b], value) ? blockEnd[b] : std::max(lastUse[value], from + 1);
+            ranges[value].emplace_back(from, to);
+        };
+        for (IrId id : insts)
+            if (inRegister(id)) add(id, at[id]);
+        for (size_t w = 0; w < words; ++w)
+            for (uint32_t bit = 0; bit < 64 && liveIn[b][w] >> bit; ++bit)
+                if ((liveIn[b][w] >> bit) & 1) add(static_cast<IrId>(w * 64 + bit), blockStart[b]);
+        for (IrId id : insts)
+            for (uint32_t i = 0; i < function.insts[id].count; ++i) lastUse[function.operand(id, i)] = 0;
+    }
+}
+
+bool FunctionLowering::fits(IrId id, uint32_t r) const {
+    const std::vector<Range>& taken = occupied[r];
+    for (const Range& range : ranges[id]) {
+        // The first taken range ending after this one starts must start after it ends
+        auto next = std::upper_bound(taken.begin(), taken.end(), range.first,
+                                     [](uint32_t position, const Range& other) { return position < other.second; });
+        if (next != taken.end() && next->first < range.second) return false;
+    }
+    return true;
+}
+
+// First register above every value live across position: where a call
+// there can put its callee and arguments
+uint32_t FunctionLowering::callArea(uint32_t position) const {
+    uint32_t base = 0;
+    for (uint32_t r = 0; r < MAX_REGISTERS; ++r) {
+        const std::vector<Range>& taken = occupied[r];
+        auto next = std::upper_bound(taken.begin(), taken.end(), position,
+                                     [](uint32_t at, const Range& other) { return at < other.second; });
+        if (next != taken.end() && next->first <= position) base = r + 1;
+    }
+    return base;
+}
+
+// First fit over the values in order of definition, a value taking any
+// register none of whose values is live at the same time. A phi and the
+// values flowing into it share a register where their ranges allow, which
+// leaves no copy on that edge. A call's callee and arguments that die at
+// the call aim for the registers the call will read them from, and its
+// result for the register the call leaves it in.
+void FunctionLowering::allocate() {
+    std::vector<IrId> order;
+    std::vector<std::vector<IrId>> phiUsers(function.insts.size());
+    std::vector<std::pair<IrId, uint32_t>> callOperand(function.insts.size(), {IR_NONE, 0});
+    for (uint32_t b : layout)
+        for (IrId id : function.blocks[b].insts) {
+            const IrInst& inst = function.insts[id];
+            if (inRegister(id) || inst.op == IR_CALL) order.push_back(id);
+            if (inst.op == IR_PHI)
+                for (uint32_t i = 0; i < inst.count; ++i) phiUsers[function.operand(id, i)].push_back(id);
+            if (inst.op == IR_CALL)
+                for (uint32_t i = inst.count; i-- > 0;) {
+                    IrId value = function.operand(id, i);
+                    if (inRegister(value) && ranges[value].back().second == at[id]) callOperand[value] = {id, i};
+                }
+        }
+    std::stable_sort(order.begin(), order.end(), [&](IrId a, IrId b) { return at[a] < at[b]; });
+
+    reg.assign(function.insts.size(), NO_REGISTER);
+    callBase.assign(function.insts.size(), 0);
+    occupied.assign(MAX_REGISTERS, {});
+    frame = function.params;
+    for (IrId id : order) {
+        const IrInst& inst = function.insts[id];
+        if (inst.op == IR_CALL) {
+            uint32_t base = callArea(at[id]);
+            callBase[id] = base;
+            frame = std::max(frame, base + inst.count);
+            if (frame > MAX_REGISTERS) {
+                fail("call needs more than 256 registers");
+                return;
+            }
+        }
+        if (!inRegister(id)) continue;
+
+        uint32_t chosen = NO_REGISTER;
+        auto prefer = [&](uint32_t r) {
+            if (chosen == NO_REGISTER && r < MAX_REGISTERS && fits(id, r)) chosen = r;
+        };
+        if (inst.op == IR_PARAM) chosen = inst.index;
+        if (inst.op == IR_PHI)
+            for (uint32_t i = 0; i < inst.count; ++i) {
+                IrId value = function.operand(id, i);
+                if (reg[value] != NO_REGISTER) prefer(reg[value]);
+            }
+        for (IrId phi : phiUsers[id])
+            if (reg[phi] != NO_REGISTER) prefer(reg[phi]);
+        if (callOperand[id].first != IR_NONE) prefer(callArea(at[callOperand[id].first]) + callOperand[id].second);
+        if (inst.op == IR_CALL) prefer(callBase[id]);
+        for (uint32_t r = 0; r < MAX_REGISTERS && chosen == NO_REGISTER; ++r) prefer(r);
+        if (chosen == NO_REGISTER) {
+            fail("needs more than 256 registers");
+            return;
+        }
+        reg[id] = chosen;
+        std::vector<Range>& taken = occupied[chosen];
+        for (const Range& range : ranges[id])
+            taken.insert(std::upper_bound(taken.begin(), taken.end(), range), range);
+        maxRegister = std::max(maxRegister, chosen + 1);
+    }
+}
+
+// Scratch registers sit above every allocated one, for constants loaded
+// into an operand and for breaking a cycle of phi copies
+uint32_t FunctionLowering::scratch(uint32_t k) {
+    uint32_t r = maxRegister + k - 1;
+    if (r >= MAX_REGISTERS) {
+        fail("needs more than 256 registers");
+        return 0;
+    }
+    frame = std::max(frame, r + 1);
+    return r;
+}
+
+void FunctionLowering::load(IrId id, uint32_t target) {
+    const IrInst& inst = function.insts[id];
+    if (inst.op == IR_INT && inst.integer >= -SBX_BIAS && inst.integer <= 0xFFFF - SBX_BIAS) {
+        emit(encodeBx(OP_LOADI, target, static_cast<uint32_t>(inst.integer + SBX_BIAS)));
+        return;
+    }
+    switch (inst.op) {
+        case IR_INT: case IR_FLOAT: {
+            uint32_t index;
+            if (!pool.slot(inst.op == IR_INT ? Value::ofInt(inst.integer) : Value::ofReal(inst.real), index)) {
+                fail("more than 65536 constants");
+                return;
+            }
+            emit(encodeBx(OP_LOADK, target, index));
+            return;
+        }
+        case IR_UNDEF:
+            emit(encode(OP_CLEAR, target));
+            return;
+        case IR_GETGLOBAL:
+            if (sunk[id]) {
+                emit(encodeBx(OP_GETGLOBAL, target, inst.index));
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+    if (reg[id] != target) emit(encode(OP_MOVE, target, reg[id]));
+}
+
+// Register holding operand id, loading a constant into scratch k first
+uint32_t FunctionLowering::operand(IrId id, uint32_t k) {
+    if (inRegister(id)) return reg[id];
+    uint32_t r = scratch(k);
+    load(id, r);
+    return r;
+}
+
+// Register copies as if all at once: in an order that reads every source
+// before it is overwritten, going through temporary around a cycle
+void FunctionLowering::parallelMove(std::vector<std::pair<uint32_t, uint32_t>>& moves, uint32_t temporary) {
+    while (!moves.empty()) {
+        size_t ready = moves.size();
+        for (size_t i = 0; i < moves.size() && ready == moves.size(); ++i) {
+            bool read = false;
+            for (const auto& other : moves) read |= other.second == moves[i].first;
+            if (!read) ready = i;
+        }
+        if (ready < moves.size()) {
+            emit(encode(OP_MOVE, moves[ready].first, moves[ready].second));
+            moves.erase(moves.begin() + ready);
+            continue;
+        }
+        if (temporary >= MAX_REGISTERS) {
+            fail("needs more than 256 registers");
+            return;
+        }
+        frame = std::max(frame, temporary + 1);
+        uint32_t saved = moves[0].first;
+        emit(encode(OP_MOVE, temporary, saved));
+        for (auto& move : moves)
+            if (move.second == saved) move.second = temporary;
+    }
+}
+
+// The phis of to take their values from the edge out of from: the
+// register copies, then the constants
+void FunctionLowering::copies(uint32_t from, uint32_t to) {
+    const IrBlock& target = function.blocks[to];
+    uint32_t k = static_cast<uint32_t>(std::find(target.preds.begin(), target.preds.end(), from) - target.preds.begin());
+    std::vector<std::pair<uint32_t, uint32_t>> moves;   // Destination, source
+    std::vector<std::pair<uint32_t, IrId>> constants;
+    for (IrId id : target.insts) {
+        if (function.insts[id].op != IR_PHI) break;
+        IrId value = function.operand(id, k);
+        if (!inRegister(value)) constants.emplace_back(reg[id], value);
+        else if (reg[value] != reg[id]) moves.emplace_back(reg[id], reg[value]);
+    }
+    parallelMove(moves, maxRegister);
+    for (const auto& constant : constants) load(constant.second, constant.first);
+}
+
+void FunctionLowering::instruction(IrId id, uint32_t next) {
+    const IrInst& inst = function.insts[id];
+    const IrBlock& block = function.blocks[inst.block];
+    switch (inst.op) {
+        case IR_NOP: case IR_INT: case IR_FLOAT: case IR_UNDEF: case IR_PARAM: case IR_PHI:
+            return;
+        case IR_GETGLOBAL:
+            if (!sunk[id]) emit(encodeBx(OP_GETGLOBAL, reg[id], inst.index));
+            return;
+        case IR_SETGLOBAL:
+            emit(encodeBx(OP_SETGLOBAL, operand(function.operand(id, 0), 1), inst.index));
+            return;
+        case IR_CHECK:
+            emit(encodeBx(OP_CHECK, operand(function.operand(id, 0), 1), inst.index));
+            return;
+        case IR_NEG: case IR_NOT: case IR_BNOT: {
+            Opcode op = static_cast<Opcode>(OP_NEG + (inst.op - IR_NEG));
+            emit(encode(op, reg[id], operand(function.operand(id, 0), 1)));
+            return;
+        }
+        case IR_CALL: {
+            // Operands that die here may already sit in the area, in any order
+            uint32_t base = callBase[id];
+            std::vector<std::pair<uint32_t, uint32_t>> moves;
+            for (uint32_t i = 0; i < inst.count; ++i) {
+                IrId value = function.operand(id, i);
+                if (inRegister(value) && reg[value] != base + i) moves.emplace_back(base + i, reg[value]);
+            }
+            parallelMove(moves, base + inst.count);
+            for (uint32_t i = 0; i < inst.count; ++i)
+                if (!inRegister(function.operand(id, i))) load(function.operand(id, i), base + i);
+            emit(encode(OP_CALL, base, inst.count - 1));
+            if (reg[id] != NO_REGISTER && reg[id] != base) emit(encode(OP_MOVE, reg[id], base));
+            return;
+        }
+        case IR_JUMP: {
+            uint32_t succ = block.succs[0];
+            copies(inst.block, succ);
+            if (succ != next) fixups.emplace_back(emit(encodeBx(OP_JMP, 0, SBX_BIAS)), succ);
+            return;
+        }
+        case IR_BRANCH: {
+            uint32_t condition = operand(function.operand(id, 0), 1);
+            uint32_t whenTrue = block.succs[0], whenFalse = block.succs[1];
+            if (whenTrue == next) {
+                fixups.emplace_back(emit(encodeBx(OP_JMPF, condition, SBX_BIAS)), whenFalse);
+            } else if (whenFalse == next) {
+                fixups.emplace_back(emit(encodeBx(OP_JMPT, condition, SBX_BIAS)), whenTrue);
+            } else {
+                fixups.emplace_back(emit(encodeBx(OP_JMPF, condition, SBX_BIAS)), whenFalse);
+                fixups.emplace_back(emit(encodeBx(OP_JMP, 0, SBX_BIAS)), whenTrue);
+            }
+            return;
+        }
+        case IR_RET:
+            emit(encode(OP_RET, operand(function.operand(id, 0), 1)));
+            return;
+        case IR_RET0:
+            emit(encode(OP_RET0, 0));
+            return;
+        default:
+            break;
+    }
+
+    // Binary: ADDI for a small int on either side of an add, or on the
+    // right of a subtract
+    IrId left = function.operand(id, 0), right = function.operand(id, 1);
+    uint32_t step;
+    if (inst.op == IR_ADD && !smallStep(function.insts[right], false, step) && smallStep(function.insts[left], false, step))
+        std::swap(left, right);
+    if ((inst.op == IR_ADD || inst.op == IR_SUB) && smallStep(function.insts[right], inst.op == IR_SUB, step)) {
+        emit(encode(OP_ADDI, reg[id], operand(left, 1), step));
+        return;
+    }
+    Opcode op = static_cast<Opcode>(OP_ADD + (inst.op - IR_ADD));
+    uint32_t a = operand(left, 1);
+    uint32_t b = operand(right, inRegister(left) ? 1 : 2);
+    emit(encode(op, reg[id], a, b));
+}
+
+bool FunctionLowering::lower() {
+    removeUnreachable(function);
+    compactBlocks(function);
+    splitEdges();
+    number();
+    sinkGlobals();
+    liveRanges();
+    allocate();
+    if (!ok) return false;
+
+    out.name = function.name;
+    out.params = function.params;
+    out.locals = function.locals;
+    blockPc.assign(function.blocks.size(), 0);
+    for (size_t i = 0; i < layout.size(); ++i) {
+        uint32_t b = layout[i];
+        uint32_t next = i + 1 < layout.size() ? layout[i + 1] : NO_REGISTER;
+        blockPc[b] = static_cast<uint32_t>(out.code.size());
+        for (IrId id : function.blocks[b].insts) instruction(id, next);
+    }
+    for (const auto& fixup : fixups) {
+        int64_t offset = static_cast<int64_t>(blockPc[fixup.second]) - (static_cast<int64_t>(fixup.first) + 1);
+        if (offset < -SBX_BIAS || offset > 0xFFFF - SBX_BIAS) {
+            fail("jump too long");
+            break;
+        }
+        uint32_t& ins = out.code[fixup.first];
+        ins = encodeBx(opcodeOf(ins), argA(ins), static_cast<uint32_t>(offset + SBX_BIAS));
+    }
+    out.registers = std::max(frame, maxRegister);
+    return ok;
+}
+
+bool lowerModule(const IrModule& module, Program& program, std::vector<std::string>& errors) {
+    program = Program();
+    program.globals = module.globals;
+    program.functionSlots = module.functionSlots;
+    program.functions.resize(module.functions.size());
+    ConstantPool pool(program);
+    bool ok = true;
+    for (size_t i = 0; i < module.functions.size(); ++i) {
+        FunctionLowering lowering(module.functions[i], program.functions[i], pool, errors);
+        ok &= lowering.lower();
+    }
+    if (module.globals.size() > 0x10000) {
+        errors.push_back("more than 65536 globals");
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,76 @@
+#include "operators.hpp"
+#include <cstring>
+
+OperatorTable::OperatorTable() {
+    const struct { TokenType type; uint8_t power; uint8_t flags; } table[] = {
+        {TT_EQUAL, P_ASSIGN, B_RIGHT | B_ASSIGN},
+        {TT_IADD, P_ASSIGN, B_RIGHT | B_ASSIGN}, {TT_ISUB, P_ASSIGN, B_RIGHT | B_ASSIGN},
+        {TT_IMUL, P_ASSIGN, B_RIGHT | B_ASSIGN}, {TT_IDIV, P_ASSIGN, B_RIGHT | B_ASSIGN},
+        {TT_IMOD, P_ASSIGN, B_RIGHT | B_ASSIGN}, {TT_IAT, P_ASSIGN, B_RIGHT | B_ASSIGN},
+        {TT_IAND, P_ASSIGN, B_RIGHT | B_ASSIGN}, {TT_IOR, P_ASSIGN, B_RIGHT | B_ASSIGN},
+        {TT_IXOR, P_ASSIGN, B_RIGHT | B_ASSIGN}, {TT_LARROW, P_ASSIGN, B_RIGHT | B_ASSIGN},
+
+        {TT_OR, P_OR, 0}, {TT_AND, P_AND, 0},
+        {TT_PIPE, P_BITOR, 0}, {TT_CARET, P_BITXOR, 0}, {TT_AMPERSAND, P_BITAND, 0},
+        {TT_EQ, P_EQUALITY, 0}, {TT_NEQ, P_EQUALITY, 0},
+        {TT_LT, P_COMPARISON, 0}, {TT_GT, P_COMPARISON, 0},
+        {TT_LE, P_COMPARISON, 0}, {TT_GE, P_COMPARISON, 0},
+        {TT_LSHIFT, P_SHIFT, 0}, {TT_RSHIFT, P_SHIFT, 0},
+        {TT_PLUS, P_TERM, 0}, {TT_MINUS, P_TERM, 0},
+        {TT_STAR, P_FACTOR, 0}, {TT_SLASH, P_FACTOR, 0},
+        {TT_PERCENT, P_FACTOR, 0}, {TT_AT, P_FACTOR, 0},
+        {TT_LPAREN, P_CALL, 0},
+        {TT_DOT, P_MEMBER, 0}, {TT_RARROW, P_MEMBER, 0},
+    };
+    for (const auto& entry : table) infixes[entry.type] = Binding {entry.power, entry.flags};
+
+    prefixes[TT_MINUS] = P_PREFIX;
+    prefixes[TT_PLUS] = P_PREFIX;
+    prefixes[TT_EXCL] = P_PREFIX;
+    prefixes[TT_TILDE] = P_PREFIX;
+};
+
+const OperatorTable& OperatorTable::builtin() {
+    static const OperatorTable table;
+    return table;
+}
+
+bool OperatorTable::define(std::string_view text, Binding infix, uint8_t prefix) {
+    if (text.empty()) return false;
+    for (char c : text)
+        if (!(charClassDict[static_cast<uint8_t>(c)] & CC_OPERATOR)) return false;
+
+    int32_t index = find(text.data(), static_cast<uint32_t>(text.size()));
+    if (index >= 0) {
+        customs[index].infix = infix;
+        customs[index].prefix = prefix;
+    } else {
+        customs.push_back(Custom {std::string(text), infix, prefix});
+    }
+    return true;
+}
+
+uint64_t OperatorTable::fingerprint() const {
+    std::string bytes;
+    for (size_t type = 0; type < TOKEN_TYPES; ++type) {
+        bytes += static_cast<char>(infixes[type].power);
+        bytes += static_cast<char>(infixes[type].flags);
+        bytes += static_cast<char>(prefixes[type]);
+    }
+    for (const Custom& custom : customs) {
+        bytes += custom.text;
+        bytes += '\0';
+        bytes += static_cast<char>(custom.infix.power);
+        bytes += static_cast<char>(custom.infix.flags);
+        bytes += static_cast<char>(custom.prefix);
+    }
+    return hashSymbol(bytes.data(), static_cast<uint32_t>(bytes.size()));
+}
+
+int32_t OperatorTable::find(const char* text, uint32_t length) const {
+    for (size_t i = 0; i < customs.size(); ++i) {
+        const std::string& name = customs[i].text;
+        if (name.size() == length && memcmp(name.data(), text, length) == 0) return static_cast<int32_t>(i);
+    }
+    return -1;
+}
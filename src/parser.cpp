@@ -1,46 +1,410 @@
 #include "parser.hpp"
 #include "lexer.hpp"
+#include <memory>
 
-Parser::Parser(const std::vector<Token>& tokens, const std::string& reference) : toks(tokens), source(reference.data()) {
-    begin = toks.data();
+Parser::Parser(const TokenStream& tokens, const std::string& reference) : toks(tokens), source(reference.data()) {
+    operators = &OperatorTable::builtin();
+    begin = toks.begin();
     current = begin;
-    end = toks.data() + toks.size();
-    nodes.reserve(1024);
+    end = toks.end();
+    pending.reserve(256);
+    diagnostics.reserve(MAX_DIAGNOSTICS);
 };
 
+Parser::Parser(const Parser& parent, size_t from, size_t to) : toks(parent.toks), source(parent.source) {
+    operators = parent.operators;
+    begin = toks.begin();
+    current = begin + from;
+    end = begin + to;
+    pending.reserve(256);
+    diagnostics.reserve(MAX_DIAGNOSTICS);
+};
+
+void Parser::setOperators(const OperatorTable* table) {
+    operators = table ? table : &OperatorTable::builtin();
+}
+
+NodeId Parser::finishNode(NodeType type, uint64_t payload, size_t mark) {
+    uint32_t count = static_cast<uint32_t>(pending.size() - mark);
+    NodeId node = arena.create(type, payload, pending.data() + mark, count);
+    pending.resize(mark);
+    return node;
+}
+
+void Parser::endStatement() {
+    if (match(TT_NEWLINE)) return;
+    TokenType type = peek();
+    if (type == TT_DEDENT || type == TT_EOF) return;
+    report(DIAG_UNEXPECTED_TOKEN);
+    synchronize();
+}
+
+const char* diagnosticMessage(DiagnosticId id) {
+    switch (id) {
+        case DIAG_INDENT: return "unindent does not match any outer indentation level";
+        case DIAG_UNEXPECTED_INDENT: return "unexpected indent";
+        case DIAG_UNEXPECTED_TOKEN: return "unexpected token after statement";
+        case DIAG_EXPECTED_EXPRESSION: return "expected an expression";
+        case DIAG_EXPECTED_NAME: return "expected a name";
+        case DIAG_EXPECTED_LPAREN: return "expected '('";
+        case DIAG_EXPECTED_RPAREN: return "expected ')'";
+        case DIAG_EXPECTED_BLOCK: return "expected an indented block";
+        case DIAG_UNKNOWN_OPERATOR: return "unknown operator";
+        case DIAG_NUMBER_RANGE: return "number literal out of range";
+        case DIAG_CHAR_LITERAL: return "char literal must hold exactly one character";
+    }
+    return "unknown error";
+}
+
+uint32_t Parser::here() const {
+    if (current != end) return current.offset();
+    return current != begin ? (current - 1).offset() : 0;
+}
+
+void Parser::report(DiagnosticId id, uint32_t offset) {
+    // Later errors in the same statement are usually fallout of the first
+    if (panicking) return;
+    panicking = true;
+    if (diagnostics.size() < MAX_DIAGNOSTICS) diagnostics.push_back(Diagnostic {offset, id});
+    else ++droppedDiagnostics;
+}
+
+NodeId Parser::error(DiagnosticId id) {
+    uint32_t offset = here();
+    report(id, offset);
+    return arena.create(AST_ERROR, offset);
+}
+
+// Skip the rest of the line. A block it opened is left for parseLine.
+void Parser::synchronize() {
+    PROFILE_ONLY(TokenStream::Iterator from = current;)
+    while (current != end && current.type() != TT_NEWLINE && current.type() != TT_DEDENT && current.type() != TT_EOF)
+        ++current;
+    PROFILE_ONLY(counters.skipped += current - from;)
+    if (match(TT_NEWLINE) && peek() == TT_INDENT) orphanBlock = true;
+}
+
 NodeId Parser::parse() {
-    NodeId unit = parseDeclaration();
-    
-    while (current != end && current->type != TT_EOF) {
-        NodeId statement = parseDeclaration();
-        unit = createNode(AST_BLOCK, unit, statement);
+    PROFILE_PHASE("parse");
+    size_t mark = pending.size();
+    parseDeclarations();
+    NodeId root = finishNode(AST_BLOCK, 0, mark);
+    PROFILE_ONLY(publishCounters();)
+    return root;
+}
+
+#if LIGHTNING_PROFILE
+// Node types are counted from the arena at the end, not per node
+void Parser::publishCounters() {
+    arena.countTypes(counters.nodes);
+    counters.arenaBytes = arena.bytes();
+    if (Profiler* profiler = Profiler::active()) profiler->add(counters);
+    counters = ParserCounters();
+}
+#endif
+
+void Parser::parseDeclarations() {
+    while (current != end && current.type() != TT_EOF) {
+        // The lexer closes the base indentation level at EOF too
+        if (match(TT_NEWLINE) || match(TT_DEDENT)) continue;
+        pending.push_back(parseLine(true));
     }
+}
 
-    return unit;
+NodeId Parser::parseLine(bool topLevel) {
+    panicking = false;
+    if (peek() == TT_ERROR) {
+        report(DIAG_INDENT);
+        ++current;
+        panicking = false;
+    }
+
+    if (peek() == TT_INDENT) {
+        // Still parse the block, to report the errors inside it
+        uint32_t offset = current.offset();
+        if (!orphanBlock) report(DIAG_UNEXPECTED_INDENT);
+        orphanBlock = false;
+        NodeId block = parseBlock();
+        return arena.create(AST_ERROR, offset, {block});
+    }
+    orphanBlock = false;
+
+    return topLevel ? parseDeclaration() : parseStatement();
+}
+
+NodeId Parser::parseParallel(ThreadPool& workers, size_t chunkTokens) {
+    PROFILE_PHASE("parse-parallel");
+    // Cut where a declaration starts at depth 0: after a NEWLINE at depth 0
+    // or a DEDENT back to it, unless a block or else branch follows
+    const uint8_t* types = toks.typeData();
+    size_t from = current.position();
+    size_t to = end.position();
+    std::vector<size_t> cuts {from};
+    int depth = 0;
+    for (size_t i = from; i + 1 < to; ++i) {
+        uint8_t type = types[i];
+        if (type == TT_INDENT) ++depth;
+        else if (type == TT_DEDENT) --depth;
+        else if (type != TT_NEWLINE) continue;
+
+        uint8_t next = types[i + 1];
+        if (depth != 0 || i + 1 - cuts.back() < chunkTokens) continue;
+        if (next == TT_INDENT || next == TT_DEDENT || next == TT_ELSE || next == TT_ELIF) continue;
+        cuts.push_back(i + 1);
+    }
+    cuts.push_back(to);
+
+    struct Part {
+        std::unique_ptr<Parser> parser;
+        uint32_t firstChunk;
+    };
+    std::vector<Part> parts(cuts.size() - 1);
+
+    workers.run(parts.size(), [&](size_t k) {
+        PROFILE_PHASE("parse-chunk");
+        parts[k].parser.reset(new Parser(*this, cuts[k], cuts[k + 1]));
+        parts[k].parser->parseDeclarations();
+    });
+
+    // Place each worker's chunks after the ones before it, then rewrite
+    // their ids in parallel
+    uint32_t chunk = arena.chunkCount();
+    for (Part& part : parts) {
+        part.firstChunk = chunk;
+        chunk += part.parser->arena.chunkCount();
+    }
+    workers.run(parts.size(), [&](size_t k) {
+        parts[k].parser->arena.relocate(parts[k].firstChunk);
+    });
+
+    size_t mark = pending.size();
+    for (Part& part : parts) {
+        arena.adopt(part.parser->arena);
+        for (NodeId declaration : part.parser->pending)
+            pending.push_back(AstArena::relocated(declaration, part.firstChunk));
+        for (const Diagnostic& diagnostic : part.parser->diagnostics) {
+            if (diagnostics.size() < MAX_DIAGNOSTICS) diagnostics.push_back(diagnostic);
+            else ++droppedDiagnostics;
+        }
+        droppedDiagnostics += part.parser->droppedDiagnostics;
+        PROFILE_ONLY(counters.merge(part.parser->counters);)
+    }
+    current = end;
+    NodeId root = finishNode(AST_BLOCK, 0, mark);
+    PROFILE_ONLY(publishCounters();)
+    return root;
 }
 
 NodeId Parser::parseDeclaration() {
-    const Token* ahead = current + 1;
-    if (ahead == end) return parseStatement();
-    else if (ahead->type == TT_LPAREN) return parseFunction();
-    else if (ahead->type == TT_ASSIGNOP) return parseAssignment();
-    else return parseStatement();
+    if (peek() == TT_DEF) return parseFunction();
+
+    // name(args): also opens a function
+    TokenStream::Iterator ahead = current + 1;
+    if (peek() == TT_IDENT && ahead != end && ahead.type() == TT_LPAREN) {
+        size_t close = toks.matchBracket(ahead.position());
+        PROFILE_ONLY(counters.lookahead += close - ahead.position();)
+        if (close + 1 < toks.size() && toks.type(close + 1) == TT_COLON) return parseFunction();
+    }
+    return parseStatement();
 }
 
 NodeId Parser::parseFunction() {
-    node.nameOffset = current->offset;
-    node.nameLength = current->length;
+    match(TT_DEF);
+
+    symbol_t name = peek() == TT_IDENT ? current.lexeme() : 0;
+    expect(TT_IDENT, DIAG_EXPECTED_NAME);
+    expect(TT_LPAREN, DIAG_EXPECTED_LPAREN);
+
+    size_t mark = pending.size();
+    while (peek() == TT_IDENT) {
+        symbol_t arg = current.lexeme();
+        ++current;
+        size_t argMark = pending.size();
+        if (match(TT_COLON) && peek() == TT_IDENT) {
+            pending.push_back(arena.create(AST_TYPE, current.lexeme()));
+            ++current;
+        }
+        pending.push_back(finishNode(AST_ARG, arg, argMark));
+        if (!match(TT_COMMA)) break;
+    }
+    expect(TT_RPAREN, DIAG_EXPECTED_RPAREN);
+
+    pending.push_back(parseBody());
+    return finishNode(AST_FUNCDEF, name, mark);
+}
+
+NodeId Parser::parseStatement() {
+    switch (peek()) {
+        case TT_IF: return parseIf();
+        case TT_WHILE: return parseWhile();
+        case TT_RETURN: return parseReturn();
+        case TT_IMPORT: return parseImport();
+        default: break;
+    }
+
+    NodeId expression = parseExpression();
+    endStatement();
+    return expression;
+}
+
+// ':' then an indented block, or a single statement on the same line
+NodeId Parser::parseBody() {
+    match(TT_COLON);
+    uint32_t offset = here();
+    if (match(TT_NEWLINE)) {
+        if (peek() != TT_INDENT) report(DIAG_EXPECTED_BLOCK, offset);
+        return parseBlock();
+    }
+
+    size_t mark = pending.size();
+    pending.push_back(parseStatement());
+    return finishNode(AST_BLOCK, 0, mark);
+}
+
+NodeId Parser::parseBlock() {
+    size_t mark = pending.size();
+    if (!match(TT_INDENT)) return finishNode(AST_BLOCK, 0, mark);
+
+    while (current != end && current.type() != TT_DEDENT && current.type() != TT_EOF) {
+        if (match(TT_NEWLINE)) continue;
+        pending.push_back(parseLine(false));
+    }
+    match(TT_DEDENT);
+
+    return finishNode(AST_BLOCK, 0, mark);
+}
+
+NodeId Parser::parseIf() {
+    ++current;  // if, or elif
+    size_t mark = pending.size();
+    pending.push_back(parseExpression());
+    pending.push_back(parseBody());
+
+    if (peek() == TT_ELIF) {
+        pending.push_back(parseIf());
+    } else if (peek() == TT_ELSE) {
+        ++current;
+        pending.push_back(parseBody());
+    }
+    return finishNode(AST_IF, 0, mark);
+}
+
+NodeId Parser::parseWhile() {
+    ++current;
+    size_t mark = pending.size();
+    pending.push_back(parseExpression());
+    pending.push_back(parseBody());
+    return finishNode(AST_WHILE, 0, mark);
+}
+
+NodeId Parser::parseReturn() {
     ++current;
+    size_t mark = pending.size();
+    TokenType type = peek();
+    if (type != TT_NEWLINE && type != TT_DEDENT && type != TT_EOF) pending.push_back(parseExpression());
+    endStatement();
+    return finishNode(AST_RETURN, 0, mark);
+}
+
+// import a.b.c
+NodeId Parser::parseImport() {
     ++current;
-    const Token* ahead = current + 1;
-    Argument arg;
-    while (ahead != end && current->type == TT_IDENT && ahead->type == TT_PUNCT) {
-        arg.nameOffset = current->offset;
-        arg.nameLength = current->length;
+    size_t mark = pending.size();
+    uint32_t offset = here();
+    do {
+        if (peek() != TT_IDENT) {
+            report(DIAG_EXPECTED_NAME);
+            break;
+        }
+        pending.push_back(arena.create(AST_IDENT, current.lexeme()));
+        ++current;
+    } while (match(TT_DOT));
+    endStatement();
+    return finishNode(AST_IMPORT, offset, mark);
+}
+
+NodeId Parser::parseExpression(uint8_t minPower) {
+    NodeId left = parsePrefix();
+
+    for (;;) {
+        TokenType op = peek();
+        Binding binding = operators->infix(op);
+        uint32_t custom = 0;
+        if (op == TT_CUSTOM_OP) {
+            int32_t index = operators->find(source + current.offset(), current.length());
+            if (index < 0) {
+                report(DIAG_UNKNOWN_OPERATOR);
+                break;
+            }
+            custom = static_cast<uint32_t>(index);
+            binding = operators->customInfix(custom);
+        }
+        if (binding.power < minPower) break;
+
+        if (op == TT_LPAREN) {
+            left = parseCall(left);
+            continue;
+        }
+
         ++current;
-        const char punct = source[ahead->offset];
-        if (punct == ',') {
-            
+        NodeId right = parseExpression(binding.flags & B_RIGHT ? binding.power : binding.power + 1);
+        NodeType type = binding.flags & B_ASSIGN ? AST_ASSIGN : AST_BINARY;
+        left = arena.create(type, operatorPayload(op, custom), {left, right});
+    }
+    return left;
+}
+
+NodeId Parser::parsePrefix() {
+    TokenType op = peek();
+    uint8_t power = operators->prefix(op);
+    uint32_t custom = 0;
+    if (op == TT_CUSTOM_OP) {
+        int32_t index = operators->find(source + current.offset(), current.length());
+        if (index < 0) return error(DIAG_UNKNOWN_OPERATOR);
+        custom = static_cast<uint32_t>(index);
+        power = operators->customPrefix(custom);
+    }
+    if (power == P_NONE) return parsePrimary();
+
+    ++current;
+    return arena.create(AST_UNARY, operatorPayload(op, custom), {parseExpression(power)});
+}
+
+NodeId Parser::parsePrimary() {
+    NodeId node;
+    switch (peek()) {
+        case TT_IDENT:
+            node = arena.create(AST_IDENT, current.lexeme());
+            break;
+        case TT_NUMBER:
+        case TT_CHAR: {
+            uint16_t flags = toks.constant(current.position()).flags;
+            if (flags & K_OVERFLOW) report(DIAG_NUMBER_RANGE);
+            if (flags & K_INVALID) report(DIAG_CHAR_LITERAL);
+            node = arena.create(AST_NUMBER, current.lexeme());
+            break;
         }
+        case TT_LPAREN:
+            ++current;
+            node = parseExpression();
+            expect(TT_RPAREN, DIAG_EXPECTED_RPAREN);
+            return node;
+        default:
+            // Left for the statement level to skip
+            return error(DIAG_EXPECTED_EXPRESSION);
     }
-}
\ No newline at end of file
+    ++current;
+    return node;
+}
+
+NodeId Parser::parseCall(NodeId callee) {
+    ++current;
+    size_t mark = pending.size();
+    pending.push_back(callee);
+    while (peek() != TT_RPAREN && peek() != TT_NEWLINE && peek() != TT_EOF) {
+        pending.push_back(parseExpression());
+        if (!match(TT_COMMA)) break;
+    }
+    expect(TT_RPAREN, DIAG_EXPECTED_RPAREN);
+    return finishNode(AST_FUNCCALL, 0, mark);
+}
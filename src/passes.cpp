@@ -0,0 +1,601 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include "profile.hpp"
+
+static const char* passNames[IR_PASSES] = {"fold", "simplify", "cse", "dce"};
+
+const char* passName(IrPass pass) {
+    return pass < IR_PASSES ? passNames[pass] : "?";
+}
+
+void PassStats::merge(const PassStats& other) {
+    for (int i = 0; i < IR_PASSES; ++i) {
+        nanos[i] += other.nanos[i];
+        changes[i] += other.changes[i];
+    }
+}
+
+// What a value can be at run time. NONE is the optimistic start, for
+// values not reached yet; one left over after inference is treated as ANY.
+enum ValueKind : uint8_t { KIND_NONE, KIND_INT, KIND_FLOAT, KIND_NUM, KIND_ANY };
+
+static ValueKind join(ValueKind a, ValueKind b) {
+    if (a == KIND_NONE || a == b) return b;
+    if (b == KIND_NONE) return a;
+    return a != KIND_ANY && b != KIND_ANY ? KIND_NUM : KIND_ANY;
+}
+
+static bool isNumber(ValueKind kind) { return kind == KIND_INT || kind == KIND_FLOAT || kind == KIND_NUM; }
+
+// Arithmetic gives a number when it doesn't trap: an int from two ints,
+// a float as soon as one side is a float
+static ValueKind arithmetic(ValueKind a, ValueKind b) {
+    if (a == KIND_NONE || b == KIND_NONE) return KIND_NONE;
+    if (a == KIND_FLOAT || b == KIND_FLOAT) return KIND_FLOAT;
+    return a == KIND_INT && b == KIND_INT ? KIND_INT : KIND_NUM;
+}
+
+static ValueKind transfer(const IrFunction& function, IrId id, const std::vector<ValueKind>& kinds) {
+    const IrInst& inst = function.insts[id];
+    auto in = [&](uint32_t i) { return kinds[function.operand(id, i)]; };
+    switch (inst.op) {
+        case IR_INT: return KIND_INT;
+        case IR_FLOAT: return KIND_FLOAT;
+        case IR_PHI: {
+            ValueKind kind = KIND_NONE;
+            for (uint32_t i = 0; i < inst.count; ++i) kind = join(kind, in(i));
+            return kind;
+        }
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_MOD:
+            return arithmetic(in(0), in(1));
+        case IR_NEG:
+            return in(0) == KIND_NONE ? KIND_NONE : isNumber(in(0)) ? in(0) : KIND_NUM;
+        case IR_BAND: case IR_BOR: case IR_BXOR: case IR_SHL: case IR_SHR:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_NOT: case IR_BNOT:
+            return KIND_INT;
+        default:
+            return KIND_ANY;
+    }
+}
+
+// Optimistic fixed point over the reachable blocks
+static std::vector<ValueKind> inferKinds(const IrFunction& function, const std::vector<uint32_t>& order) {
+    std::vector<ValueKind> kinds(function.insts.size(), KIND_NONE);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (uint32_t b : order)
+            for (IrId id : function.blocks[b].insts) {
+                if (!producesValue(function.insts[id].op)) continue;
+                ValueKind kind = transfer(function, id, kinds);
+                if (kind != kinds[id]) {
+                    kinds[id] = kind;
+                    changed = true;
+                }
+            }
+    }
+    for (ValueKind& kind : kinds)
+        if (kind == KIND_NONE) kind = KIND_ANY;
+    return kinds;
+}
+
+static bool isConstant(const IrInst& inst) { return inst.op == IR_INT || inst.op == IR_FLOAT; }
+
+// Whether running id could stop the program or change something another
+// instruction sees
+static bool hasEffect(const IrFunction& function, IrId id, const std::vector<ValueKind>& kinds) {
+    const IrInst& inst = function.insts[id];
+    auto in = [&](uint32_t i) { return kinds[function.operand(id, i)]; };
+    switch (inst.op) {
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_LT: case IR_LE:
+            return !isNumber(in(0)) || !isNumber(in(1));
+        case IR_DIV: case IR_MOD: {
+            const IrInst& divisor = function.insts[function.operand(id, 1)];
+            bool nonzero = in(1) == KIND_FLOAT || (divisor.op == IR_INT && divisor.integer != 0);
+            return !isNumber(in(0)) || !nonzero;
+        }
+        case IR_BAND: case IR_BOR: case IR_BXOR: case IR_SHL: case IR_SHR:
+            return in(0) != KIND_INT || in(1) != KIND_INT;
+        case IR_NEG: return !isNumber(in(0));
+        case IR_BNOT: return in(0) != KIND_INT;
+        case IR_INT: case IR_FLOAT: case IR_UNDEF: case IR_PARAM: case IR_PHI:
+        case IR_EQ: case IR_NE: case IR_NOT:
+            return false;
+        default:
+            return true;    // Globals, calls and terminators
+    }
+}
+
+// Values replaced during a pass. Operands are redirected as they are met,
+// and once more over the whole function at the end of the pass, for the
+// phi operands that come in along back edges.
+struct Rewrites {
+    std::vector<IrId> forward;
+
+    IrId resolve(IrId id) const {
+        while (id < forward.size() && forward[id] != IR_NONE) id = forward[id];
+        return id;
+    }
+    void replace(IrFunction& function, IrId id, IrId with) {
+        if (forward.size() < function.insts.size()) forward.resize(function.insts.size(), IR_NONE);
+        forward[id] = with;
+        function.insts[id].op = IR_NOP;
+    }
+    void redirect(IrFunction& function, IrId id) const {
+        IrInst& inst = function.insts[id];
+        for (uint32_t i = 0; i < inst.count; ++i) function.operands[inst.first + i] = resolve(function.operands[inst.first + i]);
+    }
+    void finish(IrFunction& function) const {
+        for (const IrBlock& block : function.blocks)
+            for (IrId id : block.insts)
+                if (function.insts[id].op != IR_NOP) redirect(function, id);
+        compactBlocks(function);
+    }
+};
+
+static void makeInt(IrInst& inst, int64_t value) {
+    inst.op = IR_INT;
+    inst.count = 0;
+    inst.integer = value;
+}
+
+static void makeReal(IrInst& inst, double value) {
+    inst.op = IR_FLOAT;
+    inst.count = 0;
+    inst.real = value;
+}
+
+static bool truthy(const IrInst& constant) {
+    return constant.op == IR_INT ? constant.integer != 0 : constant.real != 0;
+}
+
+// Same results as the VM's handlers; false where the VM would stop
+static bool evaluate(IrOp op, const IrInst& b, const IrInst* c, IrInst& out) {
+    if (!c) {
+        switch (op) {
+            case IR_NEG:
+                if (b.op == IR_INT) makeInt(out, static_cast<int64_t>(0 - static_cast<uint64_t>(b.integer)));
+                else makeReal(out, -b.real);
+                return true;
+            case IR_NOT: makeInt(out, !truthy(b)); return true;
+            case IR_BNOT:
+                if (b.op != IR_INT) return false;
+                makeInt(out, ~b.integer);
+                return true;
+            default: return false;
+        }
+    }
+    if (b.op == IR_INT && c->op == IR_INT) {
+        uint64_t x = static_cast<uint64_t>(b.integer), y = static_cast<uint64_t>(c->integer);
+        int64_t value;
+        switch (op) {
+            case IR_ADD: value = static_cast<int64_t>(x + y); break;
+            case IR_SUB: value = static_cast<int64_t>(x - y); break;
+            case IR_MUL: value = static_cast<int64_t>(x * y); break;
+            case IR_DIV:
+                if (!y) return false;
+                value = c->integer == -1 ? static_cast<int64_t>(0 - x) : b.integer / c->integer;
+                break;
+            case IR_MOD:
+                if (!y) return false;
+                value = c->integer == -1 ? 0 : b.integer % c->integer;
+                break;
+            case IR_BAND: value = static_cast<int64_t>(x & y); break;
+            case IR_BOR: value = static_cast<int64_t>(x | y); break;
+            case IR_BXOR: value = static_cast<int64_t>(x ^ y); break;
+            case IR_SHL: value = static_cast<int64_t>(x << (y & 63)); break;
+            case IR_SHR: value = b.integer >> (y & 63); break;
+            case IR_EQ: value = x == y; break;
+            case IR_NE: value = x != y; break;
+            case IR_LT: value = b.integer < c->integer; break;
+            case IR_LE: value = b.integer <= c->integer; break;
+            default: return false;
+        }
+        makeInt(out, value);
+        return true;
+    }
+    double x = b.op == IR_INT ? static_cast<double>(b.integer) : b.real;
+    double y = c->op == IR_INT ? static_cast<double>(c->integer) : c->real;
+    switch (op) {
+        case IR_ADD: makeReal(out, x + y); return true;
+        case IR_SUB: makeReal(out, x - y); return true;
+        case IR_MUL: makeReal(out, x * y); return true;
+        case IR_DIV: makeReal(out, x / y); return true;
+        case IR_MOD: makeReal(out, std::fmod(x, y)); return true;
+        case IR_EQ: makeInt(out, x == y); return true;
+        case IR_NE: makeInt(out, x != y); return true;
+        case IR_LT: makeInt(out, x < y); return true;
+        case IR_LE: makeInt(out, x <= y); return true;
+        default: return false;
+    }
+}
+
+static bool sameConstant(const IrInst& a, const IrInst& b) {
+    if (a.op != b.op) return false;
+    return a.op == IR_INT ? a.integer == b.integer : !memcmp(&a.real, &b.real, sizeof(double));
+}
+
+uint32_t foldConstants(IrFunction& function) {
+    Rewrites rewrites;
+    uint32_t changes = 0;
+    for (uint32_t b : reversePostorder(function)) {
+        std::vector<IrId> insts = function.blocks[b].insts;
+        for (IrId id : insts) {
+            if (function.insts[id].op == IR_NOP) continue;
+            rewrites.redirect(function, id);
+            IrInst& inst = function.insts[id];
+            if (inst.op == IR_PHI) {
+                // One value on every edge, not counting the phi itself
+                IrId only = IR_NONE;
+                bool trivial = true, constants = true;
+                for (uint32_t i = 0; i < inst.count && (trivial || constants); ++i) {
+                    IrId value = function.operand(id, i);
+                    if (value == id) continue;
+                    if (only == IR_NONE) only = value;
+                    if (value != only) trivial = false;
+                    if (!isConstant(function.insts[value]) || !sameConstant(function.insts[value], function.insts[only]))
+                        constants = false;
+                }
+                if (only == IR_NONE) continue;  // Incomplete or unreachable
+                if (trivial) {
+                    rewrites.replace(function, id, only);
+                    ++changes;
+                } else if (constants) {
+                    // Equal constants from different blocks: one in the entry serves all
+                    IrInst value = function.insts[only];
+                    IrId with = value.op == IR_INT ? function.constant(value.integer) : function.realConstant(value.real);
+                    rewrites.replace(function, id, with);
+                    ++changes;
+                }
+                continue;
+            }
+            if (inst.op == IR_CHECK) {
+                // Only an undef, or a phi that may pass one on, can be unset
+                IrOp value = function.insts[function.operand(id, 0)].op;
+                if (value != IR_UNDEF && value != IR_PHI) {
+                    inst.op = IR_NOP;
+                    ++changes;
+                }
+                continue;
+            }
+            if (inst.op == IR_BRANCH) {
+                const IrInst& condition = function.insts[function.operand(id, 0)];
+                if (!isConstant(condition)) continue;
+                IrBlock& block = function.blocks[b];
+                uint32_t dropped = block.succs[truthy(condition) ? 1 : 0];
+                inst.op = IR_JUMP;
+                inst.count = 0;
+                removeEdge(function, b, dropped);
+                ++changes;
+                continue;
+            }
+            if (inst.op < IR_ADD || inst.op > IR_BNOT) continue;
+            bool unary = inst.op >= IR_NEG;
+            const IrInst& left = function.insts[function.operand(id, 0)];
+            if (!isConstant(left)) continue;
+            const IrInst* right = nullptr;
+            if (!unary) {
+                right = &function.insts[function.operand(id, 1)];
+                if (!isConstant(*right)) continue;
+            }
+            IrInst folded = inst;
+            if (!evaluate(inst.op, left, right, folded)) continue;
+            folded.flags = inst.flags;
+            function.insts[id] = folded;
+            ++changes;
+        }
+    }
+    changes += removeUnreachable(function);
+    rewrites.finish(function);
+    return changes;
+}
+
+static bool isPowerOfTwo(int64_t value) { return value > 1 && !(value & (value - 1)); }
+static bool commutative(IrOp op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_BAND || op == IR_BOR || op == IR_BXOR || op == IR_EQ || op == IR_NE;
+}
+static bool boolean(IrOp op) { return (op >= IR_EQ && op <= IR_LE) || op == IR_NOT; }
+
+// Identities that hold for ints only are applied where inference shows
+// both operands are ints, since the same rewrite on a float, or on a value
+// that makes the op trap, would change the result.
+uint32_t simplifyOperators(IrFunction& function) {
+    Rewrites rewrites;
+    uint32_t changes = 0;
+    std::vector<uint32_t> order = reversePostorder(function);
+    std::vector<ValueKind> kinds = inferKinds(function, order);
+    auto kind = [&](IrId id) { return id < kinds.size() ? kinds[id] : KIND_ANY; };
+    auto intConstant = [&](IrId id, int64_t& value) {
+        const IrInst& inst = function.insts[id];
+        value = inst.integer;
+        return inst.op == IR_INT;
+    };
+
+    for (uint32_t b : order) {
+        // constant() adds to the entry block, so walk a copy
+        std::vector<IrId> insts = function.blocks[b].insts;
+        for (IrId id : insts) {
+            if (function.insts[id].op == IR_NOP) continue;
+            rewrites.redirect(function, id);
+            IrOp op = function.insts[id].op;
+
+            if (op == IR_BRANCH) {
+                IrId condition = function.operand(id, 0);
+                if (function.insts[condition].op != IR_NOT) continue;
+                function.operand(id, 0) = function.operand(condition, 0);
+                std::swap(function.blocks[b].succs[0], function.blocks[b].succs[1]);
+                ++changes;
+                continue;
+            }
+            if (op >= IR_NEG && op <= IR_BNOT) {
+                IrId inner = function.operand(id, 0);
+                if (function.insts[inner].op != op) continue;
+                IrId value = function.operand(inner, 0);
+                bool exact = op == IR_NEG ? isNumber(kind(value)) : op == IR_BNOT ? kind(value) == KIND_INT
+                                                                                 : boolean(function.insts[value].op);
+                if (!exact) continue;
+                rewrites.replace(function, id, value);
+                ++changes;
+                continue;
+            }
+            if (op < IR_ADD || op > IR_LE) continue;
+
+            if (commutative(op) && isConstant(function.insts[function.operand(id, 0)]) &&
+                !isConstant(function.insts[function.operand(id, 1)])) {
+                std::swap(function.operand(id, 0), function.operand(id, 1));
+                ++changes;
+            }
+            IrId left = function.operand(id, 0), right = function.operand(id, 1);
+            if (kind(left) != KIND_INT || kind(right) != KIND_INT) continue;
+            int64_t c = 0;
+            bool constant = intConstant(right, c);
+            IrInst& inst = function.insts[id];
+            IrId same = IR_NONE;    // Operand the result equals
+            bool folds = false;     // Or the constant it equals
+            int64_t value = 0;
+
+            if (left == right) {
+                switch (op) {
+                    case IR_SUB: case IR_BXOR: case IR_NE: case IR_LT: folds = true; value = 0; break;
+                    case IR_EQ: case IR_LE: folds = true; value = 1; break;
+                    case IR_BAND: case IR_BOR: same = left; break;
+                    default: break;
+                }
+            } else if (constant) {
+                switch (op) {
+                    case IR_ADD: case IR_SUB: case IR_BOR: case IR_BXOR:
+                        if (c == 0) same = left;
+                        else if (op == IR_BOR && c == -1) folds = true, value = -1;
+                        break;
+                    case IR_SHL: case IR_SHR:
+                        if (!(c & 63)) same = left;
+                        break;
+                    case IR_MUL:
+                        if (c == 1) same = left;
+                        else if (c == 0) folds = true, value = 0;
+                        break;
+                    case IR_DIV:
+                        if (c == 1) same = left;
+                        break;
+                    case IR_MOD:
+                        if (c == 1 || c == -1) folds = true, value = 0;
+                        break;
+                    case IR_BAND:
+                        if (c == -1) same = left;
+                        else if (c == 0) folds = true, value = 0;
+                        break;
+                    default: break;
+                }
+            }
+            if (same != IR_NONE) {
+                rewrites.replace(function, id, same);
+                ++changes;
+                continue;
+            }
+            if (folds) {
+                makeInt(inst, value);
+                ++changes;
+                continue;
+            }
+            if (!constant) continue;
+
+            // x * 2^k is a shift; x - c adds -c, so that chains of adds
+            // and subtracts of constants, as in "x -= 1; x += 3", combine
+            if (op == IR_MUL && isPowerOfTwo(c)) {
+                int shift = 0;
+                while ((int64_t(1) << shift) != c) ++shift;
+                IrId amount = function.constant(shift);
+                function.insts[id].op = IR_SHL;
+                function.operand(id, 1) = amount;
+                ++changes;
+                continue;
+            }
+            if (op == IR_SUB) {
+                c = static_cast<int64_t>(0 - static_cast<uint64_t>(c));
+                IrId negated = function.constant(c);
+                function.insts[id].op = IR_ADD;
+                function.operand(id, 1) = negated;
+                ++changes;
+                op = IR_ADD;
+            }
+            if (op == IR_ADD && function.insts[left].op == IR_ADD) {
+                int64_t inner;
+                IrId base = function.operand(left, 0);
+                if (!intConstant(function.operand(left, 1), inner) || kind(base) != KIND_INT) continue;
+                IrId sum = function.constant(static_cast<int64_t>(static_cast<uint64_t>(inner) + static_cast<uint64_t>(c)));
+                function.operand(id, 0) = base;
+                function.operand(id, 1) = sum;
+                ++changes;
+            }
+        }
+    }
+    rewrites.finish(function);
+    return changes;
+}
+
+// Immediate dominators, Cooper, Harvey and Kennedy's iteration over the
+// reverse postorder
+static std::vector<uint32_t> dominators(const IrFunction& function, const std::vector<uint32_t>& order) {
+    const uint32_t UNSET = 0xFFFFFFFF;
+    std::vector<uint32_t> rank(function.blocks.size(), UNSET);
+    for (uint32_t i = 0; i < order.size(); ++i) rank[order[i]] = i;
+    std::vector<uint32_t> idom(function.blocks.size(), UNSET);
+    idom[order[0]] = order[0];
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            uint32_t b = order[i];
+            uint32_t next = UNSET;
+            for (uint32_t pred : function.blocks[b].preds) {
+                if (rank[pred] == UNSET || idom[pred] == UNSET) continue;
+                if (next == UNSET) {
+                    next = pred;
+                    continue;
+                }
+                uint32_t x = pred, y = next;
+                while (x != y) {
+                    while (rank[x] > rank[y]) x = idom[x];
+                    while (rank[y] > rank[x]) y = idom[y];
+                }
+                next = x;
+            }
+            if (next != idom[b]) {
+                idom[b] = next;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// Op and operands, or op and the bits of a constant
+typedef std::tuple<uint8_t, uint64_t, uint64_t> ValueKey;
+
+uint32_t numberValues(IrFunction& function) {
+    std::vector<uint32_t> order = reversePostorder(function);
+    std::vector<uint32_t> idom = dominators(function, order);
+    std::vector<std::vector<uint32_t>> children(function.blocks.size());
+    for (size_t i = 1; i < order.size(); ++i) children[idom[order[i]]].push_back(order[i]);
+
+    Rewrites rewrites;
+    uint32_t changes = 0;
+    std::map<ValueKey, IrId> available;
+    std::vector<ValueKey> scope;    // Keys added, undone on leaving a subtree
+    std::vector<std::pair<uint32_t, size_t>> stack;     // Block, or ~block on the way out with its scope mark
+    stack.emplace_back(order[0], 0);
+    while (!stack.empty()) {
+        std::pair<uint32_t, size_t> top = stack.back();
+        stack.pop_back();
+        if (top.first & 0x80000000) {
+            while (scope.size() > top.second) {
+                available.erase(scope.back());
+                scope.pop_back();
+            }
+            continue;
+        }
+        uint32_t b = top.first;
+        stack.emplace_back(b | 0x80000000, scope.size());
+        for (IrId id : function.blocks[b].insts) {
+            rewrites.redirect(function, id);
+            IrInst& inst = function.insts[id];
+            bool pure = isConstant(inst) || (inst.op >= IR_ADD && inst.op <= IR_BNOT);
+            if (!pure) continue;
+            ValueKey key;
+            if (inst.op == IR_INT) key = ValueKey(inst.op, static_cast<uint64_t>(inst.integer), 0);
+            else if (inst.op == IR_FLOAT) {
+                uint64_t bits;
+                memcpy(&bits, &inst.real, sizeof(bits));
+                key = ValueKey(inst.op, bits, 0);
+            } else {
+                uint64_t a = function.operand(id, 0);
+                uint64_t c = inst.count > 1 ? function.operand(id, 1) : IR_NONE;
+                if (commutative(inst.op) && a > c) std::swap(a, c);
+                key = ValueKey(inst.op, a, c);
+            }
+            auto found = available.find(key);
+            if (found != available.end()) {
+                rewrites.replace(function, id, found->second);
+                ++changes;
+            } else {
+                available.emplace(key, id);
+                scope.push_back(key);
+            }
+        }
+        for (uint32_t child : children[b]) stack.emplace_back(child, 0);
+    }
+    rewrites.finish(function);
+    return changes;
+}
+
+uint32_t eliminateDeadCode(IrFunction& function) {
+    std::vector<uint32_t> order = reversePostorder(function);
+    std::vector<ValueKind> kinds = inferKinds(function, order);
+    std::vector<uint8_t> live(function.insts.size());
+    std::vector<IrId> work;
+    for (uint32_t b : order)
+        for (IrId id : function.blocks[b].insts)
+            if (hasEffect(function, id, kinds)) {
+                live[id] = 1;
+                work.push_back(id);
+            }
+    while (!work.empty()) {
+        IrId id = work.back();
+        work.pop_back();
+        const IrInst& inst = function.insts[id];
+        for (uint32_t i = 0; i < inst.count; ++i) {
+            IrId operand = function.operand(id, i);
+            if (live[operand]) continue;
+            live[operand] = 1;
+            work.push_back(operand);
+        }
+    }
+    uint32_t changes = 0;
+    for (IrBlock& block : function.blocks)
+        for (IrId id : block.insts)
+            if (!live[id]) {
+                function.insts[id].op = IR_NOP;
+                ++changes;
+            }
+    compactBlocks(function);
+    return changes;
+}
+
+template <typename Pass>
+static uint32_t timed(PassStats& stats, IrPass which, IrFunction& function, Pass pass) {
+    PROFILE_PHASE(passName(which));
+    auto start = std::chrono::steady_clock::now();
+    uint32_t changes = pass(function);
+    stats.nanos[which] += static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    stats.changes[which] += changes;
+    return changes;
+}
+
+// Folding exposes identities, simplifying exposes constants and common
+// subexpressions, and so on; a few rounds reach the fixed point on
+// anything but contrived input
+PassStats optimizeFunction(IrFunction& function) {
+    PassStats stats;
+    for (int round = 0; round < 4; ++round) {
+        uint32_t changes = timed(stats, PASS_FOLD, function, foldConstants);
+        changes += timed(stats, PASS_SIMPLIFY, function, simplifyOperators);
+        changes += timed(stats, PASS_CSE, function, numberValues);
+        if (!changes) break;
+    }
+    timed(stats, PASS_DCE, function, eliminateDeadCode);
+    return stats;
+}
+
+PassStats optimize(IrModule& module, ThreadPool* workers) {
+    std::vector<PassStats> perFunction(module.functions.size());
+    auto one = [&](size_t i) { perFunction[i] = optimizeFunction(module.functions[i]); };
+    if (workers) workers->run(module.functions.size(), one);
+    else for (size_t i = 0; i < module.functions.size(); ++i) one(i);
+    PassStats total;
+    for (const PassStats& stats : perFunction) total.merge(stats);
+    return total;
+}
@@ -0,0 +1,205 @@
+#include "profile.hpp"
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <map>
+#include "ast.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static_assert(AST_IMPORT < ParserCounters::NODE_TYPES, "raise ParserCounters::NODE_TYPES");
+
+static const char* categoryNames[TOKEN_CATEGORIES] = {
+    "ident", "keyword", "number", "string", "operator", "punct", "layout", "error",
+};
+static const char* nodeNames[ParserCounters::NODE_TYPES] = {
+    "unknown", "funcdef", "arg", "call", "block", "type", "null", "ident",
+    "number", "unary", "binary", "assign", "if", "while", "return", "error",
+    "import",
+};
+
+static std::atomic<Profiler*> installed {nullptr};
+
+static uint64_t steadyNanos() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t threadCpuNanos() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    uint64_t k = (static_cast<uint64_t>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    uint64_t u = (static_cast<uint64_t>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return (k + u) * 100;
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) return 0;
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec);
+#endif
+}
+
+uint32_t profileThreadId() {
+    static std::atomic<uint32_t> next {1};
+    thread_local uint32_t id = next.fetch_add(1);
+    return id;
+}
+
+void LexerCounters::merge(const LexerCounters& other) {
+    for (uint32_t c = 0; c < TOKEN_CATEGORIES; ++c) {
+        tokens[c] += other.tokens[c];
+        bytes[c] += other.bytes[c];
+    }
+    trivia += other.trivia;
+    internHits += other.internHits;
+    internInserts += other.internInserts;
+    for (uint32_t b = 0; b < PROBE_BUCKETS; ++b) probes[b] += other.probes[b];
+    grows += other.grows;
+    growNanos += other.growNanos;
+    if (other.maxIndentDepth > maxIndentDepth) maxIndentDepth = other.maxIndentDepth;
+}
+
+void ParserCounters::merge(const ParserCounters& other) {
+    for (uint32_t t = 0; t < NODE_TYPES; ++t) nodes[t] += other.nodes[t];
+    arenaBytes += other.arenaBytes;
+    lookahead += other.lookahead;
+    skipped += other.skipped;
+}
+
+Profiler::Profiler() : origin(steadyNanos()) {};
+
+void Profiler::install(Profiler* profiler) {
+    installed.store(profiler, std::memory_order_release);
+}
+
+Profiler* Profiler::active() {
+    return installed.load(std::memory_order_acquire);
+}
+
+uint64_t Profiler::now() const {
+    return steadyNanos() - origin;
+}
+
+void Profiler::addPhase(const PhaseRecord& phase) {
+    std::lock_guard<std::mutex> guard(lock);
+    records.push_back(phase);
+}
+
+void Profiler::add(const LexerCounters& counters) {
+    std::lock_guard<std::mutex> guard(lock);
+    lexerTotals.merge(counters);
+}
+
+void Profiler::add(const ParserCounters& counters) {
+    std::lock_guard<std::mutex> guard(lock);
+    parserTotals.merge(counters);
+}
+
+std::vector<PhaseRecord> Profiler::phases() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return records;
+}
+
+LexerCounters Profiler::lexer() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return lexerTotals;
+}
+
+ParserCounters Profiler::parser() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return parserTotals;
+}
+
+static void appendf(std::string& out, const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length > 0) out.append(buffer, static_cast<size_t>(length) < sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+// Phase names are string literals from the code, no escaping needed
+std::string Profiler::json() const {
+    std::vector<PhaseRecord> phaseList = phases();
+    LexerCounters lex = lexer();
+    ParserCounters parse = parser();
+
+    std::string out = "{\n  \"phases\": [";
+    for (size_t i = 0; i < phaseList.size(); ++i) {
+        const PhaseRecord& p = phaseList[i];
+        appendf(out, "%s\n    {\"name\": \"%s\", \"thread\": %u, \"start_ns\": %" PRIu64 ", \"wall_ns\": %" PRIu64
+                ", \"cpu_ns\": %" PRIu64 "}", i ? "," : "", p.name, p.thread, p.start, p.wall, p.cpu);
+    }
+
+    // Per phase name, summed over threads and calls
+    struct Total {
+        uint64_t calls = 0, wall = 0, cpu = 0;
+    };
+    std::map<std::string, Total> totals;
+    for (const PhaseRecord& p : phaseList) {
+        Total& total = totals[p.name];
+        ++total.calls;
+        total.wall += p.wall;
+        total.cpu += p.cpu;
+    }
+    out += "\n  ],\n  \"totals\": {";
+    bool first = true;
+    for (const auto& entry : totals) {
+        appendf(out, "%s\n    \"%s\": {\"calls\": %" PRIu64 ", \"wall_ns\": %" PRIu64 ", \"cpu_ns\": %" PRIu64 "}",
+                first ? "" : ",", entry.first.c_str(), entry.second.calls, entry.second.wall, entry.second.cpu);
+        first = false;
+    }
+
+    out += "\n  },\n  \"lexer\": {\n    \"tokens\": {";
+    for (uint32_t c = 0; c < TOKEN_CATEGORIES; ++c)
+        appendf(out, "%s\"%s\": %" PRIu64, c ? ", " : "", categoryNames[c], lex.tokens[c]);
+    out += "},\n    \"bytes\": {";
+    for (uint32_t c = 0; c < TOKEN_CATEGORIES; ++c)
+        appendf(out, "%s\"%s\": %" PRIu64, c ? ", " : "", categoryNames[c], lex.bytes[c]);
+    appendf(out, "},\n    \"trivia_bytes\": %" PRIu64 ",\n    \"intern_hits\": %" PRIu64
+            ",\n    \"intern_inserts\": %" PRIu64 ",\n    \"probe_lengths\": [", lex.trivia, lex.internHits,
+            lex.internInserts);
+    for (uint32_t b = 0; b < LexerCounters::PROBE_BUCKETS; ++b)
+        appendf(out, "%s%" PRIu64, b ? ", " : "", lex.probes[b]);
+    appendf(out, "],\n    \"grows\": %" PRIu64 ",\n    \"grow_ns\": %" PRIu64 ",\n    \"max_indent_depth\": %" PRIu64
+            "\n  },\n  \"parser\": {\n    \"nodes\": {", lex.grows, lex.growNanos, lex.maxIndentDepth);
+    for (uint32_t t = 0; t <= AST_IMPORT; ++t)
+        appendf(out, "%s\"%s\": %" PRIu64, t ? ", " : "", nodeNames[t], parse.nodes[t]);
+    appendf(out, "},\n    \"arena_bytes\": %" PRIu64 ",\n    \"lookahead_tokens\": %" PRIu64
+            ",\n    \"skipped_tokens\": %" PRIu64 "\n  }\n}\n", parse.arenaBytes, parse.lookahead, parse.skipped);
+    return out;
+}
+
+// Complete ("X") events in microseconds, one track per thread
+std::string Profiler::chromeTrace() const {
+    std::vector<PhaseRecord> phaseList = phases();
+    std::string out = "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    for (size_t i = 0; i < phaseList.size(); ++i) {
+        const PhaseRecord& p = phaseList[i];
+        appendf(out, "%s\n  {\"name\": \"%s\", \"cat\": \"lightning\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"cpu_us\": %.3f}}", i ? "," : "", p.name, p.thread,
+                p.start / 1e3, p.wall / 1e3, p.cpu / 1e3);
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+PhaseTimer::PhaseTimer(const char* name) : profiler(Profiler::active()), name(name) {
+    if (!profiler) return;
+    start = profiler->now();
+    cpuStart = threadCpuNanos();
+};
+
+PhaseTimer::~PhaseTimer() {
+    if (!profiler) return;
+    uint64_t stop = profiler->now();
+    profiler->addPhase(PhaseRecord {name, profileThreadId(), start, stop - start, threadCpuNanos() - cpuStart});
+};
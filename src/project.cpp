@@ -0,0 +1,250 @@
+#include "project.hpp"
+#include <algorithm>
+#include "mappedfile.hpp"
+
+Project::Project(std::string root, std::string extension) : root(std::move(root)), extension(std::move(extension)) {};
+
+Module* Project::find(const std::string& name) const {
+    auto found = byName.find(name);
+    return found == byName.end() ? nullptr : list[found->second].get();
+}
+
+// Lists the files under root again. Modules of files still there carry
+// over with their front end; a changed size or time marks them for reading.
+void Project::scan() {
+    std::unordered_map<std::string, std::unique_ptr<Module>> previous;
+    for (auto& module : list) previous[module->name] = std::move(module);
+    list.clear();
+
+    namespace fs = std::filesystem;
+    std::error_code error;
+    for (fs::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error)) {
+        if (!it->is_regular_file(error) || it->path().extension() != extension) continue;
+        std::string name = it->path().lexically_relative(root).replace_extension().generic_string();
+        std::replace(name.begin(), name.end(), '/', '.');
+
+        std::unique_ptr<Module> module;
+        auto found = previous.find(name);
+        if (found != previous.end()) module = std::move(found->second);
+        else {
+            module.reset(new Module);
+            module->name = name;
+        }
+        module->path = it->path().string();
+        fs::file_time_type modified = fs::last_write_time(it->path(), error);
+        uintmax_t bytes = fs::file_size(it->path(), error);
+        module->parsed = !module->parser || modified != module->modified || bytes != module->bytes;
+        module->modified = modified;
+        module->bytes = bytes;
+        list.push_back(std::move(module));
+    }
+
+    std::sort(list.begin(), list.end(), [](const std::unique_ptr<Module>& a, const std::unique_ptr<Module>& b) {
+        return a->name < b->name;
+    });
+    byName.clear();
+    for (uint32_t i = 0; i < list.size(); ++i) byName[list[i]->name] = i;
+}
+
+// Whether the parser reported a diagnostic on the line holding offset.
+// An import that did keeps the names read before its error, as "import a."
+// keeps a, which would make a dependency that was never written.
+static bool reportedOnLine(const Module& module, uint64_t offset) {
+    const std::string& source = module.source;
+    size_t start = offset ? source.rfind('\n', offset - 1) : std::string::npos;
+    start = start == std::string::npos ? 0 : start + 1;
+    size_t end = source.find('\n', offset);
+    if (end == std::string::npos) end = source.size();
+    const std::vector<Diagnostic>& diagnostics = module.parser->diagnostics;
+    auto found = std::lower_bound(diagnostics.begin(), diagnostics.end(), start,
+                                  [](const Diagnostic& diagnostic, size_t at) { return diagnostic.offset < at; });
+    return found != diagnostics.end() && found->offset <= end;
+}
+
+// Reads the file and, unless its bytes are the ones parsed last time,
+// rebuilds the front end and collects the top-level imports. A file that
+// can't be read leaves the module empty, with its error, until it can.
+void Project::parse(Module& module) {
+    MappedFile file(module.path);
+    if (!file.isOpen()) {
+        module.parser.reset();
+        module.tokens.reset();
+        module.lexer.reset();
+        module.source.clear();
+        module.hash = 0;
+        module.root = 0;
+        module.importNames.clear();
+        module.error = "cannot read " + module.path;
+        return;
+    }
+    module.error.clear();
+    std::string_view text = file.view();
+    uint64_t hash = hashSymbol(text.data(), static_cast<uint32_t>(text.size()));
+    if (module.parser && hash == module.hash && text == module.source) {
+        module.parsed = false;
+        return;
+    }
+
+    // The parser refers to the tokens, and both to the source
+    module.parser.reset();
+    module.tokens.reset();
+    module.lexer.reset();
+    module.source.assign(text.data(), text.size());
+    module.hash = hash;
+    module.lexer.reset(new Lexer(std::string_view(module.source)));
+    module.tokens.reset(new TokenStream(module.lexer->tokenizeStream()));
+    module.parser.reset(new Parser(*module.tokens, module.source));
+    module.root = module.parser->parse();
+
+    module.importNames.clear();
+    const AstArena& arena = module.parser->arena;
+    const AstNode& block = arena[module.root];
+    for (uint32_t i = 0; i < block.count; ++i) {
+        const AstNode& statement = arena[block.child(i)];
+        if (statement.type != AST_IMPORT || statement.count == 0 || reportedOnLine(module, statement.payload)) continue;
+        std::string name;
+        for (uint32_t k = 0; k < statement.count; ++k) {
+            if (k) name += '.';
+            name += module.lexer->pool.data() + arena[statement.child(k)].payload;
+        }
+        module.importNames.push_back(std::move(name));
+    }
+}
+
+// Blocked modules are in a cycle or import one. Strongly connected
+// components of the blocked modules (Tarjan's, without recursion) tell
+// the two apart: a component of two or more, or a module importing
+// itself, is a cycle.
+void Project::markCycles() {
+    const uint32_t unvisited = UINT32_MAX;
+    std::vector<uint32_t> index(list.size(), unvisited), low(list.size()), stack;
+    std::vector<bool> onStack(list.size());
+    std::vector<std::pair<uint32_t, size_t>> path;  // Module and its next import to follow
+    uint32_t visited = 0;
+    auto enter = [&](uint32_t i) {
+        index[i] = low[i] = visited++;
+        stack.push_back(i);
+        onStack[i] = true;
+        path.push_back({i, 0});
+    };
+    for (auto& module : list) module->cyclic = false;
+    for (uint32_t first = 0; first < list.size(); ++first) {
+        if (!list[first]->blocked || index[first] != unvisited) continue;
+        enter(first);
+        while (!path.empty()) {
+            uint32_t i = path.back().first;
+            const std::vector<uint32_t>& imports = list[i]->imports;
+            if (path.back().second < imports.size()) {
+                uint32_t import = imports[path.back().second++];
+                if (!list[import]->blocked) continue;
+                if (index[import] == unvisited) enter(import);
+                else if (onStack[import]) low[i] = std::min(low[i], index[import]);
+                continue;
+            }
+            path.pop_back();
+            if (!path.empty()) low[path.back().first] = std::min(low[path.back().first], low[i]);
+            if (low[i] != index[i]) continue;
+            size_t root = stack.size();
+            while (stack[--root] != i) {}
+            bool cycle = stack.size() - root > 1 || std::find(imports.begin(), imports.end(), i) != imports.end();
+            for (size_t k = root; k < stack.size(); ++k) {
+                onStack[stack[k]] = false;
+                list[stack[k]]->cyclic = cycle;
+            }
+            stack.resize(root);
+        }
+    }
+}
+
+BuildStats Project::build(TaskScheduler& scheduler, const Stage& stage) {
+    scan();
+    BuildStats stats;
+    stats.modules = list.size();
+
+    // Front end: every new or touched file is an independent task
+    for (auto& module : list) {
+        module->staged = false;
+        if (!module->parsed) continue;
+        Module* target = module.get();
+        scheduler.spawn([target] { parse(*target); });
+    }
+    scheduler.wait();
+
+    // Resolve imports into edges, both ways
+    for (auto& module : list) {
+        module->imports.clear();
+        module->importers.clear();
+        module->unresolved.clear();
+    }
+    for (uint32_t i = 0; i < list.size(); ++i) {
+        Module& module = *list[i];
+        for (const std::string& name : module.importNames) {
+            auto found = byName.find(name);
+            if (found == byName.end()) {
+                module.unresolved.push_back(name);
+                continue;
+            }
+            if (std::find(module.imports.begin(), module.imports.end(), found->second) != module.imports.end()) continue;
+            module.imports.push_back(found->second);
+            list[found->second]->importers.push_back(i);
+        }
+        stats.parsed += module.parsed;
+        stats.unresolved += module.unresolved.size();
+        stats.unreadable += !module.error.empty();
+    }
+
+    // Topological order; what it never reaches is in or behind a cycle
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> indegree(list.size());
+    for (uint32_t i = 0; i < list.size(); ++i) {
+        indegree[i] = static_cast<uint32_t>(list[i]->imports.size());
+        if (indegree[i] == 0) order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); ++k)
+        for (uint32_t importer : list[order[k]]->importers)
+            if (--indegree[importer] == 0) order.push_back(importer);
+    for (uint32_t i = 0; i < list.size(); ++i) {
+        Module& module = *list[i];
+        module.blocked = indegree[i] != 0;
+        module.dirty = false;
+        if (module.blocked) module.stageValid = false;
+        stats.blocked += module.blocked;
+    }
+    markCycles();
+
+    // Affected modules, in order so each sees its imports' verdict
+    for (uint32_t i : order) {
+        Module& module = *list[i];
+        std::vector<std::string> resolved;
+        for (uint32_t import : module.imports) resolved.push_back(list[import]->name);
+        bool dirty = module.parsed || !module.stageValid || resolved != module.resolvedBefore;
+        for (uint32_t import : module.imports) dirty = dirty || list[import]->dirty;
+        module.dirty = dirty;
+        module.resolvedBefore = std::move(resolved);
+    }
+
+    // Stages: a module starts once its last dirty import finishes
+    std::function<void(Module*)> run = [&](Module* module) {
+        stage(*module);
+        module->staged = true;
+        module->stageValid = true;
+        for (uint32_t importer : module->importers) {
+            Module* next = list[importer].get();
+            if (next->dirty && next->waiting.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                scheduler.spawn([&run, next] { run(next); });
+        }
+    };
+    std::vector<Module*> ready;
+    for (uint32_t i : order) {
+        Module& module = *list[i];
+        if (!module.dirty) continue;
+        uint32_t waiting = 0;
+        for (uint32_t import : module.imports) waiting += list[import]->dirty;
+        module.waiting.store(waiting, std::memory_order_relaxed);
+        if (waiting == 0) ready.push_back(&module);
+        ++stats.staged;
+    }
+    for (Module* module : ready) scheduler.spawn([&run, module] { run(module); });
+    scheduler.wait();
+    return stats;
+}
@@ -0,0 +1,292 @@
+#include "scan.hpp"
+#include "lexer.hpp"
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHTNING_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static inline uint8_t info(char c) {
+    return charClassDict[static_cast<uchar_t>(c)];
+}
+
+static inline uint32_t firstSet(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+static inline uint32_t popCount(uint32_t mask) {
+#if defined(_MSC_VER)
+    mask = mask - ((mask >> 1) & 0x55555555u);
+    mask = (mask & 0x33333333u) + ((mask >> 2) & 0x33333333u);
+    return (((mask + (mask >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+#else
+    return static_cast<uint32_t>(__builtin_popcount(mask));
+#endif
+}
+
+// Scalar kernels, the reference for every vector kernel
+static const char* scalarIdent(const char* p, const char* end) {
+    while (p < end && (info(*p) & CC_IDENT_CONT)) ++p;
+    return p;
+}
+
+static const char* scalarDigits(const char* p, const char* end) {
+    while (p < end && info(*p) == CC_DIGIT) ++p;
+    return p;
+}
+
+static const char* scalarOperators(const char* p, const char* end) {
+    while (p < end && (info(*p) & CC_OPERATOR)) ++p;
+    return p;
+}
+
+static const char* scalarSpaces(const char* p, const char* end) {
+    while (p < end && *p == ' ') ++p;
+    return p;
+}
+
+static const char* scalarLine(const char* p, const char* end) {
+    while (p < end && info(*p) != CC_NEWLINE) ++p;
+    return p;
+}
+
+static const char* scalarString(const char* p, const char* end) {
+    while (p < end && *p != '"' && *p != '\\' && info(*p) != CC_NEWLINE) ++p;
+    return p;
+}
+
+static inline bool isBreak(const char* p, const char* end) {
+    return *p == '\n' || (*p == '\r' && (p + 1 == end || p[1] != '\n'));
+}
+
+static size_t scalarCountLines(const char* p, const char* end) {
+    size_t count = 0;
+    for (; p < end; ++p) count += isBreak(p, end);
+    return count;
+}
+
+static uint32_t* scalarLineStarts(const char* p, const char* end, uint32_t offset, uint32_t* out) {
+    for (const char* q = p; q < end; ++q)
+        if (isBreak(q, end)) *out++ = offset + static_cast<uint32_t>(q - p) + 1;
+    return out;
+}
+
+static const ScanKernels scalarKernels = {
+    scalarIdent, scalarDigits, scalarOperators, scalarSpaces, scalarLine, scalarString,
+    scalarCountLines, scalarLineStarts, "scalar",
+};
+
+#ifdef LIGHTNING_SSE2
+// 0xFF in every lane where lo <= x <= hi (unsigned)
+static inline __m128i inRange(__m128i x, char lo, char hi) {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    __m128i span = _mm_set1_epi8(static_cast<char>(hi - lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, span), shifted);
+}
+
+static inline __m128i isIdent(__m128i x) {
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    __m128i mask = inRange(x, '0', '9');
+    mask = _mm_or_si128(mask, inRange(lower, 'a', 'z'));
+    return _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+}
+
+static inline __m128i isOperator(__m128i x) {
+    __m128i mask = _mm_cmpeq_epi8(x, _mm_set1_epi8('!'));
+    mask = _mm_or_si128(mask, inRange(x, '%', '&'));
+    mask = _mm_or_si128(mask, inRange(x, '*', '+'));
+    mask = _mm_or_si128(mask, inRange(x, '-', '/'));
+    mask = _mm_or_si128(mask, inRange(x, '<', '@'));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('^')));
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('|')));
+    return _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('~')));
+}
+
+static inline __m128i isNewline(__m128i x) {
+    return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                        _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')));
+}
+
+static inline __m128i isStringEnd(__m128i x) {
+    __m128i mask = _mm_or_si128(isNewline(x), _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+    return _mm_or_si128(mask, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+}
+
+// Bitmask of the lanes in p[0, 16) that end the run
+#define SSE2_STOP(name, inRun)                                              \
+    static inline uint32_t name(const char* p) {                            \
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));   \
+        return ~static_cast<uint32_t>(_mm_movemask_epi8(inRun)) & 0xFFFF;   \
+    }
+
+SSE2_STOP(identStop, isIdent(x))
+SSE2_STOP(digitsStop, inRange(x, '0', '9'))
+SSE2_STOP(operatorsStop, isOperator(x))
+SSE2_STOP(spacesStop, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')))
+SSE2_STOP(lineStop, _mm_xor_si128(isNewline(x), _mm_set1_epi8(-1)))
+SSE2_STOP(stringStop, _mm_xor_si128(isStringEnd(x), _mm_set1_epi8(-1)))
+
+#undef SSE2_STOP
+
+// Walk 16 bytes at a time while every lane is in the run, then finish with
+// the scalar kernel for the tail
+#define SSE2_RUN(name, stopMask, tail)                                      \
+    static const char* name(const char* p, const char* end) {               \
+        while (end - p >= 16) {                                             \
+            uint32_t stop = stopMask(p);                                    \
+            if (stop) return p + firstSet(stop);                            \
+            p += 16;                                                        \
+        }                                                                   \
+        return tail(p, end);                                                \
+    }
+
+SSE2_RUN(sse2Ident, identStop, scalarIdent)
+SSE2_RUN(sse2Digits, digitsStop, scalarDigits)
+SSE2_RUN(sse2Operators, operatorsStop, scalarOperators)
+SSE2_RUN(sse2Spaces, spacesStop, scalarSpaces)
+SSE2_RUN(sse2Line, lineStop, scalarLine)
+SSE2_RUN(sse2String, stringStop, scalarString)
+
+#undef SSE2_RUN
+
+// Break lanes of p[0, 16); next tells whether p[16] exists and is '\n'
+static inline uint32_t breakMask(const char* p, bool next) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    uint32_t lf = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))));
+    uint32_t cr = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+    uint32_t crlf = (lf >> 1) | (static_cast<uint32_t>(next) << 15);
+    return lf | (cr & ~crlf);
+}
+
+static size_t sse2CountLines(const char* p, const char* end) {
+    size_t count = 0;
+    while (end - p >= 16) {
+        count += popCount(breakMask(p, end - p > 16 && p[16] == '\n'));
+        p += 16;
+    }
+    return count + scalarCountLines(p, end);
+}
+
+static uint32_t* sse2LineStarts(const char* p, const char* end, uint32_t offset, uint32_t* out) {
+    const char* start = p;
+    while (end - p >= 16) {
+        uint32_t mask = breakMask(p, end - p > 16 && p[16] == '\n');
+        uint32_t base = offset + static_cast<uint32_t>(p - start) + 1;
+        while (mask) {
+            *out++ = base + firstSet(mask);
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+    return scalarLineStarts(p, end, offset + static_cast<uint32_t>(p - start), out);
+}
+
+static const ScanKernels sse2Kernels = {
+    sse2Ident, sse2Digits, sse2Operators, sse2Spaces, sse2Line, sse2String,
+    sse2CountLines, sse2LineStarts, "sse2",
+};
+#endif
+
+#ifdef LIGHTNING_AVX2
+// Defined in scan_avx2.cpp, which is the only unit built with AVX2 enabled.
+// They stop at the run end or when fewer than 32 bytes remain.
+const char* avx2IdentBlocks(const char* p, const char* end);
+const char* avx2DigitsBlocks(const char* p, const char* end);
+const char* avx2OperatorsBlocks(const char* p, const char* end);
+const char* avx2SpacesBlocks(const char* p, const char* end);
+const char* avx2LineBlocks(const char* p, const char* end);
+const char* avx2StringBlocks(const char* p, const char* end);
+const char* avx2CountLineBlocks(const char* p, const char* end, size_t& count);
+const char* avx2LineStartBlocks(const char* p, const char* end, uint32_t offset, uint32_t*& out);
+
+// Most runs end within 16 bytes, so test those with SSE2 before switching to
+// 256-bit blocks; short runs would otherwise lose to the scalar kernels
+#define AVX2_RUN(name, stopMask, blocks, tail)                              \
+    static const char* name(const char* p, const char* end) {               \
+        if (end - p >= 16) {                                                \
+            uint32_t stop = stopMask(p);                                    \
+            if (stop) return p + firstSet(stop);                            \
+            p += 16;                                                        \
+        }                                                                   \
+        return tail(blocks(p, end), end);                                   \
+    }
+
+AVX2_RUN(avx2Ident, identStop, avx2IdentBlocks, sse2Ident)
+AVX2_RUN(avx2Digits, digitsStop, avx2DigitsBlocks, sse2Digits)
+AVX2_RUN(avx2Operators, operatorsStop, avx2OperatorsBlocks, sse2Operators)
+AVX2_RUN(avx2Spaces, spacesStop, avx2SpacesBlocks, sse2Spaces)
+AVX2_RUN(avx2Line, lineStop, avx2LineBlocks, sse2Line)
+AVX2_RUN(avx2String, stringStop, avx2StringBlocks, sse2String)
+
+#undef AVX2_RUN
+
+static size_t avx2CountLines(const char* p, const char* end) {
+    size_t count = 0;
+    p = avx2CountLineBlocks(p, end, count);
+    return count + sse2CountLines(p, end);
+}
+
+static uint32_t* avx2LineStarts(const char* p, const char* end, uint32_t offset, uint32_t* out) {
+    const char* rest = avx2LineStartBlocks(p, end, offset, out);
+    return sse2LineStarts(rest, end, offset + static_cast<uint32_t>(rest - p), out);
+}
+
+static const ScanKernels avx2Kernels = {
+    avx2Ident, avx2Digits, avx2Operators, avx2Spaces, avx2Line, avx2String,
+    avx2CountLines, avx2LineStarts, "avx2",
+};
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) return false;
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool avx = (regs[2] >> 28) & 1;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+ScanLevel detectScanLevel() {
+#ifdef LIGHTNING_AVX2
+    static const bool avx2 = cpuHasAvx2();
+    if (avx2) return SCAN_AVX2;
+#endif
+#ifdef LIGHTNING_SSE2
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+const ScanKernels& scanKernels(ScanLevel level) {
+    ScanLevel best = detectScanLevel();
+    if (level > best) level = best;
+#ifdef LIGHTNING_AVX2
+    if (level == SCAN_AVX2) return avx2Kernels;
+#endif
+#ifdef LIGHTNING_SSE2
+    if (level == SCAN_SSE2) return sse2Kernels;
+#endif
+    return scalarKernels;
+}
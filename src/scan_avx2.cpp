@@ -0,0 +1,123 @@
+// AVX2 block kernels for scan.cpp. This unit is compiled with AVX2 enabled, so
+// it must stay free of inline code shared with other units and is only
+// reached after the runtime CPU check in detectScanLevel().
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static inline uint32_t firstSet(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+// 0xFF in every lane where lo <= x <= hi (unsigned)
+static inline __m256i inRange(__m256i x, char lo, char hi) {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    __m256i span = _mm256_set1_epi8(static_cast<char>(hi - lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, span), shifted);
+}
+
+static inline __m256i isIdent(__m256i x) {
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    __m256i mask = inRange(x, '0', '9');
+    mask = _mm256_or_si256(mask, inRange(lower, 'a', 'z'));
+    return _mm256_or_si256(mask, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+}
+
+// Operator membership by nibble lookup: lo[x & 15] & hi[x >> 4] is non-zero
+// exactly for the bytes whose class has CC_OPERATOR set
+static inline __m256i isOperator(__m256i x) {
+    const __m256i loTable = _mm256_setr_epi8(
+        0x10, 0x04, 0x00, 0x00, 0x00, 0x04, 0x04, 0x00,
+        0x00, 0x00, 0x04, 0x04, (char)0xA8, 0x0C, (char)0xAC, 0x0C,
+        0x10, 0x04, 0x00, 0x00, 0x00, 0x04, 0x04, 0x00,
+        0x00, 0x00, 0x04, 0x04, (char)0xA8, 0x0C, (char)0xAC, 0x0C);
+    const __m256i hiTable = _mm256_setr_epi8(
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+    __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_shuffle_epi8(loTable, _mm256_and_si256(x, nibble));
+    __m256i hi = _mm256_shuffle_epi8(hiTable, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+    __m256i hit = _mm256_and_si256(lo, hi);
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(hit, _mm256_setzero_si256()), _mm256_set1_epi8(-1));
+}
+
+static inline __m256i notNewline(__m256i x) {
+    __m256i newline = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                                      _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')));
+    return _mm256_xor_si256(newline, _mm256_set1_epi8(-1));
+}
+
+static inline __m256i notStringEnd(__m256i x) {
+    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+                                   _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+    return _mm256_andnot_si256(stop, notNewline(x));
+}
+
+#define AVX2_BLOCKS(name, inRun)                                            \
+    const char* name(const char* p, const char* end) {                      \
+        while (end - p >= 32) {                                             \
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); \
+            uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(inRun)); \
+            if (stop) return p + firstSet(stop);                            \
+            p += 32;                                                        \
+        }                                                                   \
+        return p;                                                           \
+    }
+
+AVX2_BLOCKS(avx2IdentBlocks, isIdent(x))
+AVX2_BLOCKS(avx2DigitsBlocks, inRange(x, '0', '9'))
+AVX2_BLOCKS(avx2OperatorsBlocks, isOperator(x))
+AVX2_BLOCKS(avx2SpacesBlocks, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')))
+AVX2_BLOCKS(avx2LineBlocks, notNewline(x))
+AVX2_BLOCKS(avx2StringBlocks, notStringEnd(x))
+
+#undef AVX2_BLOCKS
+
+// Line breaks: '\n', or '\r' not followed by '\n'. next tells whether
+// p[32] exists and is '\n'.
+static inline uint32_t breakMask(const char* p, bool next) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    uint32_t lf = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))));
+    uint32_t cr = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+    uint32_t crlf = (lf >> 1) | (static_cast<uint32_t>(next) << 31);
+    return lf | (cr & ~crlf);
+}
+
+const char* avx2CountLineBlocks(const char* p, const char* end, size_t& count) {
+    while (end - p >= 32) {
+        uint32_t mask = breakMask(p, end - p > 32 && p[32] == '\n');
+#if defined(_MSC_VER)
+        count += __popcnt(mask);
+#else
+        count += static_cast<size_t>(__builtin_popcount(mask));
+#endif
+        p += 32;
+    }
+    return p;
+}
+
+const char* avx2LineStartBlocks(const char* p, const char* end, uint32_t offset, uint32_t*& out) {
+    const char* start = p;
+    while (end - p >= 32) {
+        uint32_t mask = breakMask(p, end - p > 32 && p[32] == '\n');
+        uint32_t base = offset + static_cast<uint32_t>(p - start) + 1;
+        while (mask) {
+            *out++ = base + firstSet(mask);
+            mask &= mask - 1;
+        }
+        p += 32;
+    }
+    return p;
+}
@@ -0,0 +1,109 @@
+#include "scheduler.hpp"
+
+// The scheduler and worker index of the running thread, to find its deque
+static thread_local TaskScheduler* currentScheduler = nullptr;
+static thread_local unsigned currentIndex = 0;
+
+TaskScheduler::TaskScheduler(unsigned threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i) queues.emplace_back(new Queue);
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back([this, i] { work(i); });
+};
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+};
+
+void TaskScheduler::spawn(Task task) {
+    unsigned index = currentScheduler == this ? currentIndex : 0;
+    pending.fetch_add(1);
+    {
+        Queue& queue = *queues[index];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    // A sleeper bumps sleeping before it checks queued, and this checks
+    // sleeping after bumping queued, so one of them sees the other
+    queued.fetch_add(1);
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> guard(mutex);
+        wake.notify_one();
+    }
+}
+
+// Own deque newest first, then the others oldest first, starting past our
+// own index so thieves spread out
+bool TaskScheduler::take(unsigned index, Task& task) {
+    {
+        Queue& queue = *queues[index];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    unsigned count = size();
+    for (unsigned k = 1; k < count; ++k) {
+        Queue& victim = *queues[(index + k) % count];
+        std::unique_lock<std::mutex> guard(victim.lock, std::try_to_lock);
+        if (!guard.owns_lock() || victim.tasks.empty()) continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool TaskScheduler::runOne(unsigned index) {
+    Task task;
+    if (!take(index, task)) return false;
+    queued.fetch_sub(1);
+    task();
+    if (pending.fetch_sub(1) == 1) {
+        // Last task: release wait()
+        std::lock_guard<std::mutex> guard(mutex);
+        wake.notify_all();
+    }
+    return true;
+}
+
+void TaskScheduler::work(unsigned index) {
+    currentScheduler = this;
+    currentIndex = index;
+    while (true) {
+        if (runOne(index)) continue;
+        std::unique_lock<std::mutex> guard(mutex);
+        sleeping.fetch_add(1);
+        // A try_lock miss in take() can leave queued non-zero; that spins
+        // once more instead of sleeping, which is what we want
+        wake.wait(guard, [&] { return stopping || queued.load() > 0; });
+        sleeping.fetch_sub(1);
+        if (stopping) return;
+    }
+}
+
+void TaskScheduler::wait() {
+    TaskScheduler* outerScheduler = currentScheduler;
+    unsigned outerIndex = currentIndex;
+    currentScheduler = this;
+    currentIndex = 0;
+    while (pending.load() > 0) {
+        if (runOne(0)) continue;
+        std::unique_lock<std::mutex> guard(mutex);
+        sleeping.fetch_add(1);
+        wake.wait(guard, [&] { return pending.load() == 0 || queued.load() > 0; });
+        sleeping.fetch_sub(1);
+    }
+    currentScheduler = outerScheduler;
+    currentIndex = outerIndex;
+}
@@ -0,0 +1,205 @@
+#include "server.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if LIGHTNING_SERVER
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Bounds on what a peer may claim to send, so a stray connection can't
+// make either side allocate without limit
+static constexpr uint32_t MAX_STRINGS = 1 << 16;
+static constexpr uint32_t MAX_BYTES = 1u << 30;
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// A message is a count, then each string as its length and bytes
+static bool sendStrings(int fd, const std::vector<std::string>& strings) {
+    uint32_t count = static_cast<uint32_t>(strings.size());
+    if (!writeAll(fd, &count, sizeof(count))) return false;
+    for (const std::string& string : strings) {
+        uint32_t length = static_cast<uint32_t>(string.size());
+        if (!writeAll(fd, &length, sizeof(length)) || !writeAll(fd, string.data(), length)) return false;
+    }
+    return true;
+}
+
+static bool receiveStrings(int fd, std::vector<std::string>& strings) {
+    uint32_t count;
+    if (!readAll(fd, &count, sizeof(count)) || count > MAX_STRINGS) return false;
+    strings.resize(count);
+    for (std::string& string : strings) {
+        uint32_t length;
+        if (!readAll(fd, &length, sizeof(length)) || length > MAX_BYTES) return false;
+        string.resize(length);
+        if (length && !readAll(fd, &string[0], length)) return false;
+    }
+    return true;
+}
+
+static bool address(const std::string& path, sockaddr_un& where, std::string& error) {
+    memset(&where, 0, sizeof(where));
+    where.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(where.sun_path)) {
+        error = "bad socket path " + path;
+        return false;
+    }
+    memcpy(where.sun_path, path.data(), path.size());
+    return true;
+}
+
+static int connectTo(const std::string& path, std::string& error) {
+    sockaddr_un where;
+    if (!address(path, where, error)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = strerror(errno);
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&where), sizeof(where)) != 0) {
+        error = "no server on " + path + ": " + strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+CompileServer::CompileServer(std::string path) : path(std::move(path)) {};
+
+CompileServer::~CompileServer() { stop(); };
+
+void CompileServer::stop() {
+    if (listener < 0) return;
+    close(listener);
+    unlink(path.c_str());
+    listener = -1;
+}
+
+bool CompileServer::listen() {
+    sockaddr_un where;
+    if (!address(path, where, error)) return false;
+    // A socket left by a server that died answers nobody; a live one keeps it
+    std::string refused;
+    int probe = connectTo(path, refused);
+    if (probe >= 0) {
+        close(probe);
+        error = "a server is already listening on " + path;
+        return false;
+    }
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    // Connecting takes write permission, so no other user gets requests in.
+    // The socket is made 0600 rather than changed after bind(), which would
+    // leave it open to anyone in between.
+    mode_t mask = umask(0177);
+    bool bound = fd >= 0 && bind(fd, reinterpret_cast<sockaddr*>(&where), sizeof(where)) == 0;
+    umask(mask);
+    if (!bound || ::listen(fd, 16) != 0) {
+        error = "cannot listen on " + path + ": " + strerror(errno);
+        if (bound) unlink(path.c_str());
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    listener = fd;
+    return true;
+}
+
+void CompileServer::serve(const Handler& handler) {
+    // A client that hangs up before its reply mustn't take the server down
+    signal(SIGPIPE, SIG_IGN);
+    for (bool more = listener >= 0; more;) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            error = strerror(errno);
+            break;
+        }
+        // A client that goes quiet mid-message gives up its turn instead of
+        // holding every later one back
+        timeval limit = {static_cast<time_t>(timeoutMs / 1000), static_cast<suseconds_t>(timeoutMs % 1000 * 1000)};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit));
+        std::vector<std::string> strings;
+        if (receiveStrings(client, strings) && !strings.empty()) {
+            Request request;
+            request.directory = std::move(strings[0]);
+            request.args.assign(strings.begin() + 1, strings.end());
+            Reply reply;
+            more = handler(request, reply);
+            sendStrings(client, {std::to_string(reply.status), reply.out, reply.err});
+        }
+        close(client);
+    }
+    // Clients that connect later find no socket rather than a backlog nobody reads
+    stop();
+}
+
+bool sendRequest(const std::string& path, const Request& request, Reply& reply, std::string& error) {
+    int fd = connectTo(path, error);
+    if (fd < 0) return false;
+    std::vector<std::string> strings;
+    strings.reserve(request.args.size() + 1);
+    strings.push_back(request.directory);
+    strings.insert(strings.end(), request.args.begin(), request.args.end());
+    bool ok = sendStrings(fd, strings) && receiveStrings(fd, strings) && strings.size() == 3;
+    close(fd);
+    if (!ok) {
+        error = "no reply from " + path;
+        return false;
+    }
+    reply.status = atoi(strings[0].c_str());
+    reply.out = std::move(strings[1]);
+    reply.err = std::move(strings[2]);
+    return true;
+}
+
+#else
+
+CompileServer::CompileServer(std::string path) : path(std::move(path)) {};
+
+CompileServer::~CompileServer() {};
+
+void CompileServer::stop() {}
+
+bool CompileServer::listen() {
+    error = "no Unix sockets on this platform";
+    return false;
+}
+
+void CompileServer::serve(const Handler&) {}
+
+bool sendRequest(const std::string&, const Request&, Reply&, std::string& error) {
+    error = "no Unix sockets on this platform";
+    return false;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back([this] { work(); });
+};
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+};
+
+void ThreadPool::drain(const std::function<void(size_t)>* job, size_t jobs) {
+    if (!job) return;
+    size_t index;
+    while ((index = next.fetch_add(1, std::memory_order_relaxed)) < jobs) {
+        (*job)(index);
+        finished.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void ThreadPool::work() {
+    uint64_t seen = 0;
+    while (true) {
+        const std::function<void(size_t)>* job;
+        size_t jobs;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            // Snapshot under the lock; a worker that wakes after the job was
+            // retired sees no task and must not touch the counters
+            job = task;
+            jobs = count;
+            ++active;
+        }
+        drain(job, jobs);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --active;
+        }
+        done.notify_all();
+    }
+}
+
+void ThreadPool::run(size_t jobs, const std::function<void(size_t)>& job) {
+    if (jobs == 0) return;
+    if (workers.empty() || jobs == 1) {
+        for (size_t i = 0; i < jobs; ++i) job(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &job;
+        count = jobs;
+        next.store(0, std::memory_order_relaxed);
+        finished.store(0, std::memory_order_relaxed);
+        ++generation;
+    }
+    wake.notify_all();
+    drain(&job, jobs);
+
+    // Wait for the stragglers and for every worker to leave this job
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return finished.load(std::memory_order_acquire) == count && active == 0; });
+    task = nullptr;
+    count = 0;
+}
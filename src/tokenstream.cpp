@@ -0,0 +1,152 @@
+#include "tokenstream.hpp"
+#include "keywords.hpp"
+#include <cstring>
+
+static const uint8_t VARIABLE = 0xFF;
+
+// Length implied by the token type, or VARIABLE
+static const struct LengthTable {
+    uint8_t lengths[128];
+    constexpr LengthTable() : lengths() {
+        for (int t = 0; t < 128; ++t) lengths[t] = VARIABLE;
+        for (int t = TT_LPAREN; t <= TT_RBRACKET; ++t) lengths[t] = 1;
+        for (int t = TT_EXCL; t <= TT_DOT; ++t) lengths[t] = 1;
+        for (int t = TT_AND; t <= TT_RARROW; ++t) lengths[t] = 2;
+        for (const Keyword& keyword : keywordList) lengths[keyword.type] = KeywordTable::textLength(keyword.text);
+        lengths[TT_DEDENT] = 0;
+        lengths[TT_ERROR] = 0;
+        lengths[TT_EOF] = 0;
+    }
+} impliedLength;
+
+// Tokens whose payload is their lexeme
+static inline bool hasSymbol(TokenType type) {
+    return type == TT_IDENT || type == TT_NUMBER || type == TT_CHAR || type == TT_CUSTOM_OP;
+}
+
+static inline bool hasConstant(TokenType type) {
+    return type == TT_NUMBER || type == TT_CHAR;
+}
+
+TokenStream::TokenStream(const std::vector<char>* pool, const Interner* interner, const std::vector<Constant>* constants,
+                         const std::vector<char>* strings)
+    : pool(pool), interner(interner), constants(constants), strings(strings) {};
+
+TokenStream::TokenStream(const std::vector<Token>& tokens, const std::vector<char>* pool, const Interner* interner,
+                         const std::vector<Constant>* constants, const std::vector<char>* strings)
+    : pool(pool), interner(interner), constants(constants), strings(strings) {
+    reserve(tokens.size());
+    for (const Token& token : tokens) push_back(token);
+};
+
+void TokenStream::reserve(size_t count) {
+    types.reserve(count);
+    offsets.reserve(count);
+    payloads.reserve(count);
+}
+
+void TokenStream::push_back(const Token& token) {
+    uint8_t stored = static_cast<uint8_t>(token.type);
+    uint32_t payload = 0;
+
+    if (token.type == TT_CUSTOM_OP && token.length <= 2) {
+        stored |= SHORT_OP;
+        payload = token.length;
+    }
+    else if (token.type == TT_STRING && token.format == F_ESCAPED) {
+        stored |= ESCAPED;
+        payload = token.lexeme;
+    }
+    else if (hasSymbol(token.type))
+        payload = token.lexeme;
+    else if (impliedLength.lengths[token.type] == VARIABLE)
+        payload = token.length;
+
+    types.push_back(stored);
+    offsets.push_back(token.offset);
+    payloads.push_back(payload);
+}
+
+size_t TokenStream::bytes() const {
+    return types.size() * sizeof(uint8_t) + offsets.size() * sizeof(uint32_t) + payloads.size() * sizeof(uint32_t);
+}
+
+const char* TokenStream::text(symbol_t symbol, uint32_t& length) const {
+    if (interner) {
+        std::string_view name = interner->name(symbol);
+        length = static_cast<uint32_t>(name.size());
+        return name.data();
+    }
+    const char* string = pool->data() + symbol;
+    length = static_cast<uint32_t>(strlen(string));
+    return string;
+}
+
+symbol_t TokenStream::lexeme(size_t i) const {
+    if (types[i] == (TT_STRING | ESCAPED)) return payloads[i];
+    return hasSymbol(type(i)) && !(types[i] & SHORT_OP) ? payloads[i] : 0;
+}
+
+uint32_t TokenStream::length(size_t i) const {
+    uint8_t implied = impliedLength.lengths[type(i)];
+    if (implied != VARIABLE) return implied;
+    if (types[i] == (TT_STRING | ESCAPED)) {
+        StringHeader header;
+        memcpy(&header, strings->data() + payloads[i], sizeof(header));
+        return header.spelled;
+    }
+    if (!hasSymbol(type(i)) || (types[i] & SHORT_OP)) return payloads[i];
+    if (hasConstant(type(i))) return constant(i).length;
+
+    uint32_t length;
+    text(payloads[i], length);
+    return length;
+}
+
+Format TokenStream::format(size_t i) const {
+    if (types[i] == (TT_STRING | ESCAPED)) return F_ESCAPED;
+    if (!hasConstant(type(i))) return F_NONE;
+    return constant(i).format;
+}
+
+Token TokenStream::operator[](size_t i) const {
+    return Token {lexeme(i), offsets[i], length(i), type(i), format(i)};
+}
+
+size_t TokenStream::find(TokenType type, size_t from) const {
+    const uint8_t* data = types.data();
+    size_t count = types.size();
+    for (size_t i = from; i < count; ++i)
+        if ((data[i] & TYPE_MASK) == type) return i;
+    return count;
+}
+
+size_t TokenStream::matchBracket(size_t open) const {
+    TokenType opener = type(open);
+    TokenType closer = opener == TT_LPAREN ? TT_RPAREN
+                     : opener == TT_LBRACE ? TT_RBRACE
+                     : opener == TT_LBRACKET ? TT_RBRACKET
+                     : TT_UNKNOWN;
+    if (closer == TT_UNKNOWN) return size();
+
+    // Brackets carry no flag bits, so the raw bytes compare directly
+    const uint8_t* data = types.data();
+    size_t count = types.size();
+    size_t depth = 0;
+    for (size_t i = open; i < count; ++i) {
+        if (data[i] == opener) ++depth;
+        else if (data[i] == closer && --depth == 0) return i;
+    }
+    return count;
+}
+
+size_t TokenStream::skipBlock(size_t indent) const {
+    const uint8_t* data = types.data();
+    size_t count = types.size();
+    size_t depth = 0;
+    for (size_t i = indent; i < count; ++i) {
+        if (data[i] == TT_INDENT) ++depth;
+        else if (data[i] == TT_DEDENT && --depth == 0) return i;
+    }
+    return count;
+}
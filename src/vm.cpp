@@ -0,0 +1,451 @@
+#include "vm.hpp"
+#include <cmath>
+#include <cstring>
+#include "jit.hpp"
+
+// Handler order of the threaded label table; must match enum Opcode
+#define VM_OPCODES(X) \
+    X(OP_MOVE) X(OP_LOADI) X(OP_LOADK) X(OP_GETGLOBAL) X(OP_SETGLOBAL) X(OP_CLEAR) X(OP_CHECK) \
+    X(OP_ADD) X(OP_SUB) X(OP_MUL) X(OP_DIV) X(OP_MOD) \
+    X(OP_BAND) X(OP_BOR) X(OP_BXOR) X(OP_SHL) X(OP_SHR) \
+    X(OP_EQ) X(OP_NE) X(OP_LT) X(OP_LE) \
+    X(OP_ADDI) \
+    X(OP_NEG) X(OP_NOT) X(OP_BNOT) \
+    X(OP_JMP) X(OP_JMPF) X(OP_JMPT) \
+    X(OP_CALL) X(OP_RET) X(OP_RET0)
+
+#define VM_LIST(op) op,
+static constexpr Opcode handlerOrder[] = {VM_OPCODES(VM_LIST)};
+#undef VM_LIST
+
+static constexpr bool inOrder() {
+    for (size_t i = 0; i < sizeof(handlerOrder) / sizeof(handlerOrder[0]); ++i)
+        if (handlerOrder[i] != i) return false;
+    return sizeof(handlerOrder) / sizeof(handlerOrder[0]) == OPCODES;
+}
+static_assert(inOrder(), "VM_OPCODES out of step with enum Opcode");
+
+std::string valueString(const Value& value) {
+    char text[32];
+    switch (value.type) {
+        case V_INT:
+            snprintf(text, sizeof(text), "%lld", static_cast<long long>(value.integer));
+            return text;
+        case V_FLOAT: {
+            // Shortest spelling that reads back as the same double
+            for (int precision = 15; precision <= 17; ++precision) {
+                snprintf(text, sizeof(text), "%.*g", precision, value.real);
+                if (strtod(text, nullptr) == value.real) break;
+            }
+            if (std::isfinite(value.real) && !strpbrk(text, ".e")) strcat(text, ".0");
+            return text;
+        }
+        case V_NONE: return "none";
+        case V_FUNCTION: return "<function>";
+        case V_NATIVE: return "<native>";
+        case V_FOREIGN: return "<foreign>";
+        default: return "<unset>";
+    }
+}
+
+static bool printNative(VM& vm, const Value* args, uint32_t count, Value& result) {
+    std::string line;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i) line += ' ';
+        line += valueString(args[i]);
+    }
+    line += '\n';
+    fwrite(line.data(), 1, line.size(), vm.out);
+    result = Value::of(V_NONE);
+    return true;
+}
+
+VM::VM(const Program& program, size_t stackValues) : program(program), stack(stackValues) {
+    mode = LIGHTNING_COMPUTED_GOTO ? DISPATCH_THREADED : DISPATCH_SWITCH;
+    frames.reserve(256);
+    reset();
+    define("print", printNative);
+};
+
+VM::~VM() = default;
+
+void VM::setDispatch(Dispatch dispatch) {
+    mode = LIGHTNING_COMPUTED_GOTO ? dispatch : DISPATCH_SWITCH;
+}
+
+void VM::setJit(uint32_t threshold) {
+    native.reset(threshold ? new Jit(program, threshold) : nullptr);
+}
+
+void VM::define(const char* name, Native native) {
+    natives.push_back(native);
+    nativeNames.emplace_back(name);
+    reset();
+}
+
+void VM::define(const char* name, const ForeignFunction& function) {
+    foreign.push_back(function);
+    foreignNames.emplace_back(name);
+    reset();
+}
+
+// Globals back to their state before the module body ran. A def wins over
+// a C function of the same name, and that over a native.
+void VM::reset() {
+    globals.assign(program.globals.size(), Value::of(V_UNSET));
+    for (size_t i = 0; i < natives.size(); ++i)
+        for (size_t slot = 0; slot < program.globals.size(); ++slot)
+            if (program.globals[slot] == nativeNames[i]) globals[slot] = Value::of(V_NATIVE, i);
+    for (size_t i = 0; i < foreign.size(); ++i)
+        for (size_t slot = 0; slot < program.globals.size(); ++slot)
+            if (program.globals[slot] == foreignNames[i]) globals[slot] = Value::of(V_FOREIGN, i);
+    for (size_t i = 1; i < program.functions.size(); ++i)
+        globals[program.functionSlots[i]] = Value::of(V_FUNCTION, i);
+}
+
+bool VM::fail(const Function* function, const uint32_t* pc, const char* message, const char* detail) {
+    char where[32];
+    snprintf(where, sizeof(where), " at %zu: ", static_cast<size_t>(pc - function->code.data() - 1));
+    std::string text = "in " + function->name + where + message;
+    if (detail) text += std::string(" ") + detail;
+    error = std::move(text);
+    frames.clear();
+    return false;
+}
+
+bool VM::run(Value& result) {
+    error.clear();
+    frames.clear();
+    if (program.functions.empty() || program.functions[0].registers > stack.size()) {
+        error = "stack overflow";
+        return false;
+    }
+#if LIGHTNING_COMPUTED_GOTO
+    if (mode == DISPATCH_THREADED) return execute<true>(result);
+#endif
+    return execute<false>(result);
+}
+
+static inline bool truthy(const Value& value) {
+    switch (value.type) {
+        case V_INT: return value.integer != 0;
+        case V_FLOAT: return value.real != 0;
+        case V_FUNCTION: case V_NATIVE: case V_FOREIGN: return true;
+        default: return false;
+    }
+}
+
+static inline bool numeric(const Value& value) { return value.type == V_INT || value.type == V_FLOAT; }
+static inline double real(const Value& value) {
+    return value.type == V_INT ? static_cast<double>(value.integer) : value.real;
+}
+static inline int64_t wrap(uint64_t bits) { return static_cast<int64_t>(bits); }
+
+// Arithmetic and comparisons once either operand isn't an int. False when
+// the operand types don't support op.
+static bool slowBinary(Opcode op, const Value& b, const Value& c, Value& out) {
+    if (!numeric(b) || !numeric(c)) {
+        if (op != OP_EQ && op != OP_NE) return false;
+        bool same = b.type == c.type && (b.type == V_NONE || b.type == V_UNSET || b.index == c.index);
+        out = Value::ofInt(same == (op == OP_EQ));
+        return true;
+    }
+    double x = real(b), y = real(c);
+    switch (op) {
+        case OP_ADD: out = Value::ofReal(x + y); return true;
+        case OP_SUB: out = Value::ofReal(x - y); return true;
+        case OP_MUL: out = Value::ofReal(x * y); return true;
+        case OP_DIV: out = Value::ofReal(x / y); return true;
+        case OP_MOD: out = Value::ofReal(std::fmod(x, y)); return true;
+        case OP_EQ: out = Value::ofInt(x == y); return true;
+        case OP_NE: out = Value::ofInt(x != y); return true;
+        case OP_LT: out = Value::ofInt(x < y); return true;
+        case OP_LE: out = Value::ofInt(x <= y); return true;
+        default: return false;  // Bitwise ops take ints only
+    }
+}
+
+// Handlers are written once. The switch loop reaches them through its case
+// labels and goes back to the top after each; the threaded loop enters at
+// the first handler through the label table and every handler jumps
+// straight to the next, giving the branch predictor one indirect branch
+// per opcode instead of one for all of them.
+#define CASE(op) case op: L_##op:
+#if LIGHTNING_COMPUTED_GOTO
+#define NEXT() if constexpr (THREADED) { ins = *pc++; goto *labels[opcodeOf(ins)]; } else continue
+#else
+#define NEXT() continue
+#endif
+
+// Hands the frame to the function's native code, if it has some, and
+// resumes wherever that stops; otherwise counts towards compiling it
+#define JIT_ENTER() \
+    if (native) { \
+        const uint32_t* code = function->code.data(); \
+        pc = code + native->enter(static_cast<uint32_t>(function - program.functions.data()), \
+                                  static_cast<uint32_t>(pc - code), base, globalSlots); \
+    }
+
+#define RA (base[argA(ins)])
+#define RB (base[argB(ins)])
+#define RC (base[argC(ins)])
+
+// Int op int stays int (wrapping), anything else goes to slowBinary
+#define INT_BINARY(op, expr) \
+    CASE(op) { \
+        const Value& b = RB; \
+        const Value& c = RC; \
+        if (b.type == V_INT && c.type == V_INT) { \
+            uint64_t x = static_cast<uint64_t>(b.integer), y = static_cast<uint64_t>(c.integer); \
+            (void)x; (void)y; \
+            RA = Value::ofInt(expr); \
+        } else if (!slowBinary(op, b, c, RA)) goto operands; \
+        NEXT(); \
+    }
+
+#define INT_ONLY(op, expr) \
+    CASE(op) { \
+        const Value& b = RB; \
+        const Value& c = RC; \
+        if (b.type != V_INT || c.type != V_INT) goto operands; \
+        uint64_t x = static_cast<uint64_t>(b.integer), y = static_cast<uint64_t>(c.integer); \
+        (void)x; (void)y; \
+        RA = Value::ofInt(expr); \
+        NEXT(); \
+    }
+
+template <bool THREADED>
+bool VM::execute(Value& result) {
+#if LIGHTNING_COMPUTED_GOTO
+#define VM_LABEL(op) &&L_##op,
+    static const void* const labels[] = {VM_OPCODES(VM_LABEL)};
+#undef VM_LABEL
+#endif
+    reset();
+    const Function* function = &program.functions[0];
+    const uint32_t* pc = function->code.data();
+    Value* base = stack.data();
+    Value* limit = stack.data() + stack.size();
+    const Value* constants = program.constants.data();
+    Value* globalSlots = globals.data();
+    const char* detail = nullptr;
+    uint32_t ins;
+    for (uint32_t i = 0; i < function->registers; ++i) base[i] = Value::of(V_UNSET);
+
+#if LIGHTNING_COMPUTED_GOTO
+    if constexpr (THREADED) {
+        ins = *pc++;
+        goto *labels[opcodeOf(ins)];
+    }
+#endif
+    for (;;) {
+        ins = *pc++;
+        switch (opcodeOf(ins)) {
+            CASE(OP_MOVE) {
+                RA = RB;
+                NEXT();
+            }
+            CASE(OP_LOADI) {
+                RA = Value::ofInt(argSBx(ins));
+                NEXT();
+            }
+            CASE(OP_LOADK) {
+                RA = constants[argBx(ins)];
+                NEXT();
+            }
+            CASE(OP_GETGLOBAL) {
+                const Value& value = globalSlots[argBx(ins)];
+                if (value.type == V_UNSET) {
+                    detail = program.globals[argBx(ins)].c_str();
+                    goto undefined;
+                }
+                RA = value;
+                NEXT();
+            }
+            CASE(OP_SETGLOBAL) {
+                globalSlots[argBx(ins)] = RA;
+                NEXT();
+            }
+            CASE(OP_CLEAR) {
+                RA = Value::of(V_UNSET);
+                NEXT();
+            }
+            CASE(OP_CHECK) {
+                if (RA.type == V_UNSET) {
+                    detail = function->locals[argBx(ins)].c_str();
+                    goto undefined;
+                }
+                NEXT();
+            }
+
+            INT_BINARY(OP_ADD, wrap(x + y))
+            INT_BINARY(OP_SUB, wrap(x - y))
+            INT_BINARY(OP_MUL, wrap(x * y))
+            // Truncating like C; -1 is special-cased since INT64_MIN / -1 traps
+            CASE(OP_DIV) {
+                const Value& b = RB;
+                const Value& c = RC;
+                if (b.type == V_INT && c.type == V_INT) {
+                    if (c.integer == 0) goto division;
+                    RA = Value::ofInt(c.integer == -1 ? wrap(0 - static_cast<uint64_t>(b.integer)) : b.integer / c.integer);
+                } else if (!slowBinary(OP_DIV, b, c, RA)) goto operands;
+                NEXT();
+            }
+            CASE(OP_MOD) {
+                const Value& b = RB;
+                const Value& c = RC;
+                if (b.type == V_INT && c.type == V_INT) {
+                    if (c.integer == 0) goto division;
+                    RA = Value::ofInt(c.integer == -1 ? 0 : b.integer % c.integer);
+                } else if (!slowBinary(OP_MOD, b, c, RA)) goto operands;
+                NEXT();
+            }
+            INT_ONLY(OP_BAND, wrap(x & y))
+            INT_ONLY(OP_BOR, wrap(x | y))
+            INT_ONLY(OP_BXOR, wrap(x ^ y))
+            INT_ONLY(OP_SHL, wrap(x << (y & 63)))
+            INT_ONLY(OP_SHR, static_cast<int64_t>(x) >> (y & 63))
+            INT_BINARY(OP_EQ, x == y)
+            INT_BINARY(OP_NE, x != y)
+            INT_BINARY(OP_LT, static_cast<int64_t>(x) < static_cast<int64_t>(y))
+            INT_BINARY(OP_LE, static_cast<int64_t>(x) <= static_cast<int64_t>(y))
+            CASE(OP_ADDI) {
+                const Value& b = RB;
+                if (b.type == V_INT) RA = Value::ofInt(wrap(static_cast<uint64_t>(b.integer) + argSC(ins)));
+                else if (b.type == V_FLOAT) RA = Value::ofReal(b.real + argSC(ins));
+                else goto operands;
+                NEXT();
+            }
+
+            CASE(OP_NEG) {
+                const Value& b = RB;
+                if (b.type == V_INT) RA = Value::ofInt(wrap(0 - static_cast<uint64_t>(b.integer)));
+                else if (b.type == V_FLOAT) RA = Value::ofReal(-b.real);
+                else goto operands;
+                NEXT();
+            }
+            CASE(OP_NOT) {
+                RA = Value::ofInt(!truthy(RB));
+                NEXT();
+            }
+            CASE(OP_BNOT) {
+                if (RB.type != V_INT) goto operands;
+                RA = Value::ofInt(~RB.integer);
+                NEXT();
+            }
+
+            CASE(OP_JMP) {
+                pc += argSBx(ins);
+                if (argSBx(ins) < 0) JIT_ENTER();
+                NEXT();
+            }
+            CASE(OP_JMPF) {
+                if (!truthy(RA)) {
+                    pc += argSBx(ins);
+                    if (argSBx(ins) < 0) JIT_ENTER();
+                }
+                NEXT();
+            }
+            CASE(OP_JMPT) {
+                if (truthy(RA)) {
+                    pc += argSBx(ins);
+                    if (argSBx(ins) < 0) JIT_ENTER();
+                }
+                NEXT();
+            }
+
+            CASE(OP_CALL) {
+                Value* callee = &RA;
+                uint32_t count = argB(ins);
+                if (callee->type == V_FUNCTION) {
+                    const Function* next = &program.functions[callee->index];
+                    if (count != next->params) {
+                        detail = next->name.c_str();
+                        goto arity;
+                    }
+                    Value* frame = callee + 1;
+                    if (next->registers > static_cast<size_t>(limit - frame)) goto overflow;
+                    frames.push_back({function, pc, base});
+                    for (uint32_t i = count; i < next->registers; ++i) frame[i] = Value::of(V_UNSET);
+                    function = next;
+                    pc = next->code.data();
+                    base = frame;
+                    JIT_ENTER();
+                } else if (callee->type == V_NATIVE) {
+                    Value value;
+                    error.clear();
+                    if (!natives[callee->index](*this, callee + 1, count, value)) {
+                        std::string message = error;
+                        return fail(function, pc, message.c_str());
+                    }
+                    *callee = value;
+                } else if (callee->type == V_FOREIGN) {
+                    // The trampoline reads every argument before writing the result over the callee
+                    const ForeignFunction& target = foreign[callee->index];
+                    detail = foreignNames[callee->index].c_str();
+                    if (count != target.params) goto arity;
+                    if (!target.call(target.address, callee + 1, *callee)) goto arguments;
+                } else {
+                    goto callable;
+                }
+                NEXT();
+            }
+            CASE(OP_RET) {
+                Value value = RA;
+                if (frames.empty()) {
+                    result = value;
+                    return true;
+                }
+                // Into the callee register, just below this frame
+                base[-1] = value;
+                const Frame& caller = frames.back();
+                function = caller.function;
+                pc = caller.pc;
+                base = caller.base;
+                frames.pop_back();
+                JIT_ENTER();
+                NEXT();
+            }
+            CASE(OP_RET0) {
+                if (frames.empty()) {
+                    result = Value::of(V_NONE);
+                    return true;
+                }
+                base[-1] = Value::of(V_NONE);
+                const Frame& caller = frames.back();
+                function = caller.function;
+                pc = caller.pc;
+                base = caller.base;
+                frames.pop_back();
+                JIT_ENTER();
+                NEXT();
+            }
+            default:
+                return fail(function, pc, "bad opcode");
+        }
+    }
+
+operands:
+    return fail(function, pc, "unsupported operand types for", opcodeName(opcodeOf(ins)));
+division:
+    return fail(function, pc, "division by zero");
+undefined:
+    return fail(function, pc, "undefined name", detail);
+arity:
+    return fail(function, pc, "wrong argument count for", detail);
+arguments:
+    return fail(function, pc, "wrong argument types for", detail);
+overflow:
+    return fail(function, pc, "stack overflow");
+callable:
+    return fail(function, pc, "called value is not a function");
+}
+
+#undef CASE
+#undef NEXT
+#undef JIT_ENTER
+#undef RA
+#undef RB
+#undef RC
+#undef INT_BINARY
+#undef INT_ONLY
@@ -0,0 +1,191 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "cache.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "threadpool.hpp"
+#include "tokenstream.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+template <typename T> static bool sameBytes(const T* cached, size_t count, const std::vector<T>& original) {
+    return count == original.size() && (count == 0 || memcmp(cached, original.data(), count * sizeof(T)) == 0);
+}
+
+static std::string readFile(const std::string& path) {
+    std::string bytes;
+    FILE* in = fopen(path.c_str(), "rb");
+    char buffer[4096];
+    size_t n;
+    while (in && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) bytes.append(buffer, n);
+    if (in) fclose(in);
+    return bytes;
+}
+
+static void writeFile(const std::string& path, const std::string& bytes) {
+    FILE* out = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), out);
+    fclose(out);
+}
+
+// Every node of the cached tree matches the parser's, children included
+static bool sameTree(const CachedUnit& unit, const AstArena& arena, NodeId id) {
+    const AstNode& cached = unit[id];
+    const AstNode& original = arena[id];
+    if (cached.type != original.type || cached.count != original.count || cached.payload != original.payload)
+        return false;
+    for (uint32_t i = 0; i < cached.count; ++i) {
+        if (cached.child(i) != original.child(i) || !sameTree(unit, arena, cached.child(i))) return false;
+    }
+    return true;
+}
+
+int main() {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "lightning_cache_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    TokenCache cache(directory.string());
+
+    // Enough functions to span several AST chunks, with strings, chars and errors
+    std::string src;
+    for (int i = 0; i < 3000; ++i) {
+        src += "def f" + std::to_string(i) + "(a, b):\n";
+        src += "    s = \"tab\\there\" + 'x' + \"plain\"\n";
+        src += "    return a * " + std::to_string(i) + " + b / 2.5\n";
+    }
+    src += "x = (1 +\n";
+
+    check(!CachedUnit(cache, src).valid(), "empty cache misses");
+
+    Lexer lexer(src);
+    std::vector<Token> tokens = lexer.tokenize();
+    TokenStream stream(tokens, &lexer.pool, nullptr, &lexer.constants, &lexer.strings);
+    Parser parser(stream, src);
+    NodeId root = parser.parse();
+    check(parser.arena.chunkCount() > 1, "corpus spans chunks");
+    check(!parser.diagnostics.empty(), "corpus has diagnostics");
+    check(!lexer.strings.empty(), "corpus has escaped strings");
+    check(cache.store(src, tokens, lexer, parser, root), "store");
+
+    {
+        CachedUnit unit(cache, src);
+        check(unit.valid(), "hit");
+        check(sameBytes(unit.tokens(), unit.tokenCount(), tokens), "tokens");
+        check(sameBytes(unit.pool(), unit.poolBytes(), lexer.pool), "pool");
+        check(sameBytes(unit.strings(), unit.stringBytes(), lexer.strings), "strings");
+        check(unit.constantCount() == lexer.constants.size(), "constant count");
+        for (size_t i = 0; i < unit.constantCount() && i < lexer.constants.size(); ++i) {
+            const Constant& a = unit.constants()[i];
+            const Constant& b = lexer.constants[i];
+            check(a.format == b.format && a.integer == b.integer, "constant");
+        }
+        check(unit.diagnosticCount() == parser.diagnostics.size(), "diagnostic count");
+        for (size_t i = 0; i < unit.diagnosticCount() && i < parser.diagnostics.size(); ++i)
+            check(unit.diagnostics()[i].offset == parser.diagnostics[i].offset &&
+                  unit.diagnostics()[i].id == parser.diagnostics[i].id, "diagnostic");
+        check(unit.nodes() == parser.arena.nodes(), "node count");
+        check(unit.root() == root && sameTree(unit, parser.arena, root), "tree");
+    }
+
+    // Any change to the source, even one of the same length, is a miss
+    std::string edited = src;
+    edited[edited.size() - 3] = '2';
+    check(!CachedUnit(cache, edited).valid(), "edited source misses");
+    check(!CachedUnit(cache, src + " ").valid(), "longer source misses");
+
+    // A truncated or foreign entry reads as a miss, not a crash
+    std::string entry = cache.path(src);
+    std::filesystem::resize_file(entry, 100);
+    check(!CachedUnit(cache, src).valid(), "truncated entry misses");
+    writeFile(entry, std::string(4096, 'j'));
+    check(!CachedUnit(cache, src).valid(), "foreign entry misses");
+
+    // Storing again replaces the entry
+    check(cache.store(src, tokens, lexer, parser, root), "restore");
+    check(CachedUnit(cache, src).valid(), "restored hit");
+
+    // An entry whose hash and length match but whose source differs, as a
+    // hash collision would leave, is a miss
+    std::string bytes = readFile(entry);
+    size_t stored = bytes.rfind(src);
+    check(stored != std::string::npos, "source stored");
+    if (stored != std::string::npos) {
+        bytes[stored] = 'x';
+        writeFile(entry, bytes);
+        check(!CachedUnit(cache, src).valid(), "colliding entry misses");
+        check(cache.store(src, tokens, lexer, parser, root) && CachedUnit(cache, src).valid(), "colliding entry replaced");
+    }
+
+    // Ids and offsets pointing outside the entry make it a miss, not a crash
+    bytes = readFile(entry);
+    const AstNode& top = parser.arena[root];
+    size_t at = bytes.find(std::string(reinterpret_cast<const char*>(&top), sizeof(AstNode) + sizeof(NodeId)));
+    check(at != std::string::npos, "root stored");
+    if (at != std::string::npos) {
+        std::string damaged = bytes;
+        NodeId wild = 0x7FFFFFFF;
+        memcpy(&damaged[at + sizeof(AstNode)], &wild, sizeof(wild));
+        writeFile(entry, damaged);
+        check(!CachedUnit(cache, src).valid(), "child outside the tree misses");
+        uint32_t many = 1u << 30;
+        damaged = bytes;
+        memcpy(&damaged[at + offsetof(AstNode, count)], &many, sizeof(many));
+        writeFile(entry, damaged);
+        check(!CachedUnit(cache, src).valid(), "node larger than its chunk misses");
+    }
+    const Token* name = nullptr;
+    for (const Token& token : tokens)
+        if (token.type == TT_IDENT && !name) name = &token;
+    at = name ? bytes.find(std::string(reinterpret_cast<const char*>(name), sizeof(Token))) : std::string::npos;
+    check(at != std::string::npos, "token stored");
+    if (at != std::string::npos) {
+        std::string damaged = bytes;
+        symbol_t wild = static_cast<symbol_t>(lexer.pool.size() - 1);
+        memcpy(&damaged[at + offsetof(Token, lexeme)], &wild, sizeof(wild));
+        writeFile(entry, damaged);
+        check(!CachedUnit(cache, src).valid(), "name past the pool misses");
+    }
+    writeFile(entry, bytes);
+    check(CachedUnit(cache, src).valid(), "undamaged entry hits");
+
+    // Trees spliced from worker arenas pass the same checks
+    ThreadPool workers(4);
+    Parser parallel(stream, src);
+    NodeId parallelRoot = parallel.parseParallel(workers, 1 << 10);
+    check(parallel.arena.chunkCount() > 4, "parallel parse spans worker chunks");
+    check(cache.store(src, tokens, lexer, parallel, parallelRoot) && CachedUnit(cache, src).valid(), "parallel tree hits");
+
+    // The tree depends on precedence, so another operator table misses
+    OperatorTable custom;
+    custom.define("<>", Binding {P_COMPARISON, 0});
+    check(!CachedUnit(cache, src, custom).valid(), "another operator table misses");
+    Parser customParser(stream, src);
+    customParser.setOperators(&custom);
+    NodeId customRoot = customParser.parse();
+    check(cache.store(src, tokens, lexer, customParser, customRoot), "store with a custom table");
+    check(CachedUnit(cache, src, custom).valid() && !CachedUnit(cache, src).valid(), "each table finds its own parse");
+
+    // Symbols of a shared Interner don't survive the process
+    Interner interner;
+    Lexer sharedLexer(src);
+    sharedLexer.setInterner(&interner);
+    std::vector<Token> sharedTokens = sharedLexer.tokenize();
+    check(!cache.store(src, sharedTokens, sharedLexer, parser, root), "shared interner refused");
+
+    check(!TokenCache((directory / "missing").string()).store(src, tokens, lexer, parser, root),
+          "unwritable directory fails");
+
+    std::filesystem::remove_all(directory);
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include "lexer.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const char* text) {
+    if (ok) return;
+    printf("FAIL %s: %s\n", what, text);
+    ++failures;
+}
+
+static void checkInt(const char* text, int64_t value, bool overflow = false) {
+    Constant constant = decodeNumber(text, static_cast<uint32_t>(strlen(text)));
+    check(constant.format == F_INT && constant.integer == value && ((constant.flags & K_OVERFLOW) != 0) == overflow,
+          "integer", text);
+}
+
+static void checkReal(const char* text, double value, Format format = F_FLOAT, bool overflow = false) {
+    Constant constant = decodeNumber(text, static_cast<uint32_t>(strlen(text)));
+    check(constant.format == format && constant.real == value && ((constant.flags & K_OVERFLOW) != 0) == overflow,
+          "real", text);
+}
+
+// Spellings the lexer takes as one number token, and where it stops
+static void checkLexed(const char* src, const char* first, Format format) {
+    Lexer lexer{std::string(src)};
+    std::vector<Token> tokens = lexer.tokenize();
+    bool ok = tokens[0].type == TT_NUMBER && tokens[0].length == strlen(first) &&
+              strncmp(src, first, tokens[0].length) == 0 && tokens[0].format == format &&
+              lexer.constants[tokens[0].lexeme].length == tokens[0].length;
+    check(ok, "lexed", src);
+}
+
+static void checkChar(const char* text, int64_t value, bool invalid = false) {
+    Constant constant = decodeChar(text, static_cast<uint32_t>(strlen(text)));
+    check(constant.integer == value && ((constant.flags & K_INVALID) != 0) == invalid, "char", text);
+}
+
+static void checkString(const char* contents, const std::string& value) {
+    char out[64];
+    uint32_t length = decodeString(contents, static_cast<uint32_t>(strlen(contents)), out);
+    check(std::string(out, length) == value, "string", contents);
+}
+
+// The first token of src, a string or char literal spelled as first
+static void checkLiteral(const char* src, TokenType type, const char* first, Format format, const std::string& text) {
+    Lexer lexer{std::string(src)};
+    std::vector<Token> tokens = lexer.tokenize();
+    bool ok = tokens[0].type == type && tokens[0].length == strlen(first) && tokens[0].format == format &&
+              strncmp(src, first, tokens[0].length) == 0;
+    if (ok && type == TT_STRING) ok = lexer.literal(tokens[0]) == text;
+    if (ok && type == TT_CHAR) ok = lexer.constants[tokens[0].lexeme].integer == static_cast<unsigned char>(text[0]);
+    check(ok, "literal", src);
+}
+
+int main() {
+    checkInt("0", 0);
+    checkInt("1_000_000", 1000000);
+    checkInt("9223372036854775807", INT64_MAX);
+    checkInt("9223372036854775808", INT64_MAX, true);
+    checkInt("123456789012345678901234567890", INT64_MAX, true);
+    checkInt("0x7fff_FFFF", 0x7FFFFFFF);
+    checkInt("0XFFFFFFFFFFFFFFFF", -1);
+    checkInt("0x1_0000_0000_0000_0000", 0, true);
+    checkInt("0b1011", 11);
+    checkInt("0B1111_0000", 240);
+
+    checkReal("3.25", 3.25);
+    checkReal("1e10", 1e10);
+    checkReal("1E-5", 1e-5);
+    checkReal("2.5e+3", 2500.0);
+    checkReal("1_000.000_5", 1000.0005);
+    checkReal("0.1", 0.1);
+    checkReal("123456789e30", 123456789e30);
+    checkReal("1e300", 1e300);
+    checkReal("1e400", HUGE_VAL, F_FLOAT, true);
+    checkReal("1e-400", 0.0);
+    checkReal("3.14159265358979323846264338327950288", 3.14159265358979323846);
+    checkReal("2j", 2.0, F_COMPLEX);
+    checkReal("0.5e1j", 5.0, F_COMPLEX);
+
+    // Random doubles round-trip exactly through both paths
+    std::mt19937_64 rng(5);
+    char text[64];
+    for (int i = 0; i < 100000; ++i) {
+        double value;
+        if (i & 1) {
+            uint64_t bits = rng() & 0x7FEFFFFFFFFFFFFFull;
+            memcpy(&value, &bits, sizeof(value));
+            snprintf(text, sizeof(text), "%.17g", value);
+        } else {
+            snprintf(text, sizeof(text), "%llu.%03llue%d", static_cast<unsigned long long>(rng() % 100000),
+                     static_cast<unsigned long long>(rng() % 1000), static_cast<int>(rng() % 60) - 30);
+        }
+        if (!strchr(text, '.') && !strchr(text, 'e')) continue;
+        double expected = strtod(text, nullptr);
+        Constant constant = decodeNumber(text, static_cast<uint32_t>(strlen(text)));
+        if (constant.real != expected) {
+            check(false, "round trip", text);
+            break;
+        }
+    }
+
+    checkLexed("0x1F + 1", "0x1F", F_INT);
+    checkLexed("0b_1", "0", F_INT);
+    checkLexed("1_000_", "1_000", F_INT);
+    checkLexed("12abc", "12", F_INT);
+    checkLexed("1e5x", "1e5", F_FLOAT);
+    checkLexed("1e+", "1", F_INT);
+    checkLexed("2.5e-3j", "2.5e-3j", F_COMPLEX);
+    checkLexed("4jx", "4", F_INT);
+    checkLexed("7.", "7", F_INT);
+
+    // Equal spellings share a constant, the token format comes from it
+    Lexer lexer{std::string("a = 1.5 + 0x10 + 1.5 + 16\n")};
+    std::vector<Token> tokens = lexer.tokenize();
+    check(lexer.constants.size() == 3, "shared constants", "1.5 0x10 16");
+    check(tokens[2].lexeme == tokens[6].lexeme && lexer.constants[tokens[4].lexeme].integer == 16, "constant slots", "");
+
+    checkChar("'a'", 'a');
+    checkChar("'\\n'", '\n');
+    checkChar("'\\''", '\'');
+    checkChar("'\\x41'", 0x41);
+    checkChar("'\\u00e9'", 0xE9);
+    checkChar("'\xC3\xA9'", 0xE9);
+    checkChar("'\\U0001F600'", 0x1F600);
+    checkChar("''", 0, true);
+    checkChar("'ab'", 0, true);
+    checkChar("'\\q'", 0, true);
+    checkChar("'\\uD800'", 0, true);
+
+    checkString("plain", "plain");
+    checkString("a\\tb\\nc", "a\tb\nc");
+    checkString("\\\"q\\\" \\\\", "\"q\" \\");
+    checkString("\\x41\\x4a!", "AJ!");
+    checkString("\\u00e9\\U0001F600", "\xC3\xA9\xF0\x9F\x98\x80");
+    checkString("\\0z", std::string("\0z", 2));
+    checkString("\\q \\x4 \\", "\\q \\x4 \\");
+
+    checkLiteral("\"plain text\" + 1", TT_STRING, "\"plain text\"", F_NONE, "plain text");
+    checkLiteral("\"\" x", TT_STRING, "\"\"", F_NONE, "");
+    checkLiteral("\"say \\\"hi\\\"\\n\" x", TT_STRING, "\"say \\\"hi\\\"\\n\"", F_ESCAPED, "say \"hi\"\n");
+    checkLiteral("\"it's\"", TT_STRING, "\"it's\"", F_NONE, "it's");
+    checkLiteral("\"open\n\"", TT_UNKNOWN, "\"open", F_NONE, "");
+    checkLiteral("\"slash\\\nx\"", TT_UNKNOWN, "\"slash\\", F_NONE, "");
+    checkLiteral("'x' + 1", TT_CHAR, "'x'", F_INT, "x");
+    checkLiteral("'\\'' x", TT_CHAR, "'\\''", F_INT, "'");
+    checkLiteral("'\"'", TT_CHAR, "'\"'", F_INT, "\"");
+    checkLiteral("'open", TT_UNKNOWN, "'open", F_NONE, "");
+
+    // A view lexer reads plain strings from the caller's buffer, also in its tail
+    std::string viewed = "a = \"first\"\nb = \"last\" + \"tab\\t\"";
+    Lexer view{std::string_view(viewed)};
+    std::vector<Token> viewTokens = view.tokenize();
+    check(view.literal(viewTokens[2]) == "first" && view.literal(viewTokens[6]) == "last" &&
+          view.literal(viewTokens[8]) == "tab\t", "view literals", viewed.c_str());
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
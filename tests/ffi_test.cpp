@@ -0,0 +1,169 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "ffi.hpp"
+#include "vm_harness.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static int64_t mixed(int64_t a, double b, int64_t c, double d) {
+    return a * 1000 + static_cast<int64_t>(b * 100) + c * 10 + static_cast<int64_t>(d);
+}
+static int32_t negative(int64_t a) { return static_cast<int32_t>(-a); }
+static int64_t widen(int32_t a) { return a; }
+static double half(double x) { return x / 2; }
+static int64_t answer() { return 42; }
+static int64_t touched = 0;
+static void touch(int64_t value) { touched = value; }
+
+// Runs src with the C functions named below bound, compiled both ways and
+// with the JIT off and on; all four must agree, printing included
+static bool runs(const std::string& src, Value& result, std::string& error) {
+    ForeignLibrary process(nullptr);
+    ForeignFunction labs, cos, half;
+    process.lookup("labs", "l(l)", labs);
+    process.lookup("cos", "d(d)", cos);
+    half.address = reinterpret_cast<void*>(&::half);
+    half.call = foreignTrampoline("d(d)", half.params);
+
+    bool first = true, ran = false;
+    std::string output;
+    for (int optimizing = 0; optimizing < 2; ++optimizing) {
+        Program program;
+        if (!compileSource(src, optimizing, program, error)) return false;
+        for (uint32_t threshold : {0u, 1u}) {
+            VM vm(program);
+            vm.define("labs", labs);
+            vm.define("cos", cos);
+            vm.define("half", half);
+            vm.setJit(threshold);
+            Outcome outcome = runCaptured(vm);
+            if (first) {
+                ran = outcome.ran;
+                result = outcome.result;
+                error = outcome.error;
+                output = outcome.output;
+                first = false;
+            } else {
+                bool same = outcome.ran ? outcome.result.type == result.type && outcome.result.index == result.index
+                                        : message(outcome.error) == message(error);
+                check(outcome.ran == ran && same && outcome.output == output, ("compilers and JIT agree: " + src).c_str());
+            }
+        }
+    }
+    return ran;
+}
+
+static void testSignatures() {
+    uint32_t params = 99;
+    check(foreignTrampoline("d(d)", params) && params == 1, "one double");
+    check(foreignTrampoline("v()", params) && params == 0, "no parameters");
+    check(foreignTrampoline("l(lidd)", params) && params == 4, "four parameters");
+    params = 99;
+    check(!foreignTrampoline("l(lllll)", params) && params == 99, "too many parameters");
+    check(!foreignTrampoline("x(d)", params), "unknown return type");
+    check(!foreignTrampoline("d(q)", params), "unknown parameter type");
+    check(!foreignTrampoline("d(d", params) && !foreignTrampoline("d(d)x", params), "unbalanced");
+    check(!foreignTrampoline("", params) && !foreignTrampoline(nullptr, params), "empty");
+    check(foreignTrampoline("l(i)", params) != foreignTrampoline("l(l)", params), "int parameters are their own");
+    check(foreignTrampoline("l(dii)", params) != foreignTrampoline("l(dil)", params), "so is each place");
+    check(foreignTrampoline("i(l)", params) != foreignTrampoline("l(l)", params), "int returns don't");
+    check(foreignTrampoline("d(ld)", params) != foreignTrampoline("d(dl)", params), "parameter order matters");
+}
+
+static void testTrampolines() {
+    uint32_t params = 0;
+    Value args[4] = {Value::ofInt(1), Value::ofReal(2.5), Value::ofInt(3), Value::ofInt(4)};
+    Value result;
+    ForeignCall call = foreignTrampoline("l(ldld)", params);
+    check(call && call(reinterpret_cast<void*>(&mixed), args, result) && result.type == V_INT && result.integer == 1284,
+          "mixed parameters, int converted to double");
+    args[0] = Value::ofReal(1.0);
+    check(call && !call(reinterpret_cast<void*>(&mixed), args, result), "float for an int parameter");
+    args[0] = Value::of(V_NONE);
+    call = foreignTrampoline("d(d)", params);
+    check(call && !call(reinterpret_cast<void*>(&half), args, result), "none for a double parameter");
+
+    args[0] = Value::ofInt(5);
+    call = foreignTrampoline("i(l)", params);
+    check(call && call(reinterpret_cast<void*>(&negative), args, result) && result.integer == -5,
+          "int return is sign extended");
+    call = foreignTrampoline("l(i)", params);
+    args[0] = Value::ofInt(INT32_MIN);
+    check(call && call(reinterpret_cast<void*>(&widen), args, result) && result.integer == INT32_MIN,
+          "int parameter takes the smallest int");
+    args[0] = Value::ofInt(static_cast<int64_t>(INT32_MAX) + 1);
+    check(call && !call(reinterpret_cast<void*>(&widen), args, result), "int parameter refuses what needs 64 bits");
+    args[0] = Value::ofInt(static_cast<int64_t>(INT32_MIN) - 1);
+    check(call && !call(reinterpret_cast<void*>(&widen), args, result), "so below the smallest int");
+    args[0] = Value::ofInt(5);
+    call = foreignTrampoline("l()", params);
+    check(call && call(reinterpret_cast<void*>(&answer), args, result) && result.integer == 42, "no arguments");
+    call = foreignTrampoline("v(l)", params);
+    check(call && call(reinterpret_cast<void*>(&touch), args, result) && result.type == V_NONE && touched == 5,
+          "void return gives none");
+}
+
+static void testLibraries() {
+    ForeignLibrary process(nullptr);
+    check(process.isOpen(), "the running program opens");
+    ForeignFunction function;
+    check(process.lookup("labs", "l(l)", function) && function.params == 1, "labs from libc");
+    Value args[2] = {Value::ofInt(-7), Value::ofInt(0)};
+    Value result;
+    check(function.call(function.address, args, result) && result.integer == 7, "labs runs");
+    check(!process.lookup("no_such_function_here", "v()", function) && process.error.find("no symbol") == 0,
+          "missing symbol");
+    check(!process.lookup("labs", "l(z)", function) && process.error.find("bad signature") == 0, "bad signature");
+
+    ForeignLibrary missing("no_such_library.so");
+    check(!missing.isOpen() && !missing.error.empty() && !missing.lookup("labs", "l(l)", function), "missing library");
+#ifdef __linux__
+    ForeignLibrary libm("libm.so.6");
+    check(libm.isOpen() && libm.lookup("pow", "d(dd)", function), "pow from libm by name");
+    args[0] = Value::ofInt(2);
+    args[1] = Value::ofReal(10);
+    check(function.call(function.address, args, result) && result.type == V_FLOAT && result.real == 1024, "pow runs");
+#endif
+}
+
+static void testVm() {
+    Value result;
+    std::string error;
+    check(runs("return cos(0.0) + labs(-3)\n", result, error) && result.type == V_FLOAT && result.real == 4.0,
+          "C functions from the language");
+    const char* loop =
+        "f(n):\n"
+        "    s = 0\n"
+        "    i = 0\n"
+        "    while i < n:\n"
+        "        s += labs(i - 50) + half(i)\n"
+        "        i += 1\n"
+        "    return s\n"
+        "return f(100)\n";
+    check(runs(loop, result, error) && result.type == V_FLOAT && result.real == 2500 + 2475, "C calls in a hot loop");
+    check(!runs("return cos(1, 2)\n", result, error) && error.find("wrong argument count for cos") != std::string::npos,
+          "arity");
+    check(!runs("return labs(1.5)\n", result, error) && error.find("wrong argument types for labs") != std::string::npos,
+          "argument types");
+    check(runs("return cos == cos && cos != labs\n", result, error) && result.integer == 1, "foreign values compare");
+    check(runs("labs(x):\n    return 0\nreturn labs(-3)\n", result, error) && result.integer == 0, "a def wins");
+    check(!runs("return sin(1.0)\n", result, error) && error.find("undefined name sin") != std::string::npos,
+          "unbound names stay undefined");
+}
+
+int main() {
+    testSignatures();
+    testTrampolines();
+    testLibraries();
+    testVm();
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
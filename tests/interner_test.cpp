@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "interner.hpp"
+#include "lexer.hpp"
+
+int main() {
+    Interner interner(64);  // Small, so shards grow under contention
+    int failures = 0;
+
+    // Threads intern overlapping ranges; equal strings must get equal ids
+    const int threads = 8, names = 20000;
+    std::vector<std::vector<symbol_t>> ids(threads, std::vector<symbol_t>(names));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < names; ++i) {
+                int n = (i * 7 + t * 131) % names;
+                ids[t][n] = interner.intern("symbol_" + std::to_string(n));
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    for (int n = 0; n < names; ++n) {
+        for (int t = 1; t < threads; ++t)
+            if (ids[t][n] != ids[0][n]) ++failures;
+        if (interner.name(ids[0][n]) != "symbol_" + std::to_string(n)) ++failures;
+    }
+    if (interner.size() != static_cast<size_t>(names)) ++failures;
+
+    // Lexers sharing the table agree on symbols across files, serial and parallel
+    std::string a = "alpha = beta + 1\nlong_custom = alpha <=> gamma\n";
+    std::string b = "gamma = alpha\n    beta\n";
+    Lexer first(a), second(b);
+    first.setInterner(&interner);
+    second.setInterner(&interner);
+    std::vector<Token> tokensA = first.tokenize();
+    std::vector<Token> tokensB = second.tokenize();
+    if (tokensA[0].lexeme != tokensB[2].lexeme || tokensA[2].lexeme != tokensB[5].lexeme) ++failures;
+    for (const Token& token : tokensA) {
+        if (token.type == TT_IDENT && interner.name(token.lexeme) != std::string_view(a).substr(token.offset, token.length))
+            ++failures;
+    }
+
+    std::string big;
+    for (int i = 0; i < 500; ++i) big += "f" + std::to_string(i % 50) + " = x" + std::to_string(i) + " >>> 2\n";
+    ThreadPool pool(4);
+    Lexer serial(big), parallel(big);
+    serial.setInterner(&interner);
+    parallel.setInterner(&interner);
+    std::vector<Token> expected = serial.tokenize();
+    std::vector<Token> tokens = parallel.tokenizeParallel(pool, 256);
+    if (expected.size() != tokens.size()) ++failures;
+    for (size_t i = 0; i < expected.size() && i < tokens.size(); ++i)
+        if (expected[i].lexeme != tokens[i].lexeme || expected[i].type != tokens[i].type) ++failures;
+
+    // Hash and compare read only inside the name (run under ASan), hash every
+    // byte, and agree with memcmp at every length around the load widths
+    std::unordered_set<uint64_t> hashes;
+    for (uint32_t length = 0; length <= 70; ++length) {
+        std::unique_ptr<char[]> name(new char[length ? length : 1]);
+        std::unique_ptr<char[]> other(new char[length ? length : 1]);
+        memset(name.get(), 'a', length);
+        hashes.insert(hashSymbol(name.get(), length));
+        for (uint32_t i = 0; i < length; ++i) {
+            name[i] = 'b';
+            hashes.insert(hashSymbol(name.get(), length));
+            memcpy(other.get(), name.get(), length);
+            if (!sameName(name.get(), other.get(), length)) ++failures;
+            other[length - 1 - i] ^= 1;
+            if (sameName(name.get(), other.get(), length)) ++failures;
+            name[i] = 'a';
+        }
+    }
+    if (hashes.size() != 71 + 70 * 71 / 2) ++failures;
+
+    printf("%s (%d failures)\n", failures ? "interner mismatches" : "interner consistent", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "vm_harness.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static bool buildIr(const std::string& src, IrModule& module, std::string& error) {
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    IrBuilder builder(parser.arena, lexer);
+    if (builder.build(root, module)) return true;
+    error = builder.errors.empty() ? "" : builder.errors[0];
+    return false;
+}
+
+// Dump of the first def, or of the module body if there is none
+static std::string optimized(const std::string& src, PassStats* stats = nullptr) {
+    IrModule module;
+    std::string error;
+    if (!buildIr(src, module, error)) return "error: " + error;
+    PassStats totals = optimize(module);
+    if (stats) *stats = totals;
+    return dumpIr(module, module.functions[module.functions.size() > 1 ? 1 : 0]);
+}
+
+static size_t count(const std::string& text, const char* what) {
+    size_t n = 0;
+    for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) ++n;
+    return n;
+}
+
+static bool sameOutcome(const Outcome& a, const Outcome& b) {
+    if (a.ran != b.ran || a.output != b.output) return false;
+    if (!a.ran) return message(a.error) == message(b.error);
+    return a.result.type == b.result.type && a.result.index == b.result.index;
+}
+
+// The tree compiler, the IR lowered as built, and the IR after the passes
+// must all run src to the same result, output and error
+static bool agrees(const std::string& src, int64_t expected) {
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    Program direct;
+    Compiler compiler(parser.arena, lexer);
+    if (!compiler.compile(root, direct)) {
+        printf("  compile: %s\n", compiler.errors[0].c_str());
+        return false;
+    }
+    VM referenceVm(direct, 1 << 16);
+    Outcome reference = runCaptured(referenceVm);
+
+    bool ok = true;
+    for (int optimizing = 0; optimizing < 2; ++optimizing) {
+        IrModule module;
+        IrBuilder builder(parser.arena, lexer);
+        std::vector<std::string> errors;
+        Program lowered;
+        if (!builder.build(root, module)) {
+            printf("  build: %s\n", builder.errors[0].c_str());
+            return false;
+        }
+        if (optimizing) optimize(module);
+        if (!lowerModule(module, lowered, errors)) {
+            printf("  lower: %s\n", errors.empty() ? "" : errors[0].c_str());
+            return false;
+        }
+        VM vm(lowered, 1 << 16);
+        Outcome outcome = runCaptured(vm);
+        if (!sameOutcome(reference, outcome)) {
+            printf("  %s: %s vs %s\n", optimizing ? "optimized" : "unoptimized",
+                   reference.ran ? valueString(reference.result).c_str() : reference.error.c_str(),
+                   outcome.ran ? valueString(outcome.result).c_str() : outcome.error.c_str());
+            ok = false;
+        }
+    }
+    if (expected != INT64_MIN && !(reference.ran && reference.result.type == V_INT && reference.result.integer == expected)) {
+        printf("  expected %lld, got %s\n", static_cast<long long>(expected),
+               reference.ran ? valueString(reference.result).c_str() : reference.error.c_str());
+        ok = false;
+    }
+    return ok;
+}
+
+static void testBuilder() {
+    IrModule module;
+    std::string error;
+    check(buildIr("def f(n):\n    i = 0\n    while i < n:\n        i += 1\n    return i\n", module, error), "loop builds");
+    std::string text = module.functions.size() == 2 ? dumpIr(module, module.functions[1]) : "";
+    check(count(text, " = phi ") == 2, "phis for the names read in the loop header");
+    check(text.find("; compound") != std::string::npos, "compound assignment is flagged");
+    check(text.find("param 0") != std::string::npos, "parameter");
+    optimize(module);
+    check(count(dumpIr(module, module.functions[1]), " = phi ") == 1, "the phi of the unchanged name folds");
+
+    check(buildIr("def f(a, b):\n    if a:\n        x = 1\n    else:\n        x = b\n    return x\n", module, error),
+          "diamond builds");
+    text = dumpIr(module, module.functions[1]);
+    check(count(text, " = phi ") == 1, "one phi where the branches meet");
+    check(text.find("undef") == std::string::npos, "no undefined read");
+
+    check(buildIr("def f():\n    return y\n    y = 1\n", module, error), "read before assignment builds");
+    text = dumpIr(module, module.functions[1]);
+    check(text.find("undef") != std::string::npos, "local read before assignment");
+    check(text.find("check") != std::string::npos && text.find(" y") != std::string::npos, "the read is checked");
+    optimize(module);
+    check(dumpIr(module, module.functions[1]).find("check") != std::string::npos, "the check outlives the passes");
+
+    check(buildIr("def f(a):\n    if a:\n        x = 1\n    else:\n        x = 2\n    return x\n", module, error),
+          "assigned on both branches builds");
+    check(dumpIr(module, module.functions[1]).find("check") == std::string::npos, "assigned reads are not checked");
+
+    check(buildIr("x = 1\nx += 2\nreturn x\n", module, error), "module body builds");
+    text = dumpIr(module, module.functions[0]);
+    check(count(text, "setglobal x") == 2 && text.find("getglobal x") != std::string::npos, "module names are globals");
+
+    check(!buildIr("return 2j\n", module, error) && error.find("complex") != std::string::npos, "complex rejected");
+    check(!buildIr("1 = 2\n", module, error) && error.find("assign to a name") != std::string::npos, "bad target");
+}
+
+static void testFolding() {
+    std::string text = optimized("def f():\n    x = 2 * 3 + 1\n    return x << 2\n");
+    check(text.find("ret v") != std::string::npos && text.find("int 28") != std::string::npos, "arithmetic folds");
+    check(count(text, "\n") == 3, "only the result is left");
+
+    text = optimized("def f(a):\n    if 1 < 2:\n        return a\n    return 0\n");
+    check(text.find("branch") == std::string::npos && text.find("int 0") == std::string::npos, "constant branch folds");
+
+    text = optimized("def f(a):\n    x = 5\n    if a:\n        x = 5\n    return x + 1\n");
+    check(text.find("int 6") != std::string::npos && text.find("phi") == std::string::npos, "equal phi operands fold");
+
+    text = optimized("def f():\n    return 1 / 0\n");
+    check(text.find("div") != std::string::npos, "division by zero is left to trap");
+
+    text = optimized("def f():\n    return 1.5 * 2\n");
+    check(text.find("float 3") != std::string::npos, "mixed constants fold to a float");
+}
+
+static void testSimplify() {
+    std::string text = optimized("def f(a):\n    a = a & 255\n    a += 0\n    a *= 8\n    return a\n");
+    check(text.find("shl") != std::string::npos && text.find("mul") == std::string::npos, "multiply by 8 is a shift");
+    check(count(text, " = add ") == 0, "adding 0 disappears");
+
+    text = optimized("def f(a):\n    a *= 8\n    return a\n");
+    check(text.find("mul") != std::string::npos, "no shift when a may be a float");
+
+    text = optimized("def f(a):\n    a = a & 255\n    a -= 1\n    a -= 2\n    a += 10\n    return a\n");
+    check(count(text, " = add ") == 1 && text.find("int 7") != std::string::npos, "constant steps combine");
+
+    text = optimized("def f(a, b):\n    if !(a < b):\n        return 1\n    return 2\n");
+    check(text.find("not") == std::string::npos, "branch on a negation swaps its targets");
+
+    text = optimized("def f(a):\n    a = a ^ 3\n    return a - a\n");
+    check(text.find("sub") == std::string::npos && text.find("int 0") != std::string::npos, "x - x on ints");
+    text = optimized("def f(a):\n    return a - a\n");
+    check(text.find("sub") != std::string::npos, "x - x kept when x may be a float or fail");
+}
+
+static void testCse() {
+    std::string text = optimized("def f(a, b):\n    x = a * b + 1\n    y = b * a + 1\n    return x == y\n");
+    check(count(text, " = mul ") == 1, "commuted multiply numbered once");
+    check(count(text, " = add ") == 1, "add of the same values numbered once");
+
+    text = optimized("def f(a, b):\n    if a:\n        x = a + b\n    else:\n        x = a + b\n    return x\n");
+    check(count(text, " = add ") == 2, "sibling branches don't share");
+
+    text = optimized("def f(a, b):\n    x = a + b\n    if a:\n        x = a + b\n    return x\n");
+    check(count(text, " = add ") == 1 && text.find("phi") == std::string::npos, "dominating value reused");
+}
+
+static void testDce() {
+    std::string text = optimized("def f(a):\n    x = a + 1\n    y = a == 2\n    return a\n");
+    check(text.find("eq") == std::string::npos, "unused comparison removed");
+    check(text.find("add") != std::string::npos, "unused add that could fail kept");
+
+    text = optimized("def f(a):\n    a = a & 1\n    x = a + 1\n    return a\n");
+    check(text.find("add") == std::string::npos, "unused int add removed");
+
+    text = optimized("def f():\n    g()\n    return 0\n");
+    check(text.find("call") != std::string::npos, "calls kept");
+
+    PassStats stats;
+    optimized("def f(a):\n    return a * 1 + 0 * 2\n", &stats);
+    check(stats.changes[PASS_FOLD] > 0, "fold counted");
+    check(!strcmp(passName(PASS_CSE), "cse"), "pass names");
+}
+
+static void testLowering() {
+    check(agrees("return 1 + 2 * 3 - 4 / 2\n", 5), "module arithmetic");
+    check(agrees("i = 0\ns = 0\nwhile i < 100:\n    s += i\n    i += 1\nreturn s\n", 4950), "while over globals");
+    check(agrees("def sum(n):\n    s = 0\n    while n:\n        s += n\n        n -= 1\n    return s\nreturn sum(100)\n", 5050),
+          "while over locals");
+    check(agrees("fib(n):\n    if n < 2:\n        return n\n    return fib(n - 1) + fib(n - 2)\nreturn fib(20)\n", 6765),
+          "recursion");
+    // Loop-carried values that trade places need a cycle of copies
+    check(agrees("def f(n):\n    a = 0\n    b = 1\n    while n:\n        t = a\n        a = b\n        b = t\n        n -= 1\n"
+                 "    return a * 10 + b\nreturn f(5) * 100 + f(4)\n",
+                 1001),
+          "swap in a loop");
+    check(agrees("def f(n):\n    a = 0\n    b = 1\n    while n > 0:\n        c = a + b\n        a = b\n        b = c\n"
+                 "        n -= 1\n    return a\nreturn f(50)\n",
+                 12586269025),
+          "fibonacci loop");
+    check(agrees("def f(a, b, c):\n    return a * 100 + b * 10 + c\nreturn f(1, f(0, 0, 2), 3)\n", 123), "nested calls");
+    check(agrees("def f(x):\n    y = x + 1\n    z = g(y)\n    return y + z\ndef g(v):\n    return v * 2\nreturn f(3)\n", 12),
+          "value live across a call");
+    check(agrees("def f(a):\n    return a && 7 || 3\nreturn f(0) * 10 + f(1)\n", 37), "logical operators");
+    check(agrees("def f(x):\n    if x > 90:\n        return 4\n    elif x > 80:\n        return 3\n    else:\n        return 1\n"
+                 "return f(95) * 100 + f(85) * 10 + f(5)\n",
+                 431),
+          "elif chain");
+    check(agrees("def f():\n    x = 0\n    k = 0\n    while k < 10:\n        if k & 1:\n            x += k\n        else:\n"
+                 "            x -= 1\n        k += 1\n    return x\nreturn f()\n",
+                 20),
+          "branch in a loop");
+    check(agrees("def f(a):\n    s = 0.0\n    while a:\n        s += 1 / a\n        a -= 1\n    return s * 1000\nreturn f(3)\n",
+                 INT64_MIN),
+          "floats");
+    check(agrees("print(1, 2.5, 3 > 4)\nprint(1.0 / 3, 100000)\n", INT64_MIN), "print");
+    check(agrees("def f(n):\n    return f(n + 1)\nreturn f(0)\n", INT64_MIN), "stack overflow");
+    check(agrees("return 1 / 0\n", INT64_MIN), "division by zero");
+    check(agrees("def f(a):\n    x = a + 1\n    return 0\nreturn f(f)\n", INT64_MIN), "dead add still fails");
+    check(agrees("def f():\n    y = y + 1\n    return y\nreturn f()\n", INT64_MIN), "local read before assignment");
+    check(agrees("return missing(1 / 0)\n", INT64_MIN), "callee looked up before its arguments");
+    check(agrees("x = 100000\ny = -100000\nreturn x + y + 9223372036854775807\n", 9223372036854775807LL), "big constants");
+    check(agrees("def f(a):\n    if a:\n        return 1\n    return 2\n    a = 5\nreturn f(0)\n", 2), "unreachable tail");
+
+    // More values live at once than registers would hold
+    std::string wide = "def f(a):\n";
+    for (int i = 0; i < 300; ++i) wide += "    v" + std::to_string(i) + " = a + " + std::to_string(i) + "\n";
+    wide += "    return v0";
+    for (int i = 1; i < 300; ++i) wide += " + v" + std::to_string(i);
+    wide += "\nreturn f(1)\n";
+    IrModule module;
+    std::string error;
+    Program program;
+    std::vector<std::string> errors;
+    check(buildIr(wide, module, error) && !lowerModule(module, program, errors) && !errors.empty() &&
+              errors[0].find("256 registers") != std::string::npos,
+          "register limit");
+}
+
+static void testParallel() {
+    std::string src;
+    for (int i = 0; i < 40; ++i) {
+        std::string n = std::to_string(i);
+        src += "def f" + n + "(a, b):\n    x = a * b + " + n + "\n    y = b * a + " + n + "\n    if 1:\n        x = x & 255\n"
+               "    while x > 0:\n        x -= 2 * 4\n    return x + y - y\n";
+    }
+    IrModule serial, parallel;
+    std::string error;
+    check(buildIr(src, serial, error) && buildIr(src, parallel, error), "many functions build");
+    PassStats one = optimize(serial);
+    ThreadPool workers(4);
+    PassStats many = optimize(parallel, &workers);
+    bool same = serial.functions.size() == parallel.functions.size();
+    for (size_t i = 0; same && i < serial.functions.size(); ++i)
+        same = dumpIr(serial, serial.functions[i]) == dumpIr(parallel, parallel.functions[i]);
+    check(same, "parallel passes give the same IR");
+    bool counted = true;
+    for (int pass = 0; pass < IR_PASSES; ++pass) counted &= one.changes[pass] == many.changes[pass];
+    check(counted, "parallel passes make the same changes");
+}
+
+int main() {
+    testBuilder();
+    testFolding();
+    testSimplify();
+    testCse();
+    testDce();
+    testLowering();
+    testParallel();
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "vm_harness.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static Outcome execute(const Program& program, uint32_t threshold, size_t stackValues = 1 << 16) {
+    VM vm(program, stackValues);
+    vm.setJit(threshold);
+    return runCaptured(vm);
+}
+
+static bool sameOutcome(const Outcome& a, const Outcome& b) {
+    return a.ran == b.ran && a.error == b.error && a.output == b.output && a.result.type == b.result.type &&
+           (a.result.type == V_NONE || a.result.type == V_UNSET || a.result.index == b.result.index);
+}
+
+// Interpreted and compiled from the first call must agree, for both
+// compilers' bytecode; returns the JIT's outcome on the tree compiler's
+static Outcome jitted(const std::string& src, size_t stackValues = 1 << 16) {
+    Outcome first;
+    for (int optimizing = 0; optimizing < 2; ++optimizing) {
+        Program program;
+        std::string error;
+        if (!compileSource(src, optimizing, program, error)) {
+            check(false, ("compiles: " + src + error).c_str());
+            return Outcome();
+        }
+        Outcome interpreted = execute(program, 0, stackValues);
+        Outcome compiled = execute(program, 1, stackValues);
+        check(sameOutcome(interpreted, compiled), ("JIT agrees with the interpreter: " + src).c_str());
+        if (!sameOutcome(interpreted, compiled))
+            printf("  interpreted %s%s, compiled %s%s\n", valueString(interpreted.result).c_str(),
+                   interpreted.error.c_str(), valueString(compiled.result).c_str(), compiled.error.c_str());
+        check(!LIGHTNING_JIT || compiled.entries > 0, ("native code ran: " + src).c_str());
+        if (!optimizing) first = compiled;
+    }
+    return first;
+}
+
+static bool returnsInt(const std::string& src, int64_t expected) {
+    Outcome outcome = jitted(src);
+    return outcome.ran && outcome.result.type == V_INT && outcome.result.integer == expected;
+}
+
+static bool returnsReal(const std::string& src, double expected) {
+    Outcome outcome = jitted(src);
+    return outcome.ran && outcome.result.type == V_FLOAT && outcome.result.real == expected;
+}
+
+static bool fails(const std::string& src, const char* message) {
+    Outcome outcome = jitted(src);
+    return !outcome.ran && outcome.error.find(message) != std::string::npos;
+}
+
+// Wraps body in a function f(a, b) that loops a few times, so native code
+// runs the body on entry and again from the back edge
+static std::string looped(const char* body, const char* args) {
+    return std::string("f(a, b):\n    i = 0\n    r = 0\n    while i < 3:\n        r = ") + body +
+           "\n        i += 1\n    return r\nreturn f(" + args + ")\n";
+}
+
+static void testIntegers() {
+    check(returnsInt(looped("a + b", "5, 7"), 12), "add");
+    check(returnsInt(looped("a - b", "5, 7"), -2), "sub");
+    check(returnsInt(looped("a * b", "-5, 7"), -35), "mul");
+    check(returnsInt(looped("a / b", "-7, 2"), -3), "div truncates");
+    check(returnsInt(looped("a % b", "-7, 2"), -1), "mod");
+    check(returnsInt(looped("a / b", "-9223372036854775807 - 1, -1"), -9223372036854775807 - 1), "div by -1");
+    check(returnsInt(looped("a % b", "-9223372036854775807 - 1, -1"), 0), "mod by -1");
+    check(returnsInt(looped("(a & b) * 100 + (a | b) * 10 + (a ^ b)", "5, 3"), 1 * 100 + 7 * 10 + 6), "bitwise");
+    check(returnsInt(looped("(a << b) + (-a >> 1)", "3, 65"), 6 - 2), "shifts take counts mod 64");
+    check(returnsInt(looped("(a == b) + (a != b) * 10 + (a < b) * 100 + (a <= b) * 1000", "2, 3"), 1110), "compare");
+    check(returnsInt(looped("(a > b) + (a >= b) * 10", "3, 3"), 10), "swapped compare");
+    check(returnsInt(looped("-a + ~b + !a + !0", "4, 0"), -4 - 1 + 0 + 1), "unary");
+    check(returnsInt(looped("a + 100 - 3", "1, 0"), 98), "immediates");
+    check(returnsInt(looped("a + 9223372036854775807", "1, 0"), -9223372036854775807 - 1), "ints wrap");
+    check(returnsInt(looped("a + 100000 + b", "1, 0"), 100001), "constants");
+    check(returnsInt(looped("a && b", "1, 9"), 9), "and");
+}
+
+static void testFloats() {
+    check(returnsReal(looped("a + b", "1.5, 2"), 3.5), "float add");
+    check(returnsReal(looped("a - b", "1, 0.25"), 0.75), "float sub");
+    check(returnsReal(looped("a * b", "1.5, 1.5"), 2.25), "float mul");
+    check(returnsReal(looped("a / b", "1, 4.0"), 0.25), "float div");
+    check(returnsReal(looped("a / b", "1.0, 0"), 1.0 / 0.0), "float div by int zero");
+    check(returnsReal(looped("a % b", "7.5, 2"), 1.5), "float mod leaves native code");
+    check(returnsReal(looped("-a", "2.5, 0"), -2.5), "float neg");
+    check(returnsReal(looped("a + 1", "0.5, 0"), 1.5), "float add of an immediate");
+    check(returnsInt(looped("(a < b) + (a <= b) * 10 + (a == b) * 100 + (a != b) * 1000", "1.5, 2"), 1011), "float compare");
+    check(returnsInt(looped("(a == b) + (a != b) * 10 + (a < b) * 100 + (a <= b) * 1000", "0.0 / 0, 1.0"), 10),
+          "compares with nan");
+    check(returnsInt(looped("(a == b) * 10 + (a != b)", "f, f"), 10), "compare functions");
+    check(returnsReal("pi(terms):\n"
+                      "    s = 0.0\n"
+                      "    sign = 1.0\n"
+                      "    k = 0\n"
+                      "    while k < terms:\n"
+                      "        s += sign / (2 * k + 1)\n"
+                      "        sign = -sign\n"
+                      "        k += 1\n"
+                      "    return s * 4\n"
+                      "return pi(1000)\n",
+                      3.140592653839794),
+          "leibniz");
+    check(returnsReal(looped("b", "0, 1.5"), 1.5), "floats move whole");
+}
+
+static void testControlFlow() {
+    check(returnsInt("count(n):\n    i = 0\n    while i < n:\n        i += 1\n    return i\nreturn count(100000)\n", 100000),
+          "loop");
+    check(returnsInt("steps(n):\n"
+                     "    s = 0\n"
+                     "    while n != 1:\n"
+                     "        if n & 1:\n"
+                     "            n = 3 * n + 1\n"
+                     "        else:\n"
+                     "            n = n >> 1\n"
+                     "        s += 1\n"
+                     "    return s\n"
+                     "return steps(27)\n",
+                     111),
+          "collatz");
+    check(returnsInt("fib(n):\n    if n < 2:\n        return n\n    return fib(n - 1) + fib(n - 2)\nreturn fib(20)\n", 6765),
+          "calls leave native code and come back");
+    check(returnsInt("i = 0\ns = 0\nwhile i < 100:\n    s += i\n    i += 1\nreturn s\n", 4950), "globals in the module body");
+    check(returnsInt("f(x):\n    while x:\n        x = x - 0.5\n    return 7\nreturn f(2.0)\n", 7), "float conditions");
+    Outcome printed = jitted("i = 0\nwhile i < 3:\n    print(i, i * 0.5)\n    i += 1\n");
+    check(printed.ran && printed.output == "0 0.0\n1 0.5\n2 1.0\n", "natives from a compiled loop");
+}
+
+static void testErrors() {
+    check(fails(looped("a / b", "1, 0"), "in f at "), "division by zero reports the interpreter's pc");
+    check(fails(looped("a % b", "1, 0"), "division by zero"), "modulo by zero");
+    check(fails(looped("a + missing", "1, 0"), "undefined name missing"), "undefined global");
+    check(fails(looped("a & b", "1.5, 1"), "unsupported operand types for band"), "bitwise on float");
+    check(fails(looped("a + b", "f, 1"), "unsupported operand types for add"), "function operand");
+    check(fails("def f():\n    y = y + 1\n    return y\nreturn f()\n", "undefined name y"), "local read before assignment");
+    check(fails("def f(n):\n    return f(n + 1)\nreturn f(0)\n", "stack overflow"), "stack overflow");
+}
+
+static void testThreshold() {
+    Program program;
+    std::string error;
+    check(compileSource("f(n):\n    return n + 1\nf(1)\nf(2)\n", false, program, error), "compiles");
+    VM twice(program);
+    twice.setJit(3);
+    Value result;
+    check(twice.run(result) && !twice.jit()->compiled(1), "two calls stay under a threshold of 3");
+    check(twice.run(result) && twice.jit()->compiled(1) == LIGHTNING_JIT, "counts carry across runs");
+    check(twice.jit()->codeBytes > 0 || !LIGHTNING_JIT, "code size is counted");
+    twice.setJit(0);
+    check(!twice.jit() && twice.run(result), "turned off");
+
+    Program loop;
+    check(compileSource("count(n):\n    i = 0\n    while i < n:\n        i += 1\n    return i\nreturn count(50)\n", false,
+                        loop, error),
+          "compiles");
+    VM once(loop);
+    once.setJit(10);
+    check(once.run(result) && result.integer == 50, "runs");
+    check(once.jit()->compiled(1) == LIGHTNING_JIT, "back edges count towards compiling a function called once");
+}
+
+int main() {
+    testIntegers();
+    testFloats();
+    testControlFlow();
+    testErrors();
+    testThreshold();
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "keywords.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const char* text) {
+    if (ok) return;
+    printf("FAIL %s: %s\n", what, text);
+    ++failures;
+}
+
+int main() {
+    for (const Keyword& keyword : keywordList) {
+        check(keywordTable.find(keyword.text, static_cast<uint32_t>(strlen(keyword.text))) == keyword.type,
+              "keyword", keyword.text);
+    }
+
+    // Prefixes, extensions, case and periodic spellings stay identifiers
+    const char* others[] = {"i", "iff", "de", "deff", "Def", "els", "elsee", "elif_", "whilE", "whil",
+                            "returns", "eturn", "fi", "ifif", "if1", "aaaa", "aaaaa", "elifelif"};
+    for (const char* other : others)
+        check(keywordTable.find(other, static_cast<uint32_t>(strlen(other))) == TT_IDENT, "identifier", other);
+
+    // The lexer emits keyword types without interning them
+    std::string src = "def f(x):\n    if x: return 1\n    elif y: return iff\n    else:\n        while z: define\n";
+    Lexer lexer(src);
+    std::vector<Token> tokens = lexer.tokenize();
+    TokenType expected[] = {TT_DEF, TT_IF, TT_RETURN, TT_ELIF, TT_RETURN, TT_ELSE, TT_WHILE};
+    size_t next = 0;
+    for (const Token& token : tokens) {
+        bool keyword = token.type >= TT_DEF && token.type <= TT_RETURN;
+        if (keyword) check(next < 7 && token.type == expected[next++] && token.lexeme == 0, "lexed", src.c_str() + token.offset);
+    }
+    check(next == 7, "keyword count", "");
+    for (size_t offset = 0; offset < lexer.pool.size(); offset += strlen(lexer.pool.data() + offset) + 1) {
+        const char* name = lexer.pool.data() + offset;
+        check(keywordTable.find(name, static_cast<uint32_t>(strlen(name))) == TT_IDENT, "interned", name);
+    }
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstring>
+#include <vector>
+#include "lexer.hpp"
+
+// Token comparisons shared by the lexer tests.
+
+inline bool sameToken(const Token& a, const Token& b) {
+    return a.lexeme == b.lexeme && a.offset == b.offset && a.length == b.length &&
+           a.type == b.type && a.format == b.format;
+}
+
+// Field for field, for lexers that share a pool or built it in the same order
+inline bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (!sameToken(a[i], b[i])) return false;
+    }
+    return true;
+}
+
+inline bool sameConstant(const Constant& a, const Constant& b) {
+    return a.integer == b.integer && a.length == b.length && a.format == b.format;
+}
+
+// Pools and arenas differ after edits, so compare symbols by their text and
+// literals by their value
+inline bool sameTokens(const std::vector<Token>& a, const Lexer& lexerA,
+                       const std::vector<Token>& b, const Lexer& lexerB) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].offset != b[i].offset || a[i].length != b[i].length ||
+            a[i].type != b[i].type || a[i].format != b[i].format)
+            return false;
+        bool symbol = a[i].type == TT_IDENT || (a[i].type == TT_CUSTOM_OP && a[i].length > 2);
+        if (symbol && strcmp(lexerA.pool.data() + a[i].lexeme, lexerB.pool.data() + b[i].lexeme) != 0)
+            return false;
+        if (a[i].type == TT_STRING && lexerA.literal(a[i]) != lexerB.literal(b[i])) return false;
+        if ((a[i].type == TT_NUMBER || a[i].type == TT_CHAR) &&
+            !sameConstant(lexerA.constants[a[i].lexeme], lexerB.constants[b[i].lexeme]))
+            return false;
+    }
+    return true;
+}
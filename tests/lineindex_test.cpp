@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include "lineindex.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const char* level, int detail) {
+    if (ok) return;
+    printf("FAIL [%s] %s (%d)\n", level, what, detail);
+    ++failures;
+}
+
+// Line starts the way the lexer sees line breaks
+static std::vector<uint32_t> naiveStarts(const std::string& src) {
+    std::vector<uint32_t> starts {0};
+    for (size_t i = 0; i < src.size(); ++i) {
+        if (src[i] == '\n' || (src[i] == '\r' && (i + 1 == src.size() || src[i + 1] != '\n')))
+            starts.push_back(static_cast<uint32_t>(i + 1));
+    }
+    return starts;
+}
+
+static bool matches(LineIndex& index, const std::string& src) {
+    std::vector<uint32_t> starts = naiveStarts(src);
+    if (index.lines() != starts.size()) return false;
+    size_t line = 0;
+    for (uint32_t offset = 0; offset <= src.size(); ++offset) {
+        while (line + 1 < starts.size() && starts[line + 1] <= offset) ++line;
+        Location at = index.locate(offset);
+        if (at.line != line + 1 || at.column != offset - starts[line] + 1) return false;
+    }
+    return index.lineStart(static_cast<uint32_t>(starts.size())) == starts.back();
+}
+
+static std::string noise(std::mt19937& rng, size_t length) {
+    static const char alphabet[] = "ab \n\r\r\n";
+    std::string text;
+    for (size_t i = 0; i < length; ++i) text += alphabet[rng() % (sizeof(alphabet) - 1)];
+    return text;
+}
+
+int main() {
+    std::mt19937 rng(12);
+
+    for (int level = SCAN_SCALAR; level <= detectScanLevel(); ++level) {
+        const char* name = scanKernels(static_cast<ScanLevel>(level)).name;
+
+        // Lengths around the 16 and 32 byte blocks, with breaks on block edges
+        for (size_t length = 0; length < 200; ++length) {
+            std::string src = noise(rng, length);
+            LineIndex index(src);
+            index.setScanLevel(static_cast<ScanLevel>(level));
+            check(matches(index, src), "build", name, static_cast<int>(length));
+        }
+
+        // Edits follow a full rebuild
+        std::string src = noise(rng, 3000);
+        LineIndex index(src);
+        index.setScanLevel(static_cast<ScanLevel>(level));
+        index.locate(0);
+        for (int i = 0; i < 2000; ++i) {
+            uint32_t offset = static_cast<uint32_t>(rng() % (src.size() + 1));
+            uint32_t removed = static_cast<uint32_t>(rng() % 8);
+            if (offset + removed > src.size()) removed = static_cast<uint32_t>(src.size() - offset);
+            std::string inserted = noise(rng, i % 50 == 0 ? 100 : rng() % 5);
+            src.replace(offset, removed, inserted);
+            index.update(src, Edit {offset, removed, inserted});
+            if (i % 97 == 0 || src.size() < 64) check(matches(index, src), "update", name, i);
+        }
+        check(matches(index, src), "after updates", name, 0);
+    }
+
+    // Lookups build the table once
+    std::string big;
+    for (int i = 0; i < 100000; ++i) big += "value = other + 1\r\n";
+    LineIndex index(big);
+    Location last = index.locate(static_cast<uint32_t>(big.size() - 3));
+    check(last.line == 100000 && last.column == 17, "big file", "default", static_cast<int>(last.line));
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include "lexer.hpp"
+#include "lexer_harness.hpp"
+
+// Nested blocks, blank and comment-only lines, CRLF, a bad dedent and custom
+// operators, so chunk cuts land in every indentation state
+static std::string corpus(int functions) {
+    std::string src;
+    for (int i = 0; i < functions; ++i) {
+        src += "def f" + std::to_string(i % 97) + "(a, b):\n";
+        src += "    x = a +++ b * " + std::to_string(i) + ".5\n";
+        src += "\n";
+        src += "    # comment line\n\n\n";
+        src += "    if x >= 3:\r\n";
+        src += "        while x:\n";
+        src += "            x -= shared_name_" + std::to_string(i % 13) + "\n";
+        src += "      mismatched\n";
+        src += "  \n";
+        src += "result_" + std::to_string(i) + " = f(1, 2) <=> 3\n";
+        src += "mask = 0x" + std::to_string(i % 31) + "F | 0b1_01 + 2.5e-" + std::to_string(i % 7) + " * 3j\n";
+        src += "names = [\"plain\", \"esc\\t" + std::to_string(i) + "\", 'c', '\\n']\n";
+    }
+    return src;
+}
+
+int main() {
+    ThreadPool workers(4);
+    int failures = 0;
+    const char* tails[] = {"", "\n", "    trailing", "# comment at eof", "\n\n        deep"};
+
+    for (int functions : {1, 7, 150}) {
+        for (const char* tail : tails) {
+            std::string src = corpus(functions) + tail;
+            Lexer serial(src);
+            std::vector<Token> expected = serial.tokenize();
+
+            for (size_t chunkBytes : {1, 16, 100, 4096}) {
+                Lexer parallel(src);
+                std::vector<Token> tokens = parallel.tokenizeParallel(workers, chunkBytes);
+                bool sameConstants = parallel.constants.size() == serial.constants.size();
+                for (size_t i = 0; sameConstants && i < serial.constants.size(); ++i)
+                    sameConstants = sameConstant(parallel.constants[i], serial.constants[i]);
+                if (!sameTokens(expected, tokens) || parallel.pool != serial.pool || !sameConstants ||
+                    parallel.strings != serial.strings) {
+                    printf("FAIL functions=%d chunk=%zu tail=\"%s\"\n", functions, chunkBytes, tail);
+                    ++failures;
+                }
+            }
+        }
+    }
+
+    printf("%s\n", failures ? "parallel lexing mismatches" : "parallel lexing matches serial");
+    return failures ? 1 : 0;
+}
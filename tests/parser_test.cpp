@@ -0,0 +1,231 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "tokenstream.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+// S-expression of the tree, names read from the lexer pool
+static void dump(const AstArena& arena, NodeId id, const Lexer& lexer, std::string& out) {
+    static const char* names[] = {"?", "def", "arg", "call", "block", "type", "null",
+                                  "id", "num", "unary", "binary", "assign", "if", "while", "return", "error",
+                                  "import"};
+    const AstNode& node = arena[id];
+    out += "(";
+    out += names[node.type];
+    switch (node.type) {
+        case AST_IDENT: case AST_ARG: case AST_TYPE: case AST_FUNCDEF:
+            out += " ";
+            out += lexer.pool.data() + node.payload;
+            break;
+        case AST_NUMBER: {
+            const Constant& constant = lexer.constants[node.payload];
+            char text[32];
+            if (constant.format == F_INT) snprintf(text, sizeof(text), " %lld", static_cast<long long>(constant.integer));
+            else snprintf(text, sizeof(text), " %g%s", constant.real, constant.format == F_COMPLEX ? "j" : "");
+            out += text;
+            break;
+        }
+        case AST_UNARY: case AST_BINARY: case AST_ASSIGN:
+            out += " " + std::to_string(node.payload);
+            break;
+        default:
+            break;
+    }
+    for (uint32_t i = 0; i < node.count; ++i) {
+        out += " ";
+        dump(arena, node.child(i), lexer, out);
+    }
+    out += ")";
+}
+
+static std::string parseToString(const std::string& src, const OperatorTable* operators) {
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    parser.setOperators(operators);
+    std::string out;
+    dump(parser.arena, parser.parse(), lexer, out);
+    return out;
+}
+
+static void checkParse(const std::string& src, const std::string& expected, const OperatorTable* operators = nullptr) {
+    std::string got = parseToString(src, operators);
+    if (got == expected) return;
+    printf("FAIL parse\n  source:   %s\n  got:      %s\n  expected: %s\n", src.c_str(), got.c_str(), expected.c_str());
+    ++failures;
+}
+
+static void checkArena() {
+    AstArena arena;
+    check(arena.nodes() == 1 && arena[0].type == AST_NULL, "null node");
+
+    // Nodes never move while the arena grows
+    NodeId first = arena.create(AST_IDENT, 7);
+    const AstNode* address = &arena[first];
+    std::vector<NodeId> ids;
+    for (uint32_t i = 0; i < 200000; ++i) ids.push_back(arena.create(AST_NUMBER, i, {first, first}));
+    check(&arena[first] == address, "stable address");
+    check(arena[ids[123456]].payload == 123456 && arena[ids[123456]].child(1) == first, "node contents");
+
+    // Child lists longer than a chunk
+    NodeId wide = arena.create(AST_BLOCK, 0, ids.data(), static_cast<uint32_t>(ids.size()));
+    NodeId after = arena.create(AST_IDENT, 9);
+    check(arena[wide].count == ids.size() && arena[wide].child(199999) == ids.back(), "wide node");
+    check(arena[after].payload == 9 && arena[wide].child(0) == ids[0], "node after wide node");
+    check(arena.nodes() == 200004, "node count");
+
+    arena.clear();
+    check(arena.nodes() == 1 && arena.bytes() == AstArena::CHUNK_WORDS * 8, "clear");
+}
+
+// Every error in the source is reported in one pass, at the right token
+static void checkRecovery() {
+    std::string src =
+        "x = (1 + 2\n"             // Missing ')'
+        "def (a):\n"               // Missing name
+        "    y = )\n"              // Missing expression
+        "    z = 1\n"
+        "  w = 2\n"                // Dedent to an unknown column
+        "if x\n"                   // No block after the newline
+        "q = a $ b\n"              // Junk after the expression
+        "    orphan\n"             // Block of the broken line, no new error
+        "r = 1\n"
+        "    s = 2\n"              // Stray indent
+        "t = a ** b\n"             // Unregistered operator
+        "c = 'ab' + 'c'\n"         // Char literal of two chars
+        "import a.\n"              // Missing name after the dot
+        "u = 3\n";
+    struct { DiagnosticId id; const char* at; } expected[] = {
+        {DIAG_EXPECTED_RPAREN, "\ndef"}, {DIAG_EXPECTED_NAME, "(a)"}, {DIAG_EXPECTED_EXPRESSION, ")\n"},
+        {DIAG_INDENT, "  w = 2"}, {DIAG_EXPECTED_BLOCK, "\nq ="}, {DIAG_UNEXPECTED_TOKEN, "$"},
+        {DIAG_UNEXPECTED_INDENT, "    s = 2"}, {DIAG_UNKNOWN_OPERATOR, "** b"}, {DIAG_CHAR_LITERAL, "'ab'"},
+        {DIAG_EXPECTED_NAME, "\nu = 3"},
+    };
+    const size_t count = sizeof(expected) / sizeof(expected[0]);
+
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    check(parser.diagnostics.size() == count, "diagnostic count");
+    for (size_t i = 0; i < count && i < parser.diagnostics.size(); ++i) {
+        const Diagnostic& diagnostic = parser.diagnostics[i];
+        bool ok = diagnostic.id == expected[i].id && src.compare(diagnostic.offset, strlen(expected[i].at), expected[i].at) == 0;
+        if (!ok) printf("  diagnostic %zu: %s at %u\n", i, diagnosticMessage(diagnostic.id), diagnostic.offset);
+        check(ok, "diagnostic");
+    }
+
+    // Parsing went on to the end
+    const AstNode& module = parser.arena[root];
+    const AstNode& last = parser.arena[module.child(module.count - 1)];
+    check(last.type == AST_ASSIGN && parser.arena[last.child(1)].type == AST_NUMBER, "parsed past errors");
+
+    // Parallel parsing reports the same diagnostics
+    ThreadPool workers(2);
+    Parser parallel(tokens, src);
+    parallel.parseParallel(workers, 1);
+    bool same = parallel.diagnostics.size() == parser.diagnostics.size();
+    for (size_t i = 0; same && i < parser.diagnostics.size(); ++i)
+        same = parallel.diagnostics[i].id == parser.diagnostics[i].id && parallel.diagnostics[i].offset == parser.diagnostics[i].offset;
+    check(same, "parallel diagnostics");
+
+    // The buffer is fixed, the overflow is counted
+    std::string noisy;
+    for (int i = 0; i < 1000; ++i) noisy += "a = )\n";
+    Lexer noisyLexer(noisy);
+    TokenStream noisyTokens = noisyLexer.tokenizeStream();
+    Parser noisyParser(noisyTokens, noisy);
+    noisyParser.parse();
+    check(noisyParser.diagnostics.size() == Parser::MAX_DIAGNOSTICS, "diagnostic limit");
+    check(noisyParser.droppedDiagnostics == 1000 - Parser::MAX_DIAGNOSTICS, "dropped diagnostics");
+}
+
+int main() {
+    checkArena();
+    checkRecovery();
+
+    checkParse("x = 1 + 2 * 3\n",
+               "(block (assign 73 (id x) (binary 69 (num 1) (binary 68 (num 2) (num 3)))))");
+    checkParse("def f(a, b: int):\n    return a - -b\n",
+               "(block (def f (arg a) (arg b (type int)) (block (return (binary 70 (id a) (unary 70 (id b)))))))");
+    checkParse("g(x, y):\n  while x < y:\n    x += g(1)(2)\n  if x == y: y = 0\n  elif x: y\n  else:\n    y\n",
+               "(block (def g (arg x) (arg y) (block (while (binary 72 (id x) (id y)) (block (assign 88 (id x) "
+               "(call (call (id g) (num 1)) (num 2))))) (if (binary 92 (id x) (id y)) (block (assign 73 (id y) (num 0))) "
+               "(if (id x) (block (id y)) (block (id y)))))))");
+    checkParse("print(a, b)\n(a)\n", "(block (call (id print) (id a) (id b)) (id a))");
+    checkParse("", "(block)");
+    checkParse("import os\nimport pkg.util.io\n", "(block (import (id os)) (import (id pkg) (id util) (id io)))");
+
+    // Precedence and associativity from the operator table
+    checkParse("x = y = a || b && c\n",
+               "(block (assign 73 (id x) (assign 73 (id y) (binary 83 (id a) (binary 82 (id b) (id c))))))");
+    checkParse("a.b(c) - -d * e\n",
+               "(block (binary 70 (call (binary 81 (id a) (id b)) (id c)) (binary 68 (unary 70 (id d)) (id e))))");
+    checkParse("1 << 2 + 3 == 4 & 5\n",
+               "(block (binary 67 (binary 92 (binary 97 (num 1) (binary 69 (num 2) (num 3))) (num 4)) (num 5)))");
+
+    // Custom operators: unknown ones end the expression until registered
+    checkParse("a ** b\n", "(block (id a))");
+    OperatorTable custom;
+    check(custom.define("|>", Binding {P_OR, 0}), "define |>");
+    check(custom.define("**", Binding {P_PREFIX, B_RIGHT}), "define **");
+    check(custom.define("!!", Binding {}, P_PREFIX), "define !!");
+    check(!custom.define("a+", Binding {P_TERM, 0}), "reject non-operator");
+    check(custom.find("**", 2) == 1 && custom.find("*", 1) < 0, "find custom");
+    checkParse("a |> f ** 2 ** 3 + !!b\n",
+               "(block (binary 64 (id a) (binary 69 (binary 4294967360 (id f) (binary 4294967360 (num 2) (num 3))) "
+               "(unary 8589934656 (id b)))))", &custom);
+
+    // A module big enough to span many arena chunks, with a wide top level
+    std::string big;
+    for (int i = 0; i < 20000; ++i) {
+        big += "def f" + std::to_string(i) + "(a, b):\n";
+        big += "    x = a * 3 + b\n";
+        big += "    if x >= 10:\n        return x\n";
+    }
+    Lexer lexer(big);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, big);
+    NodeId root = parser.parse();
+    check(parser.arena[root].count == 20000, "top-level declarations");
+    check(parser.arena[parser.arena[root].child(19999)].type == AST_FUNCDEF, "last declaration");
+    printf("%zu nodes in %zu KB\n", parser.arena.nodes(), parser.arena.bytes() / 1024);
+
+    // Parallel parsing builds the same tree, whatever the cut size
+    std::string mixed;
+    for (int i = 0; i < 2000; ++i) {
+        mixed += "def f" + std::to_string(i) + "(a):\n    while a:\n        a -= g(a, 1)\n    return a\n";
+        mixed += "if x: y = " + std::to_string(i) + "\nelse: y = 0\n";
+        mixed += "if x:\n    y\nelif z:\n    w\nelse:\n    v\n";
+        mixed += "total = total + f" + std::to_string(i) + "(x) * 2\n\n";
+    }
+    Lexer mixedLexer(mixed);
+    TokenStream mixedTokens = mixedLexer.tokenizeStream();
+    Parser serial(mixedTokens, mixed);
+    std::string expected;
+    dump(serial.arena, serial.parse(), mixedLexer, expected);
+
+    ThreadPool workers(4);
+    for (size_t chunkTokens : {1, 64, 4096, 1 << 20}) {
+        Parser parallel(mixedTokens, mixed);
+        std::string got;
+        NodeId root = parallel.parseParallel(workers, chunkTokens);
+        dump(parallel.arena, root, mixedLexer, got);
+        check(got == expected, "parallel tree");
+        check(parallel.arena.nodes() == serial.arena.nodes(), "parallel node count");
+        if (chunkTokens == 1) check(parallel.arena.chunkCount() > 8000, "one part per declaration");
+    }
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "profile.hpp"
+#include "tokenstream.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static bool contains(const std::string& text, const char* part) {
+    return text.find(part) != std::string::npos;
+}
+
+int main() {
+    std::string src = "# header\n"
+                      "def f(a, b):\n"
+                      "    if a:\n"
+                      "        while b:\n"
+                      "            b = b - 1\n"
+                      "    return a + b * 2\n"
+                      "g(x, \"text\") + )\n"
+                      "f(1, 2)\n";
+    Profiler profiler;
+    Profiler::install(&profiler);
+    {
+        Lexer lexer(src);
+        std::vector<Token> tokens = lexer.tokenize();
+        TokenStream stream(tokens, &lexer.pool, nullptr, &lexer.constants, &lexer.strings);
+        Parser parser(stream, src);
+        parser.parse();
+    }
+    {
+        // Lexed again after uninstalling: nothing more is recorded
+        Profiler::install(nullptr);
+        Lexer lexer(src);
+        lexer.tokenize();
+    }
+
+    std::string json = profiler.json();
+    std::string trace = profiler.chromeTrace();
+    check(contains(json, "\"phases\"") && contains(json, "\"lexer\"") && contains(json, "\"parser\""), "json sections");
+    check(contains(trace, "\"traceEvents\""), "trace events");
+
+#if LIGHTNING_PROFILE
+    std::vector<PhaseRecord> phases = profiler.phases();
+    check(phases.size() == 2, "one lex and one parse phase");
+    if (phases.size() == 2) {
+        check(!strcmp(phases[0].name, "lex") && !strcmp(phases[1].name, "parse"), "phase names");
+        check(phases[0].start + phases[0].wall <= phases[1].start, "phases in order");
+    }
+    check(contains(trace, "\"name\": \"lex\", \"cat\": \"lightning\", \"ph\": \"X\""), "lex trace event");
+
+    LexerCounters lex = profiler.lexer();
+    // f a b a b b b a b g x f: 12 uses of 5 names. Number spellings share
+    // the table: 1 2 1 2 adds 2 more and hits them twice.
+    check(lex.tokens[TC_IDENT] == 12 && lex.bytes[TC_IDENT] == 12, "identifiers");
+    check(lex.internInserts == 7 && lex.internHits == 9, "intern hits and inserts");
+    uint64_t probes = 0;
+    for (uint64_t count : lex.probes) probes += count;
+    check(probes == 16, "a probe length per lookup");
+    check(lex.tokens[TC_KEYWORD] == 4, "keywords");
+    check(lex.tokens[TC_NUMBER] == 4 && lex.tokens[TC_STRING] == 1 && lex.bytes[TC_STRING] == 6, "literals");
+    check(lex.maxIndentDepth == 3, "indent depth");
+    uint64_t bytes = lex.trivia;
+    for (uint64_t count : lex.bytes) bytes += count;
+    check(bytes == src.size(), "token and trivia bytes cover the input");
+
+    ParserCounters parse = profiler.parser();
+    check(parse.nodes[AST_FUNCDEF] == 1 && parse.nodes[AST_WHILE] == 1 && parse.nodes[AST_IF] == 1, "node types");
+    check(parse.nodes[AST_FUNCCALL] == 2, "calls");
+    check(parse.arenaBytes >= AstArena::CHUNK_WORDS * sizeof(uint64_t), "arena bytes");
+    check(parse.lookahead > 0, "call or definition lookahead");
+    check(parse.skipped > 0, "recovery skipped tokens");
+#else
+    check(profiler.phases().empty(), "no phases without LIGHTNING_PROFILE");
+#endif
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
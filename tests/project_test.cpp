@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "project.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static void write(const std::filesystem::path& path, const std::string& text) {
+    std::filesystem::create_directories(path.parent_path());
+    FILE* out = fopen(path.string().c_str(), "wb");
+    fwrite(text.data(), 1, text.size(), out);
+    fclose(out);
+}
+
+// Stage that records the order modules were staged in
+struct Recorder {
+    std::mutex lock;
+    std::vector<std::string> order;
+
+    Project::Stage stage() {
+        return [this](Module& module) {
+            std::lock_guard<std::mutex> guard(lock);
+            order.push_back(module.name);
+        };
+    }
+    size_t position(const std::string& name) const {
+        return std::find(order.begin(), order.end(), name) - order.begin();
+    }
+    bool staged(const std::string& name) const { return position(name) < order.size(); }
+};
+
+int main() {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "lightning_project_test";
+    fs::remove_all(root);
+
+    // main -> app.view -> (core.math, core.io); app.model -> core.math; tools is standalone
+    write(root / "main.lt", "import app.view\nimport app.model\nmain()\n");
+    write(root / "app/view.lt", "import core.math\nimport core.io\nimport core.math\ndef show(x):\n    return x\n");
+    write(root / "app/model.lt", "import core.math\nm = 1\n");
+    write(root / "core/math.lt", "def add(a, b):\n    return a + b\n");
+    write(root / "core/io.lt", "def put(x):\n    return x\n");
+    write(root / "tools.lt", "x = (1 +\n");
+    write(root / "notes.txt", "import nothing\n");
+
+    TaskScheduler scheduler(4);
+    Project project(root.string());
+    Recorder first;
+    BuildStats stats = project.build(scheduler, first.stage());
+    check(stats.modules == 6 && stats.parsed == 6 && stats.staged == 6, "full build");
+    check(stats.unresolved == 0 && stats.blocked == 0, "clean graph");
+
+    Module* view = project.find("app.view");
+    check(view && view->imports.size() == 2 && view->importNames.size() == 3, "duplicate import resolved once");
+    check(project.find("tools") && !project.find("tools")->parser->diagnostics.empty(), "diagnostics kept");
+    check(first.position("core.math") < first.position("app.view") &&
+          first.position("core.io") < first.position("app.view") &&
+          first.position("app.view") < first.position("main") &&
+          first.position("app.model") < first.position("main"), "imports staged first");
+
+    // Nothing changed: nothing re-parsed or re-staged
+    Recorder idle;
+    stats = project.build(scheduler, idle.stage());
+    check(stats.parsed == 0 && stats.staged == 0, "no-op rebuild");
+
+    // A leaf change re-stages its importers, transitively, and nothing else
+    write(root / "core/io.lt", "def put(x):\n    return x + 1\n");
+    fs::last_write_time(root / "core/io.lt", fs::last_write_time(root / "core/io.lt") + std::chrono::seconds(1));
+    Recorder leaf;
+    stats = project.build(scheduler, leaf.stage());
+    check(stats.parsed == 1 && stats.staged == 3, "leaf rebuild");
+    check(leaf.order == std::vector<std::string>({"core.io", "app.view", "main"}), "leaf rebuild order");
+
+    // Touched without a change: read again, not re-parsed
+    fs::last_write_time(root / "core/math.lt", fs::last_write_time(root / "core/math.lt") + std::chrono::seconds(1));
+    stats = project.build(scheduler, Recorder().stage());
+    check(stats.parsed == 0 && stats.staged == 0, "touch without change");
+
+    // A missing import, then the file appears
+    write(root / "app/model.lt", "import core.math\nimport core.db\nm = 1\n");
+    fs::last_write_time(root / "app/model.lt", fs::last_write_time(root / "app/model.lt") + std::chrono::seconds(1));
+    stats = project.build(scheduler, Recorder().stage());
+    check(stats.unresolved == 1 && project.find("app.model")->unresolved[0] == "core.db", "unresolved import");
+    write(root / "core/db.lt", "db = 0\n");
+    Recorder added;
+    stats = project.build(scheduler, added.stage());
+    check(stats.unresolved == 0 && stats.parsed == 1, "import resolves once the file exists");
+    check(added.staged("core.db") && added.staged("app.model") && added.staged("main") && !added.staged("app.view"),
+          "new module re-stages its importers");
+
+    // A cycle blocks its members and their importers, not the rest
+    write(root / "core/db.lt", "import app.model\ndb = 0\n");
+    fs::last_write_time(root / "core/db.lt", fs::last_write_time(root / "core/db.lt") + std::chrono::seconds(1));
+    Recorder cycle;
+    stats = project.build(scheduler, cycle.stage());
+    check(stats.blocked == 3, "cycle and importer blocked");
+    check(project.find("core.db")->blocked && project.find("app.model")->blocked && project.find("main")->blocked,
+          "blocked modules");
+    check(!cycle.staged("core.db") && !cycle.staged("main") && !project.find("tools")->blocked, "cycle not staged");
+    check(project.find("core.db")->cyclic && project.find("app.model")->cyclic && !project.find("main")->cyclic,
+          "members of the cycle told from what imports it");
+
+    // Breaking the cycle stages everything it held back
+    write(root / "core/db.lt", "db = 0\n");
+    fs::last_write_time(root / "core/db.lt", fs::last_write_time(root / "core/db.lt") + std::chrono::seconds(2));
+    Recorder broken;
+    stats = project.build(scheduler, broken.stage());
+    check(stats.blocked == 0 && broken.staged("app.model") && broken.staged("main"), "cycle broken");
+
+    // Removing a file unresolves its imports
+    fs::remove(root / "core/io.lt");
+    stats = project.build(scheduler, Recorder().stage());
+    check(stats.modules == 6 && stats.unresolved == 1 && !project.find("core.io"), "removed module");
+
+    // Names read before an error in an import are no dependency
+    write(root / "tools.lt", "import core.math.\nimport core.\nx = 1\n");
+    fs::last_write_time(root / "tools.lt", fs::last_write_time(root / "tools.lt") + std::chrono::seconds(3));
+    stats = project.build(scheduler, Recorder().stage());
+    Module* tools = project.find("tools");
+    check(tools->importNames.empty() && tools->imports.empty() && stats.unresolved == 1, "broken imports ignored");
+
+    // A file that can't be read is an error of its module
+    fs::path math = root / "core/math.lt";
+    fs::permissions(math, fs::perms::none);
+    fs::last_write_time(math, fs::last_write_time(math) + std::chrono::seconds(3));
+    FILE* probe = fopen(math.string().c_str(), "rb");
+    if (probe) fclose(probe);   // Permissions don't hold back root
+    else {
+        stats = project.build(scheduler, Recorder().stage());
+        Module* unreadable = project.find("core.math");
+        check(stats.unreadable == 1 && !unreadable->error.empty() && !unreadable->parser, "unreadable file reported");
+        fs::permissions(math, fs::perms::owner_read | fs::perms::owner_write);
+        stats = project.build(scheduler, Recorder().stage());
+        check(stats.unreadable == 0 && project.find("core.math")->error.empty(), "readable again");
+    }
+    fs::permissions(math, fs::perms::owner_read | fs::perms::owner_write);
+
+    fs::remove_all(root);
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "lexer.hpp"
+#include "lexer_harness.hpp"
+
+int main() {
+    std::string src;
+    for (int i = 0; i < 40; ++i) {
+        src += "def f" + std::to_string(i) + "(a, b):\n";
+        src += "    x = a + b * " + std::to_string(i) + "\n";
+        src += "    # note\n\n";
+        src += "    if x:\r\n";
+        src += "        return x ->> 1\n";
+        src += "    s = \"text\" + \"a\\\"b\" + 'q'\n";
+    }
+
+    // Snippets that open and close blocks, split CRLF pairs and start comments
+    const char* inserts[] = {"", "y", "\n", "    ", "\n    z = 1\n", "\n        deep\n", "#", "\r", "12.5", "   \n", "name_",
+                             "\"", "'", "\\"};
+
+    Lexer incremental(src);
+    std::vector<Token> tokens = incremental.tokenize();
+    std::string text = src;
+    srand(7);
+    int failures = 0;
+
+    for (int step = 0; step < 3000; ++step) {
+        uint32_t offset = static_cast<uint32_t>(rand() % (text.size() + 1));
+        uint32_t removed = static_cast<uint32_t>(rand() % 4);
+        if (offset + removed > text.size()) removed = static_cast<uint32_t>(text.size() - offset);
+        const char* inserted = inserts[rand() % (sizeof(inserts) / sizeof(inserts[0]))];
+
+        incremental.relex(tokens, Edit {offset, removed, inserted});
+        text.replace(offset, removed, inserted);
+
+        Lexer full(text);
+        std::vector<Token> expected = full.tokenize();
+        if (!sameTokens(expected, full, tokens, incremental)) {
+            printf("FAIL step %d: offset %u removed %u inserted \"%s\"\n", step, offset, removed, inserted);
+            ++failures;
+            break;
+        }
+    }
+
+    printf("%s\n", failures ? "incremental lexing mismatches" : "incremental lexing matches full lexing");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "lexer.hpp"
+#include "lexer_harness.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what, const char* level, int detail) {
+    if (ok) return;
+    printf("FAIL [%s] %s (%d)\n", level, what, detail);
+    ++failures;
+}
+
+// Every kernel must stop exactly where the scalar kernel stops, for every byte
+// value, for runs cut short by the end of input, and for a run broken by one
+// stop byte at each position: inside, on the edge of and after a vector block
+static void checkKernels(const ScanKernels& ref, const ScanKernels& simd) {
+    ScanFn refFns[] = {ref.ident, ref.digits, ref.operators, ref.spaces, ref.line, ref.string};
+    ScanFn simdFns[] = {simd.ident, simd.digits, simd.operators, simd.spaces, simd.line, simd.string};
+    const char runBytes[] = {'a', '5', '+', ' ', 'x', 'x'};
+    char buffer[160];
+
+    for (int k = 0; k < 6; ++k) {
+        for (int b = 0; b < 256; ++b) {
+            for (int run = 0; run < 100; run += 7) {
+                memset(buffer, b, sizeof(buffer));
+                const char* end = buffer + run;
+                check(refFns[k](buffer, end) == simdFns[k](buffer, end), "bounded run", simd.name, b);
+                end = buffer + sizeof(buffer);
+                check(refFns[k](buffer, end) == simdFns[k](buffer, end), "full run", simd.name, b);
+            }
+        }
+
+        memset(buffer, runBytes[k], sizeof(buffer));
+        for (int at = 0; at < static_cast<int>(sizeof(buffer)); ++at) {
+            for (int b = 0; b < 256; ++b) {
+                buffer[at] = static_cast<char>(b);
+                const char* end = buffer + sizeof(buffer);
+                check(refFns[k](buffer, end) == simdFns[k](buffer, end), "stop byte", simd.name, at);
+                end = buffer + at;
+                check(refFns[k](buffer, end) == simdFns[k](buffer, end), "stop byte past the end", simd.name, at);
+            }
+            buffer[at] = runBytes[k];
+        }
+    }
+}
+
+static std::string corpus() {
+    std::string src;
+    for (int i = 0; i < 400; ++i) {
+        src += "def function_name_" + std::to_string(i) + "(alpha, beta_gamma_delta_epsilon):\n";
+        src += "    # a long comment line that should be skipped by the line kernel ....\n";
+        src += "    value = alpha * 1234567890123 + beta_gamma_delta_epsilon / 3.14159265\n";
+        src += "    if value >>= 2 and value <- 3 || value ->> 4:\n";
+        src += "        print(value, $ \"quoted\" `tick`)\r\n";
+        src += "        table = {\"a longer string key past one vector block\": 'x', \"esc\\\"aped\\n\": '\\''}\n";
+        src += "                                                        \n";
+        src += "  bad_indent\n";
+    }
+    src += "# trailing comment without newline";
+    return src;
+}
+
+int main() {
+    const ScanKernels& ref = scanKernels(SCAN_SCALAR);
+    std::string src = corpus();
+
+    Lexer scalar(src);
+    scalar.setScanLevel(SCAN_SCALAR);
+    std::vector<Token> expected = scalar.tokenize();
+
+    for (int level = SCAN_SSE2; level <= detectScanLevel(); ++level) {
+        const ScanKernels& simd = scanKernels(static_cast<ScanLevel>(level));
+        checkKernels(ref, simd);
+
+        Lexer lexer(src);
+        lexer.setScanLevel(static_cast<ScanLevel>(level));
+        std::vector<Token> tokens = lexer.tokenize();
+        check(sameTokens(expected, tokens), "token stream", simd.name, static_cast<int>(tokens.size()));
+        check(lexer.pool == scalar.pool, "intern pool", simd.name, static_cast<int>(lexer.pool.size()));
+        printf("%s: %zu tokens checked\n", simd.name, tokens.size());
+    }
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
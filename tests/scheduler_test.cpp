@@ -0,0 +1,54 @@
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <vector>
+#include "scheduler.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+// Binary tree of tasks, each spawning its children from a worker
+static void tree(TaskScheduler& scheduler, std::atomic<size_t>& visited, int depth) {
+    visited.fetch_add(1);
+    if (depth == 0) return;
+    for (int i = 0; i < 2; ++i) scheduler.spawn([&scheduler, &visited, depth] { tree(scheduler, visited, depth - 1); });
+}
+
+int main() {
+    for (unsigned threads : {1u, 2u, 4u}) {
+        TaskScheduler scheduler(threads);
+        check(scheduler.size() == threads, "thread count");
+
+        std::atomic<size_t> visited {0};
+        scheduler.spawn([&] { tree(scheduler, visited, 14); });
+        scheduler.wait();
+        check(visited.load() == (1u << 15) - 1, "every spawned task ran before wait returned");
+
+        // Reusable, and wait with nothing spawned returns
+        scheduler.wait();
+        std::atomic<size_t> flat {0};
+        for (int i = 0; i < 1000; ++i) scheduler.spawn([&] { flat.fetch_add(1); });
+        scheduler.wait();
+        check(flat.load() == 1000, "tasks spawned from outside");
+
+        // A chain: each task releases the next, as finished modules release importers
+        std::vector<int> order;
+        std::function<void(int)> step = [&](int i) {
+            order.push_back(i);
+            if (i < 100) scheduler.spawn([&step, i] { step(i + 1); });
+        };
+        scheduler.spawn([&] { step(0); });
+        scheduler.wait();
+        bool inOrder = order.size() == 101;
+        for (size_t i = 0; inOrder && i < order.size(); ++i) inOrder = order[i] == static_cast<int>(i);
+        check(inOrder, "dependent chain");
+    }
+
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server.hpp"
+
+#if LIGHTNING_SERVER
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+#if LIGHTNING_SERVER
+// Echoes each request back: status is the argument count, out the
+// directory and err the arguments joined by '|'; "stop" ends serving
+static bool echo(const Request& request, Reply& reply) {
+    reply.status = static_cast<int>(request.args.size());
+    reply.out = request.directory;
+    for (const std::string& arg : request.args) reply.err += arg + "|";
+    return !(request.args.size() == 1 && request.args[0] == "stop");
+}
+
+static void testRoundTrips(const std::string& path) {
+    CompileServer server(path);
+    server.timeoutMs = 200;
+    check(server.listen(), "listens");
+    std::thread serving([&] { server.serve(echo); });
+
+    struct stat info;
+    check(stat(path.c_str(), &info) == 0 && (info.st_mode & 0777) == 0600, "only its owner may connect");
+
+    CompileServer second(path);
+    check(!second.listen() && second.error.find("already listening") != std::string::npos, "one server per socket");
+
+    Request request;
+    request.directory = "/some/where";
+    request.args = {"-j", "2", "", "src"};
+    Reply reply;
+    std::string error;
+    check(sendRequest(path, request, reply, error), "request answered");
+    check(reply.status == 4 && reply.out == "/some/where" && reply.err == "-j|2||src|", "request arrives whole");
+
+    request.directory.clear();
+    request.args.clear();
+    reply = Reply();
+    check(sendRequest(path, request, reply, error) && reply.status == 0 && reply.out.empty() && reply.err.empty(),
+          "empty request");
+
+    request.args.assign(1, std::string(1 << 20, 'x'));
+    reply = Reply();
+    check(sendRequest(path, request, reply, error) && reply.err.size() == (1u << 20) + 1, "large request");
+
+    // A client that sends half a message and goes quiet times out
+    sockaddr_un where = {};
+    where.sun_family = AF_UNIX;
+    memcpy(where.sun_path, path.data(), path.size());
+    int silent = socket(AF_UNIX, SOCK_STREAM, 0);
+    uint32_t count = 2;
+    check(connect(silent, reinterpret_cast<sockaddr*>(&where), sizeof(where)) == 0 &&
+          write(silent, &count, sizeof(count)) == sizeof(count), "silent client connects");
+    request.args = {"after"};
+    reply = Reply();
+    check(sendRequest(path, request, reply, error) && reply.err == "after|", "answered past a silent client");
+    close(silent);
+
+    request.args = {"stop"};
+    check(sendRequest(path, request, reply, error) && reply.status == 1, "stop is answered");
+    serving.join();
+    check(!sendRequest(path, request, reply, error) && !error.empty(), "stopped");
+}
+
+static void testStaleSocket(const std::string& path) {
+    {
+        CompileServer server(path);
+        check(server.listen(), "first server");
+    }
+    check(!std::filesystem::exists(path), "socket removed with its server");
+
+    // A socket file with no server behind it, as a crashed one leaves
+    sockaddr_un where = {};
+    where.sun_family = AF_UNIX;
+    memcpy(where.sun_path, path.data(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    check(bind(fd, reinterpret_cast<sockaddr*>(&where), sizeof(where)) == 0, "stale socket made");
+    close(fd);
+    Reply reply;
+    std::string error;
+    check(!sendRequest(path, Request(), reply, error) && error.find("no server") == 0, "nobody answers");
+    {
+        CompileServer server(path);
+        check(server.listen(), "stale socket replaced");
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file) fclose(file);
+    CompileServer server(path);
+    check(!server.listen(), "an ordinary file is left alone");
+    std::error_code ignored;
+    std::filesystem::remove(path, ignored);
+
+    check(!CompileServer(std::string(200, 'x')).listen(), "path too long for a socket");
+}
+#endif
+
+int main() {
+#if LIGHTNING_SERVER
+    std::string path = (std::filesystem::temp_directory_path() / "lightning_server_test.sock").string();
+    std::error_code ignored;
+    std::filesystem::remove(path, ignored);
+    testRoundTrips(path);
+    testStaleSocket(path);
+#endif
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
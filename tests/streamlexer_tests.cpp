@@ -1,14 +1,82 @@
-/* DECAPRATED
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "lexer_harness.hpp"
 #include "streamlexer.hpp"
 
-int main() {
-    std::string src = "if lang = Spanish\n\n  print Hola#, 1234.0\r\n else\n\r  print Hello, 1234";
-    Lexer lexer = Lexer(src);
-    for (Token tok = lexer.nextToken(); tok.type != TT_EOF; tok = lexer.nextToken()) {
-        printf("Type: %d, lexeme: \"%s\"\n", tok.type, src.substr(tok.index, tok.length).c_str());
+// Compares one batch with the whole input's tokens from first on. The
+// stream decodes every string, so those compare by their text, and its
+// constants index the batch's own arena, so those compare by value.
+static bool sameBatch(const std::vector<Token>& a, size_t first, const Lexer& whole,
+                      const std::vector<Token>& b, const StreamLexer& stream) {
+    if (first + b.size() > a.size()) return false;
+    for (size_t i = 0; i < b.size(); ++i) {
+        const Token& x = a[first + i];
+        if (x.offset != b[i].offset || x.length != b[i].length || x.type != b[i].type)
+            return false;
+        if (x.type == TT_STRING) {
+            if (b[i].format != F_ESCAPED || whole.literal(x) != escapedString(stream.strings, b[i].lexeme))
+                return false;
+        }
+        else if (x.type == TT_NUMBER || x.type == TT_CHAR) {
+            if (b[i].lexeme >= stream.constants.size() || x.format != b[i].format) return false;
+            if (!sameConstant(whole.constants[x.lexeme], stream.constants[b[i].lexeme])) return false;
+        }
+        else if (x.lexeme != b[i].lexeme || x.format != b[i].format)
+            return false;
     }
-    return 0;
+    return true;
 }
 
-*/
\ No newline at end of file
+int main() {
+    std::string src = "if lang = Spanish\n\n  print Hola#, 1234.0\r\n else\n\r  print Hello, 1234\n";
+    for (int i = 0; i < 200; ++i) {
+        src += "def f" + std::to_string(i) + "(a):\n    # comment\n    return a * " + std::to_string(i) + ".5\n";
+        src += "    s = \"plain\" + \"line\\n" + std::to_string(i) + "\"\n";
+        if (i % 50 == 0) src += "    " + std::string(300, 'x') + " = 1\n";   // Longer than the buffer
+    }
+    src += "  last line without newline";
+
+    Interner interner;
+    Lexer whole(src);
+    whole.setInterner(&interner);
+    std::vector<Token> expected = whole.tokenize();
+
+    int failures = 0;
+    for (size_t bufferBytes : {64, 1000, 1 << 16}) {
+        // Short, irregular reads like a pipe
+        size_t position = 0;
+        srand(static_cast<unsigned>(bufferBytes));
+        StreamLexer::Reader reader = [&](char* buffer, size_t capacity) -> size_t {
+            size_t n = std::min(capacity, std::min(src.size() - position, static_cast<size_t>(1 + rand() % 97)));
+            memcpy(buffer, src.data() + position, n);
+            position += n;
+            return n;
+        };
+
+        StreamLexer stream(reader, interner, bufferBytes, 2);
+        std::vector<Token> batch;
+        size_t tokens = 0, batches = 0, strings = 0, largest = 0;
+        bool same = true;
+        while (stream.next(batch)) {
+            same = same && sameBatch(expected, tokens, whole, batch, stream);
+            tokens += batch.size();
+            strings += stream.strings.size();
+            largest = std::max(largest, stream.strings.size());
+            ++batches;
+        }
+        if (!same || tokens != expected.size()) {
+            printf("FAIL buffer %zu: %zu tokens vs %zu\n", bufferBytes, tokens, expected.size());
+            ++failures;
+        }
+        else if (batches > 2 && largest == strings) {
+            printf("FAIL buffer %zu: one batch holds every string\n", bufferBytes);
+            ++failures;
+        }
+        else printf("buffer %zu: %zu tokens in %zu batches\n", bufferBytes, tokens, batches);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include "lexer.hpp"
+#include "lexer_harness.hpp"
+#include "tokenstream.hpp"
+
+static int failures = 0;
+
+static void checkStream(const std::vector<Token>& tokens, const TokenStream& stream, const char* what) {
+    if (stream.size() != tokens.size()) {
+        printf("FAIL %s: size %zu vs %zu\n", what, stream.size(), tokens.size());
+        ++failures;
+        return;
+    }
+    size_t i = 0;
+    for (TokenStream::Iterator it = stream.begin(); it != stream.end(); ++it, ++i) {
+        Token token = *it;
+        const Token& expected = tokens[i];
+        if (!sameToken(token, expected) || it.type() != expected.type) {
+            printf("FAIL %s: token %zu (type %d)\n", what, i, expected.type);
+            ++failures;
+            return;
+        }
+    }
+}
+
+int main() {
+    std::string src;
+    for (int i = 0; i < 300; ++i) {
+        src += "def f" + std::to_string(i) + "(a, [b, {c}]):\n";
+        src += "    x = (a + b) * " + std::to_string(i) + ".25 \\ 2 +- 1 <=> y\r\n";
+        src += "    if x != 3 && $y:\n";
+        src += "        s = \"plain\" + \"tab\\t\" + 'c'\n";
+        src += "        return g((x), [x])\n";
+        src += "  odd\n";
+    }
+
+    Lexer lexer(src);
+    std::vector<Token> tokens = lexer.tokenize();
+    Lexer streamLexer(src);
+    TokenStream stream = streamLexer.tokenizeStream();
+    checkStream(tokens, stream, "tokenizeStream");
+    checkStream(tokens, TokenStream(tokens, &lexer.pool, nullptr, &lexer.constants, &lexer.strings), "converted");
+
+    Interner interner;
+    Lexer sharedLexer(src);
+    sharedLexer.setInterner(&interner);
+    std::vector<Token> sharedTokens = sharedLexer.tokenize();
+    checkStream(sharedTokens, TokenStream(sharedTokens, nullptr, &interner, &sharedLexer.constants, &sharedLexer.strings),
+                "shared interner");
+
+    // Type-only scans against a naive walk over the Token vector
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type == TT_LPAREN || tokens[i].type == TT_LBRACE || tokens[i].type == TT_LBRACKET) {
+            TokenType closer = tokens[i].type == TT_LPAREN ? TT_RPAREN : tokens[i].type == TT_LBRACE ? TT_RBRACE : TT_RBRACKET;
+            size_t depth = 0, j = i;
+            for (; j < tokens.size(); ++j) {
+                if (tokens[j].type == tokens[i].type) ++depth;
+                else if (tokens[j].type == closer && --depth == 0) break;
+            }
+            if (stream.matchBracket(i) != j) ++failures;
+        }
+        if (tokens[i].type == TT_INDENT) {
+            size_t depth = 0, j = i;
+            for (; j < tokens.size(); ++j) {
+                if (tokens[j].type == TT_INDENT) ++depth;
+                else if (tokens[j].type == TT_DEDENT && --depth == 0) break;
+            }
+            if (stream.skipBlock(i) != j) ++failures;
+        }
+    }
+
+    double ratio = static_cast<double>(stream.bytes()) / (tokens.size() * sizeof(Token));
+    printf("%zu tokens, %.0f%% of the Token vector size\n", stream.size(), ratio * 100);
+    if (ratio > 0.6) ++failures;
+
+    printf("%s\n", failures ? "token stream mismatches" : "token stream matches Token vector");
+    return failures ? 1 : 0;
+}
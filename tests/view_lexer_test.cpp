@@ -0,0 +1,95 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "lexer.hpp"
+#include "lexer_harness.hpp"
+#include "mappedfile.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+
+static void compare(const std::string& src, std::string_view view, const char* what) {
+    Lexer owned(src);
+    std::vector<Token> expected = owned.tokenize();
+    Lexer viewed(view);
+    std::vector<Token> tokens = viewed.tokenize();
+    if (!sameTokens(expected, tokens) || owned.pool != viewed.pool) {
+        printf("FAIL %s: \"%.*s\"\n", what, static_cast<int>(src.size() > 40 ? 40 : src.size()), src.c_str());
+        ++failures;
+    }
+}
+
+int main() {
+    const char* samples[] = {
+        "",
+        "x",
+        "\n",
+        "if a:\n    b = 1.5\n",
+        "if a:\n    b = 1.\n    c = 12",
+        "if a:\n    b = c  ",
+        "if a:\n    b = c\r",
+        "def f(x):\n    # trailing comment",
+        "a +++ b\n    \n  ",
+        "value = 3.",
+        "ident_at_end_of_view",
+    };
+
+    for (const char* sample : samples) {
+        std::string src = sample;
+        compare(src, std::string_view(src), "string_view");
+        Lexer literal(sample);
+        if (!sameTokens(Lexer(src).tokenize(), literal.tokenize())) {
+            printf("FAIL const char*: \"%s\"\n", sample);
+            ++failures;
+        }
+
+#ifndef _WIN32
+        // Put the view flush against a PROT_NONE page, so any read past it faults
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        char* region = static_cast<char*>(mmap(nullptr, 2 * page, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        mprotect(region + page, page, PROT_NONE);
+        char* start = region + page - src.size();
+        memcpy(start, src.data(), src.size());
+        compare(src, std::string_view(start, src.size()), "guard page");
+        munmap(region, 2 * page);
+#endif
+    }
+
+    // Whole-file map, also through the parallel path
+    std::string src;
+    for (int i = 0; i < 2000; ++i)
+        src += "def f" + std::to_string(i) + "(a):\n    return a * " + std::to_string(i) + "\n";
+    src += "tail_line = 1";
+    const char* path = "view_lexer_test.lt";
+    FILE* file = fopen(path, "wb");
+    fwrite(src.data(), 1, src.size(), file);
+    fclose(file);
+    {
+        MappedFile mapped(path);
+        if (!mapped.isOpen() || mapped.view().size() != src.size()) {
+            printf("FAIL mapping %s\n", path);
+            ++failures;
+        }
+        compare(src, mapped.view(), "mapped file");
+
+        Lexer serial(src);
+        std::vector<Token> expected = serial.tokenize();
+        ThreadPool workers(4);
+        Lexer parallel(mapped.view());
+        std::vector<Token> tokens = parallel.tokenizeParallel(workers, 512);
+        if (!sameTokens(expected, tokens) || serial.pool != parallel.pool) {
+            printf("FAIL parallel over mapped file\n");
+            ++failures;
+        }
+    }
+    remove(path);
+
+    printf("%s\n", failures ? "view lexing mismatches" : "view lexing matches owned input");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "bytecode.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "tokenstream.hpp"
+#include "vm.hpp"
+
+// Compiling and running programs for the VM, IR, JIT and FFI tests, with
+// whatever a run prints captured for comparison.
+
+struct Outcome {
+    bool compiled = false;
+    bool ran = false;
+    Value result = Value::of(V_UNSET);
+    std::string error;      // Compile or runtime
+    std::string output;
+    uint64_t entries = 0;   // Native code runs
+};
+
+// The tree compiler's bytecode, or the IR's lowered after the passes
+inline bool compileSource(const std::string& src, bool optimizing, Program& program, std::string& error) {
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    std::vector<std::string> errors;
+    if (!optimizing) {
+        Compiler compiler(parser.arena, lexer);
+        if (compiler.compile(root, program)) return true;
+        errors = compiler.errors;
+    } else {
+        IrModule module;
+        IrBuilder builder(parser.arena, lexer);
+        if (builder.build(root, module)) {
+            optimize(module);
+            if (lowerModule(module, program, errors)) return true;
+        } else {
+            errors = builder.errors;
+        }
+    }
+    error = errors.empty() ? "" : errors[0];
+    return false;
+}
+
+// Runs vm as the caller set it up, printing into a temporary file
+inline Outcome runCaptured(VM& vm) {
+    Outcome outcome;
+    outcome.compiled = true;
+    FILE* file = tmpfile();
+    vm.out = file;
+    outcome.ran = vm.run(outcome.result);
+    outcome.error = vm.error;
+    outcome.entries = vm.jit() ? vm.jit()->entries : 0;
+    rewind(file);
+    char buffer[256];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) outcome.output.append(buffer, n);
+    fclose(file);
+    return outcome;
+}
+
+// Runtime error without its "in f at N: " prefix, as the compilers differ in pcs
+inline std::string message(const std::string& error) {
+    size_t at = error.find(": ");
+    return at == std::string::npos ? error : error.substr(at + 2);
+}
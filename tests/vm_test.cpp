@@ -0,0 +1,173 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "vm_harness.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (ok) return;
+    printf("FAIL %s\n", what);
+    ++failures;
+}
+
+static Outcome runWith(const Program& program, Dispatch dispatch, size_t stackValues) {
+    VM vm(program, stackValues);
+    vm.setDispatch(dispatch);
+    return runCaptured(vm);
+}
+
+// Runs under both dispatch loops, which must agree
+static Outcome run(const std::string& src, size_t stackValues = 1 << 16) {
+    Outcome outcome;
+    Program program;
+    if (!compileSource(src, false, program, outcome.error)) return outcome;
+    outcome = runWith(program, DISPATCH_SWITCH, stackValues);
+    Outcome threaded = runWith(program, DISPATCH_THREADED, stackValues);
+    bool same = threaded.ran == outcome.ran && threaded.error == outcome.error && threaded.output == outcome.output &&
+                threaded.result.type == outcome.result.type && threaded.result.index == outcome.result.index;
+    check(same, ("dispatch loops agree: " + src).c_str());
+    return outcome;
+}
+
+static bool returnsInt(const std::string& src, int64_t expected) {
+    Outcome outcome = run(src);
+    if (!outcome.ran) printf("  %s\n", outcome.error.c_str());
+    return outcome.ran && outcome.result.type == V_INT && outcome.result.integer == expected;
+}
+
+static bool returnsReal(const std::string& src, double expected) {
+    Outcome outcome = run(src);
+    return outcome.ran && outcome.result.type == V_FLOAT && outcome.result.real == expected;
+}
+
+static bool fails(const std::string& src, const char* message, size_t stackValues = 1 << 16) {
+    Outcome outcome = run(src, stackValues);
+    return outcome.compiled && !outcome.ran && outcome.error.find(message) != std::string::npos;
+}
+
+static bool rejects(const std::string& src, const char* message) {
+    Outcome outcome = run(src);
+    return !outcome.compiled && outcome.error.find(message) != std::string::npos;
+}
+
+static void testArithmetic() {
+    check(returnsInt("return 1 + 2 * 3 - 4 / 2\n", 5), "precedence");
+    check(returnsInt("return -7 / 2\n", -3), "division truncates");
+    check(returnsInt("return -7 % 2\n", -1), "modulo takes the dividend's sign");
+    check(returnsInt("return (1 << 10) | 5 ^ 1 & 3\n", 1028), "bitwise");
+    check(returnsInt("return -(1 << 63) >> 62\n", -2), "arithmetic right shift");
+    check(returnsInt("return ~5 + 300 - 1000\n", -706), "complement and large immediates");
+    check(returnsInt("return 9223372036854775807 + 1 == -9223372036854775807 - 1\n", 1), "ints wrap");
+    check(returnsInt("return (3 > 2) + (2 >= 2) + (1 < 1) + (1 <= 0) + (4 != 4) + (4 == 4)\n", 3), "comparisons");
+    check(returnsInt("return !0 + !7\n", 1), "not");
+    check(returnsReal("return 1 + 0.5\n", 1.5), "int and float give float");
+    check(returnsReal("return 7.5 % 2\n", 1.5), "float modulo");
+    check(returnsReal("return 1.0 / 4\n", 0.25), "float division");
+    check(returnsInt("return 1.5 < 2\n", 1), "mixed comparison");
+    check(returnsInt("return 0 || 5\n", 5), "or gives the deciding operand");
+    check(returnsInt("return 3 && 0\n", 0), "and gives the deciding operand");
+    check(returnsInt("return 2 && 3 || 4\n", 3), "and before or");
+}
+
+static void testControlFlow() {
+    check(returnsInt("i = 0\ns = 0\nwhile i < 100:\n    s += i\n    i += 1\nreturn s\n", 4950), "while over globals");
+    check(returnsInt("sum(n):\n    s = 0\n    while n:\n        s += n\n        n -= 1\n    return s\nreturn sum(100)\n", 5050),
+          "while over locals");
+    const char* grade =
+        "grade(x):\n"
+        "    if x > 90:\n"
+        "        return 4\n"
+        "    elif x > 80:\n"
+        "        return 3\n"
+        "    elif x > 70:\n"
+        "        return 2\n"
+        "    else:\n"
+        "        return 1\n";
+    check(returnsInt(std::string(grade) + "return grade(95) * 1000 + grade(85) * 100 + grade(75) * 10 + grade(5)\n", 4321),
+          "if elif else");
+    check(returnsInt("x = 0\nif x:\n    x = 5\nreturn x\n", 0), "if without else");
+    check(run("x = 1\n").result.type == V_NONE, "module without return gives none");
+}
+
+static void testFunctions() {
+    const char* fib =
+        "fib(n):\n"
+        "    if n < 2:\n"
+        "        return n\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "return fib(20)\n";
+    check(returnsInt(fib, 6765), "recursive fib");
+    check(returnsInt("return twice(4)\ndef twice(x):\n    return x * 2\n", 8), "call before def");
+    check(returnsInt("def f(x, y):\n    x = y - x\n    return x\nreturn f(3, 10)\n", 7), "target read on the right");
+    check(returnsInt("def f(a):\n    a = 0 || a\n    return a\nreturn f(9)\n", 9), "or into its own operand");
+    check(returnsInt("def f(a, b, c):\n    return a * 100 + b * 10 + c\nreturn f(1, f(0, 0, 2), 3)\n", 123), "nested calls");
+    check(returnsInt("count = 0\ndef bump():\n    count += 0\ndef touch():\n    return count\ncount = 4\nreturn touch()\n", 4),
+          "unassigned names are globals");
+    check(run("def nothing():\n    x = 1\nreturn nothing()\n").result.type == V_NONE, "falling off the end gives none");
+
+    Outcome ordered = run("def f(x):\n    print(x)\n    return x\nreturn f(1) > f(2)\n");
+    check(ordered.ran && ordered.output == "1\n2\n", "swapped comparison evaluates left to right");
+
+    Outcome printed = run("print(1, 2.5, 3 > 4)\nprint(1.0 / 3, 100.0)\n");
+    check(printed.ran && printed.output == "1 2.5 0\n0.3333333333333333 100.0\n", "print");
+}
+
+static void testErrors() {
+    check(fails("return 1 / 0\n", "division by zero"), "division by zero");
+    check(fails("return 1 % 0\n", "division by zero"), "modulo by zero");
+    check(fails("return missing + 1\n", "undefined name missing"), "undefined global");
+    check(fails("def f(a):\n    return a\nreturn f(1, 2)\n", "wrong argument count for f"), "arity");
+    check(fails("def f(n):\n    return f(n + 1)\nreturn f(0)\n", "stack overflow", 1024), "stack overflow");
+    check(fails("x = 1\nreturn x(2)\n", "not a function"), "calling an int");
+    check(fails("def f():\n    return 1\nreturn f + 1\n", "unsupported operand types for add"), "function operand");
+    check(fails("return 1.5 & 1\n", "unsupported operand types for band"), "bitwise on float");
+    check(fails("def f():\n    y = y + 1\n    return y\nreturn f()\n", "undefined name y"), "local read before assignment");
+    Outcome unset = run("def f(a):\n    if a > 0:\n        t = a\n    return t\nprint(f(1))\nprint(f(0))\n");
+    check(!unset.ran && unset.output == "1\n" && unset.error.find("undefined name t") != std::string::npos,
+          "local assigned on one branch only");
+    check(fails("def f(n):\n    while n:\n        t = n\n        n -= 1\n    return t\nreturn f(0)\n", "undefined name t"),
+          "local assigned only in a loop body");
+}
+
+static void testCompileErrors() {
+    check(rejects("return 2j\n", "complex"), "complex literal");
+    check(rejects("return a @ b\n", "binary operator"), "matrix multiply");
+    check(rejects("return a.b\n", "binary operator"), "member access");
+    check(rejects("1 = 2\n", "assign to a name"), "assignment target");
+    check(rejects("return (1 +\n", "syntax error"), "syntax error");
+    check(rejects("def f(a, a):\n    return a\n", "duplicate parameter"), "duplicate parameter");
+}
+
+static void testEncoding() {
+    Program program;
+    std::string error;
+    check(compileSource("def f(n):\n    i = 0\n    while i < n:\n        i += 1\n    return i - 1\n", false, program, error),
+          "loop compiles");
+    check(program.functions.size() == 2 && program.functions[1].params == 1, "one function of one parameter");
+    std::string text = program.functions.size() == 2 ? disassemble(program, program.functions[1]) : "";
+    check(text.find("addi      r1 r1 1") != std::string::npos, "compound add by a literal is one addi");
+    check(text.find("addi      r2 r1 -1") != std::string::npos, "subtracting a literal adds its negation");
+    check(text.find("jmpf") != std::string::npos && text.find("jmp       ->") != std::string::npos, "loop jumps");
+    check(text.find("check") == std::string::npos, "assigned locals are read unchecked");
+
+    check(compileSource("def f(a):\n    if a:\n        t = 1\n    return t\n", false, program, error), "maybe unset compiles");
+    text = program.functions.size() == 2 ? disassemble(program, program.functions[1]) : "";
+    check(text.find("check") != std::string::npos && text.find(" t") != std::string::npos, "maybe unset read is checked");
+
+    check(compileSource("x = 100000\ny = 100000\nz = 2.5\n", false, program, error), "constants compile");
+    check(program.constants.size() == 2, "constants are pooled");
+    check(program.globals.size() == 3, "one slot per global name");
+}
+
+int main() {
+    testArithmetic();
+    testControlFlow();
+    testFunctions();
+    testErrors();
+    testCompileErrors();
+    testEncoding();
+    if (failures) printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
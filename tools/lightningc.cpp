@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bytecode.hpp"
+#include "ffi.hpp"
+#include "ir.hpp"
+#include "lineindex.hpp"
+#include "mappedfile.hpp"
+#include "project.hpp"
+#include "scheduler.hpp"
+#include "server.hpp"
+#include "vm.hpp"
+
+static void usage(FILE* out) {
+    fprintf(out, "usage: lightningc [-j THREADS] DIR\n"
+                 "       lightningc [-O] [--time-passes] [--jit] [-j THREADS]\n"
+                 "                  [--link LIBRARY]... [--extern NAME:SIGNATURE]... --run FILE\n"
+                 "       lightningc --serve SOCKET [-j THREADS]\n"
+                 "       lightningc --connect SOCKET ARGS...\n"
+                 "  Lexes and parses every .lt file under DIR and reports diagnostics,\n"
+                 "  unresolved imports and import cycles; or compiles FILE to bytecode\n"
+                 "  and runs it. -O compiles through the SSA IR and its passes, run on\n"
+                 "  THREADS workers, and --time-passes reports each pass on stderr.\n"
+                 "  --jit compiles functions to native code once they run hot.\n"
+                 "  --extern binds the C function NAME, from a --link library or the C\n"
+                 "  library, to the global of that name; SIGNATURE is like d(dd) for pow.\n"
+                 "  --serve answers on a Unix socket, keeping each DIR's modules lexed and\n"
+                 "  parsed so a check redoes only changed files; --connect sends a DIR\n"
+                 "  check there as if run from here, runs anything else, --run included,\n"
+                 "  here, and --connect SOCKET --shutdown stops the server.\n");
+}
+
+// Through the IR: the passes run per function on the pool, then the
+// result is lowered to the same bytecode the tree compiler emits
+static bool optimizeFile(const char* path, const AstArena& arena, const Lexer& lexer, NodeId root, unsigned threads,
+                         bool timePasses, Program& program, FILE* out, FILE* err) {
+    IrModule module;
+    IrBuilder builder(arena, lexer);
+    if (!builder.build(root, module)) {
+        for (const std::string& error : builder.errors) fprintf(out, "%s: error: %s\n", path, error.c_str());
+        return false;
+    }
+    ThreadPool workers(threads);
+    PassStats stats = optimize(module, &workers);
+    if (timePasses) {
+        fprintf(err, "%-10s %10s %10s\n", "pass", "ms", "changes");
+        for (int pass = 0; pass < IR_PASSES; ++pass)
+            fprintf(err, "%-10s %10.3f %10llu\n", passName(static_cast<IrPass>(pass)), stats.nanos[pass] / 1e6,
+                    static_cast<unsigned long long>(stats.changes[pass]));
+        fprintf(err, "%zu functions on %u threads\n", module.functions.size(), workers.size());
+    }
+    std::vector<std::string> errors;
+    if (lowerModule(module, program, errors)) return true;
+    for (const std::string& error : errors) fprintf(out, "%s: error: %s\n", path, error.c_str());
+    return false;
+}
+
+// Calls and loop iterations before a function is compiled to native code
+static constexpr uint32_t jitThreshold = 100;
+
+struct RunOptions {
+    bool optimizing = false;
+    bool timePasses = false;
+    bool jit = false;
+    unsigned threads = 0;
+    std::vector<std::string> libraries;
+    std::vector<std::string> externs;   // NAME:SIGNATURE
+};
+
+// Each extern from the first library that has it, the running program last
+static bool bindExterns(const RunOptions& options, std::vector<std::unique_ptr<ForeignLibrary>>& libraries, VM& vm,
+                        FILE* out) {
+    for (const std::string& path : options.libraries) {
+        libraries.push_back(std::make_unique<ForeignLibrary>(path.c_str()));
+        if (!libraries.back()->isOpen()) {
+            fprintf(out, "error: %s\n", libraries.back()->error.c_str());
+            return false;
+        }
+    }
+    libraries.push_back(std::make_unique<ForeignLibrary>(nullptr));
+    for (const std::string& spec : options.externs) {
+        const char* colon = strchr(spec.c_str(), ':');
+        std::string name(spec.c_str(), colon ? colon - spec.c_str() : spec.size());
+        ForeignFunction function;
+        bool found = false;
+        std::string error = "missing signature for " + name;
+        for (size_t i = 0; colon && i < libraries.size() && !found; ++i) {
+            found = libraries[i]->lookup(name.c_str(), colon + 1, function);
+            if (!found) error = libraries[i]->error;
+        }
+        if (!found) {
+            fprintf(out, "error: %s\n", error.c_str());
+            return false;
+        }
+        vm.define(name.c_str(), function);
+    }
+    return true;
+}
+
+static int runFile(const char* path, const RunOptions& options, FILE* out, FILE* err) {
+    MappedFile file(path);
+    if (!file.isOpen()) {
+        fprintf(out, "%s: error: cannot read file\n", path);
+        return 1;
+    }
+    std::string src(file.view());
+    Lexer lexer(src);
+    TokenStream tokens = lexer.tokenizeStream();
+    Parser parser(tokens, src);
+    NodeId root = parser.parse();
+    LineIndex lines(src);
+    for (const Diagnostic& diagnostic : parser.diagnostics) {
+        Location at = lines.locate(diagnostic.offset);
+        fprintf(out, "%s:%u:%u: error: %s\n", path, at.line, at.column, diagnosticMessage(diagnostic.id));
+    }
+    if (!parser.diagnostics.empty()) return 1;
+
+    Program program;
+    if (options.optimizing) {
+        if (!optimizeFile(path, parser.arena, lexer, root, options.threads, options.timePasses, program, out, err))
+            return 1;
+    } else {
+        Compiler compiler(parser.arena, lexer);
+        if (!compiler.compile(root, program)) {
+            for (const std::string& error : compiler.errors) fprintf(out, "%s: error: %s\n", path, error.c_str());
+            return 1;
+        }
+    }
+    VM vm(program);
+    vm.out = out;
+    vm.setJit(options.jit ? jitThreshold : 0);
+    std::vector<std::unique_ptr<ForeignLibrary>> libraries;
+    if (!bindExterns(options, libraries, vm, out)) return 1;
+    Value result;
+    if (!vm.run(result)) {
+        fprintf(out, "%s: runtime error %s\n", path, vm.error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// A source tree's modules, kept from one check to the next with the report
+// each got when last staged
+struct Workspace {
+    std::unique_ptr<Project> project;
+    std::mutex lock;
+    std::unordered_map<std::string, std::string> reports;  // By module name
+};
+
+// What outlives a command: nothing for a single run, everything a server
+// has built so far when it runs them on request
+struct Session {
+    std::unique_ptr<TaskScheduler> scheduler;
+    unsigned threads = 0;
+    // By the tree's absolute path and its spelling, which reports print
+    std::map<std::string, std::unique_ptr<Workspace>> workspaces;
+
+    TaskScheduler& schedulerFor(unsigned wanted) {
+        if (!scheduler || wanted != threads) {
+            scheduler.reset();    // Its workers exit before the new ones start
+            scheduler.reset(new TaskScheduler(wanted));
+            threads = wanted;
+        }
+        return *scheduler;
+    }
+};
+
+static int checkTree(const std::string& root, const RunOptions& options, Session& session, FILE* out) {
+    std::error_code error;
+    std::string key = std::filesystem::absolute(root, error).lexically_normal().string() + '\n' + root;
+    std::unique_ptr<Workspace>& workspace = session.workspaces[key];
+    if (!workspace) {
+        workspace.reset(new Workspace);
+        workspace->project.reset(new Project(root));
+    }
+    TaskScheduler& scheduler = session.schedulerFor(options.threads);
+    Project& project = *workspace->project;
+    Workspace* reports = workspace.get();
+    uint64_t steals = scheduler.steals();
+    auto start = std::chrono::steady_clock::now();
+    // Each module's report is formatted on a worker; all are printed in
+    // module order once the build is done, the unchanged ones from before
+    BuildStats stats = project.build(scheduler, [reports](Module& module) {
+        std::string report;
+        if (!module.error.empty()) report += module.path + ": error: " + module.error + "\n";
+        LineIndex lines(module.source);
+        static const std::vector<Diagnostic> none;
+        for (const Diagnostic& diagnostic : module.parser ? module.parser->diagnostics : none) {
+            Location at = lines.locate(diagnostic.offset);
+            char line[512];
+            snprintf(line, sizeof(line), "%s:%u:%u: error: %s\n", module.path.c_str(), at.line, at.column,
+                     diagnosticMessage(diagnostic.id));
+            report += line;
+        }
+        for (const std::string& name : module.unresolved)
+            report += module.path + ": error: no module named " + name + "\n";
+        std::lock_guard<std::mutex> guard(reports->lock);
+        reports->reports[module.name] = std::move(report);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Blocked modules aren't staged, so whatever they reported before is stale
+    std::unordered_map<std::string, std::string> current;
+    for (const auto& module : project.modules()) {
+        auto found = reports->reports.find(module->name);
+        if (module->blocked || found == reports->reports.end()) continue;
+        fputs(found->second.c_str(), out);
+        current[module->name] = std::move(found->second);
+    }
+    reports->reports = std::move(current);
+
+    size_t errors = stats.unresolved + stats.unreadable;
+    for (const auto& module : project.modules()) {
+        if (module->cyclic) {
+            fprintf(out, "%s: error: import cycle through %s\n", module->path.c_str(), module->name.c_str());
+        } else if (module->blocked) {
+            // Only behind a cycle, through at least one blocked import
+            uint32_t behind = 0;
+            while (!project.modules()[module->imports[behind]]->blocked) ++behind;
+            fprintf(out, "%s: error: imports %s, which an import cycle holds back\n", module->path.c_str(),
+                    project.modules()[module->imports[behind]]->name.c_str());
+        }
+        if (module->parser) errors += module->parser->diagnostics.size() + module->parser->droppedDiagnostics;
+    }
+    errors += stats.blocked;
+    fprintf(out, "%zu modules, %zu parsed, %zu staged, %zu errors in %.1f ms on %u threads (%llu steals)\n",
+            stats.modules, stats.parsed, stats.staged, errors, seconds * 1e3, scheduler.size(),
+            static_cast<unsigned long long>(scheduler.steals() - steals));
+    return errors ? 1 : 0;
+}
+
+// One command line, without the program name
+static int runCommand(const std::vector<std::string>& args, Session& session, FILE* out, FILE* err) {
+    RunOptions options;
+    const char* root = nullptr;
+    const char* script = nullptr;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        bool more = i + 1 < args.size();
+        if (arg == "--run" && more && !script) script = args[++i].c_str();
+        else if (arg == "-O") options.optimizing = true;
+        else if (arg == "--time-passes") options.timePasses = options.optimizing = true;
+        else if (arg == "--jit") options.jit = true;
+        else if (arg == "--link" && more) options.libraries.push_back(args[++i]);
+        else if (arg == "--extern" && more) options.externs.push_back(args[++i]);
+        else if (arg == "-j" && more) options.threads = static_cast<unsigned>(atoi(args[++i].c_str()));
+        else if (!arg.empty() && arg[0] != '-' && !root) root = arg.c_str();
+        else {
+            usage(out);
+            return 1;
+        }
+    }
+    if (script && !root) return runFile(script, options, out, err);
+    if (!root || script) {
+        usage(out);
+        return 1;
+    }
+    return checkTree(root, options, session, out);
+}
+
+// A tree check: DIR and perhaps -j, the only command a server runs.
+// Anything that runs code stays in the process of whoever asked for it.
+static bool isCheck(const std::vector<std::string>& args) {
+    bool root = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "-j" && i + 1 < args.size()) ++i;
+        else if (!args[i].empty() && args[i][0] != '-' && !root) root = true;
+        else return false;
+    }
+    return root;
+}
+
+static std::string drain(FILE* file) {
+    std::string text;
+    rewind(file);
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, n);
+    fclose(file);
+    return text;
+}
+
+// Runs each request's check in its client's directory, into buffers
+// sent back as the reply
+static int serve(const std::vector<std::string>& args) {
+    if (args.size() != 2 && !(args.size() == 4 && args[2] == "-j")) {
+        usage(stdout);
+        return 1;
+    }
+    Session session;
+    unsigned threads = args.size() == 4 ? static_cast<unsigned>(atoi(args[3].c_str())) : 0;
+    session.schedulerFor(threads);
+    CompileServer server(args[1]);
+    if (!server.listen()) {
+        printf("error: %s\n", server.error.c_str());
+        return 1;
+    }
+    printf("serving on %s\n", args[1].c_str());
+    fflush(stdout);
+    server.serve([&](const Request& request, Reply& reply) {
+        if (request.args.size() == 1 && request.args[0] == "--shutdown") {
+            reply.out = "server stopped\n";
+            return false;
+        }
+        if (!isCheck(request.args)) {
+            reply.status = 1;
+            reply.out = "error: the server only checks trees\n";
+            return true;
+        }
+        std::error_code error;
+        std::filesystem::current_path(request.directory, error);
+        FILE* out = tmpfile();
+        FILE* err = tmpfile();
+        if (error || !out || !err) {
+            reply.status = 1;
+            reply.out = "error: cannot run in " + request.directory + "\n";
+            if (out) fclose(out);
+            if (err) fclose(err);
+            return true;
+        }
+        // A request without -j gets the server's
+        std::vector<std::string> command = request.args;
+        if (std::find(command.begin(), command.end(), "-j") == command.end() && threads) {
+            command.push_back("-j");
+            command.push_back(std::to_string(threads));
+        }
+        reply.status = runCommand(command, session, out, err);
+        reply.out = drain(out);
+        reply.err = drain(err);
+        return true;
+    });
+    if (!server.error.empty()) {
+        printf("error: %s\n", server.error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static int forward(const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        usage(stdout);
+        return 1;
+    }
+    Request request;
+    request.args.assign(args.begin() + 2, args.end());
+    if (!isCheck(request.args) && !(request.args.size() == 1 && request.args[0] == "--shutdown")) {
+        Session session;
+        return runCommand(request.args, session, stdout, stderr);
+    }
+    std::error_code ignored;
+    request.directory = std::filesystem::current_path(ignored).string();
+    Reply reply;
+    std::string error;
+    if (!sendRequest(args[1], request, reply, error)) {
+        printf("error: %s\n", error.c_str());
+        return 1;
+    }
+    fwrite(reply.out.data(), 1, reply.out.size(), stdout);
+    fwrite(reply.err.data(), 1, reply.err.size(), stderr);
+    return reply.status;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "--serve") return serve(args);
+    if (!args.empty() && args[0] == "--connect") return forward(args);
+    Session session;
+    return runCommand(args, session, stdout, stderr);
+}